@@ -70,6 +70,9 @@ type UnitData struct {
 const (
 	FrameDigest = 25000
 	FrameRender = 33333
+	// FrameTrailer is the number of bytes following the samples: configuration id, chirp start, chirp stop,
+	// chirp to adc skew, shared epoch, adc start and adc stop
+	FrameTrailer = 56
 )
 
 type Diagnostic struct {
@@ -120,10 +123,13 @@ type RemoteUnit struct {
 	outbound   chan []byte
 	done       chan bool
 
-	total    int
-	start    time.Time
-	duration float64
-	rate     float64
+	total         int
+	start         time.Time
+	duration      float64
+	rate          float64
+	configuration int64
+	skew          int64
+	epoch         int64
 
 	threshold []float64
 
@@ -825,8 +831,11 @@ func CalculateVelocity(freqDiff, sweepFreq, sweepBandwidth float64) float64 {
 }
 
 func (r *RemoteUnit) process(data []byte) {
+	if len(data) <= FrameTrailer {
+		return
+	}
 
-	incoming := decodeBinaryToFloat64Arrays(data, ((len(data)-16)/4)/2)
+	incoming := decodeBinaryToFloat64Arrays(data[:len(data)-FrameTrailer], ((len(data)-FrameTrailer)/4)/2)
 	if len(incoming) < 4 {
 		//fmt.Println("FAIL", len(incoming))
 		return
@@ -854,6 +863,27 @@ func (r *RemoteUnit) process(data []byte) {
 		//fmt.Printf("%d, ", value1)
 	}
 	r.duration = float64(adcStop - adcStart)
+	// Frames captured after a chirp or sampling change carry a new configuration id
+	configuration, err := extractInt64FromBytes(data, len(data)-FrameTrailer, len(data)-FrameTrailer+7)
+	if err != nil {
+		fmt.Println(err)
+	}
+	if configuration != r.configuration {
+		log.Event("Unit '%s' switched to configuration %d", r.Unit.Metadata.Name, configuration)
+		r.configuration = configuration
+	}
+	// Nanoseconds between the chirp start and the first adc conversion of the frame
+	skew, err := extractInt64FromBytes(data, len(data)-32, len(data)-25)
+	if err != nil {
+		fmt.Println(err)
+	}
+	r.skew = skew
+	// Chirp start on the clock shared by synchronized units, zero when the unit is not synchronized
+	epoch, err := extractInt64FromBytes(data, len(data)-24, len(data)-17)
+	if err != nil {
+		fmt.Println(err)
+	}
+	r.epoch = epoch
 	//fmt.Printf("ADC: %dµs Chirp: %dµs\n", adcStop-adcStart, chirtpStop-chirpStart)
 	//value1, err := extractInt64FromBytes(data, (len(data)-1)-15, (len(data)-1)-8)
 	//if err != nil {
@@ -0,0 +1,226 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "check.h"
+#include "calibration.h"
+#include "waveform.h"
+
+// Runs the VCO calibration against a simulated tuning curve that bows away from a straight line. Each segment of the
+// sweep is rendered as the noisy beat signal the adc would convert, measured with beatFrequency and fitted into a
+// linearization, and the ramp the linearization produces has to sweep the band evenly. The beat estimate and the
+// polynomial fit are checked on their own against known tones and polynomials, and fits from random tuning curves have
+// to keep a rising ramp rising or be refused. Exits with 1 if any estimate, fit or linearization comes out wrong.
+
+typedef struct Options {
+    // Bend of the tuning curve, which strays from a straight line by a quarter of it at the middle of the DAC range
+    double bow = 0.5;
+    int segments = CALIBRATION_DEFAULT_SEGMENTS;
+    // Standard deviation of the adc noise in codes
+    double noise = 20;
+    int curves = 1000;
+    uint32_t seed = 1;
+} Options;
+
+static void usage(const char *name) {
+    printf("Usage: %s [--bow bend] [--segments N] [--noise codes] [--curves N] [--seed N]\n", name);
+}
+
+static bool parseOptions(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            return false;
+        } else if (strcmp(arg, "--bow") == 0) {
+            options->bow = atof(value);
+            i++;
+        } else if (strcmp(arg, "--segments") == 0) {
+            options->segments = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--noise") == 0) {
+            options->noise = atof(value);
+            i++;
+        } else if (strcmp(arg, "--curves") == 0) {
+            options->curves = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--seed") == 0) {
+            options->seed = (uint32_t) strtoul(value, nullptr, 10);
+            i++;
+        } else {
+            return false;
+        }
+    }
+    // A bend of one or more would stall the VCO at an end of the ramp
+    return options->segments >= CALIBRATION_MIN_SEGMENTS && options->segments <= CALIBRATION_MAX_SEGMENTS &&
+           fabs(options->bow) < 1 && options->curves >= 0;
+}
+
+// Defaults of the calibration chirp, 250 samples per lane
+#define HOST_SAMPLE_RATE 20000.0f
+#define HOST_SAMPLES 250
+// Beat of a segment that sweeps the whole band evenly split into segments, in hertz
+#define HOST_BEAT 1000.0
+
+// A tone of the adc, centered in the 12-bit range
+static std::vector<uint16_t> tone(double frequency, double noise, std::mt19937 &random) {
+    std::normal_distribution<double> gaussian(0.0, noise > 0 ? noise : 1e-9);
+    std::vector<uint16_t> samples(HOST_SAMPLES);
+    double phase = std::uniform_real_distribution<double>(0.0, 2 * M_PI)(random);
+    for (size_t i = 0; i < samples.size(); i++) {
+        double value = 2048 + 1500 * sin(2 * M_PI * frequency * (double) i / HOST_SAMPLE_RATE + phase);
+        value += gaussian(random);
+        samples[i] = (uint16_t) fmin(fmax(round(value), 0), 4095);
+    }
+    return samples;
+}
+
+static int checkBeats(std::mt19937 &random) {
+    int wrong = 0;
+    const double frequencies[] = {250, 600, 1000, 2200, 4000};
+    for (double frequency: frequencies) {
+        for (double noise: {0.0, 20.0, 150.0}) {
+            auto samples = tone(frequency, noise, random);
+            float beat = beatFrequency(samples.data(), samples.size(), HOST_SAMPLE_RATE);
+            // Within 2% of the tone, noise included
+            if (fabs(beat - frequency) > 0.02 * frequency) {
+                printf("Beat of %.0f Hz with noise %.0f: %.1f Hz\n", frequency, noise, beat);
+                wrong++;
+            }
+        }
+    }
+    // Nothing to measure without at least two crossings
+    std::vector<uint16_t> flat(HOST_SAMPLES, 2048);
+    wrong += CHECK(beatFrequency(flat.data(), flat.size(), HOST_SAMPLE_RATE) == 0);
+    auto slow = tone(20, 0, random);
+    wrong += CHECK(beatFrequency(slow.data(), slow.size(), HOST_SAMPLE_RATE) == 0);
+    wrong += CHECK(beatFrequency(slow.data(), 1, HOST_SAMPLE_RATE) == 0);
+    printf("Beats: %d wrong\n", wrong);
+    return wrong;
+}
+
+static int checkFit() {
+    int wrong = 0;
+    // Points on a cubic come back as its coefficients
+    const float cubic[] = {0.1f, -0.4f, 1.5f, 0.3f};
+    float x[16], y[16];
+    for (int i = 0; i < 16; i++) {
+        x[i] = (float) i / 15.0f;
+        y[i] = cubic[0] + x[i] * (cubic[1] + x[i] * (cubic[2] + x[i] * cubic[3]));
+    }
+    float coefficients[LINEARIZATION_ORDER + 1]{};
+    bool fitted = polynomialFit(x, y, 16, 3, coefficients);
+    for (int i = 0; fitted && i <= LINEARIZATION_ORDER; i++) {
+        fitted = fabsf(coefficients[i] - cubic[i]) < 1e-3f;
+    }
+    wrong += CHECK(fitted);
+    // A line through points on a line, and a constant through their mean
+    float line[LINEARIZATION_ORDER + 1]{};
+    float straight[4] = {1, 3, 5, 7}, at[4] = {0, 1, 2, 3};
+    wrong += CHECK(polynomialFit(at, straight, 4, 1, line) && fabsf(line[0] - 1) < 1e-4f && fabsf(line[1] - 2) < 1e-4f);
+    wrong += CHECK(polynomialFit(at, straight, 4, 0, line) && fabsf(line[0] - 4) < 1e-4f);
+    // Too few points, points that do not pin the curve down, and an order the linearization cannot hold
+    wrong += CHECK(!polynomialFit(x, y, 3, 3, coefficients));
+    float same[6] = {0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f};
+    wrong += CHECK(!polynomialFit(same, y, 6, 3, coefficients));
+    wrong += CHECK(!polynomialFit(x, y, 16, LINEARIZATION_ORDER + 1, coefficients));
+    printf("Fits: %d wrong\n", wrong);
+    return wrong;
+}
+
+// Normalized frequency of the VCO at normalized DAC code v, rising from zero to one
+static double tuning(double bow, double v) {
+    return v + bow * v * (1 - v);
+}
+
+// Greatest distance of the swept frequency from the straight ramp it should follow
+static double nonlinearity(double bow, const Linearization *linearization) {
+    double worst = 0;
+    for (int i = 0; i <= 200; i++) {
+        double x = i / 200.0;
+        double code = linearization != nullptr ? linearizationValue(*linearization, (float) x) : x;
+        worst = fmax(worst, fabs(tuning(bow, code) - x));
+    }
+    return worst;
+}
+
+static int checkCalibration(const Options &options, std::mt19937 &random) {
+    std::vector<CalibrationSegment> segments((size_t) options.segments);
+    for (int i = 0; i < options.segments; i++) {
+        auto &segment = segments[(size_t) i];
+        segment.start = (float) i / (float) options.segments;
+        segment.width = 1.0f / (float) options.segments;
+        // The beat follows the band the segment sweeps, averaged over its frames as the firmware does
+        double swept = tuning(options.bow, segment.start + segment.width) - tuning(options.bow, segment.start);
+        double beat = 0;
+        for (int frame = 0; frame < CALIBRATION_FRAMES_PER_SEGMENT; frame++) {
+            auto samples = tone(swept * options.segments * HOST_BEAT, options.noise, random);
+            beat += beatFrequency(samples.data(), samples.size(), HOST_SAMPLE_RATE);
+        }
+        segment.beat = (float) (beat / CALIBRATION_FRAMES_PER_SEGMENT);
+    }
+
+    Linearization curve{};
+    bool fitted = fitLinearization(segments.data(), segments.size(), &curve);
+    double before = nonlinearity(options.bow, nullptr);
+    double after = fitted ? nonlinearity(options.bow, &curve) : before;
+    printf("Calibration over %d segments: %.4f %.4f %.4f %.4f, nonlinearity %.2f%% of the band, %.2f%% before\n",
+           options.segments, curve.coefficients[0], curve.coefficients[1], curve.coefficients[2],
+           curve.coefficients[3], after * 100, before * 100);
+    // A cubic leaves a little of the bend, but nowhere near all of it, and a straight curve straight
+    int wrong = CHECK(fitted && linearizationMonotonic(curve) && after <= fmax(before / 4, 0.005));
+
+    // Fewer segments than the fit needs, a segment that measured nothing, and a sweep that ran backwards
+    wrong += CHECK(!fitLinearization(segments.data(), CALIBRATION_MIN_SEGMENTS - 1, &curve));
+    auto silent = segments;
+    silent[2].beat = 0;
+    wrong += CHECK(!fitLinearization(silent.data(), silent.size(), &curve));
+    auto backwards = segments;
+    backwards[1].width = -backwards[1].width;
+    wrong += CHECK(!fitLinearization(backwards.data(), backwards.size(), &curve));
+    return wrong;
+}
+
+// Tuning curves of random positive slope, every fit accepted has to keep the ramp rising over the whole band
+static int checkCurves(const Options &options, std::mt19937 &random) {
+    std::uniform_real_distribution<double> slope(0.05, 1.0);
+    int accepted = 0, refused = 0, wrong = 0;
+    for (int n = 0; n < options.curves; n++) {
+        CalibrationSegment segments[CALIBRATION_DEFAULT_SEGMENTS];
+        for (int i = 0; i < CALIBRATION_DEFAULT_SEGMENTS; i++) {
+            segments[i] = {
+                    .start = (float) i / CALIBRATION_DEFAULT_SEGMENTS,
+                    .width = 1.0f / CALIBRATION_DEFAULT_SEGMENTS,
+                    .beat = (float) (slope(random) * HOST_BEAT),
+            };
+        }
+        Linearization curve{};
+        curve.coefficients[0] = 0.5f;
+        if (!fitLinearization(segments, CALIBRATION_DEFAULT_SEGMENTS, &curve)) {
+            // A refused fit leaves the result alone
+            wrong += CHECK(curve.coefficients[0] == 0.5f);
+            refused++;
+            continue;
+        }
+        accepted++;
+        wrong += CHECK(curve.valid && linearizationMonotonic(curve));
+    }
+    printf("Random curves: %d fitted, %d refused, %d wrong\n", accepted, refused, wrong);
+    return wrong;
+}
+
+int main(int argc, char **argv) {
+    Options options{};
+    if (!parseOptions(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+    std::mt19937 random(options.seed);
+    int wrong = checkBeats(random);
+    wrong += checkFit();
+    wrong += checkCalibration(options, random);
+    wrong += checkCurves(options, random);
+    return wrong > 0 ? 1 : 0;
+}
@@ -0,0 +1,315 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "capture_file.h"
+
+CaptureWriter::~CaptureWriter() {
+    close();
+}
+
+bool CaptureWriter::open(const char *path, const char *source, int64_t created, uint32_t bytes) {
+    fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    CaptureHeader header{};
+    header.magic = CAPTURE_MAGIC;
+    header.version = CAPTURE_VERSION;
+    header.chunkBytes = bytes;
+    header.created = created;
+    strncpy(header.source, source, sizeof(header.source) - 1);
+    chunkBytes = bytes;
+    offset = 0;
+    sequence = 0;
+    pending.clear();
+    frameIndex.clear();
+    chunkIndex.clear();
+    settingsIndex.clear();
+    chunk = {};
+    if (!put(&header, sizeof(header))) {
+        return false;
+    }
+    offset = sizeof(header);
+    return true;
+}
+
+bool CaptureWriter::append(uint8_t type, int64_t time, const uint8_t *payload, size_t length) {
+    if (fd < 0) {
+        return false;
+    }
+    size_t bytes = captureRecordBytes(length);
+    // The chunk header counts its bytes in 32 bits
+    if (bytes > UINT32_MAX) {
+        return false;
+    }
+    // Start a new chunk rather than split a record, a record larger than a chunk gets one of its own
+    if (!pending.empty() && pending.size() + bytes > chunkBytes) {
+        if (!flush()) {
+            return false;
+        }
+    }
+    if (pending.empty()) {
+        chunk.sequence = sequence;
+        chunk.frame = frameIndex.size();
+        chunk.records = 0;
+    }
+    uint64_t at = offset + sizeof(CaptureChunk) + pending.size();
+    if (type == CAPTURE_FRAME) {
+        frameIndex.push_back(at);
+    } else if (type == CAPTURE_METADATA || type == CAPTURE_SETTINGS) {
+        settingsIndex.push_back({frameIndex.size(), at});
+    }
+    size_t position = pending.size();
+    pending.resize(position + bytes);
+    captureEncodeRecord(&pending[position], bytes, type, sequence, time, payload, length);
+    chunk.records++;
+    sequence++;
+    return true;
+}
+
+bool CaptureWriter::flush() {
+    if (pending.empty()) {
+        return true;
+    }
+    chunk.magic = CAPTURE_CHUNK_MAGIC;
+    chunk.index = (uint32_t) chunkIndex.size();
+    chunk.bytes = (uint32_t) pending.size();
+    if (!put(&chunk, sizeof(chunk)) || !put(pending.data(), pending.size())) {
+        return false;
+    }
+    chunkIndex.push_back(offset);
+    offset += sizeof(chunk) + pending.size();
+    pending.clear();
+    return true;
+}
+
+bool CaptureWriter::put(const void *data, size_t length) {
+    auto bytes = (const uint8_t *) data;
+    while (length > 0) {
+        ssize_t written = ::write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += written;
+        length -= (size_t) written;
+    }
+    return true;
+}
+
+bool CaptureWriter::close() {
+    if (fd < 0) {
+        return true;
+    }
+    bool ok = flush();
+    CaptureFooter footer{};
+    footer.magic = CAPTURE_FOOTER_MAGIC;
+    footer.chunks = (uint32_t) chunkIndex.size();
+    footer.records = sequence;
+    footer.frames = frameIndex.size();
+    footer.frameIndex = offset;
+    footer.chunkIndex = footer.frameIndex + frameIndex.size() * sizeof(uint64_t);
+    footer.settingsIndex = footer.chunkIndex + chunkIndex.size() * sizeof(uint64_t);
+    footer.settings = (uint32_t) settingsIndex.size();
+    ok = ok && put(frameIndex.data(), frameIndex.size() * sizeof(uint64_t));
+    ok = ok && put(chunkIndex.data(), chunkIndex.size() * sizeof(uint64_t));
+    ok = ok && put(settingsIndex.data(), settingsIndex.size() * sizeof(CaptureSettings));
+    ok = ok && put(&footer, sizeof(footer));
+    ok = ::close(fd) == 0 && ok;
+    fd = -1;
+    return ok;
+}
+
+uint64_t CaptureWriter::records() const {
+    return sequence;
+}
+
+uint64_t CaptureWriter::frames() const {
+    return frameIndex.size();
+}
+
+CaptureReader::~CaptureReader() {
+    close();
+}
+
+bool CaptureReader::open(const char *path) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(CaptureHeader)) {
+        ::close(fd);
+        return false;
+    }
+    size = (size_t) st.st_size;
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        size = 0;
+        return false;
+    }
+    base = (const uint8_t *) mapped;
+    // Replay reads front to back, seeks jump anywhere
+    madvise(mapped, size, MADV_SEQUENTIAL);
+
+    auto head = (const CaptureHeader *) base;
+    if (head->magic != CAPTURE_MAGIC || head->version != CAPTURE_VERSION) {
+        close();
+        return false;
+    }
+
+    if (size >= sizeof(CaptureHeader) + sizeof(CaptureFooter)) {
+        auto footer = (const CaptureFooter *) (base + size - sizeof(CaptureFooter));
+        if (footer->magic == CAPTURE_FOOTER_MAGIC && footer->frameIndex >= sizeof(CaptureHeader) &&
+            footer->chunkIndex == footer->frameIndex + footer->frames * sizeof(uint64_t) &&
+            footer->settingsIndex == footer->chunkIndex + (uint64_t) footer->chunks * sizeof(uint64_t) &&
+            footer->settingsIndex + footer->settings * sizeof(CaptureSettings) + sizeof(CaptureFooter) == size) {
+            end = footer->frameIndex;
+            frameTable = (const uint64_t *) (base + footer->frameIndex);
+            settingsTable = (const CaptureSettings *) (base + footer->settingsIndex);
+            frameCount = footer->frames;
+            settingsCount = footer->settings;
+            recordCount = footer->records;
+            chunkCount = footer->chunks;
+            return true;
+        }
+    }
+    return recover();
+}
+
+bool CaptureReader::recover() {
+    rebuilt = true;
+    rebuiltFrames.clear();
+    rebuiltSettings.clear();
+    frameCount = 0;
+    recordCount = 0;
+    chunkCount = 0;
+    uint64_t offset = sizeof(CaptureHeader);
+    // Take every whole chunk, the last one may have been cut off mid write
+    while (captureChunkValid(base + offset, size - offset)) {
+        auto chunk = (const CaptureChunk *) (base + offset);
+        uint64_t position = offset + sizeof(CaptureChunk);
+        uint64_t limit = position + chunk->bytes;
+        size_t frames = rebuiltFrames.size();
+        size_t settings = rebuiltSettings.size();
+        uint32_t records = 0;
+        while (position < limit) {
+            const CaptureRecord *record = nullptr;
+            size_t bytes = captureRecordAt(base + position, limit - position, &record);
+            if (bytes == 0) {
+                break;
+            }
+            if (record->type == CAPTURE_FRAME) {
+                rebuiltFrames.push_back(position);
+            } else if (record->type == CAPTURE_METADATA || record->type == CAPTURE_SETTINGS) {
+                rebuiltSettings.push_back({rebuiltFrames.size(), position});
+            }
+            position += bytes;
+            records++;
+        }
+        if (position != limit || records != chunk->records) {
+            rebuiltFrames.resize(frames);
+            rebuiltSettings.resize(settings);
+            break;
+        }
+        recordCount += records;
+        chunkCount++;
+        offset = limit;
+    }
+    end = offset;
+    frameCount = rebuiltFrames.size();
+    settingsTable = rebuiltSettings.data();
+    settingsCount = (uint32_t) rebuiltSettings.size();
+    return true;
+}
+
+void CaptureReader::close() {
+    if (base != nullptr) {
+        munmap((void *) base, size);
+    }
+    base = nullptr;
+    size = 0;
+    end = 0;
+    frameTable = nullptr;
+    settingsTable = nullptr;
+    frameCount = 0;
+    settingsCount = 0;
+    recordCount = 0;
+    chunkCount = 0;
+    rebuiltFrames.clear();
+    rebuiltSettings.clear();
+    rebuilt = false;
+}
+
+const CaptureHeader &CaptureReader::header() const {
+    return *(const CaptureHeader *) base;
+}
+
+uint64_t CaptureReader::frames() const {
+    return frameCount;
+}
+
+uint64_t CaptureReader::records() const {
+    return recordCount;
+}
+
+uint32_t CaptureReader::chunks() const {
+    return chunkCount;
+}
+
+bool CaptureReader::recovered() const {
+    return rebuilt;
+}
+
+uint64_t CaptureReader::frameOffset(uint64_t n) const {
+    if (n >= frameCount) {
+        return 0;
+    }
+    return rebuilt ? rebuiltFrames[n] : frameTable[n];
+}
+
+uint64_t CaptureReader::settingsOffset(uint64_t n) const {
+    // Settings change rarely, the index holds a handful of documents
+    uint32_t low = 0, high = settingsCount;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (settingsTable[middle].frame <= n) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low > 0 ? settingsTable[low - 1].offset : 0;
+}
+
+uint64_t CaptureReader::skipChunk(uint64_t offset) const {
+    // A record starts with its type, never with the first byte of the chunk magic
+    if (offset + sizeof(CaptureChunk) <= end && *(const uint32_t *) (base + offset) == CAPTURE_CHUNK_MAGIC) {
+        return offset + sizeof(CaptureChunk);
+    }
+    return offset;
+}
+
+uint64_t CaptureReader::begin() const {
+    return skipChunk(sizeof(CaptureHeader));
+}
+
+const CaptureRecord *CaptureReader::next(uint64_t *offset) const {
+    if (*offset >= end) {
+        return nullptr;
+    }
+    const CaptureRecord *record = nullptr;
+    size_t bytes = captureRecordAt(base + *offset, end - *offset, &record);
+    if (bytes == 0) {
+        return nullptr;
+    }
+    *offset = skipChunk(*offset + bytes);
+    return record;
+}
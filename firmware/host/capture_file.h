@@ -0,0 +1,108 @@
+#ifndef RADAR_CAPTURE_FILE_H
+#define RADAR_CAPTURE_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "capture.h"
+
+// Appends records to a capture file. Records are gathered in memory until the chunk is full and then written with its
+// chunk header in one piece, so a recorder that dies loses at most the open chunk. close writes the indexes and the
+// footer.
+class CaptureWriter {
+public:
+
+    ~CaptureWriter();
+
+    bool open(const char *path, const char *source, int64_t created, uint32_t chunkBytes = CAPTURE_CHUNK_BYTES);
+
+    bool append(uint8_t type, int64_t time, const uint8_t *payload, size_t length);
+
+    bool close();
+
+    uint64_t records() const;
+
+    uint64_t frames() const;
+
+private:
+
+    bool flush();
+
+    bool put(const void *data, size_t length);
+
+    int fd = -1;
+    uint32_t chunkBytes = CAPTURE_CHUNK_BYTES;
+    // File offset the open chunk will be written at
+    uint64_t offset = 0;
+    CaptureChunk chunk{};
+    std::vector<uint8_t> pending;
+    std::vector<uint64_t> frameIndex;
+    std::vector<uint64_t> chunkIndex;
+    std::vector<CaptureSettings> settingsIndex;
+    uint64_t sequence = 0;
+
+};
+
+// Maps a capture file and finds frames through its frame index. The records are read in place, a record and its
+// payload stay valid until the reader is closed.
+class CaptureReader {
+public:
+
+    ~CaptureReader();
+
+    bool open(const char *path);
+
+    void close();
+
+    const CaptureHeader &header() const;
+
+    uint64_t frames() const;
+
+    uint64_t records() const;
+
+    uint32_t chunks() const;
+
+    // True when the file had no footer and the indexes were rebuilt by walking the chunks
+    bool recovered() const;
+
+    // File offset of frame n, or zero past the last frame
+    uint64_t frameOffset(uint64_t n) const;
+
+    // File offset of the last metadata or settings document recorded before frame n, or zero if there is none
+    uint64_t settingsOffset(uint64_t n) const;
+
+    // File offset of the first record
+    uint64_t begin() const;
+
+    // The record at offset, advancing offset past it and any chunk header that follows. Returns nullptr at the end.
+    const CaptureRecord *next(uint64_t *offset) const;
+
+    static const uint8_t *payload(const CaptureRecord *record) {
+        return (const uint8_t *) (record + 1);
+    }
+
+private:
+
+    bool recover();
+
+    // Skip the chunk header at offset, if there is one
+    uint64_t skipChunk(uint64_t offset) const;
+
+    const uint8_t *base = nullptr;
+    size_t size = 0;
+    // End of the last chunk, where the indexes begin
+    uint64_t end = 0;
+    const uint64_t *frameTable = nullptr;
+    const CaptureSettings *settingsTable = nullptr;
+    uint64_t frameCount = 0;
+    uint32_t settingsCount = 0;
+    uint64_t recordCount = 0;
+    uint32_t chunkCount = 0;
+    std::vector<uint64_t> rebuiltFrames;
+    std::vector<CaptureSettings> rebuiltSettings;
+    bool rebuilt = false;
+
+};
+
+
+#endif //RADAR_CAPTURE_FILE_H
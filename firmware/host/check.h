@@ -0,0 +1,19 @@
+#ifndef RADAR_CHECK_H
+#define RADAR_CHECK_H
+
+#include <cstdio>
+
+// Shared by the host checks, each adds up what comes out wrong and exits with 1 if anything did
+
+// One if the check came out wrong, which is then reported by name
+static inline int check(const char *name, bool right) {
+    if (!right) {
+        printf("%s: WRONG\n", name);
+    }
+    return right ? 0 : 1;
+}
+
+// A check named by its own condition
+#define CHECK(condition) check(#condition, condition)
+
+#endif //RADAR_CHECK_H
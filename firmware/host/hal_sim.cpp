@@ -0,0 +1,409 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "pipeline.h"
+#include "imu.h"
+#include "hal_sim.h"
+
+void Notification::give() {
+    std::lock_guard<std::mutex> guard(lock);
+    pending++;
+    ready.notify_one();
+}
+
+bool Notification::take(std::chrono::microseconds timeout) {
+    std::unique_lock<std::mutex> guard(lock);
+    if (!ready.wait_for(guard, timeout, [this] { return pending > 0; })) {
+        return false;
+    }
+    pending = 0;
+    return true;
+}
+
+SimAdcSource::SimAdcSource(ChirpSource &chirps) : chirps(chirps), stream(chirps.encodedBytes()) {}
+
+void SimAdcSource::load() {
+    chirps.encode(stream.data(), stream.size());
+    position = 0;
+    loaded = true;
+}
+
+esp_err_t SimAdcSource::start() {
+    if (!loaded) {
+        load();
+    }
+    position = 0;
+    return ESP_OK;
+}
+
+esp_err_t SimAdcSource::read(uint8_t *dest, uint32_t length, uint32_t *read) {
+    // The ADC keeps converting past the end of the chirp, into the next one
+    if (position >= stream.size()) {
+        load();
+    }
+    size_t count = stream.size() - position;
+    count = count < length ? count : length;
+    count -= count % PIPELINE_CONVERSION_BYTES;
+    memcpy(dest, &stream[position], count);
+    position += count;
+    *read = (uint32_t) count;
+    return ESP_OK;
+}
+
+esp_err_t SimAdcSource::stop() {
+    loaded = false;
+    return ESP_OK;
+}
+
+void SimDacBus::write(const uint16_t *words, int count) {
+    for (int i = 0; i < count; i++) {
+        // Bit 15 of an MCP4922 command selects channel B
+        latched[(words[i] >> 15) & 0x1] = words[i] & 0xFFF;
+    }
+    writes += count;
+}
+
+SimChirpTimer::~SimChirpTimer() {
+    stop();
+}
+
+esp_err_t SimChirpTimer::initialize(ChirpAlarm next, void *nextCtx) {
+    alarm = next;
+    ctx = nextCtx;
+    return ESP_OK;
+}
+
+esp_err_t SimChirpTimer::setPeriod(uint32_t next) {
+    period = next;
+    return ESP_OK;
+}
+
+esp_err_t SimChirpTimer::start() {
+    if (alarm == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (running) {
+        return ESP_OK;
+    }
+    running = true;
+    thread = std::thread([this] {
+        auto next = std::chrono::steady_clock::now();
+        while (running) {
+            // Scheduled from the previous deadline so the period does not drift with the alarm's own duration
+            next += std::chrono::microseconds(period.load());
+            std::this_thread::sleep_until(next);
+            alarm(ctx);
+        }
+    });
+    return ESP_OK;
+}
+
+esp_err_t SimChirpTimer::stop() {
+    if (!running) {
+        return ESP_OK;
+    }
+    running = false;
+    if (thread.joinable()) {
+        thread.join();
+    }
+    return ESP_OK;
+}
+
+esp_err_t SimChirpTimer::suspend() {
+    return ESP_OK;
+}
+
+esp_err_t SimChirpTimer::resume() {
+    return ESP_OK;
+}
+
+uint64_t i2cWireNanoseconds(uint32_t frequency, size_t writing, size_t reading) {
+    uint64_t clocks = reading > 0 ? 9 * (2 + writing + reading) + 3 : 9 * (1 + writing) + 2;
+    return clocks * 1000000000ULL / frequency;
+}
+
+SimI2CBus::SimI2CBus(uint32_t frequency) : frequency(frequency) {}
+
+esp_err_t SimI2CBus::read(uint8_t address, uint8_t reg, uint8_t *dest, size_t length) {
+    std::lock_guard<std::mutex> guard(lock);
+    current.transfers++;
+    nanoseconds += i2cWireNanoseconds(frequency, 1, length);
+    auto device = devices.find(address);
+    if (device == devices.end()) {
+        // Nothing acknowledges the address
+        current.nacks++;
+        return ESP_FAIL;
+    }
+    current.bytes += 1 + length;
+    for (size_t i = 0; i < length; i++) {
+        dest[i] = device->second[(reg + i) & 0xFF];
+    }
+    return ESP_OK;
+}
+
+esp_err_t SimI2CBus::write(uint8_t address, uint8_t reg, const uint8_t *src, size_t length) {
+    std::lock_guard<std::mutex> guard(lock);
+    current.transfers++;
+    current.bytes += 1 + length;
+    nanoseconds += i2cWireNanoseconds(frequency, 1 + length, 0);
+    auto &registers = devices[address];
+    registers.resize(256, 0);
+    for (size_t i = 0; i < length; i++) {
+        registers[(reg + i) & 0xFF] = src[i];
+    }
+    return ESP_OK;
+}
+
+I2CStats SimI2CBus::stats() {
+    std::lock_guard<std::mutex> guard(lock);
+    I2CStats snapshot = current;
+    snapshot.busy = nanoseconds / 1000;
+    return snapshot;
+}
+
+SimLsm6dsm::SimLsm6dsm(uint32_t frequency) : frequency(frequency) {
+    registers[LSM6DSM_WHO_AM_I] = LSM6DSM_ID;
+    // IF_INC is set out of reset
+    registers[LSM6DSM_CTRL3_C] = 0x04;
+}
+
+size_t SimLsm6dsm::watermark() {
+    return registers[LSM6DSM_FIFO_CTRL1] | (registers[LSM6DSM_FIFO_CTRL2] & 0x07) << 8;
+}
+
+void SimLsm6dsm::detect(const int16_t *accel) {
+    // Wake-up threshold in 1/64 of 2 g, against the slope filter, half the change from the last sample
+    bool waking = (registers[LSM6DSM_TAP_CFG] & 0x80) != 0;
+    int threshold = (registers[LSM6DSM_WAKE_UP_THS] & 0x3F) * 512;
+    if (waking && primed) {
+        uint8_t axes = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            if (std::abs(accel[axis] - previous[axis]) / 2 > threshold) {
+                axes |= (uint8_t) (0x04 >> axis);
+            }
+        }
+        if (axes != 0) {
+            registers[LSM6DSM_WAKE_UP_SRC] |= (uint8_t) (0x08 | axes);
+        }
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        previous[axis] = accel[axis];
+    }
+
+    float x = accel[0], y = accel[1], z = accel[2];
+    float norm = std::sqrt(x * x + y * y + z * z);
+    bool tilting = (registers[LSM6DSM_CTRL10_C] & 0x0C) == 0x0C;
+    if (tilting && primed && norm > 0) {
+        float cosine = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            cosine += rest[axis] * (float) accel[axis] / norm;
+        }
+        tilted = cosine < std::cos(35.0f * (float) M_PI / 180.0f) ? tilted + 1 : 0;
+    }
+    if ((!primed || tilted >= 2 * IMU_RATE) && norm > 0) {
+        if (primed) {
+            registers[LSM6DSM_FUNC_SRC1] |= 0x20;
+        }
+        for (int axis = 0; axis < 3; axis++) {
+            rest[axis] = (float) accel[axis] / norm;
+        }
+        tilted = 0;
+    }
+    primed = true;
+}
+
+void SimLsm6dsm::sample(const ImuSample &sample, float temperature) {
+    std::lock_guard<std::mutex> guard(lock);
+    detect(sample.accel);
+    auto temp = (int16_t) std::lround((temperature - 25.0f) * 256.0f);
+    const int16_t outputs[7] = {temp, sample.gyro[0], sample.gyro[1], sample.gyro[2], sample.accel[0],
+                                sample.accel[1], sample.accel[2]};
+    for (int i = 0; i < 7; i++) {
+        registers[LSM6DSM_OUT_TEMP_L + 2 * i] = (uint8_t) outputs[i];
+        registers[LSM6DSM_OUT_TEMP_L + 2 * i + 1] = (uint8_t) ((uint16_t) outputs[i] >> 8);
+    }
+    uint8_t batching = registers[LSM6DSM_FIFO_CTRL3];
+    bool streaming = (registers[LSM6DSM_FIFO_CTRL5] & 0x07) == LSM6DSM_STREAM_MODE;
+    if (!streaming || (batching & 0x07) == 0 || (batching & 0x38) == 0) {
+        return;
+    }
+    // The gyroscope is the first data set, the accelerometer the second
+    for (int i = 1; i < 7; i++) {
+        if (fifo.size() == IMU_FIFO_WORDS) {
+            fifo.pop_front();
+            popped++;
+            overrun = true;
+        }
+        fifo.push_back((uint16_t) outputs[i]);
+    }
+}
+
+bool SimLsm6dsm::interrupt() {
+    std::lock_guard<std::mutex> guard(lock);
+    uint8_t routes = registers[LSM6DSM_INT1_CTRL], motion = registers[LSM6DSM_MD1_CFG];
+    bool watermarked = (routes & 0x08) != 0 && watermark() > 0 && fifo.size() >= watermark();
+    bool woken = (motion & 0x20) != 0 && (registers[LSM6DSM_WAKE_UP_SRC] & 0x08) != 0;
+    bool tilted = (motion & 0x02) != 0 && (registers[LSM6DSM_FUNC_SRC1] & 0x20) != 0;
+    bool carried = (routes & 0x40) != 0 && (registers[LSM6DSM_FUNC_SRC1] & 0x40) != 0;
+    return watermarked || woken || tilted || carried;
+}
+
+void SimLsm6dsm::carried() {
+    std::lock_guard<std::mutex> guard(lock);
+    if ((registers[LSM6DSM_CTRL10_C] & 0x05) == 0x05) {
+        registers[LSM6DSM_FUNC_SRC1] |= 0x40;
+    }
+}
+
+void SimLsm6dsm::fail(uint32_t transfers) {
+    std::lock_guard<std::mutex> guard(lock);
+    failing = transfers;
+}
+
+bool SimLsm6dsm::account(uint8_t address, size_t writing, size_t reading) {
+    current.transfers++;
+    if (address != IMU_ADDRESS || failing > 0) {
+        failing -= failing > 0 ? 1 : 0;
+        current.nacks++;
+        // Only the address goes out before the missing acknowledge
+        nanoseconds += i2cWireNanoseconds(frequency, 0, 0);
+        return false;
+    }
+    current.bytes += writing + reading;
+    nanoseconds += i2cWireNanoseconds(frequency, writing, reading);
+    return true;
+}
+
+uint8_t SimLsm6dsm::status(uint8_t reg) {
+    // DIFF_FIFO has eleven bits, a full FIFO reads one short
+    size_t level = fifo.size() < IMU_FIFO_WORDS ? fifo.size() : IMU_FIFO_WORDS - 1;
+    auto pattern = (uint16_t) (popped % IMU_FIFO_PATTERN);
+    switch (reg) {
+        case LSM6DSM_FIFO_STATUS1:
+            return (uint8_t) level;
+        case LSM6DSM_FIFO_STATUS2:
+            return (uint8_t) (((level >> 8) & 0x07) | (fifo.empty() ? 0x10 : 0) | (overrun ? 0x40 : 0) |
+                              (watermark() > 0 && fifo.size() >= watermark() ? 0x80 : 0));
+        case LSM6DSM_FIFO_STATUS3:
+            return (uint8_t) pattern;
+        default:
+            return (uint8_t) (pattern >> 8);
+    }
+}
+
+esp_err_t SimLsm6dsm::read(uint8_t address, uint8_t reg, uint8_t *dest, size_t length) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!account(address, 1, length)) {
+        return ESP_FAIL;
+    }
+    bool increment = (registers[LSM6DSM_CTRL3_C] & 0x04) != 0;
+    uint8_t at = reg & 0x7F;
+    bool popping = false;
+    for (size_t i = 0; i < length; i++) {
+        if (at == LSM6DSM_FIFO_DATA_OUT_L || at == LSM6DSM_FIFO_DATA_OUT_H) {
+            uint16_t word = fifo.empty() ? 0 : fifo.front();
+            dest[i] = at == LSM6DSM_FIFO_DATA_OUT_L ? (uint8_t) word : (uint8_t) (word >> 8);
+            popping = true;
+            if (at == LSM6DSM_FIFO_DATA_OUT_H && !fifo.empty()) {
+                fifo.pop_front();
+                popped++;
+            }
+        } else if (at >= LSM6DSM_FIFO_STATUS1 && at <= LSM6DSM_FIFO_STATUS4) {
+            dest[i] = status(at);
+        } else if (at == LSM6DSM_WAKE_UP_SRC || at == LSM6DSM_FUNC_SRC1) {
+            // Interrupts are latched, reading the source clears them
+            dest[i] = registers[at];
+            registers[at] &= at == LSM6DSM_WAKE_UP_SRC ? 0x00 : (uint8_t) ~0x60;
+        } else {
+            dest[i] = registers[at];
+        }
+        if (!increment) {
+            continue;
+        }
+        // Past FIFO_DATA_OUT_H the address rolls back to FIFO_DATA_OUT_L
+        at = at == LSM6DSM_FIFO_DATA_OUT_H ? LSM6DSM_FIFO_DATA_OUT_L : (uint8_t) ((at + 1) & 0x7F);
+    }
+    if (popping) {
+        overrun = false;
+    }
+    return ESP_OK;
+}
+
+esp_err_t SimLsm6dsm::write(uint8_t address, uint8_t reg, const uint8_t *src, size_t length) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!account(address, 1 + length, 0)) {
+        return ESP_FAIL;
+    }
+    bool increment = (registers[LSM6DSM_CTRL3_C] & 0x04) != 0;
+    for (size_t i = 0; i < length; i++) {
+        uint8_t at = (uint8_t) ((reg + (increment ? i : 0)) & 0x7F);
+        registers[at] = src[i];
+        // Bypass mode empties the FIFO and starts the pattern over
+        if (at == LSM6DSM_FIFO_CTRL5 && (src[i] & 0x07) == LSM6DSM_BYPASS_MODE) {
+            popped = 0;
+            fifo.clear();
+            overrun = false;
+        }
+    }
+    return ESP_OK;
+}
+
+I2CStats SimLsm6dsm::stats() {
+    std::lock_guard<std::mutex> guard(lock);
+    I2CStats snapshot = current;
+    snapshot.busy = nanoseconds / 1000;
+    return snapshot;
+}
+
+SimTransport::SimTransport(FILE *sink) : sink(sink) {}
+
+bool SimTransport::connected() {
+    return true;
+}
+
+esp_err_t SimTransport::send(const uint8_t *data, size_t length, bool binary) {
+    if (binary) {
+        frames++;
+        if (sink != nullptr) {
+            uint32_t prefix = (uint32_t) length;
+            if (fwrite(&prefix, sizeof(prefix), 1, sink) != 1 || fwrite(data, 1, length, sink) != length) {
+                return ESP_FAIL;
+            }
+        }
+    } else {
+        messages++;
+    }
+    bytes += length;
+    return ESP_OK;
+}
+
+esp_err_t SimStorage::readInt(const char *key, int32_t *dest, int32_t fallback) {
+    auto found = ints.find(key);
+    *dest = found == ints.end() ? fallback : found->second;
+    return ESP_OK;
+}
+
+esp_err_t SimStorage::readBlob(const char *key, void *dest, size_t *length) {
+    auto found = blobs.find(key);
+    if (found == blobs.end()) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (found->second.size() > *length) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dest, found->second.data(), found->second.size());
+    *length = found->second.size();
+    return ESP_OK;
+}
+
+esp_err_t SimStorage::writeBlob(const char *key, const void *value, size_t length) {
+    auto bytes = (const uint8_t *) value;
+    blobs[key].assign(bytes, bytes + length);
+    writes++;
+    return ESP_OK;
+}
+
+esp_err_t SimStorage::commit() {
+    commits++;
+    return ESP_OK;
+}
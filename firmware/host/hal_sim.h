@@ -0,0 +1,221 @@
+#ifndef RADAR_HAL_SIM_H
+#define RADAR_HAL_SIM_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "hal.h"
+#include "imu_fifo.h"
+#include "scene.h"
+
+// Notification stands in for a FreeRTOS task notification, give from any thread and take from the waiting one
+class Notification {
+public:
+
+    void give();
+
+    // Wait for at least one give and clear them all, returns false on timeout
+    bool take(std::chrono::microseconds timeout);
+
+private:
+
+    std::mutex lock;
+    std::condition_variable ready;
+    uint32_t pending = 0;
+
+};
+
+// Delivers the TYPE2 conversion words of a scene or a replayed capture, one chirp after another as the continuous ADC
+// would
+class SimAdcSource final : public AdcSource {
+public:
+
+    explicit SimAdcSource(ChirpSource &chirps);
+
+    // Render the next chirp ahead of start, so rendering is not counted as capture time
+    void load();
+
+    esp_err_t start() override;
+
+    esp_err_t read(uint8_t *dest, uint32_t length, uint32_t *read) override;
+
+    esp_err_t stop() override;
+
+private:
+
+    ChirpSource &chirps;
+    std::vector<uint8_t> stream;
+    size_t position = 0;
+    bool loaded = false;
+
+};
+
+// Keeps the last words latched on each DAC channel
+class SimDacBus final : public DacBus {
+public:
+
+    void write(const uint16_t *words, int count) override;
+
+    std::atomic<uint16_t> latched[2]{};
+    std::atomic<uint64_t> writes{0};
+
+};
+
+// Calls the alarm from its own thread at the period
+class SimChirpTimer final : public ChirpTimer {
+public:
+
+    ~SimChirpTimer() override;
+
+    esp_err_t initialize(ChirpAlarm alarm, void *ctx) override;
+
+    esp_err_t setPeriod(uint32_t period) override;
+
+    esp_err_t start() override;
+
+    esp_err_t stop() override;
+
+    esp_err_t suspend() override;
+
+    esp_err_t resume() override;
+
+private:
+
+    ChirpAlarm alarm = nullptr;
+    void *ctx = nullptr;
+    std::atomic<uint32_t> period{100};
+    std::atomic<bool> running{false};
+    std::thread thread;
+
+};
+
+// Time a register transfer holds the bus: the address, register and payload bytes of nine clocks each, a clock for
+// each start, repeated start and stop, and the address again to turn around for a read
+uint64_t i2cWireNanoseconds(uint32_t frequency, size_t writing, size_t reading);
+
+// Register file of every device on the bus, a device acknowledges its address once any register has been written
+class SimI2CBus final : public I2CBus {
+public:
+
+    explicit SimI2CBus(uint32_t frequency = 400000);
+
+    esp_err_t read(uint8_t address, uint8_t reg, uint8_t *dest, size_t length) override;
+
+    esp_err_t write(uint8_t address, uint8_t reg, const uint8_t *src, size_t length) override;
+
+    I2CStats stats() override;
+
+private:
+
+    std::mutex lock;
+    uint32_t frequency;
+    std::map<uint8_t, std::vector<uint8_t>> devices;
+    I2CStats current{};
+    uint64_t nanoseconds = 0;
+
+};
+
+// An LSM6DSM alone on the bus at IMU_ADDRESS, for the ST driver to talk to through the stmdev_ctx_t callbacks. Its
+// registers hold what was written, the FIFO status is computed, reads of FIFO_DATA_OUT pop words and wrap around as the
+// device does, and the output registers hold the last sample. Transfers are timed as they would take on the wire.
+class SimLsm6dsm final : public I2CBus {
+public:
+
+    explicit SimLsm6dsm(uint32_t frequency);
+
+    // Both sensors produce a sample, batched into the FIFO while it streams
+    void sample(const ImuSample &sample, float temperature);
+
+    // Level of INT1
+    bool interrupt();
+
+    // Latch the pedometer's significant motion, which is not derived from the samples
+    void carried();
+
+    // Leave the next transfers unacknowledged
+    void fail(uint32_t transfers);
+
+    esp_err_t read(uint8_t address, uint8_t reg, uint8_t *dest, size_t length) override;
+
+    esp_err_t write(uint8_t address, uint8_t reg, const uint8_t *src, size_t length) override;
+
+    I2CStats stats() override;
+
+private:
+
+    // Count a transfer, returns false if it goes unacknowledged
+    bool account(uint8_t address, size_t writing, size_t reading);
+
+    uint8_t status(uint8_t reg);
+
+    size_t watermark();
+
+    // The embedded functions on an accelerometer sample: wake-up on the slope of any axis, tilt once the module has
+    // rested 35 degrees from the last tilt for two seconds
+    void detect(const int16_t *accel);
+
+    std::mutex lock;
+    uint32_t frequency;
+    uint8_t registers[128]{};
+    std::deque<uint16_t> fifo;
+    // Words popped or overwritten, which fixes the pattern position of the oldest word
+    uint64_t popped = 0;
+    bool overrun = false;
+    int16_t previous[3]{};
+    bool primed = false;
+    float rest[3]{};
+    uint32_t tilted = 0;
+    uint32_t failing = 0;
+    I2CStats current{};
+    uint64_t nanoseconds = 0;
+
+};
+
+// Counts what would be sent to the bridge, optionally writing binary frames to a file with a 32-bit length prefix
+class SimTransport final : public Transport {
+public:
+
+    explicit SimTransport(FILE *sink = nullptr);
+
+    bool connected() override;
+
+    esp_err_t send(const uint8_t *data, size_t length, bool binary) override;
+
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> messages{0};
+    std::atomic<uint64_t> bytes{0};
+
+private:
+
+    FILE *sink;
+
+};
+
+// Keys and blobs in memory as the non-volatile storage would hold them, counting the writes that would wear the flash
+class SimStorage final : public Storage {
+public:
+
+    esp_err_t readInt(const char *key, int32_t *dest, int32_t fallback) override;
+
+    esp_err_t readBlob(const char *key, void *dest, size_t *length) override;
+
+    esp_err_t writeBlob(const char *key, const void *value, size_t length) override;
+
+    esp_err_t commit() override;
+
+    std::map<std::string, int32_t> ints;
+    std::map<std::string, std::vector<uint8_t>> blobs;
+    uint64_t writes = 0;
+    uint64_t commits = 0;
+
+};
+
+
+#endif //RADAR_HAL_SIM_H
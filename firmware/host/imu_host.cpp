@@ -0,0 +1,498 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "hal_sim.h"
+#include "imu.h"
+#include "orientation.h"
+
+// Runs the gyro FIFO parser against a simulated LSM6DSM FIFO in stream mode. Sample sets go in at the output data rate
+// and are read back in batches at the watermark, as the gyro task reads them, with reads of odd lengths that split
+// sets, reads that fail and stalls long enough for the FIFO to overrun. Every word of a set carries the index of the
+// set, so a set assembled from words of different sets is caught. Exits with 1 if any set comes out wrong.
+//
+// The gyro then drains the same simulated device through the bus as it does on the module, with transfers that go
+// unacknowledged, and its bus time per sample is set against polling both sensors for every sample at 100 kHz. The
+// motion detection follows, every bump, tilt and significant motion has to be reported and nothing more.
+//
+// Then the orientation filter tracks a simulated module that rests while it settles and then sways, read by a
+// gyroscope with bias and noise and an accelerometer shaken by vibration. It reports the tilt error of the filter
+// against that of the accelerometer alone, the bias it settled on, and the cost of one update.
+
+typedef struct Options {
+    double seconds = 600.0;
+    uint32_t seed = 1;
+    // Sample sets per watermark
+    int batch = 208;
+    // Filter updates timed
+    uint32_t updates = 10000000;
+    // Gyro bus clock
+    uint32_t frequency = 400000;
+} Options;
+
+static void usage(const char *name) {
+    printf("Usage: %s [--seconds S] [--seed N] [--batch sets] [--updates N] [--frequency Hz]\n", name);
+}
+
+static bool parseOptions(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            return false;
+        } else if (strcmp(arg, "--seconds") == 0) {
+            options->seconds = atof(value);
+            i++;
+        } else if (strcmp(arg, "--seed") == 0) {
+            options->seed = (uint32_t) strtoul(value, nullptr, 10);
+            i++;
+        } else if (strcmp(arg, "--batch") == 0) {
+            options->batch = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--frequency") == 0) {
+            options->frequency = (uint32_t) strtoul(value, nullptr, 10);
+            i++;
+        } else if (strcmp(arg, "--updates") == 0) {
+            options->updates = (uint32_t) strtoul(value, nullptr, 10);
+            i++;
+        } else {
+            return false;
+        }
+    }
+    return options->seconds > 0 && options->batch > 0 && options->batch * IMU_FIFO_PATTERN < IMU_FIFO_WORDS &&
+           options->frequency > 0;
+}
+
+// A sample set whose every word carries its index, so words of different sets put together are caught
+static ImuSample indexed(uint32_t set) {
+    ImuSample sample{};
+    for (int axis = 0; axis < 3; axis++) {
+        sample.gyro[axis] = (int16_t) (uint16_t) (set * 8 + axis);
+        sample.accel[axis] = (int16_t) (uint16_t) (set * 8 + 3 + axis);
+    }
+    return sample;
+}
+
+// Counts the sets that are not whole or come out of order, the low bits of the index wrap with the 16-bit words
+class IndexCheck {
+public:
+
+    void check(const ImuSample *samples, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            const ImuSample &sample = samples[i];
+            auto index = (uint16_t) ((uint16_t) sample.gyro[0] / 8);
+            bool whole = true;
+            for (int axis = 0; axis < 3; axis++) {
+                whole = whole && (uint16_t) sample.gyro[axis] == (uint16_t) (index * 8 + axis);
+                whole = whole && (uint16_t) sample.accel[axis] == (uint16_t) (index * 8 + 3 + axis);
+            }
+            // Sets may be skipped over by an overrun but never go back
+            auto gap = (uint16_t) ((index - last - 1) & 8191);
+            bool ordered = last < 0 || gap < IMU_FIFO_WORDS;
+            if (!whole || !ordered) {
+                wrong++;
+            }
+            last = index;
+        }
+    }
+
+    uint64_t wrong = 0;
+
+private:
+
+    int64_t last = -1;
+
+};
+
+// Returns the sets that came out misassembled
+static uint64_t checkFifo(const Options &options) {
+    std::mt19937 random(options.seed);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    SimLsm6dsm device(400000);
+    Imu imu(device);
+    imu.configure((uint16_t) options.batch);
+    imu.stream(true);
+    ImuFifoParser parser;
+    std::vector<uint8_t> words(IMU_FIFO_WORDS * 2);
+    std::vector<ImuSample> samples(IMU_FIFO_WORDS / IMU_FIFO_PATTERN + 1);
+    IndexCheck index;
+
+    auto sets = (uint32_t) (options.seconds * IMU_RATE);
+    uint64_t reads = 0, failed = 0, overruns = 0;
+    int stalled = 0;
+    double parsing = 0;
+    for (uint32_t set = 0; set < sets; set++) {
+        device.sample(indexed(set), 25.0f);
+        if (!device.interrupt()) {
+            continue;
+        }
+        // Now and then the task does not get to the FIFO for a while
+        if (stalled > 0) {
+            stalled--;
+            continue;
+        }
+        // Motion holds INT1 up until its sources are read
+        uint8_t detected;
+        imu.motion(&detected);
+        if (chance(random) < 0.01) {
+            stalled = (int) (IMU_FIFO_WORDS / IMU_FIFO_PATTERN * chance(random) * 2);
+            continue;
+        }
+        uint8_t status[IMU_FIFO_STATUS_BYTES];
+        device.read(IMU_ADDRESS, LSM6DSM_FIFO_STATUS1, status, sizeof(status));
+        ImuFifoStatus state = imuFifoStatus(status);
+        overruns += state.overrun ? 1 : 0;
+
+        // Mostly everything, sometimes a length that ends inside a set
+        size_t count = state.words;
+        if (chance(random) < 0.2) {
+            count = 1 + (size_t) (chance(random) * (double) (count - 1));
+        }
+        device.read(IMU_ADDRESS, LSM6DSM_FIFO_DATA_OUT_L, words.data(), count * 2);
+        reads++;
+        // A transfer that fails partway loses the words it popped
+        if (chance(random) < 0.02) {
+            failed++;
+            parser.reset();
+            continue;
+        }
+
+        auto began = std::chrono::steady_clock::now();
+        size_t parsed = parser.parse(words.data(), count, state, samples.data(), samples.size());
+        parsing += std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+        index.check(samples.data(), parsed);
+    }
+
+    printf("%u sets at %d Hz in %llu reads, %llu failed, %llu overruns\n", sets, IMU_RATE,
+           (unsigned long long) reads, (unsigned long long) failed, (unsigned long long) overruns);
+    printf("%llu sets parsed, %llu words discarded, %llu wrong, %.1f ns per set\n",
+           (unsigned long long) parser.samples, (unsigned long long) parser.discarded,
+           (unsigned long long) index.wrong, parser.samples > 0 ? parsing * 1e9 / (double) parser.samples : 0);
+    return index.wrong;
+}
+
+// Bus time per sample of the gyro as it reads the FIFO, against polling both sensors for every sample as it used to
+// at 100 kHz. Returns the sets that came out misassembled.
+static uint64_t checkBus(const Options &options) {
+    std::mt19937 random(options.seed);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    auto sets = (uint32_t) (options.seconds * IMU_RATE);
+
+    SimLsm6dsm polled(100000);
+    Imu legacy(polled);
+    legacy.configure((uint16_t) options.batch);
+    I2CStats configured = polled.stats();
+    for (uint32_t set = 0; set < sets; set++) {
+        polled.sample(indexed(set), 25.0f);
+        int16_t accel[3], gyro[3];
+        lsm6dsm_acceleration_raw_get(legacy.context(), accel);
+        lsm6dsm_angular_rate_raw_get(legacy.context(), gyro);
+    }
+    I2CStats before = polled.stats();
+    double pollingPerSet = (double) (before.busy - configured.busy) / sets;
+
+    SimLsm6dsm device(options.frequency);
+    Imu imu(device);
+    imu.configure((uint16_t) options.batch);
+    imu.stream(true);
+    configured = device.stats();
+    std::vector<ImuSample> samples(IMU_FIFO_WORDS / IMU_FIFO_PATTERN + 1);
+    IndexCheck index;
+    uint64_t drained = 0, failed = 0, temperatures = 0;
+    for (uint32_t set = 0; set < sets; set++) {
+        float temperature = 30.0f + (float) (set % 1000) / 100.0f;
+        device.sample(indexed(set), temperature);
+        if (!device.interrupt()) {
+            continue;
+        }
+        if (chance(random) < 0.01) {
+            // A transfer goes unacknowledged
+            device.fail(1 + (uint32_t) (chance(random) * 2));
+        }
+        uint8_t detected;
+        imu.motion(&detected);
+        size_t parsed = 0;
+        if (imu.drain(samples.data(), samples.size(), &parsed) != ESP_OK) {
+            failed++;
+            continue;
+        }
+        index.check(samples.data(), parsed);
+        drained += parsed;
+        if (parsed == 0) {
+            continue;
+        }
+        ImuOutputs outputs{};
+        if (imu.beginOutputs() == ESP_OK && imu.finishOutputs(&outputs, 100) == ESP_OK) {
+            // The output registers hold the newest set
+            bool newest = memcmp(&outputs.sample, &samples[parsed - 1], sizeof(ImuSample)) == 0;
+            temperatures += newest && std::fabs(outputs.temperature - temperature) < 0.01f ? 1 : 0;
+        }
+    }
+    I2CStats after = device.stats();
+    double batchedPerSet = (double) (after.busy - configured.busy) / sets;
+
+    printf("Polled at 100 kHz: %.1f us of bus per sample, %llu transfers\n", pollingPerSet,
+           (unsigned long long) (before.transfers - configured.transfers));
+    printf("FIFO at %u kHz: %.1f us of bus per sample, %llu transfers, %llu unacknowledged, %llu drains failed\n",
+           options.frequency / 1000, batchedPerSet, (unsigned long long) (after.transfers - configured.transfers),
+           (unsigned long long) after.nacks, (unsigned long long) failed);
+    printf("%llu sets drained, %llu temperatures read back, %llu wrong, %.1fx less bus time\n",
+           (unsigned long long) drained, (unsigned long long) temperatures, (unsigned long long) index.wrong,
+           batchedPerSet > 0 ? pollingPerSet / batchedPerSet : 0);
+    return index.wrong;
+}
+
+typedef struct Motion {
+    double w, x, y, z;
+} Motion;
+
+// Gravity in the body frame as an accelerometer at rest measures it
+static void gravity(double w, double x, double y, double z, double *g) {
+    g[0] = 2 * (x * z - w * y);
+    g[1] = 2 * (w * x + y * z);
+    g[2] = 1 - 2 * (x * x + y * y);
+}
+
+// Turn the true motion at a body rate over one period, integrated finely
+static void integrate(Motion *motion, const double *rate, double period) {
+    const int substeps = 16;
+    for (int k = 0; k < substeps; k++) {
+        double h = period / substeps / 2;
+        Motion m = *motion;
+        m.w += h * (-motion->x * rate[0] - motion->y * rate[1] - motion->z * rate[2]);
+        m.x += h * (motion->w * rate[0] + motion->y * rate[2] - motion->z * rate[1]);
+        m.y += h * (motion->w * rate[1] - motion->x * rate[2] + motion->z * rate[0]);
+        m.z += h * (motion->w * rate[2] + motion->x * rate[1] - motion->y * rate[0]);
+        double length = sqrt(m.w * m.w + m.x * m.x + m.y * m.y + m.z * m.z);
+        *motion = {m.w / length, m.x / length, m.y / length, m.z / length};
+    }
+}
+
+// Roll and pitch of a gravity vector as Orientation reports them, in degrees
+static void tilt(const double *g, double *roll, double *pitch) {
+    *roll = atan2(-g[1], -g[2]) * 180 / M_PI;
+    *pitch = atan2(g[0], sqrt(g[1] * g[1] + g[2] * g[2])) * 180 / M_PI;
+}
+
+// Difference of two angles in degrees, wrapped to a half turn
+static double angleError(double a, double b) {
+    return remainder(a - b, 360.0);
+}
+
+static void benchmarkOrientation(const Options &options) {
+    std::mt19937 random(options.seed);
+    std::normal_distribution<double> noise(0.0, 1.0);
+    const double period = 1.0 / IMU_RATE;
+    const double bias[3] = {0.012, -0.021, 0.008};
+    // Rests upside down, as the sensor is mounted, for three seconds before it starts to sway
+    Motion motion = {0, 1, 0, 0};
+    double rest = 3.0;
+
+    auto sets = (size_t) (options.seconds * IMU_RATE);
+    std::vector<float> gyros(sets * 3), accels(sets * 3);
+    std::vector<Motion> truth(sets);
+    for (size_t i = 0; i < sets; i++) {
+        double t = (double) i * period;
+        double rate[3] = {};
+        if (t >= rest) {
+            rate[0] = 0.6 * sin(2 * M_PI * 0.31 * t);
+            rate[1] = 0.4 * sin(2 * M_PI * 0.17 * t + 1);
+            rate[2] = 0.3 * cos(2 * M_PI * 0.05 * t);
+        }
+        integrate(&motion, rate, period);
+        truth[i] = motion;
+        double g[3];
+        gravity(motion.w, motion.x, motion.y, motion.z, g);
+        for (int axis = 0; axis < 3; axis++) {
+            // The enclosure shakes at 25 Hz once the module is moving
+            double shake = t >= rest ? 0.25 * sin(2 * M_PI * 25 * t + axis) : 0;
+            gyros[i * 3 + axis] = (float) (rate[axis] + bias[axis] + 0.003 * noise(random));
+            accels[i * 3 + axis] = (float) (g[axis] + shake + 0.01 * noise(random));
+        }
+    }
+
+    Orientation orientation(IMU_RATE);
+    double filtered = 0, alone = 0, worst = 0;
+    size_t compared = 0, settledAt = 0;
+    for (size_t i = 0; i < sets; i++) {
+        orientation.update(&gyros[i * 3], &accels[i * 3]);
+        if (!orientation.settled()) {
+            continue;
+        }
+        if (settledAt == 0) {
+            settledAt = i + 1;
+        }
+        // Give the filter a second to converge after settling
+        if ((double) i * period < rest + 1.0) {
+            continue;
+        }
+        double g[3], roll, pitch;
+        gravity(truth[i].w, truth[i].x, truth[i].y, truth[i].z, g);
+        tilt(g, &roll, &pitch);
+        EulerAngles angles = orientation.angles();
+        double error = std::hypot(angleError(angles.roll, roll), angleError(angles.pitch, pitch));
+        double measured[3] = {accels[i * 3], accels[i * 3 + 1], accels[i * 3 + 2]};
+        double accelRoll, accelPitch;
+        tilt(measured, &accelRoll, &accelPitch);
+        double accelError = std::hypot(angleError(accelRoll, roll), angleError(accelPitch, pitch));
+        filtered += error * error;
+        alone += accelError * accelError;
+        worst = error > worst ? error : worst;
+        compared++;
+    }
+    const float *estimated = orientation.bias();
+    printf("Settled after %zu samples on a bias of %.4f, %.4f, %.4f rad/s (true %.4f, %.4f, %.4f)\n", settledAt,
+           estimated[0], estimated[1], estimated[2], bias[0], bias[1], bias[2]);
+    printf("Tilt error over %zu samples: %.2f deg rms filtered (worst %.2f), %.2f deg rms from the accelerometer\n",
+           compared, compared > 0 ? sqrt(filtered / (double) compared) : 0, worst,
+           compared > 0 ? sqrt(alone / (double) compared) : 0);
+
+    // Time settled updates over the recorded samples, over and over
+    Orientation timed(IMU_RATE);
+    size_t i = 0;
+    while (!timed.settled()) {
+        timed.update(&gyros[i * 3], &accels[i * 3]);
+        i++;
+    }
+    auto began = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < options.updates; n++) {
+        size_t at = (i + n) % sets;
+        timed.update(&gyros[at * 3], &accels[at * 3]);
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+    Quaternion q = timed.quaternion();
+    printf("%u updates in %.3f s, %.1f ns per update, ending at %.3f %.3f %.3f %.3f\n", options.updates, elapsed,
+           options.updates > 0 ? elapsed * 1e9 / options.updates : 0, q.w, q.x, q.y, q.z);
+}
+
+// Full scale raw reading of a value, as the sensor clips it
+static int16_t raw(double value, double scale) {
+    double reading = std::round(value / scale);
+    return (int16_t) (reading > 32767 ? 32767 : reading < -32768 ? -32768 : reading);
+}
+
+// Tilt error in degrees of a filter against the true motion
+static double tiltError(const Orientation &orientation, const Motion &truth) {
+    double g[3], roll, pitch;
+    gravity(truth.w, truth.x, truth.y, truth.z, g);
+    tilt(g, &roll, &pitch);
+    EulerAngles angles = orientation.angles();
+    return std::hypot(angleError(angles.roll, roll), angleError(angles.pitch, pitch));
+}
+
+// Drives the motion detection through the bus as the gyro task does, every wake reads the motion sources before it
+// drains the FIFO. The module rests, is bumped twice, is knocked to a new tilt faster than the gyroscope can measure,
+// and is then carried. Returns the motion missed and falsely reported.
+static uint64_t checkMotion(const Options &options) {
+    std::mt19937 random(options.seed);
+    std::normal_distribution<double> noise(0.0, 1.0);
+    const double period = 1.0 / IMU_RATE;
+    const double bias[3] = {0.012, -0.021, 0.008};
+    const auto bumps = (size_t) (10 * IMU_RATE), knock = (size_t) (30 * IMU_RATE), carry = (size_t) (50 * IMU_RATE);
+    const auto sets = (size_t) (60 * IMU_RATE);
+
+    SimLsm6dsm device(options.frequency);
+    Imu imu(device);
+    imu.configure((uint16_t) options.batch);
+    imu.stream(true);
+    std::vector<ImuSample> samples(IMU_FIFO_WORDS / IMU_FIFO_PATTERN + 1);
+    // The gyro task realigns on motion, the other filter carries on through it
+    Orientation realigned(IMU_RATE), carried(IMU_RATE);
+
+    Motion motion = {0, 1, 0, 0};
+    uint64_t reports[3] = {}, missed = 0, spurious = 0;
+    size_t event = 0, latency = 0;
+    double errors[2][2] = {};
+    for (size_t i = 0; i < sets; i++) {
+        double rate[3] = {};
+        double shock[3] = {};
+        // Bumps along x and then z, then a knock that turns the module 55 degrees about x in two samples
+        if (i == bumps || i == 2 * bumps) {
+            shock[i == bumps ? 0 : 2] = 0.6;
+        }
+        if (i == knock || i == knock + 1) {
+            rate[0] = 0.96 / (2 * period);
+            shock[1] = 0.8;
+        }
+        integrate(&motion, rate, period);
+        double g[3];
+        gravity(motion.w, motion.x, motion.y, motion.z, g);
+        ImuSample sample{};
+        for (int axis = 0; axis < 3; axis++) {
+            sample.gyro[axis] = raw(rate[axis] + bias[axis] + 0.003 * noise(random), IMU_GYRO_RADIANS);
+            sample.accel[axis] = raw(g[axis] + shock[axis] + 0.005 * noise(random), IMU_ACCEL_G);
+        }
+        device.sample(sample, 25.0f);
+        if (i == carry) {
+            device.carried();
+        }
+        if (i == bumps || i == 2 * bumps || i == knock || i == carry) {
+            event = i;
+        }
+
+        if (device.interrupt()) {
+            uint8_t detected = 0;
+            imu.motion(&detected);
+            if (detected != 0) {
+                realigned.realign();
+                // A shock wakes on its way up and back down, the tilt comes two seconds after the knock
+                bool wake = (detected & IMU_MOTION_WAKE) != 0, tilted = (detected & IMU_MOTION_TILT) != 0;
+                bool significant = (detected & IMU_MOTION_SIGNIFICANT) != 0;
+                bool shaken = event != carry && event > 0 && i - event <= 3;
+                bool settling = i > knock && i <= knock + 3 * IMU_RATE;
+                spurious += (wake && !shaken) || (tilted && !settling) || (significant && i != carry);
+                if ((wake || significant) && i - event > latency) {
+                    latency = i - event;
+                }
+                reports[0] += wake;
+                reports[1] += tilted;
+                reports[2] += significant;
+            }
+            size_t parsed = 0;
+            imu.drain(samples.data(), samples.size(), &parsed);
+            for (size_t n = 0; n < parsed; n++) {
+                float gyro[3], accel[3];
+                for (int axis = 0; axis < 3; axis++) {
+                    gyro[axis] = (float) samples[n].gyro[axis] * IMU_GYRO_RADIANS;
+                    accel[axis] = (float) samples[n].accel[axis] * IMU_ACCEL_G;
+                }
+                realigned.update(gyro, accel);
+                carried.update(gyro, accel);
+            }
+        }
+        // Tilt error a second after the knock, and once it has settled again
+        for (int at = 0; at < 2; at++) {
+            if (i == knock + (size_t) ((at == 0 ? 1 : 3) * IMU_RATE)) {
+                errors[at][0] = tiltError(realigned, motion);
+                errors[at][1] = tiltError(carried, motion);
+            }
+        }
+    }
+    // Three wake-ups, one tilt and one significant motion at the least
+    missed += reports[0] < 3 ? 3 - reports[0] : 0;
+    missed += reports[1] < 1 ? 1 : 0;
+    missed += reports[2] < 1 ? 1 : 0;
+
+    printf("Motion: %llu wake-up, %llu tilt, %llu significant, %llu missed, %llu spurious, reported within %zu samples\n",
+           (unsigned long long) reports[0], (unsigned long long) reports[1], (unsigned long long) reports[2],
+           (unsigned long long) missed, (unsigned long long) spurious, latency);
+    printf("Tilt error 1 s after the knock: %.2f deg realigned, %.2f deg integrated through it (%.2f and %.2f at 3 s)\n",
+           errors[0][0], errors[0][1], errors[1][0], errors[1][1]);
+    return missed + spurious;
+}
+
+int main(int argc, char **argv) {
+    Options options{};
+    if (!parseOptions(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+    uint64_t wrong = checkFifo(options);
+    wrong += checkBus(options);
+    wrong += checkMotion(options);
+    benchmarkOrientation(options);
+    return wrong > 0 ? 1 : 0;
+}
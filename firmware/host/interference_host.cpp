@@ -0,0 +1,236 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "check.h"
+#include "interference.h"
+#include "reconfigure.h"
+#include "scene.h"
+
+// Renders frames of a scene and crosses some of them with another radar's chirp, the short burst of a beat that sweeps
+// down through the band and back up again as the two ramps cross, on every lane at once. Only the ramp is inspected,
+// as on the module, the flyback after it jumps like interference in every frame. Frames left clean must not be
+// flagged, and crossed frames must be flagged and, when repaired, come out closer to the clean frame than they went
+// in. The monitor is walked through transients and sustained interference to check it hops the chirp phase only for
+// the latter. Exits with 1 if the detector misses or invents more than its share, a repair makes a frame worse, or the
+// monitor hops when it should not.
+
+typedef struct Options {
+    int frames = 2000;
+    // Share of the frames crossed, and the peak of the crossing in codes
+    double crossed = 0.5;
+    double amplitude = 400;
+    // Samples the crossing lasts
+    int width = 16;
+    double noise = 2.0;
+    uint32_t seed = 1;
+} Options;
+
+static void usage(const char *name) {
+    printf("Usage: %s [--frames N] [--crossed fraction] [--amplitude codes] [--width samples] [--noise codes] "
+           "[--seed N]\n", name);
+}
+
+static bool parseOptions(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            return false;
+        } else if (strcmp(arg, "--frames") == 0) {
+            options->frames = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--crossed") == 0) {
+            options->crossed = atof(value);
+            i++;
+        } else if (strcmp(arg, "--amplitude") == 0) {
+            options->amplitude = atof(value);
+            i++;
+        } else if (strcmp(arg, "--width") == 0) {
+            options->width = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--noise") == 0) {
+            options->noise = atof(value);
+            i++;
+        } else if (strcmp(arg, "--seed") == 0) {
+            options->seed = (uint32_t) strtoul(value, nullptr, 10);
+            i++;
+        } else {
+            return false;
+        }
+    }
+    return options->frames > 0 && options->width >= 4 && options->width <= 64;
+}
+
+// Share of the crossed frames the detector may miss, and of the clean frames it may flag
+#define HOST_MISSES 0.02
+#define HOST_FALSE_ALARMS 0.01
+
+// Add a crossing centered on sample center, the beat falls from near the Nyquist rate to zero and rises again
+static void cross(uint16_t **lanes, int samples, int center, int width, double amplitude, std::mt19937 &random) {
+    std::uniform_real_distribution<double> phase(0.0, 2 * M_PI);
+    double half = width / 2.0;
+    // Cycles per sample gained per sample from the center, reaching 0.45 at the edges
+    double rate = 0.45 / half;
+    for (int lane = 0; lane < SCENE_LANES; lane++) {
+        double start = phase(random);
+        for (int i = center - width / 2; i < center + width / 2; i++) {
+            if (i < 0 || i >= samples) {
+                continue;
+            }
+            double k = i - center;
+            double value = lanes[lane][i] + amplitude * cos(M_PI * rate * k * k + start);
+            lanes[lane][i] = (uint16_t) fmin(fmax(round(value), 0), SCENE_FULL_SCALE);
+        }
+    }
+}
+
+// Squared distance of a frame from the clean one
+static double distance(uint16_t **lanes, uint16_t **clean, int samples) {
+    double sum = 0;
+    for (int lane = 0; lane < SCENE_LANES; lane++) {
+        for (int i = 0; i < samples; i++) {
+            double d = (double) lanes[lane][i] - clean[lane][i];
+            sum += d * d;
+        }
+    }
+    return sum;
+}
+
+typedef struct Frame {
+    std::vector<uint16_t> storage;
+    uint16_t *lanes[SCENE_LANES];
+
+    explicit Frame(int samples) : storage((size_t) samples * SCENE_LANES) {
+        for (int lane = 0; lane < SCENE_LANES; lane++) {
+            lanes[lane] = &storage[(size_t) lane * samples];
+        }
+    }
+} Frame;
+
+static int checkDetector(const Options &options) {
+    Chirp chirp{};
+    Sampling sampling{};
+    SceneDescription description{};
+    description.noise = options.noise;
+    description.targets.push_back({2.0, 0.0, 1.0, 0.0});
+    description.targets.push_back({5.5, 0.4, 2.0, 15.0});
+    Scene scene(chirp, sampling, description, options.seed);
+    int samples = scene.samples();
+    // As the acquisition task does, the flyback after the ramp is left out
+    int ramp = rampSamples(chirp, sampling);
+
+    auto detector = new InterferenceDetector();
+    std::mt19937 random(options.seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    Frame clean(samples), frame(samples);
+    const InterferenceMode modes[] = {INTERFERENCE_DETECT, INTERFERENCE_REPAIR, INTERFERENCE_ZERO, INTERFERENCE_DROP};
+    uint64_t crossed = 0, missed = 0, quiet = 0, alarms = 0, worse = 0, touched = 0;
+    double before = 0, after = 0;
+    for (int n = 0; n < options.frames; n++) {
+        scene.render(clean.lanes);
+        memcpy(frame.storage.data(), clean.storage.data(), frame.storage.size() * sizeof(uint16_t));
+        bool crossing = uniform(random) < options.crossed;
+        if (crossing) {
+            int center = options.width + (int) (random() % (uint32_t) (ramp - 2 * options.width));
+            cross(frame.lanes, samples, center, options.width, options.amplitude, random);
+        }
+        InterferenceMode mode = modes[n % 4];
+        std::vector<uint16_t> received = frame.storage;
+        double distorted = distance(frame.lanes, clean.lanes, samples);
+        InterferenceReport report = detector->inspect(frame.lanes, SCENE_LANES, ramp, mode);
+        bool flagged = report.corrupted > 0;
+        if (crossing) {
+            crossed++;
+            missed += flagged ? 0 : 1;
+        } else {
+            quiet++;
+            alarms += flagged ? 1 : 0;
+        }
+        bool repairs = mode == INTERFERENCE_REPAIR || mode == INTERFERENCE_ZERO;
+        if (!repairs || !flagged) {
+            // Only repair and zero may touch the samples
+            touched += frame.storage != received ? 1 : 0;
+            continue;
+        }
+        if (crossing && mode == INTERFERENCE_REPAIR) {
+            double repaired = distance(frame.lanes, clean.lanes, samples);
+            before += distorted;
+            after += repaired;
+            worse += repaired > distorted ? 1 : 0;
+        }
+    }
+    delete detector;
+
+    double missRate = crossed > 0 ? (double) missed / (double) crossed : 0;
+    double alarmRate = quiet > 0 ? (double) alarms / (double) quiet : 0;
+    printf("Detector: %llu of %llu crossed frames missed, %llu of %llu clean frames flagged, repairs left %.1f%% of "
+           "the crossing, %llu made worse, %llu touched when they should not be\n", (unsigned long long) missed,
+           (unsigned long long) crossed, (unsigned long long) alarms, (unsigned long long) quiet,
+           before > 0 ? 100 * after / before : 0, (unsigned long long) worse, (unsigned long long) touched);
+    int wrong = CHECK(missRate <= HOST_MISSES);
+    wrong += CHECK(alarmRate <= HOST_FALSE_ALARMS);
+    wrong += CHECK(worse == 0 && touched == 0 && after < before / 4);
+    return wrong;
+}
+
+// Frames not worth inspecting are left alone
+static int checkEdges() {
+    auto detector = new InterferenceDetector();
+    std::vector<uint16_t> samples(INTERFERENCE_MAX_SAMPLES + 1, 2048);
+    samples[10] = 4000;
+    uint16_t *lanes[SCENE_LANES] = {samples.data(), nullptr, nullptr, nullptr};
+    int wrong = 0;
+    wrong += CHECK(detector->inspect(lanes, SCENE_LANES, 64, INTERFERENCE_OFF).corrupted == 0);
+    wrong += CHECK(detector->inspect(lanes, SCENE_LANES, 7, INTERFERENCE_REPAIR).corrupted == 0);
+    int oversized = INTERFERENCE_MAX_SAMPLES + 1;
+    wrong += CHECK(detector->inspect(lanes, SCENE_LANES, oversized, INTERFERENCE_REPAIR).corrupted == 0);
+    wrong += CHECK(samples[10] == 4000);
+    // A single spike on a flat lane, the missing lanes skipped, flags the three differences it reaches and their guard
+    InterferenceReport report = detector->inspect(lanes, SCENE_LANES, 64, INTERFERENCE_ZERO);
+    wrong += CHECK(report.segments == 1 && report.corrupted == 5 + 2 * INTERFERENCE_GUARD && samples[10] == 2048);
+    delete detector;
+    printf("Edges: %d wrong\n", wrong);
+    return wrong;
+}
+
+static int checkMonitor() {
+    int wrong = 0;
+    InterferenceMonitor monitor;
+    // Passing transients, one in a few frames, never add up to a hop
+    int hops = 0;
+    for (int n = 0; n < 1000; n++) {
+        hops += monitor.record(n % (INTERFERENCE_WINDOW / INTERFERENCE_HOP_FRAMES + 1) == 0) ? 1 : 0;
+    }
+    wrong += CHECK(hops == 0);
+
+    // Sustained interference hops on the frame that fills the window's share, then gets a fresh window
+    InterferenceMonitor sustained;
+    int first = -1, second = -1;
+    for (int n = 0; n < 4 * INTERFERENCE_HOP_FRAMES; n++) {
+        if (sustained.record(true)) {
+            (first < 0 ? first : second) = n;
+            if (second >= 0) {
+                break;
+            }
+        }
+    }
+    wrong += CHECK(first == INTERFERENCE_HOP_FRAMES - 1 && second == 2 * INTERFERENCE_HOP_FRAMES - 1);
+    printf("Monitor: %d hops on transients, hops on frames %d and %d of sustained interference, %d wrong\n", hops,
+           first, second, wrong);
+    return wrong;
+}
+
+int main(int argc, char **argv) {
+    Options options{};
+    if (!parseOptions(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+    int wrong = checkDetector(options);
+    wrong += checkEdges();
+    wrong += checkMonitor();
+    return wrong > 0 ? 1 : 0;
+}
@@ -0,0 +1,241 @@
+#include <atomic>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "check.h"
+#include "metrics.h"
+
+// Checks the latency bins against their edges and the Prometheus text the /metrics handler sends, counters and
+// histograms alike, parsed back line by line. The buckets have to be cumulative and end in +Inf at the count, the
+// largest possible histogram has to fit the chunk the handler sends it in, and text that does not fit has to be
+// refused whole. A writer per core then records into counters and a histogram while a reader snapshots them, and every
+// snapshot has to be consistent and no smaller than the one before. Exits with 1 if any check fails.
+
+// Bytes, as METRICS_CHUNK_SIZE
+#define HOST_CHUNK_SIZE 2048
+
+typedef struct Options {
+    int records = 2000000;
+    uint32_t seed = 1;
+} Options;
+
+static void usage(const char *name) {
+    printf("Usage: %s [--records N] [--seed N]\n", name);
+}
+
+static bool parseOptions(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            return false;
+        } else if (strcmp(arg, "--records") == 0) {
+            options->records = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--seed") == 0) {
+            options->seed = (uint32_t) strtoul(value, nullptr, 10);
+            i++;
+        } else {
+            return false;
+        }
+    }
+    return options->records > 0;
+}
+
+static int checkBins() {
+    int wrong = 0;
+    for (int bin = 0; bin < METRICS_HISTOGRAM_BINS - 1; bin++) {
+        uint64_t edge = metricsBinEdge(bin);
+        wrong += CHECK(edge == (uint64_t) METRICS_HISTOGRAM_BASE_NS << bin);
+        // Each edge belongs to the bin above it
+        wrong += CHECK(metricsBin(edge - 1) == bin && metricsBin(edge) == bin + 1);
+    }
+    wrong += CHECK(metricsBin(0) == 0);
+    wrong += CHECK(metricsBin(UINT64_MAX) == METRICS_HISTOGRAM_BINS - 1);
+    wrong += CHECK(metricsBinEdge(METRICS_HISTOGRAM_BINS - 1) == 0 && metricsBinEdge(-1) == 0);
+
+    // A quarter of the latencies in each of four bins, the quantiles fall on their edges
+    HistogramSnapshot snapshot{};
+    for (int bin = 0; bin < 4; bin++) {
+        snapshot.bins[bin * 3] = 25;
+    }
+    snapshot.count = 100;
+    wrong += CHECK(histogramQuantile(snapshot, 0.1f) == metricsBinEdge(0));
+    wrong += CHECK(histogramQuantile(snapshot, 0.5f) == metricsBinEdge(6));
+    wrong += CHECK(histogramQuantile(snapshot, 0.99f) == metricsBinEdge(9));
+    // Latencies past the last edge are estimated at it
+    HistogramSnapshot slow{};
+    slow.bins[METRICS_HISTOGRAM_BINS - 1] = slow.count = 10;
+    wrong += CHECK(histogramQuantile(slow, 0.5f) == metricsBinEdge(METRICS_HISTOGRAM_BINS - 2));
+    wrong += CHECK(histogramQuantile(HistogramSnapshot{}, 0.5f) == 0);
+    printf("Bins: %d wrong\n", wrong);
+    return wrong;
+}
+
+// Parse the lines of a histogram back, returns false if any line is not the one expected
+static bool parseHistogram(const char *text, const char *name, const char *help, const HistogramSnapshot &snapshot) {
+    std::string expected = std::string("# HELP ") + name + " " + help + "\n# TYPE " + name + " histogram\n";
+    if (strncmp(text, expected.c_str(), expected.size()) != 0) {
+        return false;
+    }
+    const char *line = text + expected.size();
+    uint64_t cumulative = 0, previous = 0;
+    std::string bucket = std::string(name) + "_bucket{le=\"";
+    for (int bin = 0; bin < METRICS_HISTOGRAM_BINS; bin++) {
+        if (strncmp(line, bucket.c_str(), bucket.size()) != 0) {
+            return false;
+        }
+        line += bucket.size();
+        char *end = nullptr;
+        if (bin == METRICS_HISTOGRAM_BINS - 1) {
+            if (strncmp(line, "+Inf", 4) != 0) {
+                return false;
+            }
+            end = (char *) line + 4;
+        } else {
+            // The edge in seconds, to the precision it is printed with
+            double edge = strtod(line, &end);
+            double exact = (double) metricsBinEdge(bin) / 1e9;
+            if (end == line || fabs(edge - exact) > exact * 1e-5) {
+                return false;
+            }
+        }
+        if (strncmp(end, "\"} ", 3) != 0) {
+            return false;
+        }
+        uint64_t value = strtoull(end + 3, &end, 10);
+        cumulative += snapshot.bins[bin];
+        if (value != cumulative || value < previous || *end != '\n') {
+            return false;
+        }
+        previous = value;
+        line = end + 1;
+    }
+    char sum[64], count[64];
+    snprintf(sum, sizeof(sum), "%s_sum ", name);
+    snprintf(count, sizeof(count), "%s_count ", name);
+    if (strncmp(line, sum, strlen(sum)) != 0) {
+        return false;
+    }
+    char *end = nullptr;
+    double seconds = strtod(line + strlen(sum), &end);
+    if (fabs(seconds - (double) snapshot.sum / 1e9) > 1e-9 * fmax(1.0, seconds) || *end != '\n') {
+        return false;
+    }
+    line = end + 1;
+    if (strncmp(line, count, strlen(count)) != 0) {
+        return false;
+    }
+    // The +Inf bucket holds every latency
+    uint64_t total = strtoull(line + strlen(count), &end, 10);
+    return total == snapshot.count && total == previous && strcmp(end, "\n") == 0;
+}
+
+static int checkFormat() {
+    int wrong = 0;
+    char buf[HOST_CHUNK_SIZE];
+    const char *counter = "# HELP radar_frames_total Frames\n# TYPE radar_frames_total counter\n"
+                          "radar_frames_total 18446744073709551615\n";
+    size_t length = formatCounter(buf, sizeof(buf), "radar_frames_total", "Frames", UINT64_MAX);
+    wrong += CHECK(length == strlen(counter) && strcmp(buf, counter) == 0);
+    // The text and its terminator have to fit, anything less is refused
+    wrong += CHECK(formatCounter(buf, strlen(counter) + 1, "radar_frames_total", "Frames", UINT64_MAX) == length);
+    wrong += CHECK(formatCounter(buf, strlen(counter), "radar_frames_total", "Frames", UINT64_MAX) == 0);
+    wrong += CHECK(formatCounter(buf, 0, "radar_frames_total", "Frames", 0) == 0);
+
+    HistogramSnapshot empty{};
+    length = formatHistogram(buf, sizeof(buf), "radar_empty_seconds", "Latency", empty);
+    wrong += CHECK(length == strlen(buf) && parseHistogram(buf, "radar_empty_seconds", "Latency", empty));
+
+    HistogramSnapshot snapshot{};
+    for (int bin = 0; bin < METRICS_HISTOGRAM_BINS; bin++) {
+        snapshot.bins[bin] = (uint64_t) (bin * 7 + 1);
+        snapshot.count += snapshot.bins[bin];
+    }
+    snapshot.sum = 123456789012;
+    length = formatHistogram(buf, sizeof(buf), "radar_capture_seconds", "Latency", snapshot);
+    wrong += CHECK(length == strlen(buf) && parseHistogram(buf, "radar_capture_seconds", "Latency", snapshot));
+
+    // The widest counts the snapshot can hold still fit one chunk, under the longest help the handler sends
+    HistogramSnapshot full{};
+    for (auto &bin: full.bins) {
+        bin = UINT64_MAX / METRICS_HISTOGRAM_BINS;
+        full.count += bin;
+    }
+    full.sum = UINT64_MAX;
+    const char *longest = "radar_enqueue_seconds";
+    const char *help = "End of the adc capture to the frame entering the ring buffer";
+    length = formatHistogram(buf, sizeof(buf), longest, help, full);
+    wrong += CHECK(length > 0 && parseHistogram(buf, longest, help, full));
+    size_t needed = length;
+    // Refused whole at every capacity short of the text and its terminator
+    int refused = 0;
+    for (size_t capacity = 0; capacity <= needed; capacity++) {
+        refused += formatHistogram(buf, capacity, longest, help, full) == 0 ? 1 : 0;
+    }
+    wrong += CHECK(refused == (int) needed + 1 && formatHistogram(buf, needed + 1, longest, help, full) == needed);
+    printf("Format: largest histogram %zu of %d bytes, %d wrong\n", needed, HOST_CHUNK_SIZE, wrong);
+    return wrong;
+}
+
+static int checkConcurrent(const Options &options) {
+    Counter counter;
+    Histogram histogram;
+    std::atomic<int> writing{METRICS_CORES};
+    std::vector<std::thread> writers;
+    for (int core = 0; core < METRICS_CORES; core++) {
+        writers.emplace_back([&, core]() {
+            std::mt19937_64 random(options.seed + core);
+            for (int n = 0; n < options.records; n++) {
+                counter.add(core, 2);
+                // Latencies spread over every bin
+                histogram.record(core, random() >> (random() % 64));
+            }
+            writing--;
+        });
+    }
+
+    // Every snapshot adds up and none goes backwards
+    uint64_t snapshots = 0, torn = 0, backwards = 0, previousCount = 0, previousValue = 0;
+    while (writing > 0) {
+        HistogramSnapshot snapshot = histogram.snapshot();
+        uint64_t value = counter.value();
+        uint64_t binned = 0;
+        for (uint64_t bin: snapshot.bins) {
+            binned += bin;
+        }
+        torn += binned != snapshot.count ? 1 : 0;
+        backwards += snapshot.count < previousCount || value < previousValue || value % 2 != 0 ? 1 : 0;
+        previousCount = snapshot.count;
+        previousValue = value;
+        snapshots++;
+    }
+    for (auto &writer: writers) {
+        writer.join();
+    }
+    uint64_t expected = (uint64_t) options.records * METRICS_CORES;
+    HistogramSnapshot final = histogram.snapshot();
+    int wrong = (int) (torn + backwards);
+    wrong += CHECK(final.count == expected && counter.value() == 2 * expected);
+    printf("Concurrent: %" PRIu64 " snapshots, %" PRIu64 " torn, %" PRIu64 " backwards, %" PRIu64 " of %" PRIu64
+           " recorded\n", snapshots, torn, backwards, final.count, expected);
+    return wrong > 0 ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    Options options{};
+    if (!parseOptions(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+    int wrong = checkBins();
+    wrong += checkFormat();
+    wrong += checkConcurrent(options);
+    return wrong > 0 ? 1 : 0;
+}
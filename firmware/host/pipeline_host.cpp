@@ -0,0 +1,521 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "check.h"
+#include "pipeline.h"
+#include "interference.h"
+#include "metrics.h"
+#include "reconfigure.h"
+#include "waveform.h"
+#include "hal_sim.h"
+#include "scene.h"
+#include "capture_file.h"
+#include "recorder.h"
+
+// Runs the acquisition pipeline of the firmware against simulated peripherals: a chirp timer notifies the
+// acquisition thread, which captures a frame of TYPE2 words from the scene, inspects it for interference and queues
+// it for the sending thread to serialize and hand to the transport. Every stage is timed with the same counters and
+// histograms the firmware serves at /metrics. Exits with 1 if no frame is sent or a send fails.
+//
+// With --recording every frame also goes through a flight recorder as on the module, which is triggered halfway through
+// the run and dumps its window to the file at the end.
+//
+// With --replay the frames of a capture stand in for the scene, encoded back into the conversions the adc delivered.
+
+// Arena of the flight recorder, the module's default
+#define HOST_RECORDER_BYTES (1024 * 1024)
+#define HOST_RECORDER_PRE_US 3000000
+#define HOST_RECORDER_POST_US 1000000
+
+// Frames the queue holds, the ring buffer of the firmware holds a few hundred pointers
+#define HOST_QUEUE_FRAMES 64
+// Bytes read from the adc source per call, the size of one dma conversion frame on the firmware
+#define HOST_READ_BYTES (PIPELINE_CONVERSION_BYTES * PIPELINE_LANES * 32)
+
+// The acquisition and sending threads record into their own shard, as the pinned tasks of the firmware do
+#define HOST_ACQUISITION_CORE 0
+#define HOST_SENDING_CORE 1
+
+static int64_t now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t elapsedNanoseconds(int64_t from) {
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count() - from;
+    return elapsed > 0 ? (uint64_t) elapsed : 0;
+}
+
+static int64_t nowNanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static struct {
+    Counter captured;
+    Counter overflowed;
+    Counter dropped;
+    Counter sent;
+    Counter failed;
+    Histogram capture;
+    Histogram enqueue;
+    Histogram queue;
+    Histogram serialize;
+    Histogram send;
+    Histogram frame;
+} pipeline{};
+
+// Bounded queue of frames between the acquisition and sending threads
+class FrameQueue {
+public:
+
+    // Returns false when the queue is full, the frame stays with the caller
+    bool push(const SampleData &frame) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (frames.size() >= HOST_QUEUE_FRAMES) {
+            return false;
+        }
+        frames.push_back(frame);
+        ready.notify_one();
+        return true;
+    }
+
+    // Returns false once the queue is closed and drained
+    bool pop(SampleData *frame) {
+        std::unique_lock<std::mutex> guard(lock);
+        ready.wait(guard, [this] { return !frames.empty() || closed; });
+        if (frames.empty()) {
+            return false;
+        }
+        *frame = frames.front();
+        frames.pop_front();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+        ready.notify_all();
+    }
+
+private:
+
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<SampleData> frames;
+    bool closed = false;
+
+};
+
+// State shared with the chirp alarm, as the DAC shares it with its timer interrupt
+typedef struct Chirper {
+    SimDacBus bus;
+    Notification chirp;
+    uint16_t start;
+    std::atomic<int64_t> time;
+} Chirper;
+
+static bool chirpAlarm(void *ctx) {
+    auto chirper = (Chirper *) ctx;
+    uint16_t word = mcp4922Word(chirper->start, MCP4922_CHANNEL_A);
+    chirper->bus.write(&word, 1);
+    chirper->time = now();
+    chirper->chirp.give();
+    return false;
+}
+
+// Plays the frames of a capture as chirps, from the first frame again once the last has been played
+class ReplayChirps final : public ChirpSource {
+public:
+
+    bool open(const char *path) {
+        if (!reader.open(path) || reader.frames() == 0) {
+            return false;
+        }
+        const CaptureRecord *record = frame(0);
+        count = (int) ((record->length - SAMPLE_FRAME_TRAILER_SIZE) / (PIPELINE_LANES * sizeof(uint16_t)));
+        for (auto &lane: storage) {
+            lane.resize(count);
+        }
+        return count > 0;
+    }
+
+    int samples() const override {
+        return count;
+    }
+
+    size_t encodedBytes() const override {
+        return (size_t) count * PIPELINE_LANES * PIPELINE_CONVERSION_BYTES;
+    }
+
+    size_t encode(uint8_t *dest, size_t capacity) override {
+        uint16_t *lanes[PIPELINE_LANES];
+        for (int i = 0; i < PIPELINE_LANES; i++) {
+            lanes[i] = storage[i].data();
+        }
+        SampleData sd{};
+        sd.data = lanes;
+        const CaptureRecord *record = frame(next);
+        next = next + 1 < reader.frames() ? next + 1 : 0;
+        // Frames of another size come from a different configuration, they replay as silence
+        if (!deserializeFrame(CaptureReader::payload(record), record->length, &sd, count) || sd.size != count) {
+            for (auto &lane: storage) {
+                std::fill(lane.begin(), lane.end(), 0);
+            }
+        }
+        return encodeConversions(lanes, count, dest, capacity);
+    }
+
+private:
+
+    const CaptureRecord *frame(uint64_t n) const {
+        uint64_t offset = reader.frameOffset(n);
+        return reader.next(&offset);
+    }
+
+    CaptureReader reader;
+    int count = 0;
+    uint64_t next = 0;
+    std::vector<uint16_t> storage[PIPELINE_LANES];
+
+};
+
+static void freeFrame(uint16_t **data) {
+    for (int i = 0; i < PIPELINE_LANES; i++) {
+        delete[] data[i];
+    }
+    delete[] data;
+}
+
+typedef struct Options {
+    int frames = 1000;
+    bool realtime = false;
+    bool metrics = false;
+    uint32_t seed = 1;
+    SceneDescription scene{};
+    InterferenceMode interference = INTERFERENCE_DETECT;
+    const char *output = nullptr;
+    const char *replay = nullptr;
+    const char *recording = nullptr;
+    Chirp chirp{};
+    Sampling sampling{};
+} Options;
+
+static void usage(const char *name) {
+    printf("Usage: %s [--frames N] [--prf us] [--frequency Hz] [--target range,velocity,rcs,azimuth]...\n"
+           "       [--noise codes] [--bits N] [--seed N] [--interference mode] [--realtime] [--metrics]\n"
+           "       [--output file] [--replay capture] [--recording file]\n", name);
+}
+
+static bool parseOptions(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (strcmp(arg, "--realtime") == 0) {
+            options->realtime = true;
+        } else if (strcmp(arg, "--metrics") == 0) {
+            options->metrics = true;
+        } else if (value == nullptr) {
+            return false;
+        } else if (strcmp(arg, "--frames") == 0) {
+            options->frames = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--prf") == 0) {
+            options->chirp.prf = atoi(value);
+            options->chirp.duration = options->chirp.prf;
+            i++;
+        } else if (strcmp(arg, "--frequency") == 0) {
+            options->sampling.frequency = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--noise") == 0) {
+            options->scene.noise = atof(value);
+            i++;
+        } else if (strcmp(arg, "--bits") == 0) {
+            options->scene.bits = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--target") == 0) {
+            Target target{};
+            if (!parseTarget(value, &target)) {
+                return false;
+            }
+            options->scene.targets.push_back(target);
+            i++;
+        } else if (strcmp(arg, "--seed") == 0) {
+            options->seed = (uint32_t) strtoul(value, nullptr, 10);
+            i++;
+        } else if (strcmp(arg, "--interference") == 0) {
+            options->interference = (InterferenceMode) atoi(value);
+            i++;
+        } else if (strcmp(arg, "--output") == 0) {
+            options->output = value;
+            i++;
+        } else if (strcmp(arg, "--replay") == 0) {
+            options->replay = value;
+            i++;
+        } else if (strcmp(arg, "--recording") == 0) {
+            options->recording = value;
+            i++;
+        } else {
+            return false;
+        }
+    }
+    return options->frames > 0 && options->chirp.prf > 0 && options->sampling.frequency > 0;
+}
+
+static void acquire(const Options &options, ChirpSource &chirps, Chirper &chirper, FrameQueue &queue) {
+    SimAdcSource source(chirps);
+    auto detector = new InterferenceDetector();
+    InterferenceMonitor monitor;
+    int samples = chirps.samples();
+    uint8_t buffer[HOST_READ_BYTES];
+    int core = HOST_ACQUISITION_CORE;
+
+    for (int n = 0; n < options.frames; n++) {
+        auto **data = new uint16_t *[PIPELINE_LANES];
+        for (int i = 0; i < PIPELINE_LANES; i++) {
+            data[i] = new uint16_t[samples];
+        }
+
+        // The scene or capture stands in for the radar, so the chirp is rendered ahead of its start and not counted
+        source.load();
+
+        if (options.realtime) {
+            chirper.chirp.take(std::chrono::seconds(1));
+        } else {
+            // Chirp as soon as the previous frame is queued
+            chirpAlarm(&chirper);
+            chirper.chirp.take(std::chrono::microseconds(0));
+        }
+        int64_t chirpStart = chirper.time;
+        int64_t chirpNanoseconds = nowNanoseconds();
+
+        int64_t start = now();
+        esp_err_t err = captureFrame(source, samples, data, buffer, sizeof(buffer));
+        if (err != ESP_OK) {
+            printf("ERROR: %s\n", esp_err_to_name(err));
+            freeFrame(data);
+            continue;
+        }
+        int64_t end = now();
+        int64_t captureNanoseconds = nowNanoseconds();
+        pipeline.captured.add(core);
+        pipeline.capture.record(core, elapsedNanoseconds(chirpNanoseconds));
+
+        if (options.interference != INTERFERENCE_OFF) {
+            InterferenceReport report = detector->inspect(data, PIPELINE_LANES, samples, options.interference);
+            monitor.record(report.corrupted > 0);
+            if (report.corrupted > 0 && options.interference == INTERFERENCE_DROP) {
+                pipeline.dropped.add(core);
+                freeFrame(data);
+                continue;
+            }
+        }
+
+        SampleData sd = {
+                .data = data,
+                .size = samples,
+                .start = start,
+                .stop = end,
+                .chirpStart = chirpStart,
+                .chirpStop = chirpStart + options.chirp.duration,
+                .skew = 0,
+                .epoch = 0,
+                .configuration = 1,
+                .enqueued = now(),
+        };
+
+        if (!queue.push(sd)) {
+            pipeline.overflowed.add(core);
+            freeFrame(data);
+        } else {
+            pipeline.enqueue.record(core, elapsedNanoseconds(captureNanoseconds));
+        }
+    }
+    queue.close();
+    delete detector;
+}
+
+static void transmit(FrameQueue &queue, Transport &transport, FlightRecorder *recorder, int trigger) {
+    int core = HOST_SENDING_CORE;
+    SampleData sd{};
+    std::vector<uint8_t> binary;
+    int received = 0;
+    while (queue.pop(&sd)) {
+        pipeline.queue.record(core, (uint64_t) (now() - sd.enqueued) * 1000);
+
+        if (recorder != nullptr) {
+            recorder->append(sd, sd.chirpStart);
+            if (++received == trigger) {
+                recorder->trigger(sd.chirpStart, HOST_RECORDER_PRE_US, HOST_RECORDER_POST_US);
+            }
+        }
+
+        int64_t serializeStart = nowNanoseconds();
+        binary.resize(frameBytes(sd.size));
+        size_t length = serializeFrame(sd, binary.data(), binary.size());
+        pipeline.serialize.record(core, elapsedNanoseconds(serializeStart));
+
+        int64_t sendStart = nowNanoseconds();
+        if (length == 0 || transport.send(binary.data(), length, true) != ESP_OK) {
+            pipeline.failed.add(core);
+        } else {
+            pipeline.send.record(core, elapsedNanoseconds(sendStart));
+            pipeline.frame.record(core, (uint64_t) (now() - sd.chirpStart) * 1000);
+            pipeline.sent.add(core);
+        }
+        freeFrame(sd.data);
+    }
+}
+
+static bool writeRecording(const uint8_t *data, size_t length, void *ctx) {
+    return fwrite(data, 1, length, (FILE *) ctx) == length;
+}
+
+static bool dumpRecording(FlightRecorder &recorder, const Options &options) {
+    FILE *file = fopen(options.recording, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    recorder.freeze(now());
+    RecorderStatus status = recorder.status();
+    char metadata[256];
+    int length = snprintf(metadata, sizeof(metadata),
+                          "{\"name\":\"pipeline_host\",\"chirp\":{\"prf\":%d},\"sampling\":{\"frequency\":%d}}",
+                          options.chirp.prf, options.sampling.frequency);
+    bool ok = recorder.dump(writeRecording, file, metadata, (size_t) length, "pipeline_host");
+    ok = fclose(file) == 0 && ok;
+    recorder.release();
+    printf("Recorded %u frames over %.3f s, %llu evicted, %llu refused\n", status.frames, (double) status.span / 1e6,
+           (unsigned long long) status.evicted, (unsigned long long) status.refused);
+    return ok;
+}
+
+static void printMetrics() {
+    const struct {
+        const char *name;
+        const char *help;
+        const Counter *counter;
+    } counters[] = {
+            {"radar_frames_captured_total", "Frames captured from the adc", &pipeline.captured},
+            {"radar_frames_overflowed_total", "Frames lost to a full ring buffer", &pipeline.overflowed},
+            {"radar_frames_dropped_total", "Frames dropped for interference", &pipeline.dropped},
+            {"radar_frames_sent_total", "Frames sent over the websocket", &pipeline.sent},
+            {"radar_frames_failed_total", "Frames the websocket failed to send", &pipeline.failed},
+    };
+    const struct {
+        const char *name;
+        const char *help;
+        const Histogram *histogram;
+    } histograms[] = {
+            {"radar_capture_seconds", "Chirp start to the end of the adc capture", &pipeline.capture},
+            {"radar_enqueue_seconds", "End of the adc capture to the frame entering the ring buffer",
+             &pipeline.enqueue},
+            {"radar_queue_seconds", "Time frames wait in the ring buffer", &pipeline.queue},
+            {"radar_serialize_seconds", "Time to build the websocket payload of a frame", &pipeline.serialize},
+            {"radar_send_seconds", "Time to send a frame over the websocket", &pipeline.send},
+            {"radar_frame_seconds", "Chirp start to send complete", &pipeline.frame},
+    };
+    char buf[2048];
+    for (const auto &metric: counters) {
+        if (formatCounter(buf, sizeof(buf), metric.name, metric.help, metric.counter->value()) > 0) {
+            fputs(buf, stdout);
+        }
+    }
+    for (const auto &metric: histograms) {
+        if (formatHistogram(buf, sizeof(buf), metric.name, metric.help, metric.histogram->snapshot()) > 0) {
+            fputs(buf, stdout);
+        }
+    }
+}
+
+static void printStage(const char *name, const Histogram &histogram) {
+    HistogramSnapshot snapshot = histogram.snapshot();
+    printf("  %-10s p50 %8.1f us  p99 %8.1f us\n", name, (double) histogramQuantile(snapshot, 0.5f) / 1000,
+           (double) histogramQuantile(snapshot, 0.99f) / 1000);
+}
+
+int main(int argc, char **argv) {
+    Options options{};
+    if (!parseOptions(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *sink = nullptr;
+    if (options.output != nullptr) {
+        sink = fopen(options.output, "wb");
+        if (sink == nullptr) {
+            printf("Failed to open %s\n", options.output);
+            return 1;
+        }
+    }
+
+    if (options.scene.targets.empty()) {
+        // A still reflector ahead and a slower one walking away off to the side
+        options.scene.targets.push_back({3.0, 0.0, 1.0, 0.0});
+        options.scene.targets.push_back({7.5, 1.2, 0.5, 20.0});
+    }
+    Scene scene(options.chirp, options.sampling, options.scene, options.seed);
+    ReplayChirps replay;
+    if (options.replay != nullptr && !replay.open(options.replay)) {
+        printf("Failed to open %s\n", options.replay);
+        return 1;
+    }
+    ChirpSource &chirps = options.replay != nullptr ? (ChirpSource &) replay : (ChirpSource &) scene;
+
+    Chirper chirper{};
+    chirper.start = 0;
+    SimChirpTimer timer;
+    SimTransport transport(sink);
+    FrameQueue queue;
+
+    timer.initialize(chirpAlarm, &chirper);
+    timer.setPeriod((uint32_t) options.chirp.prf);
+    if (options.realtime) {
+        timer.start();
+    }
+
+    int64_t began = now();
+    std::vector<uint8_t> arena(options.recording != nullptr ? HOST_RECORDER_BYTES : 0);
+    FlightRecorder recorder(arena.data(), arena.size());
+    FlightRecorder *recording = options.recording != nullptr ? &recorder : nullptr;
+    std::thread sender(transmit, std::ref(queue), std::ref(transport), recording, options.frames / 2);
+    acquire(options, chirps, chirper, queue);
+    sender.join();
+    int64_t elapsed = now() - began;
+    timer.stop();
+
+    if (sink != nullptr) {
+        fclose(sink);
+    }
+    if (recording != nullptr && !dumpRecording(recorder, options)) {
+        printf("Failed to write %s\n", options.recording);
+        return 1;
+    }
+
+    if (options.metrics) {
+        printMetrics();
+        return 0;
+    }
+
+    uint64_t sent = pipeline.sent.value();
+    printf("%d samples per lane, %llu frames in %.3f s, %.1f frames/s\n", chirps.samples(),
+           (unsigned long long) sent, (double) elapsed / 1e6, elapsed > 0 ? (double) sent * 1e6 / (double) elapsed : 0);
+    printf("  captured %llu  overflowed %llu  dropped %llu  failed %llu\n",
+           (unsigned long long) pipeline.captured.value(), (unsigned long long) pipeline.overflowed.value(),
+           (unsigned long long) pipeline.dropped.value(), (unsigned long long) pipeline.failed.value());
+    printStage("capture", pipeline.capture);
+    printStage("enqueue", pipeline.enqueue);
+    printStage("queue", pipeline.queue);
+    printStage("serialize", pipeline.serialize);
+    printStage("send", pipeline.send);
+    printStage("frame", pipeline.frame);
+    return check("frames sent", sent > 0 && pipeline.failed.value() == 0);
+}
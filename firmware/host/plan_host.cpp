@@ -0,0 +1,212 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "check.h"
+#include "planner.h"
+
+// Plans the stream for the chirp, sampling and burst settings given against a link throughput, then checks the
+// planner against a table of settings and links with known plans, and walks the stream planner through a link that
+// slows, recovers and slows again to check it backs off at once, waits out the hold before a richer plan and doubles
+// the hold after one fails. Exits with 1 if any plan comes out different.
+
+typedef struct Options {
+    Chirp chirp{};
+    Sampling sampling{};
+    Burst burst{};
+    // Bytes per second
+    double throughput = 0;
+    uint32_t formats = STREAM_FORMAT(STREAM_RAW);
+} Options;
+
+static void usage(const char *name) {
+    printf("Usage: %s [--prf us] [--frequency Hz] [--chirps N] [--duty %%] [--throughput B/s] "
+           "[--formats raw,packed,compressed,spectra,detections]\n", name);
+}
+
+static bool parseFormats(const char *value, uint32_t *formats) {
+    *formats = 0;
+    char list[128];
+    snprintf(list, sizeof(list), "%s", value);
+    for (char *name = strtok(list, ","); name != nullptr; name = strtok(nullptr, ",")) {
+        int format = STREAM_RAW;
+        while (format < STREAM_FORMATS && strcmp(name, streamFormatName((StreamFormat) format)) != 0) {
+            format++;
+        }
+        if (format == STREAM_FORMATS) {
+            return false;
+        }
+        *formats |= STREAM_FORMAT(format);
+    }
+    return *formats != 0;
+}
+
+static bool parseOptions(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            return false;
+        } else if (strcmp(arg, "--prf") == 0) {
+            options->chirp.prf = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--frequency") == 0) {
+            options->sampling.frequency = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--chirps") == 0) {
+            options->burst.chirps = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--duty") == 0) {
+            options->burst.duty = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--throughput") == 0) {
+            options->throughput = atof(value);
+            i++;
+        } else if (strcmp(arg, "--formats") == 0) {
+            if (!parseFormats(value, &options->formats)) {
+                return false;
+            }
+            i++;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void printPlan(const StreamDemand &demand, const StreamPlan &plan) {
+    printf("%d samples at %.2f frames/s, %.0f B/s raw: %s, one in %d frames, %.0f B/s of %.0f B/s measured%s\n",
+           demand.samples, demand.frameRate, plan.demand, streamFormatName(plan.format), plan.decimation, plan.rate,
+           plan.throughput, plan.fits ? "" : ", does not fit");
+}
+
+typedef struct PlanCase {
+    const char *name;
+    int32_t prf;
+    int32_t frequency;
+    int32_t chirps;
+    int32_t duty;
+    double throughput;
+    uint32_t formats;
+    StreamFormat format;
+    int32_t decimation;
+    bool fits;
+} PlanCase;
+
+#define ALL_FORMATS (STREAM_FORMAT(STREAM_FORMATS) - 1)
+#define RAW_ONLY STREAM_FORMAT(STREAM_RAW)
+#define PACKED_OR_SPECTRA (STREAM_FORMAT(STREAM_PACKED) | STREAM_FORMAT(STREAM_SPECTRA))
+
+// The defaults sample 250 per lane at 80 frames/s, 2056 B raw, 1556 packed, 931 compressed, 556 spectra and 184
+// detections per frame
+static const PlanCase cases[] = {
+        {"unmeasured link",       12500, 20000, 0,  100, 0,      ALL_FORMATS, STREAM_RAW,        1,  true},
+        {"fast link",             12500, 20000, 0,  100, 1e6,    ALL_FORMATS, STREAM_RAW,        1,  true},
+        {"raw at the headroom",   12500, 20000, 0,  100, 205600, ALL_FORMATS, STREAM_RAW,        1,  true},
+        {"raw past the headroom", 12500, 20000, 0,  100, 205599, ALL_FORMATS, STREAM_PACKED,     1,  true},
+        {"compressed",            12500, 20000, 0,  100, 150000, ALL_FORMATS, STREAM_COMPRESSED, 1,  true},
+        {"spectra",               12500, 20000, 0,  100, 60000,  ALL_FORMATS, STREAM_SPECTRA,    1,  true},
+        {"detections",            12500, 20000, 0,  100, 20000,  ALL_FORMATS, STREAM_DETECTIONS, 1,  true},
+        {"detections halved",     12500, 20000, 0,  100, 10000,  ALL_FORMATS, STREAM_DETECTIONS, 2,  true},
+        {"raw halved",            12500, 20000, 0,  100, 150000, RAW_ONLY,    STREAM_RAW,        2,  true},
+        {"raw decimated",         12500, 20000, 0,  100, 20000,  RAW_ONLY,    STREAM_RAW,        11, true},
+        {"raw overrun",           12500, 20000, 0,  100, 1000,   RAW_ONLY,    STREAM_RAW,        16, false},
+        {"overrun, cheapest",     12500, 20000, 0,  100, 1000,   ALL_FORMATS, STREAM_DETECTIONS, 16, false},
+        {"packed or spectra",     12500, 20000, 0,  100, 100000, PACKED_OR_SPECTRA, STREAM_SPECTRA, 1, true},
+        {"no formats is raw",     12500, 20000, 0,  100, 150000, 0,           STREAM_RAW,        2,  true},
+        {"long chirps",           50000, 20000, 0,  100, 210000, RAW_ONLY,    STREAM_RAW,        1,  true},
+        {"fast sampling",         12500, 80000, 0,  100, 300000, RAW_ONLY,    STREAM_RAW,        3,  true},
+        {"bursts average out",    12500, 20000, 40, 25,  60000,  RAW_ONLY,    STREAM_RAW,        1,  true},
+        {"bursts decimated",      12500, 20000, 40, 25,  30000,  RAW_ONLY,    STREAM_RAW,        2,  true},
+};
+
+static int checkCases() {
+    int wrong = 0;
+    for (const auto &c: cases) {
+        Chirp chirp{};
+        chirp.prf = c.prf;
+        chirp.duration = c.prf;
+        Sampling sampling{};
+        sampling.frequency = c.frequency;
+        Burst burst{};
+        burst.chirps = c.chirps;
+        burst.duty = c.duty;
+        StreamDemand demand = streamDemand(chirp, sampling, burst);
+        StreamPlan plan = planStream(demand, c.throughput, c.formats);
+        bool right = plan.format == c.format && plan.decimation == c.decimation && plan.fits == c.fits;
+        if (!right) {
+            printf("%s: expected %s one in %d, got %s one in %d%s\n", c.name, streamFormatName(c.format),
+                   c.decimation, streamFormatName(plan.format), plan.decimation, plan.fits ? "" : " (does not fit)");
+            wrong++;
+        }
+    }
+    printf("Plans: %d of %zu right\n", (int) (sizeof(cases) / sizeof(cases[0])) - wrong,
+           sizeof(cases) / sizeof(cases[0]));
+    return wrong;
+}
+
+// Frames sent over a link of rate bytes per second, each blocking for as long as the link takes to carry it
+static void send(StreamPlanner &planner, double rate) {
+    for (int i = 0; i < PLAN_LINK_SENDS * 4; i++) {
+        planner.sent(2056, (uint64_t) (2056.0 / rate * 1e9));
+    }
+}
+
+typedef struct PlannerStep {
+    const char *name;
+    // Seconds since the settings were planned
+    double time;
+    // Link throughput the sends before the step ran at, zero for no sends
+    double link;
+    bool changed;
+    int32_t decimation;
+    // Seconds a plan has to fit before a richer one is tried
+    double hold;
+} PlannerStep;
+
+// 164480 B/s raw at the defaults
+static const PlannerStep steps[] = {
+        {"link slows",                1,  100000, true,  3, 10},
+        {"room, but within the hold", 5,  1e6,    false, 3, 10},
+        {"room after the hold",       11, 1e6,    true,  1, 10},
+        {"richer plan overruns",      12, 100000, true,  3, 20},
+        {"room, the hold doubled",    25, 1e6,    false, 3, 20},
+        {"room after the long hold",  33, 1e6,    true,  1, 20},
+        {"richer plan lasts",         60, 1e6,    false, 1, 10},
+        {"link slows again",          61, 100000, true,  3, 10},
+};
+
+static int checkPlanner() {
+    Chirp chirp{};
+    Sampling sampling{};
+    Burst burst{};
+    StreamPlanner planner(STREAM_FORMAT(STREAM_RAW));
+    StreamPlan first = planner.configure(streamDemand(chirp, sampling, burst), 0);
+    int wrong = CHECK(first.decimation == 1 && first.format == STREAM_RAW);
+    for (const auto &step: steps) {
+        if (step.link > 0) {
+            send(planner, step.link);
+        }
+        bool changed = planner.update((int64_t) (step.time * 1e6));
+        const StreamPlan &plan = planner.plan();
+        bool right = changed == step.changed && plan.decimation == step.decimation &&
+                     (double) planner.hold() == step.hold * 1e6;
+        printf("%5.0f s %-28s one in %d at %.0f B/s of %.0f B/s, holding %.0f s%s\n", step.time, step.name,
+               plan.decimation, plan.rate, plan.throughput, (double) planner.hold() / 1e6, right ? "" : "  WRONG");
+        wrong += right ? 0 : 1;
+    }
+    return wrong;
+}
+
+int main(int argc, char **argv) {
+    Options options{};
+    if (!parseOptions(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+    StreamDemand demand = streamDemand(options.chirp, options.sampling, options.burst);
+    printPlan(demand, planStream(demand, options.throughput, options.formats));
+
+    int wrong = checkCases();
+    wrong += checkPlanner();
+    return wrong > 0 ? 1 : 0;
+}
@@ -0,0 +1,281 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <thread>
+#include "check.h"
+#include "hal_sim.h"
+#include "pipeline.h"
+#include "reconfigure.h"
+#include "scene.h"
+#include "seqlock.h"
+
+// Walks the reconfiguration state machine through a table of transitions: nothing staged, a change waiting out the
+// frames in flight, a frame abandoned on error, changes staged back to back or while the hardware is being switched,
+// and a switch that fails and is aborted.
+//
+// Then runs the acquisition loop of the firmware against a simulated adc, as pipeline_host does, while another thread
+// publishes chirp and sampling changes in bursts. Each switch rebuilds the scene the adc converts, some are refused
+// as the adc refuses a sampling it cannot reinitialize with, and some captures fail. Every frame has to be captured
+// with the configuration it is stamped with. Exits with 1 if any transition or frame comes out wrong.
+
+#define HOST_READ_BYTES (PIPELINE_CONVERSION_BYTES * PIPELINE_LANES * 32)
+
+typedef struct Options {
+    int frames = 2000;
+    uint32_t seed = 1;
+    // Fraction of the switches refused, and of the captures that fail
+    double refusals = 0.2;
+    double errors = 0.02;
+} Options;
+
+static void usage(const char *name) {
+    printf("Usage: %s [--frames N] [--seed N] [--refusals fraction] [--errors fraction]\n", name);
+}
+
+static bool parseOptions(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            return false;
+        } else if (strcmp(arg, "--frames") == 0) {
+            options->frames = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--seed") == 0) {
+            options->seed = (uint32_t) strtoul(value, nullptr, 10);
+            i++;
+        } else if (strcmp(arg, "--refusals") == 0) {
+            options->refusals = atof(value);
+            i++;
+        } else if (strcmp(arg, "--errors") == 0) {
+            options->errors = atof(value);
+            i++;
+        } else {
+            return false;
+        }
+    }
+    return options->frames > 0;
+}
+
+enum Action {
+    STAGE,
+    BEGIN,
+    END,
+    DRAIN,
+    COMMIT,
+    ABORT,
+};
+
+typedef struct Transition {
+    const char *name;
+    Action action;
+    // What drain returns, only checked for DRAIN
+    bool drained;
+    ReconfigureState state;
+    uint32_t id;
+} Transition;
+
+static const char *actionName(Action action) {
+    const char *names[] = {"stage", "begin", "end", "drain", "commit", "abort"};
+    return names[action];
+}
+
+static const Transition transitions[] = {
+        {"idle",                           DRAIN,  false, RECONFIGURE_ACTIVE,  0},
+        {"frame in flight",                BEGIN,  false, RECONFIGURE_ACTIVE,  0},
+        {"change published",               STAGE,  false, RECONFIGURE_ACTIVE,  0},
+        {"waits on the frame",             DRAIN,  false, RECONFIGURE_STAGED,  0},
+        {"still waiting",                  DRAIN,  false, RECONFIGURE_STAGED,  0},
+        {"frame done",                     END,    false, RECONFIGURE_STAGED,  0},
+        {"drained",                        DRAIN,  true,  RECONFIGURE_DRAINED, 0},
+        {"drained holds until switched",   DRAIN,  true,  RECONFIGURE_DRAINED, 0},
+        {"switched",                       COMMIT, false, RECONFIGURE_ACTIVE,  1},
+        {"nothing left",                   DRAIN,  false, RECONFIGURE_ACTIVE,  1},
+        {"back to back",                   STAGE,  false, RECONFIGURE_ACTIVE,  1},
+        {"back to back again",             STAGE,  false, RECONFIGURE_ACTIVE,  1},
+        {"one switch for both",            DRAIN,  true,  RECONFIGURE_DRAINED, 1},
+        {"published while switching",      STAGE,  false, RECONFIGURE_DRAINED, 1},
+        {"switched",                       COMMIT, false, RECONFIGURE_ACTIVE,  2},
+        {"the late change follows",        DRAIN,  true,  RECONFIGURE_DRAINED, 2},
+        {"switch refused",                 ABORT,  false, RECONFIGURE_ACTIVE,  2},
+        {"nothing left after the refusal", DRAIN,  false, RECONFIGURE_ACTIVE,  2},
+        {"frame in flight",                BEGIN,  false, RECONFIGURE_ACTIVE,  2},
+        {"change published",               STAGE,  false, RECONFIGURE_ACTIVE,  2},
+        {"waits on the frame",             DRAIN,  false, RECONFIGURE_STAGED,  2},
+        {"frame abandoned on error",       END,    false, RECONFIGURE_STAGED,  2},
+        {"drained",                        DRAIN,  true,  RECONFIGURE_DRAINED, 2},
+        {"published while refused",        STAGE,  false, RECONFIGURE_DRAINED, 2},
+        {"switch refused",                 ABORT,  false, RECONFIGURE_ACTIVE,  2},
+        {"retried at the next boundary",   DRAIN,  true,  RECONFIGURE_DRAINED, 2},
+        {"switched",                       COMMIT, false, RECONFIGURE_ACTIVE,  3},
+};
+
+static int checkTransitions() {
+    Reconfigure reconfigure;
+    Chirp chirp{};
+    Sampling sampling{};
+    int wrong = 0;
+    for (const auto &t: transitions) {
+        bool drained = false;
+        switch (t.action) {
+            case STAGE:
+                reconfigure.stage();
+                break;
+            case BEGIN:
+                reconfigure.beginFrame();
+                break;
+            case END:
+                reconfigure.endFrame();
+                break;
+            case DRAIN:
+                drained = reconfigure.drain();
+                break;
+            case COMMIT:
+                chirp.prf += 1000;
+                chirp.duration = chirp.prf;
+                reconfigure.commit(chirp, sampling);
+                break;
+            case ABORT:
+                reconfigure.abort();
+                break;
+        }
+        const FrameConfiguration &active = reconfigure.active();
+        bool right = (t.action != DRAIN || drained == t.drained) && reconfigure.state() == t.state &&
+                     active.id == t.id && (t.id == 0 || active.chirp.prf == chirp.prf);
+        if (!right) {
+            printf("%s (%s): drained %d, state %d, id %u\n", t.name, actionName(t.action), drained,
+                   reconfigure.state(), active.id);
+            wrong++;
+        }
+    }
+    printf("Transitions: %d of %zu right\n", (int) (sizeof(transitions) / sizeof(transitions[0])) - wrong,
+           sizeof(transitions) / sizeof(transitions[0]));
+    return wrong;
+}
+
+typedef struct Published {
+    Chirp chirp;
+    Sampling sampling;
+} Published;
+
+// The adc as configured, a scene rendered with the chirp and sampling of a configuration
+typedef struct Hardware {
+    uint32_t id;
+    Published published;
+    std::unique_ptr<Scene> scene;
+    std::unique_ptr<SimAdcSource> source;
+} Hardware;
+
+static void configureHardware(Hardware &hardware, uint32_t id, const Published &published, uint32_t seed) {
+    SceneDescription description{};
+    description.targets.push_back({3.0, 0.0, 1.0, 0.0});
+    hardware.id = id;
+    hardware.published = published;
+    hardware.source.reset();
+    hardware.scene.reset(new Scene(published.chirp, published.sampling, description, seed));
+    hardware.source.reset(new SimAdcSource(*hardware.scene));
+}
+
+static int runAcquisition(const Options &options) {
+    Seqlock<Published> settings{};
+    Reconfigure reconfigure;
+    std::atomic<bool> running{true};
+    std::atomic<uint32_t> published{0};
+
+    // Bursts of changes back to back, then a pause of a few frames
+    std::thread publisher([&]() {
+        std::mt19937 random(options.seed);
+        const int32_t prfs[] = {5000, 8000, 12500, 20000};
+        const int32_t frequencies[] = {10000, 20000, 40000};
+        while (running) {
+            int burst = 1 + (int) (random() % 4);
+            for (int i = 0; i < burst; i++) {
+                Published next{};
+                next.chirp.prf = prfs[random() % 4];
+                next.chirp.duration = next.chirp.prf;
+                next.sampling.frequency = frequencies[random() % 3];
+                settings.store(next);
+                reconfigure.stage();
+                published++;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(200 + random() % 2000));
+        }
+    });
+
+    std::mt19937 random(options.seed + 1);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    Hardware hardware{};
+    Published initial{};
+    configureHardware(hardware, 0, initial, options.seed);
+    uint8_t buffer[HOST_READ_BYTES];
+    uint64_t commits = 0, aborts = 0, errors = 0, captured = 0, mismatched = 0;
+
+    // The persisted configuration is staged at boot
+    reconfigure.stage();
+    for (int n = 0; n < options.frames; n++) {
+        if (reconfigure.drain()) {
+            Published next{};
+            settings.load(next);
+            // The adc only reinitializes, and so can only refuse, for a new sampling. It was initialized with the
+            // persisted sampling at boot, so the first switch goes through.
+            bool resampled = memcmp(&next.sampling, &hardware.published.sampling, sizeof(Sampling)) != 0;
+            if (hardware.id > 0 && resampled && uniform(random) < options.refusals) {
+                // The adc kept its sampling, so the scene stays as it is
+                reconfigure.abort();
+                aborts++;
+            } else {
+                uint32_t id = reconfigure.commit(next.chirp, next.sampling);
+                configureHardware(hardware, id, next, options.seed + id);
+                commits++;
+            }
+        }
+
+        const FrameConfiguration &frame = reconfigure.beginFrame();
+        int samples = frame.samples;
+        uint32_t id = frame.id;
+        if (id != hardware.id || samples != hardware.scene->samples()) {
+            mismatched++;
+        }
+        std::vector<uint16_t> lanes((size_t) samples * PIPELINE_LANES);
+        uint16_t *data[PIPELINE_LANES];
+        for (int i = 0; i < PIPELINE_LANES; i++) {
+            data[i] = &lanes[(size_t) i * samples];
+        }
+        hardware.source->load();
+        esp_err_t err = uniform(random) < options.errors ? ESP_FAIL :
+                        captureFrame(*hardware.source, samples, data, buffer, sizeof(buffer));
+        // Abandoned or not, the frame is no longer in flight
+        reconfigure.endFrame();
+        if (err != ESP_OK) {
+            errors++;
+            continue;
+        }
+        captured++;
+    }
+    running = false;
+    publisher.join();
+
+    printf("%llu frames captured, %llu failed, %u changes published, %llu switched, %llu refused, "
+           "%llu captured with the wrong configuration\n", (unsigned long long) captured,
+           (unsigned long long) errors, published.load(), (unsigned long long) commits, (unsigned long long) aborts,
+           (unsigned long long) mismatched);
+    int wrong = CHECK(mismatched == 0);
+    wrong += CHECK(commits > 0);
+    wrong += CHECK(options.refusals == 0 || aborts > 0);
+    wrong += CHECK(reconfigure.state() == RECONFIGURE_ACTIVE);
+    return wrong;
+}
+
+int main(int argc, char **argv) {
+    Options options{};
+    if (!parseOptions(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+    int wrong = checkTransitions();
+    wrong += runAcquisition(options);
+    return wrong > 0 ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "pipeline.h"
+#include "capture_file.h"
+#include "websocket.h"
+
+// Records a module's websocket session to a capture file. It opens the session as the bridge does, sending a text
+// message and keeping the metadata document the module answers with, then records every frame and telemetry message
+// as it arrives. The module only sends its settings when asked, so whenever the configuration id of the frames changes
+// the recorder asks again and records the answer as the new settings.
+
+typedef struct Options {
+    const char *module = nullptr;
+    uint16_t port = 80;
+    const char *output = nullptr;
+    double seconds = 0;
+    uint32_t chunk = CAPTURE_CHUNK_BYTES;
+} Options;
+
+static std::atomic<bool> stopping{false};
+
+static void interrupt(int) {
+    stopping = true;
+}
+
+static int64_t wallClock() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static void usage(const char *name) {
+    printf("Usage: %s --module host[:port] --output file [--seconds S] [--chunk bytes]\n", name);
+}
+
+static bool parseOptions(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            return false;
+        } else if (strcmp(arg, "--module") == 0) {
+            options->module = value;
+            i++;
+        } else if (strcmp(arg, "--output") == 0) {
+            options->output = value;
+            i++;
+        } else if (strcmp(arg, "--seconds") == 0) {
+            options->seconds = atof(value);
+            i++;
+        } else if (strcmp(arg, "--chunk") == 0) {
+            options->chunk = (uint32_t) strtoul(value, nullptr, 10);
+            i++;
+        } else {
+            return false;
+        }
+    }
+    return options->module != nullptr && options->output != nullptr && options->chunk > 0;
+}
+
+// Configuration id in the trailer of a serialized frame, zero if the message is not a frame
+static uint32_t frameConfiguration(const std::vector<uint8_t> &message) {
+    if (message.size() < SAMPLE_FRAME_TRAILER_SIZE) {
+        return 0;
+    }
+    const uint8_t *trailer = &message[message.size() - SAMPLE_FRAME_TRAILER_SIZE];
+    uint64_t value = 0;
+    for (size_t i = 0; i < sizeof(int64_t); i++) {
+        value = value << 8 | trailer[i];
+    }
+    return (uint32_t) value;
+}
+
+// The metadata document carries the chirp settings, telemetry does not
+static bool isSettings(const std::vector<uint8_t> &message) {
+    static const char key[] = "\"chirp\"";
+    return std::search(message.begin(), message.end(), key, key + sizeof(key) - 1) != message.end();
+}
+
+int main(int argc, char **argv) {
+    Options options{};
+    if (!parseOptions(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+    std::string host = options.module;
+    size_t colon = host.find(':');
+    if (colon != std::string::npos) {
+        options.port = (uint16_t) atoi(host.c_str() + colon + 1);
+        host.resize(colon);
+    }
+
+    WebSocket socket;
+    if (!socket.connect(host.c_str(), options.port, "/ws")) {
+        printf("Failed to connect to ws://%s:%u/ws\n", host.c_str(), options.port);
+        return 1;
+    }
+    CaptureWriter writer;
+    if (!writer.open(options.output, options.module, wallClock(), options.chunk)) {
+        printf("Failed to open %s\n", options.output);
+        return 1;
+    }
+    signal(SIGINT, interrupt);
+    signal(SIGTERM, interrupt);
+
+    const uint8_t ping[] = "Ping!";
+    socket.send(ping, sizeof(ping) - 1, false);
+
+    int64_t began = wallClock();
+    int64_t deadline = options.seconds > 0 ? began + (int64_t) (options.seconds * 1e6) : INT64_MAX;
+    bool opened = false;
+    uint32_t configuration = 0;
+    uint64_t bytes = 0;
+    std::vector<uint8_t> message;
+    bool failed = false;
+    while (!stopping && wallClock() < deadline) {
+        // Wake up now and then to notice a signal or the deadline
+        if (!socket.readable(200)) {
+            continue;
+        }
+        bool binary = false;
+        if (!socket.receive(&message, &binary)) {
+            printf("Connection closed\n");
+            break;
+        }
+        int64_t time = wallClock();
+        uint8_t type;
+        if (binary) {
+            type = CAPTURE_FRAME;
+            uint32_t id = frameConfiguration(message);
+            if (configuration != 0 && id != configuration) {
+                // Ask for the settings the new configuration was built from
+                socket.send(ping, sizeof(ping) - 1, false);
+            }
+            configuration = id;
+        } else if (isSettings(message)) {
+            type = opened ? CAPTURE_SETTINGS : CAPTURE_METADATA;
+            opened = true;
+        } else {
+            type = CAPTURE_TELEMETRY;
+        }
+        if (!writer.append(type, time, message.data(), message.size())) {
+            printf("Failed to write %s\n", options.output);
+            failed = true;
+            break;
+        }
+        bytes += message.size();
+    }
+    socket.close();
+
+    uint64_t records = writer.records();
+    uint64_t frames = writer.frames();
+    if (!writer.close()) {
+        printf("Failed to write %s\n", options.output);
+        return 1;
+    }
+    double elapsed = (double) (wallClock() - began) / 1e6;
+    printf("%llu records, %llu frames, %.1f MB in %.1f s\n", (unsigned long long) records,
+           (unsigned long long) frames, (double) bytes / 1e6, elapsed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,241 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include "capture_file.h"
+#include "websocket.h"
+
+// Plays a capture back. Served, it stands in for the module at ws://0.0.0.0:port/ws: the bridge opens the session with
+// a text message, gets the metadata document in effect at the starting frame, then the frames and telemetry as they
+// were recorded. Settings documents are not sent unasked, as the module never sends them, but answer any later text
+// message. Without --serve the records are only read, which measures how fast a capture can be replayed.
+//
+// Records go out at the recorded pace scaled by --speed, as fast as possible with --speed max, or one frame each time
+// enter is pressed with --step.
+
+typedef struct Options {
+    const char *input = nullptr;
+    int serve = 0;
+    // Zero replays as fast as possible
+    double speed = 1.0;
+    bool step = false;
+    uint64_t seek = 0;
+} Options;
+
+static void usage(const char *name) {
+    printf("Usage: %s --input file [--serve port] [--speed factor|max] [--step] [--seek frame]\n", name);
+}
+
+static bool parseOptions(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (strcmp(arg, "--step") == 0) {
+            options->step = true;
+        } else if (value == nullptr) {
+            return false;
+        } else if (strcmp(arg, "--input") == 0) {
+            options->input = value;
+            i++;
+        } else if (strcmp(arg, "--serve") == 0) {
+            options->serve = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--speed") == 0) {
+            options->speed = strcmp(value, "max") == 0 ? 0 : atof(value);
+            if (options->speed < 0) {
+                return false;
+            }
+            i++;
+        } else if (strcmp(arg, "--seek") == 0) {
+            options->seek = strtoull(value, nullptr, 10);
+            i++;
+        } else {
+            return false;
+        }
+    }
+    return options->input != nullptr && options->serve >= 0 && options->serve <= 65535;
+}
+
+// Holds each record back until its time, relative to the first record paced
+class Pacer {
+public:
+
+    explicit Pacer(const Options &options) : speed(options.speed), step(options.step) {}
+
+    // Returns false once stepping reaches the end of stdin
+    bool wait(const CaptureRecord *record) {
+        if (step) {
+            if (record->type != CAPTURE_FRAME) {
+                return true;
+            }
+            int c;
+            while ((c = getchar()) != '\n') {
+                if (c == EOF) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        if (speed == 0) {
+            return true;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (!anchored) {
+            anchor = now;
+            first = record->time;
+            anchored = true;
+            return true;
+        }
+        auto due = anchor + std::chrono::microseconds((int64_t) ((double) (record->time - first) / speed));
+        if (due > now) {
+            std::this_thread::sleep_until(due);
+        }
+        return true;
+    }
+
+private:
+
+    double speed;
+    bool step;
+    bool anchored = false;
+    int64_t first = 0;
+    std::chrono::steady_clock::time_point anchor;
+
+};
+
+// Offset of the record replay starts at
+static uint64_t startOffset(const CaptureReader &reader, uint64_t seek) {
+    return seek == 0 ? reader.begin() : reader.frameOffset(seek);
+}
+
+static int serve(const Options &options, const CaptureReader &reader) {
+    uint64_t documentOffset = reader.settingsOffset(options.seek);
+    if (documentOffset == 0) {
+        printf("The capture holds no metadata to open a session with\n");
+        return 1;
+    }
+    int listener = websocketListen((uint16_t) options.serve);
+    if (listener < 0) {
+        printf("Failed to listen on port %d\n", options.serve);
+        return 1;
+    }
+    printf("Serving %s at ws://0.0.0.0:%d/ws\n", options.input, options.serve);
+    int connection = accept(listener, nullptr, nullptr);
+    ::close(listener);
+    WebSocket socket;
+    std::string path;
+    if (connection < 0 || !socket.accept(connection, &path)) {
+        printf("Failed to accept a session\n");
+        return 1;
+    }
+
+    // The session opens with a text message, answered with the document in effect
+    std::vector<uint8_t> message;
+    bool binary = false;
+    if (!socket.receive(&message, &binary)) {
+        printf("Session closed before it began\n");
+        return 1;
+    }
+    uint64_t cursor = documentOffset;
+    const CaptureRecord *document = reader.next(&cursor);
+    socket.send(CaptureReader::payload(document), document->length, false);
+
+    Pacer pacer(options);
+    uint64_t offset = startOffset(reader, options.seek);
+    uint64_t frames = 0, messages = 0;
+    auto began = std::chrono::steady_clock::now();
+    const CaptureRecord *record;
+    while ((record = reader.next(&offset)) != nullptr) {
+        // Answer the bridge as the module would, with the settings at this point of the capture
+        while (socket.readable(0)) {
+            if (!socket.receive(&message, &binary)) {
+                printf("Session closed\n");
+                return 0;
+            }
+            if (!binary) {
+                socket.send(CaptureReader::payload(document), document->length, false);
+            }
+        }
+        if (record->type == CAPTURE_METADATA || record->type == CAPTURE_SETTINGS) {
+            document = record;
+            continue;
+        }
+        if (!pacer.wait(record)) {
+            break;
+        }
+        bool frame = record->type == CAPTURE_FRAME;
+        if (!socket.send(CaptureReader::payload(record), record->length, frame)) {
+            printf("Session closed\n");
+            break;
+        }
+        if (frame) {
+            frames++;
+        } else {
+            messages++;
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+    printf("Sent %llu frames and %llu messages in %.1f s\n", (unsigned long long) frames,
+           (unsigned long long) messages, elapsed);
+    return 0;
+}
+
+static int play(const Options &options, const CaptureReader &reader) {
+    Pacer pacer(options);
+    uint64_t offset = startOffset(reader, options.seek);
+    uint64_t counts[CAPTURE_METADATA + 1] = {};
+    uint64_t bytes = 0;
+    uint64_t checksum = 0;
+    int64_t first = 0, last = 0;
+    auto began = std::chrono::steady_clock::now();
+    const CaptureRecord *record;
+    while ((record = reader.next(&offset)) != nullptr) {
+        if (!pacer.wait(record)) {
+            break;
+        }
+        if (first == 0) {
+            first = record->time;
+        }
+        last = record->time;
+        counts[record->type]++;
+        bytes += record->length;
+        // Touch every byte, so the rate is that of reading the capture and not only its index
+        const uint8_t *payload = CaptureReader::payload(record);
+        for (uint32_t i = 0; i < record->length; i++) {
+            checksum = checksum * 31 + payload[i];
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+    double recorded = (double) (last - first) / 1e6;
+    printf("%llu frames, %llu telemetry, %llu settings, %.1f MB\n", (unsigned long long) counts[CAPTURE_FRAME],
+           (unsigned long long) counts[CAPTURE_TELEMETRY],
+           (unsigned long long) (counts[CAPTURE_SETTINGS] + counts[CAPTURE_METADATA]), (double) bytes / 1e6);
+    printf("%.1f s recorded replayed in %.3f s, %.1f MB/s, checksum %016llx\n", recorded, elapsed,
+           elapsed > 0 ? (double) bytes / 1e6 / elapsed : 0, (unsigned long long) checksum);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    Options options{};
+    if (!parseOptions(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+    CaptureReader reader;
+    if (!reader.open(options.input)) {
+        printf("Failed to open %s\n", options.input);
+        return 1;
+    }
+    printf("%s: %llu records, %llu frames in %u chunks from %s%s\n", options.input,
+           (unsigned long long) reader.records(), (unsigned long long) reader.frames(), reader.chunks(),
+           reader.header().source, reader.recovered() ? ", recovered without a footer" : "");
+    if (options.seek > 0 && options.seek >= reader.frames()) {
+        printf("The capture has no frame %llu\n", (unsigned long long) options.seek);
+        return 1;
+    }
+    return options.serve > 0 ? serve(options, reader) : play(options, reader);
+}
@@ -0,0 +1,190 @@
+#include <cmath>
+#include <cstdio>
+#include "pipeline.h"
+#include "reconfigure.h"
+#include "waveform.h"
+#include "scene.h"
+
+// splitmix64, a fast generator whose whole state is one word, so each chirp can start its own stream
+static uint64_t nextRandom(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform in (0, 1], never zero so its logarithm is finite
+static double uniform(uint64_t *state) {
+    return ((double) (nextRandom(state) >> 11) + 1.0) * (1.0 / 9007199254740992.0);
+}
+
+// Fill values with standard normal deviates, two at a time from the Box-Muller transform
+static void gaussian(uint64_t *state, double *values, size_t count) {
+    for (size_t i = 0; i < count; i += 2) {
+        double magnitude = std::sqrt(-2.0 * std::log(uniform(state)));
+        double angle = 2.0 * M_PI * uniform(state);
+        values[i] = magnitude * std::cos(angle);
+        if (i + 1 < count) {
+            values[i + 1] = magnitude * std::sin(angle);
+        }
+    }
+}
+
+bool parseTarget(const char *text, Target *target) {
+    double fields[4] = {0.0, 0.0, 1.0, 0.0};
+    int parsed = sscanf(text, "%lf,%lf,%lf,%lf", &fields[0], &fields[1], &fields[2], &fields[3]);
+    if (parsed < 1 || fields[0] <= 0) {
+        return false;
+    }
+    *target = {fields[0], fields[1], fields[2], fields[3]};
+    return true;
+}
+
+bool parseTone(const char *text, SceneTone *tone) {
+    double fields[3] = {0.0, 0.0, 0.0};
+    int parsed = sscanf(text, "%lf,%lf,%lf", &fields[0], &fields[1], &fields[2]);
+    if (parsed < 2 || fields[0] < 0 || fields[1] <= 0) {
+        return false;
+    }
+    *tone = {fields[0] * 1e-6, fields[1], fields[2] * M_PI / 180.0};
+    return true;
+}
+
+double sceneDisplacement(const SceneDescription &description, double time) {
+    double displacement = 0;
+    for (const SceneTone &tone: description.vibration) {
+        displacement += tone.amplitude * std::sin(2.0 * M_PI * tone.frequency * time + tone.phase);
+    }
+    return displacement;
+}
+
+Scene::Scene(const Chirp &chirp, const Sampling &sampling, const SceneDescription &description, uint32_t seed)
+        : chirpConfig(chirp), sampling(sampling), description(description), seed(seed) {
+    count = frameSamples(chirp, sampling);
+    for (auto &lane: scratch) {
+        lane.resize(count);
+    }
+    // The VCO follows the code table of the chirp, one code per step interval of the timer
+    std::vector<uint16_t> codes(chirp.steps > 0 ? chirp.steps : 1, 0);
+    Linearization linear{};
+    if (chirp.steps <= 0 || buildChirpTable(chirp, linear, codes.data(), codes.size()) == 0) {
+        codes.assign(1, 0);
+    }
+    double interval = chirp.steps > 0 ? std::round((double) chirp.duration / (double) chirp.steps) : 1.0;
+    if (interval <= 0) {
+        interval = 1.0;
+    }
+    // Conversions scan the four lanes in turn at four times the sampling frequency
+    size_t conversions = (size_t) count * SCENE_LANES;
+    frequency.resize(conversions);
+    offsets.resize(conversions);
+    level.resize(conversions);
+    double conversionPeriod = 1.0 / (4.0 * (double) sampling.frequency);
+    for (size_t j = 0; j < conversions; j++) {
+        double t = (double) j * conversionPeriod;
+        auto step = (size_t) (t * 1e6 / interval);
+        // The last step returns the VCO to the bottom of the band, where it rests for the remainder of the period
+        uint16_t code = step + 1 < codes.size() ? codes[step] : 0;
+        frequency[j] = description.radar.base + description.radar.sweep * (double) code / (double) MCP4922_MAX_CODE;
+        offsets[j] = t;
+    }
+}
+
+int Scene::samples() const {
+    return count;
+}
+
+uint64_t Scene::chirp() const {
+    return next;
+}
+
+void Scene::seek(uint64_t chirp) {
+    next = chirp;
+}
+
+void Scene::render(uint16_t **lanes) {
+    uint64_t index = next++;
+    size_t conversions = (size_t) count * SCENE_LANES;
+    const SceneRadar &radar = description.radar;
+
+    // Start from the offsets and noise, then add every reflector
+    uint64_t state = ((uint64_t) seed << 32) ^ (index * 0xD1B54A32D192ED03ULL);
+    if (description.noise > 0) {
+        gaussian(&state, level.data(), conversions);
+        for (double &value: level) {
+            value *= description.noise;
+        }
+    } else {
+        level.assign(conversions, 0.0);
+    }
+    for (size_t j = 0; j < conversions; j++) {
+        level[j] += SCENE_BIAS + description.offset[j % SCENE_LANES];
+    }
+
+    double chirpTime = (double) index * (double) chirpConfig.prf * 1e-6;
+    // Phase per Hz of transmit frequency and meter of range, for the round trip
+    const double phasePerRange = 4.0 * M_PI / SCENE_SPEED_OF_LIGHT;
+    // The mount moves within the chirp as well as from one to the next
+    std::vector<double> displacement;
+    if (!description.vibration.empty()) {
+        displacement.resize(conversions);
+        for (size_t j = 0; j < conversions; j++) {
+            displacement[j] = sceneDisplacement(description, chirpTime + offsets[j]);
+        }
+    }
+    for (const Target &target: description.targets) {
+        double amplitude = radar.gain * std::sqrt(target.rcs > 0 ? target.rcs : 0.0);
+        // The second receiver is further along the wavefront by the spacing projected on the arrival direction
+        double arrival = 2.0 * M_PI * radar.spacing * std::sin(target.azimuth * M_PI / 180.0);
+        double projection = std::cos(target.azimuth * M_PI / 180.0);
+        for (size_t j = 0; j < conversions; j++) {
+            double range = target.range + target.velocity * (chirpTime + offsets[j]);
+            if (!displacement.empty()) {
+                range -= displacement[j] * projection;
+            }
+            range = range < SCENE_MIN_RANGE ? SCENE_MIN_RANGE : range;
+            double phase = phasePerRange * frequency[j] * range;
+            double a = amplitude / (range * range);
+            // I1, Q1, Q2, I2
+            switch (j % SCENE_LANES) {
+                case 0:
+                    level[j] += a * std::cos(phase);
+                    break;
+                case 1:
+                    level[j] += a * std::sin(phase);
+                    break;
+                case 2:
+                    level[j] += a * std::sin(phase + arrival);
+                    break;
+                default:
+                    level[j] += a * std::cos(phase + arrival);
+                    break;
+            }
+        }
+    }
+
+    int bits = description.bits < 1 ? 1 : (description.bits > 12 ? 12 : description.bits);
+    double quantum = (double) (1 << (12 - bits));
+    for (size_t j = 0; j < conversions; j++) {
+        double code = std::round(level[j] / quantum) * quantum;
+        code = code < 0 ? 0 : (code > SCENE_FULL_SCALE ? SCENE_FULL_SCALE : code);
+        lanes[j % SCENE_LANES][j / SCENE_LANES] = (uint16_t) code;
+    }
+}
+
+size_t Scene::encodedBytes() const {
+    return (size_t) count * SCENE_LANES * PIPELINE_CONVERSION_BYTES;
+}
+
+size_t Scene::encode(uint8_t *dest, size_t capacity) {
+    size_t total = encodedBytes();
+    if (capacity < total) {
+        return 0;
+    }
+    uint16_t *lanes[SCENE_LANES];
+    for (int i = 0; i < SCENE_LANES; i++) {
+        lanes[i] = scratch[i].data();
+    }
+    render(lanes);
+    return encodeConversions(lanes, count, dest, capacity);
+}
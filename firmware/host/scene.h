@@ -0,0 +1,138 @@
+#ifndef RADAR_SCENE_H
+#define RADAR_SCENE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "parameters.h"
+
+#define SCENE_LANES 4
+// Mid scale of the 12-bit ADC, where the IF amplifiers bias the signal
+#define SCENE_BIAS 2048.0
+#define SCENE_FULL_SCALE 4095
+#define SCENE_SPEED_OF_LIGHT 299792458.0
+// Targets closer than this are held here, the free space loss diverges at zero range
+#define SCENE_MIN_RANGE 0.05
+
+// A point reflector, moving radially at a constant velocity
+typedef struct Target {
+    // meters from the antennas at the start of the simulation
+    double range;
+    // meters per second, positive moves away
+    double velocity;
+    // radar cross section in square meters
+    double rcs;
+    // degrees from boresight in the plane of the two receivers, positive toward the second receiver
+    double azimuth;
+} Target;
+
+// A tone in the displacement of the radar toward the scene, the mount vibrating
+typedef struct SceneTone {
+    // meters peak
+    double amplitude;
+    // Hz
+    double frequency;
+    // radians at the start of the simulation
+    double phase;
+} SceneTone;
+
+// The K-LC7 front end: VCO tuning, the two receive antennas and the IF gain
+typedef struct SceneRadar {
+    // Hz transmitted at DAC code zero
+    double base = 24.0e9;
+    // Hz the VCO sweeps across the full scale of the DAC
+    double sweep = 250.0e6;
+    // spacing of the two receive antennas in wavelengths
+    double spacing = 0.5;
+    // IF amplitude in ADC codes of a 1 m^2 reflector at 1 m, falling with the square of the range
+    double gain = 400.0;
+} SceneRadar;
+
+typedef struct SceneDescription {
+    std::vector<Target> targets;
+    // rms of the white noise at the ADC input in codes
+    double noise = 2.0;
+    // effective resolution of the ADC, the 12-bit codes are rounded to this many bits
+    int32_t bits = 12;
+    // DC offset of each lane from mid scale in codes: I1, Q1, Q2, I2
+    double offset[SCENE_LANES] = {0.0, 0.0, 0.0, 0.0};
+    SceneRadar radar{};
+    // Vibration of the mount along the boresight, bringing every reflector closer by its projection on the arrival
+    std::vector<SceneTone> vibration;
+} SceneDescription;
+
+// Parse a target from "range,velocity,rcs,azimuth", trailing fields may be left out
+bool parseTarget(const char *text, Target *target);
+
+// Parse a tone from "micrometers,hertz,degrees", the phase may be left out
+bool parseTone(const char *text, SceneTone *tone);
+
+// Meters the mount has moved toward the scene at time seconds into the simulation
+double sceneDisplacement(const SceneDescription &description, double time);
+
+// Supplies the conversions of one chirp after another, as the continuous ADC delivers them
+class ChirpSource {
+public:
+
+    virtual ~ChirpSource() = default;
+
+    // Samples per lane of each chirp, the frame size the acquisition task captures
+    virtual int samples() const = 0;
+
+    // Write the next chirp as the TYPE2 conversion words the dma delivers, in scan order. Returns the bytes written or
+    // zero if dest is too small.
+    virtual size_t encode(uint8_t *dest, size_t capacity) = 0;
+
+    // Bytes encode writes for each chirp
+    virtual size_t encodedBytes() const = 0;
+
+};
+
+// Scene synthesizes the IF lanes the ADC converts during each chirp of the firmware's chirp train. The VCO follows the
+// DAC code table the firmware builds for the chirp, stepping at the same interval and resting at the bottom of the
+// band for the rest of the period. Each reflector mixes down to cos(2 pi f(t) tau(t)) on the I lanes and the sine on
+// the Q lanes, delayed by the round trip tau(t) of its current range, and reaches the second receiver with the
+// phase its azimuth adds across the antenna spacing. The four lanes are scanned one after another, so each is
+// sampled a quarter of the sample period after the previous one.
+//
+// Every chirp is rendered from its own noise stream derived from the seed and its index, so any chirp can be rendered
+// again alone and a run reproduces exactly.
+class Scene final : public ChirpSource {
+public:
+
+    Scene(const Chirp &chirp, const Sampling &sampling, const SceneDescription &description, uint32_t seed);
+
+    int samples() const override;
+
+    // Index of the chirp the next render produces
+    uint64_t chirp() const;
+
+    void seek(uint64_t chirp);
+
+    // Render the next chirp into four lanes of samples() codes: I1, Q1, Q2, I2
+    void render(uint16_t **lanes);
+
+    size_t encode(uint8_t *dest, size_t capacity) override;
+
+    size_t encodedBytes() const override;
+
+private:
+
+    Chirp chirpConfig;
+    Sampling sampling;
+    SceneDescription description;
+    uint32_t seed;
+    uint64_t next = 0;
+    int count;
+    // Transmit frequency at every conversion of a chirp, in scan order
+    std::vector<double> frequency;
+    // Time of every conversion since the chirp start
+    std::vector<double> offsets;
+    // Level of every conversion of the chirp being rendered
+    std::vector<double> level;
+    std::vector<uint16_t> scratch[SCENE_LANES];
+
+};
+
+
+#endif //RADAR_SCENE_H
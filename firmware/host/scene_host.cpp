@@ -0,0 +1,209 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "pipeline.h"
+#include "scene.h"
+#include "capture_file.h"
+
+// Renders a scene for a span of radar time and reports how many seconds of data it generates per second, optionally
+// writing the frames in the format pipeline_host writes them or as a capture replay_host can serve.
+
+typedef struct Options {
+    double seconds = 60.0;
+    uint32_t seed = 1;
+    // Render through the TYPE2 dma encoding and decode it back, as the capture path sees the scene
+    bool encode = false;
+    const char *output = nullptr;
+    const char *capture = nullptr;
+    SceneDescription scene{};
+    Chirp chirp{};
+    Sampling sampling{};
+} Options;
+
+static void usage(const char *name) {
+    printf("Usage: %s [--seconds S] [--prf us] [--duration us] [--steps N] [--resolution codes] [--frequency Hz]\n"
+           "       [--target range,velocity,rcs,azimuth]... [--vibration micrometers,hertz,degrees]...\n"
+           "       [--noise codes] [--bits N] [--offset i1,q1,q2,i2] [--spacing wavelengths] [--gain codes]\n"
+           "       [--seed N] [--encode] [--output file] [--capture file]\n", name);
+}
+
+static bool parseOptions(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (strcmp(arg, "--encode") == 0) {
+            options->encode = true;
+        } else if (value == nullptr) {
+            return false;
+        } else if (strcmp(arg, "--seconds") == 0) {
+            options->seconds = atof(value);
+            i++;
+        } else if (strcmp(arg, "--prf") == 0) {
+            options->chirp.prf = atoi(value);
+            options->chirp.duration = options->chirp.prf;
+            i++;
+        } else if (strcmp(arg, "--duration") == 0) {
+            options->chirp.duration = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--steps") == 0) {
+            options->chirp.steps = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--resolution") == 0) {
+            options->chirp.resolution = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--frequency") == 0) {
+            options->sampling.frequency = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--target") == 0) {
+            Target target{};
+            if (!parseTarget(value, &target)) {
+                return false;
+            }
+            options->scene.targets.push_back(target);
+            i++;
+        } else if (strcmp(arg, "--vibration") == 0) {
+            SceneTone tone{};
+            if (!parseTone(value, &tone)) {
+                return false;
+            }
+            options->scene.vibration.push_back(tone);
+            i++;
+        } else if (strcmp(arg, "--noise") == 0) {
+            options->scene.noise = atof(value);
+            i++;
+        } else if (strcmp(arg, "--bits") == 0) {
+            options->scene.bits = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--offset") == 0) {
+            double *offset = options->scene.offset;
+            if (sscanf(value, "%lf,%lf,%lf,%lf", &offset[0], &offset[1], &offset[2], &offset[3]) != 4) {
+                return false;
+            }
+            i++;
+        } else if (strcmp(arg, "--spacing") == 0) {
+            options->scene.radar.spacing = atof(value);
+            i++;
+        } else if (strcmp(arg, "--gain") == 0) {
+            options->scene.radar.gain = atof(value);
+            i++;
+        } else if (strcmp(arg, "--seed") == 0) {
+            options->seed = (uint32_t) strtoul(value, nullptr, 10);
+            i++;
+        } else if (strcmp(arg, "--output") == 0) {
+            options->output = value;
+            i++;
+        } else if (strcmp(arg, "--capture") == 0) {
+            options->capture = value;
+            i++;
+        } else {
+            return false;
+        }
+    }
+    return options->seconds > 0 && options->chirp.prf > 0 && options->chirp.duration <= options->chirp.prf &&
+           options->sampling.frequency > 0;
+}
+
+int main(int argc, char **argv) {
+    Options options{};
+    if (!parseOptions(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (options.scene.targets.empty()) {
+        options.scene.targets.push_back({3.0, 0.0, 1.0, 0.0});
+        options.scene.targets.push_back({7.5, 1.2, 0.5, 20.0});
+    }
+
+    FILE *sink = nullptr;
+    if (options.output != nullptr) {
+        sink = fopen(options.output, "wb");
+        if (sink == nullptr) {
+            printf("Failed to open %s\n", options.output);
+            return 1;
+        }
+    }
+
+    // Open the capture with the part of the metadata document a replay needs
+    CaptureWriter capture;
+    int64_t created = 0;
+    if (options.capture != nullptr) {
+        if (!capture.open(options.capture, "scene_host", created)) {
+            printf("Failed to open %s\n", options.capture);
+            return 1;
+        }
+        char metadata[512];
+        int length = snprintf(metadata, sizeof(metadata),
+                              "{\"name\":\"scene\",\"chirp\":{\"prf\":%d,\"duration\":%d,\"steps\":%d,"
+                              "\"resolution\":%d},\"sampling\":{\"frequency\":%d}}", options.chirp.prf,
+                              options.chirp.duration, options.chirp.steps, options.chirp.resolution,
+                              options.sampling.frequency);
+        capture.append(CAPTURE_METADATA, created, (const uint8_t *) metadata, (size_t) length);
+    }
+
+    Scene scene(options.chirp, options.sampling, options.scene, options.seed);
+    int samples = scene.samples();
+    auto chirps = (uint64_t) (options.seconds * 1e6 / options.chirp.prf);
+
+    std::vector<uint16_t> storage((size_t) samples * PIPELINE_LANES);
+    uint16_t *lanes[PIPELINE_LANES];
+    for (int i = 0; i < PIPELINE_LANES; i++) {
+        lanes[i] = &storage[(size_t) i * samples];
+    }
+    std::vector<uint8_t> stream(scene.encodedBytes());
+    std::vector<uint8_t> frame(frameBytes(samples));
+
+    auto began = std::chrono::steady_clock::now();
+    for (uint64_t c = 0; c < chirps; c++) {
+        if (options.encode) {
+            scene.encode(stream.data(), stream.size());
+            int offsets[PIPELINE_LANES] = {0, 0, 0, 0};
+            decodeConversions(stream.data(), stream.size(), lanes, offsets, samples);
+        } else {
+            scene.render(lanes);
+        }
+        if (sink != nullptr || options.capture != nullptr) {
+            int64_t chirpStart = (int64_t) c * options.chirp.prf;
+            SampleData sd = {
+                    .data = lanes,
+                    .size = samples,
+                    .start = chirpStart,
+                    .stop = chirpStart + options.chirp.prf,
+                    .chirpStart = chirpStart,
+                    .chirpStop = chirpStart + options.chirp.duration,
+                    .skew = 0,
+                    .epoch = 0,
+                    .configuration = 1,
+                    .enqueued = 0,
+            };
+            size_t length = serializeFrame(sd, frame.data(), frame.size());
+            // Frames are recorded as they would arrive, at the end of their chirp
+            if (options.capture != nullptr && !capture.append(CAPTURE_FRAME, created + sd.stop, frame.data(), length)) {
+                printf("Failed to write %s\n", options.capture);
+                return 1;
+            }
+            uint32_t prefix = (uint32_t) length;
+            if (sink != nullptr &&
+                (fwrite(&prefix, sizeof(prefix), 1, sink) != 1 || fwrite(frame.data(), 1, length, sink) != length)) {
+                printf("Failed to write %s\n", options.output);
+                fclose(sink);
+                return 1;
+            }
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+
+    if (sink != nullptr) {
+        fclose(sink);
+    }
+    if (options.capture != nullptr && !capture.close()) {
+        printf("Failed to write %s\n", options.capture);
+        return 1;
+    }
+
+    double simulated = (double) chirps * options.chirp.prf * 1e-6;
+    printf("%llu chirps of %d samples per lane, %.1f s of data in %.3f s, %.1f s of data per second\n",
+           (unsigned long long) chirps, samples, simulated, elapsed, elapsed > 0 ? simulated / elapsed : 0);
+    return 0;
+}
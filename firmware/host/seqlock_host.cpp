@@ -0,0 +1,144 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <sched.h>
+#include "check.h"
+#include "seqlock.h"
+
+// One writer publishes values as fast as it can while readers load them, every word of a value carries the generation
+// it is published as, so a snapshot copied while a write was in progress or paired with the wrong generation is
+// caught. With --core every thread runs on one CPU, so readers preempt the writer in the middle of its stores the way
+// a higher priority task does on the module and have to back off for it to finish. Exits with 1 if any reader sees a
+// torn snapshot, a generation that goes backwards, or makes no progress.
+
+// Large enough that a copy spans many cache lines
+#define SEQLOCK_WORDS 64
+
+typedef struct Value {
+    uint32_t words[SEQLOCK_WORDS];
+} Value;
+
+typedef struct Options {
+    double seconds = 5.0;
+    int readers = 4;
+    // Pin every thread to this CPU, -1 leaves them free
+    int core = -1;
+} Options;
+
+static void usage(const char *name) {
+    printf("Usage: %s [--seconds S] [--readers N] [--core cpu]\n", name);
+}
+
+static bool parseOptions(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            return false;
+        } else if (strcmp(arg, "--seconds") == 0) {
+            options->seconds = atof(value);
+            i++;
+        } else if (strcmp(arg, "--readers") == 0) {
+            options->readers = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--core") == 0) {
+            options->core = atoi(value);
+            i++;
+        } else {
+            return false;
+        }
+    }
+    return options->readers > 0;
+}
+
+static void pin(int core) {
+    if (core < 0) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+typedef struct ReaderStats {
+    uint64_t loads = 0;
+    uint64_t torn = 0;
+    uint64_t backwards = 0;
+    uint32_t last = 0;
+} ReaderStats;
+
+int main(int argc, char **argv) {
+    Options options{};
+    if (!parseOptions(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    auto lock = new Seqlock<Value>();
+    std::atomic<bool> running{true};
+    std::atomic<uint32_t> written{0};
+    std::vector<ReaderStats> stats((size_t) options.readers);
+
+    std::thread writer([&]() {
+        pin(options.core);
+        Value next{};
+        uint32_t generation = 0;
+        while (running.load(std::memory_order_relaxed)) {
+            // The value published as generation g carries g in every word
+            generation++;
+            for (uint32_t &word: next.words) {
+                word = generation;
+            }
+            lock->store(next);
+        }
+        written = generation;
+    });
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < options.readers; r++) {
+        readers.emplace_back([&, r]() {
+            pin(options.core);
+            ReaderStats &mine = stats[(size_t) r];
+            Value snapshot{};
+            while (running.load(std::memory_order_relaxed)) {
+                uint32_t generation = lock->load(snapshot);
+                mine.loads++;
+                for (uint32_t word: snapshot.words) {
+                    if (word != generation) {
+                        mine.torn++;
+                        break;
+                    }
+                }
+                if (generation < mine.last) {
+                    mine.backwards++;
+                }
+                mine.last = generation;
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+    running = false;
+    writer.join();
+    for (auto &reader: readers) {
+        reader.join();
+    }
+
+    uint64_t loads = 0, torn = 0, backwards = 0, stalled = 0;
+    for (const auto &mine: stats) {
+        loads += mine.loads;
+        torn += mine.torn;
+        backwards += mine.backwards;
+        stalled += mine.loads == 0 ? 1 : 0;
+    }
+    printf("%u values written, %llu loads by %d readers%s: %llu torn, %llu out of order, %llu readers stalled\n",
+           written.load(), (unsigned long long) loads, options.readers, options.core >= 0 ? " on one core" : "",
+           (unsigned long long) torn, (unsigned long long) backwards, (unsigned long long) stalled);
+    delete lock;
+    return check("readers", torn + backwards + stalled == 0 && written > 0);
+}
@@ -0,0 +1,241 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "check.h"
+#include "encoding.h"
+#include "hal_sim.h"
+#include "settings_store.h"
+
+// Runs the settings persistence against storage held in memory. The writer task's debounce is driven with pushes in
+// bursts, and every burst has to come out as one write of the settings of its last push, one quiet period after it.
+// Saving settings identical to the stored ones must not write, and settings stored under the individual keys of older
+// firmware, or behind a corrupt blob, have to load and migrate to the blob. Settings out of range have to be refused
+// before they are published. Exits with 1 if any check fails.
+
+// Microseconds, as SETTINGS_WRITE_DEBOUNCE_MS
+#define HOST_DEBOUNCE_US 2000000
+
+typedef struct Options {
+    int pushes = 5000;
+    uint32_t seed = 1;
+} Options;
+
+static void usage(const char *name) {
+    printf("Usage: %s [--pushes N] [--seed N]\n", name);
+}
+
+static bool parseOptions(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            return false;
+        } else if (strcmp(arg, "--pushes") == 0) {
+            options->pushes = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--seed") == 0) {
+            options->seed = (uint32_t) strtoul(value, nullptr, 10);
+            i++;
+        } else {
+            return false;
+        }
+    }
+    return options->pushes > 0;
+}
+
+static bool stored(SimStorage &storage, System *dest) {
+    auto found = storage.blobs.find(SETTINGS_KEY_SYSTEM);
+    return found != storage.blobs.end() && decodeSystem(found->second.data(), found->second.size(), dest);
+}
+
+// Wake the writer as the task does, when the debounce is due or at the next push, whichever comes first
+typedef struct Writer {
+    Debounce debounce{HOST_DEBOUNCE_US};
+    int64_t now = 0;
+    uint64_t early = 0;
+} Writer;
+
+static bool runUntil(Writer &writer, SettingsStore &store, const System &system, int64_t until) {
+    int64_t remaining = writer.debounce.remaining(writer.now);
+    if (remaining < 0 || writer.now + remaining > until) {
+        writer.now = until;
+        return false;
+    }
+    // Nothing may be due a tick before the period is up
+    writer.early += writer.debounce.due(writer.now + remaining - 1) ? 1 : 0;
+    writer.now += remaining;
+    if (!writer.debounce.due(writer.now)) {
+        return false;
+    }
+    store.save(system, Linearization{});
+    return true;
+}
+
+static int checkDebounce(const Options &options) {
+    SimStorage storage;
+    SettingsStore store(storage);
+    Writer writer;
+    std::mt19937 random(options.seed);
+    System system{};
+    int64_t last = 0;
+    uint64_t bursts = 0, writes = 0, late = 0, stale = 0;
+    for (int n = 0; n < options.pushes; n++) {
+        // Mostly pushes well inside the quiet period, now and then a pause past it
+        int64_t gap = random() % 8 == 0 ? HOST_DEBOUNCE_US + (int64_t) (random() % 3000000) :
+                      (int64_t) (random() % (HOST_DEBOUNCE_US - 1));
+        int64_t at = last + gap;
+        if (runUntil(writer, store, system, at)) {
+            writes++;
+            System written{};
+            late += writer.now != last + HOST_DEBOUNCE_US ? 1 : 0;
+            stale += !stored(storage, &written) || written.chirp.prf != system.chirp.prf ? 1 : 0;
+        }
+        bursts += n == 0 || gap >= HOST_DEBOUNCE_US ? 1 : 0;
+        writer.now = at;
+        last = at;
+        // Every push carries a change
+        system.chirp.prf = 5000 + n;
+        writer.debounce.push(at);
+    }
+    // The last burst is written once the pushes stop
+    if (runUntil(writer, store, system, last + 10 * HOST_DEBOUNCE_US)) {
+        writes++;
+    }
+    printf("Debounce: %d pushes in %llu bursts, %llu writes, %llu commits, %llu early, %llu late, %llu stale\n",
+           options.pushes, (unsigned long long) bursts, (unsigned long long) writes,
+           (unsigned long long) storage.commits, (unsigned long long) writer.early, (unsigned long long) late,
+           (unsigned long long) stale);
+    int wrong = CHECK(writes == bursts && storage.commits == writes);
+    wrong += CHECK(writer.early == 0 && late == 0 && stale == 0);
+    return wrong;
+}
+
+static int checkUnchanged() {
+    SimStorage storage;
+    SettingsStore store(storage);
+    System system{};
+    Linearization curve{};
+    int wrong = 0;
+
+    // The first save writes the settings, the curve is left out until one has been set
+    wrong += CHECK(store.save(system, curve) == 1 && storage.writes == 1);
+    wrong += CHECK(store.save(system, curve) == 0 && storage.writes == 1);
+
+    curve.valid = 1;
+    curve.coefficients[1] = 1.0f;
+    wrong += CHECK(store.save(system, curve) == 1 && storage.writes == 2);
+    wrong += CHECK(store.save(system, curve) == 0 && storage.writes == 2);
+
+    // A change undone before the write leaves nothing to write
+    system.chirp.prf = 20000;
+    system.chirp.prf = Chirp{}.prf;
+    wrong += CHECK(store.save(system, curve) == 0 && storage.writes == 2);
+
+    system.gyro = 0;
+    wrong += CHECK(store.save(system, curve) == 1 && storage.writes == 3 && storage.commits == 3);
+
+    printf("Unchanged: %llu writes for 6 saves, %d wrong\n", (unsigned long long) storage.writes, wrong);
+    return wrong;
+}
+
+static bool same(const System &a, const System &b) {
+    return memcmp(&a.chirp, &b.chirp, sizeof(Chirp)) == 0 && memcmp(&a.sampling, &b.sampling, sizeof(Sampling)) == 0 &&
+           a.audible == b.audible && a.enabled == b.enabled && a.gyro == b.gyro;
+}
+
+static int checkMigration() {
+    int wrong = 0;
+
+    // Nothing stored at all, the defaults the keys fall back to
+    SimStorage empty;
+    SettingsStore fresh(empty);
+    System defaults{};
+    wrong += check("defaults", !fresh.loadSystem(&defaults) && defaults.chirp.prf == 12500 &&
+                               defaults.sampling.frequency == 20480 && defaults.gyro == 1);
+
+    SimStorage storage;
+    storage.ints = {
+            {"audible",     1},
+            {"gyro",        0},
+            {"enable",      1},
+            {"prf",         20000},
+            {"duration",    15000},
+            {"steps",       150},
+            {"padding",     5},
+            {"resolution",  100},
+            {"frequency",   40000},
+            {"samples",     2},
+            {"attenuation", 3},
+    };
+    SettingsStore store(storage);
+    System legacy{};
+    wrong += check("legacy keys", !store.loadSystem(&legacy) && legacy.audible == 1 && legacy.gyro == 0 &&
+                                  legacy.chirp.prf == 20000 && legacy.chirp.duration == 15000 &&
+                                  legacy.chirp.steps == 150 && legacy.chirp.padding == 5 &&
+                                  legacy.chirp.resolution == 100 && legacy.sampling.frequency == 40000 &&
+                                  legacy.sampling.samples == 2 && legacy.sampling.attenuation == 3);
+
+    // The next save migrates them, after which the blob is read
+    wrong += CHECK(store.save(legacy, Linearization{}) == 1);
+    System migrated{};
+    wrong += CHECK(store.loadSystem(&migrated) && same(migrated, legacy));
+
+    // A corrupt blob is ignored for the keys
+    storage.blobs[SETTINGS_KEY_SYSTEM][ENCODING_SYSTEM_HEADER_SIZE] ^= 0x01;
+    System recovered{};
+    wrong += CHECK(!store.loadSystem(&recovered) && same(recovered, legacy));
+
+    // A corrupt curve is not loaded
+    Linearization curve{};
+    curve.valid = 1;
+    curve.coefficients[1] = 1.0f;
+    store.save(legacy, curve);
+    Linearization loaded{};
+    wrong += CHECK(store.loadLinearization(&loaded) && loaded.coefficients[1] == 1.0f);
+    storage.blobs[SETTINGS_KEY_LINEARIZATION].back() ^= 0x01;
+    wrong += CHECK(!store.loadLinearization(&loaded));
+
+    printf("Migration: %d wrong\n", wrong);
+    return wrong;
+}
+
+static int checkValidation() {
+    int wrong = 0;
+    const char *reason = nullptr;
+    wrong += CHECK(validateSystem(System{}, &reason));
+
+    // Each setting out of its range is refused with a reason
+    System bad[8];
+    bad[0].chirp.steps = 0;
+    bad[1].chirp.prf = bad[1].chirp.duration - 1;
+    bad[2].chirp.padding = (bad[2].chirp.steps + 1) / 2;
+    bad[3].sampling.frequency = SETTINGS_ADC_MAX_RATE / 4 + 1;
+    bad[4].sampling.attenuation = SETTINGS_MAX_ATTENUATION + 1;
+    bad[5].schedule.slots = 4;
+    bad[5].schedule.slot = 4;
+    bad[6].chirp.shape = CHIRP_STEPPED + 1;
+    bad[7].burst.chirps = -1;
+    int refused = 0;
+    for (auto &system: bad) {
+        reason = nullptr;
+        refused += !validateSystem(system, &reason) && reason != nullptr ? 1 : 0;
+    }
+    wrong += CHECK(refused == 8);
+    printf("Validation: %d of 8 out of range refused, %d wrong\n", refused, wrong);
+    return wrong;
+}
+
+int main(int argc, char **argv) {
+    Options options{};
+    if (!parseOptions(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+    int wrong = checkDebounce(options);
+    wrong += checkUnchanged();
+    wrong += checkMigration();
+    wrong += checkValidation();
+    return wrong > 0 ? 1 : 0;
+}
@@ -0,0 +1,205 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "check.h"
+#include "timesync.h"
+
+// Runs a master and followers over loopback UDP, each on a clock of its own that starts at a different time and runs
+// at a different rate. The followers discipline their shared clocks to the master as the modules do, and once they
+// have had time to converge every shared clock has to read the master's to within the tolerance. Every node then
+// schedules its next chirp start in its own slot of the period, and the starts, taken back to the one clock all the
+// simulated clocks derive from, have to be spaced a slot apart. Exits with 1 if a follower does not lock, does not
+// converge or starts outside its slot.
+
+typedef struct Options {
+    double seconds = 10;
+    int followers = 2;
+    uint16_t port = 15120;
+    // Microseconds the shared clocks and slot starts may be off by
+    int64_t tolerance = 500;
+    int32_t prf = 12500;
+} Options;
+
+static void usage(const char *name) {
+    printf("Usage: %s [--seconds S] [--followers N] [--port N] [--tolerance us] [--prf us]\n", name);
+}
+
+static bool parseOptions(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            return false;
+        } else if (strcmp(arg, "--seconds") == 0) {
+            options->seconds = atof(value);
+            i++;
+        } else if (strcmp(arg, "--followers") == 0) {
+            options->followers = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--port") == 0) {
+            options->port = (uint16_t) atoi(value);
+            i++;
+        } else if (strcmp(arg, "--tolerance") == 0) {
+            options->tolerance = atoll(value);
+            i++;
+        } else if (strcmp(arg, "--prf") == 0) {
+            options->prf = atoi(value);
+            i++;
+        } else {
+            return false;
+        }
+    }
+    return options->followers > 0 && options->prf > 0 && options->seconds > 0;
+}
+
+// Microseconds since the run started, on the clock every simulated clock derives from
+static std::chrono::steady_clock::time_point origin;
+
+static int64_t trueTime() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+// A node's clock, counting from its own boot at its own rate
+typedef struct SimClock {
+    int64_t offset;
+    // Parts per million fast
+    double ppm;
+} SimClock;
+
+static int64_t readClock(const SimClock &clock, int64_t at) {
+    return clock.offset + at + (int64_t) ((double) at * clock.ppm / 1e6);
+}
+
+static int64_t clockAt(const SimClock &clock, int64_t local) {
+    return (int64_t) ((double) (local - clock.offset) / (1.0 + clock.ppm / 1e6));
+}
+
+static int64_t simClock(void *ctx) {
+    return readClock(*(const SimClock *) ctx, trueTime());
+}
+
+typedef struct Node {
+    SimClock clock;
+    std::unique_ptr<SyncNode> sync;
+} Node;
+
+// Messages and slots that are known without any exchange
+static int checkMessages() {
+    int wrong = 0;
+    SyncMessage message = {
+            .type = SYNC_RESPONSE,
+            .sequence = 0xA1B2C3D4,
+            .t1 = -5,
+            .t2 = 0x0102030405060708,
+            .t3 = 1,
+    };
+    uint8_t packet[SYNC_MESSAGE_SIZE];
+    SyncMessage decoded{};
+    wrong += check("message round trip", encodeSyncMessage(message, packet, sizeof(packet)) == SYNC_MESSAGE_SIZE &&
+                                         decodeSyncMessage(packet, sizeof(packet), &decoded) &&
+                                         decoded.type == message.type && decoded.sequence == message.sequence &&
+                                         decoded.t1 == message.t1 && decoded.t2 == message.t2 &&
+                                         decoded.t3 == message.t3);
+    wrong += CHECK(!decodeSyncMessage(packet, sizeof(packet) - 1, &decoded));
+    packet[0] ^= 0xFF;
+    wrong += CHECK(!decodeSyncMessage(packet, sizeof(packet), &decoded));
+
+    // Slot 1 of 4 of a 12.5 ms period starts 3125 us into every period
+    wrong += CHECK(nextSlotStart(0, 12500, 1, 4, 0) == 3125);
+    wrong += CHECK(nextSlotStart(3126, 12500, 1, 4, 0) == 15625);
+    wrong += CHECK(nextSlotStart(3125, 12500, 1, 4, 100) == 3225);
+    wrong += CHECK(slotError(15625 + 40, 12500, 1, 4, 0) == 40);
+    wrong += CHECK(slotError(15625 - 40, 12500, 1, 4, 0) == -40);
+    wrong += CHECK(slotError(15625 + 6250, 12500, 1, 4, 0) == -6250);
+    printf("Messages and slots: %d wrong\n", wrong);
+    return wrong;
+}
+
+int main(int argc, char **argv) {
+    Options options{};
+    if (!parseOptions(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+    int wrong = checkMessages();
+
+    // Every node booted at a different time, with crystals up to 80 ppm apart
+    origin = std::chrono::steady_clock::now();
+    std::vector<Node> nodes((size_t) options.followers + 1);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        nodes[i].clock = {
+                .offset = i == 0 ? 7000000 : (int64_t) i * 1500000 + 123,
+                .ppm = i == 0 ? 0 : (i % 2 == 0 ? 40.0 : -40.0) * (double) ((i + 1) / 2),
+        };
+        nodes[i].sync.reset(new SyncNode(simClock, &nodes[i].clock));
+        bool opened = i == 0 ? nodes[i].sync->open(SYNC_MASTER, options.port, nullptr, 0) :
+                      nodes[i].sync->open(SYNC_FOLLOWER, (uint16_t) (options.port + i), "127.0.0.1", options.port);
+        if (!opened) {
+            printf("Node %zu could not open port %u\n", i, (unsigned) (options.port + i));
+            return 1;
+        }
+    }
+
+    std::atomic<bool> running{true};
+    std::vector<std::thread> threads;
+    for (auto &node: nodes) {
+        threads.emplace_back([&running, &node]() {
+            while (running) {
+                node.sync->poll(5);
+            }
+        });
+    }
+
+    // The error of every follower's shared clock over the last half of the run, once it has had time to converge
+    auto slots = (int32_t) nodes.size();
+    std::vector<int64_t> worst(nodes.size(), 0);
+    auto end = (int64_t) (options.seconds * 1e6);
+    while (trueTime() < end) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        int64_t at = trueTime();
+        if (at < end / 2) {
+            continue;
+        }
+        int64_t master = readClock(nodes[0].clock, at);
+        for (size_t i = 1; i < nodes.size(); i++) {
+            ClockModel model = nodes[i].sync->model();
+            int64_t error = model.locked ? sharedTime(model, readClock(nodes[i].clock, at)) - master : INT64_MAX;
+            worst[i] = llabs(error) > worst[i] ? llabs(error) : worst[i];
+        }
+    }
+
+    // Each node takes its next start in its own slot, taken back to true time the starts are a slot apart
+    // A couple of periods ahead on the master clock, so every node lands in the same period
+    int64_t base = (readClock(nodes[0].clock, trueTime()) / options.prf + 2) * options.prf;
+    int64_t first = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        ClockModel model = nodes[i].sync->model();
+        int64_t slot = nextSlotStart(base, options.prf, (int32_t) i, slots, 0);
+        int64_t start = clockAt(nodes[i].clock, localTime(model, slot));
+        if (i == 0) {
+            first = start;
+        }
+        int64_t spacing = start - first;
+        int64_t expected = (int64_t) i * options.prf / slots;
+        bool right = model.locked && llabs(spacing - expected) <= options.tolerance &&
+                     (i == 0 || worst[i] <= options.tolerance);
+        printf("Node %zu (%+.0f ppm, slot %zu of %d): %s, shared clock off by at most %lld us, start %lld us after "
+               "slot 0 for %lld%s\n", i, nodes[i].clock.ppm, i, slots, i == 0 ? "master" : "follower",
+               (long long) worst[i], (long long) spacing, (long long) expected, right ? "" : "  WRONG");
+        wrong += right ? 0 : 1;
+    }
+
+    running = false;
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    for (auto &node: nodes) {
+        node.sync->close();
+    }
+    return wrong > 0 ? 1 : 0;
+}
@@ -0,0 +1,354 @@
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "imu.h"
+#include "pipeline.h"
+#include "scene.h"
+#include "vibration.h"
+
+// Renders a scene while the mount vibrates along the boresight, and takes the vibration back out of every frame with
+// the accelerometer as the firmware does. The accelerometer reads the acceleration of the same motion with noise,
+// quantized to its least significant bit, from an oscillator off its nominal rate. Its sets come out of the FIFO in
+// watermark batches timed through ImuFifoClock from an interrupt edge that arrives late by a random latency, read by a
+// task that gets to them later still, and each frame waits until the IMU covers it.
+//
+// The same scene rendered without the vibration, from the same noise, is the reference. Each frame is reduced to the
+// range bin of the strongest reflector, and the slow time series of that bin is windowed into a Doppler spectrum. A
+// still reflector on a vibrating mount spreads into sidebands at the vibration frequencies, the false slow movers the
+// compensation is there to remove. Reports the phase error of the raw and compensated frames against the reference and
+// the strongest sideband of each spectrum, and exits with 1 unless compensation takes the sidebands down by at least
+// 10 dB or to within 3 dB of the reference.
+
+typedef struct Options {
+    double seconds = 10.0;
+    uint32_t seed = 1;
+    SceneDescription scene{};
+    Chirp chirp{};
+    Sampling sampling{};
+    // rms accelerometer noise on every axis in g, 90 ug/sqrt(Hz) across the band at 416 Hz
+    double noise = 0.0013;
+    // Fraction the accelerometer's oscillator runs fast by
+    double drift = 0.008;
+    // Sample sets per watermark
+    int batch = 16;
+    // Longest interrupt latency after the watermark, and longest further delay before the task reads the FIFO, in
+    // microseconds
+    double latency = 50.0;
+    double delay = 5000.0;
+} Options;
+
+static void usage(const char *name) {
+    printf("Usage: %s [--seconds S] [--seed N] [--target range,velocity,rcs,azimuth]...\n"
+           "       [--vibration micrometers,hertz,degrees]... [--noise g] [--drift fraction] [--batch sets]\n"
+           "       [--latency us] [--delay us]\n", name);
+}
+
+static bool parseOptions(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            return false;
+        } else if (strcmp(arg, "--seconds") == 0) {
+            options->seconds = atof(value);
+            i++;
+        } else if (strcmp(arg, "--seed") == 0) {
+            options->seed = (uint32_t) strtoul(value, nullptr, 10);
+            i++;
+        } else if (strcmp(arg, "--target") == 0) {
+            Target target{};
+            if (!parseTarget(value, &target)) {
+                return false;
+            }
+            options->scene.targets.push_back(target);
+            i++;
+        } else if (strcmp(arg, "--vibration") == 0) {
+            SceneTone tone{};
+            if (!parseTone(value, &tone)) {
+                return false;
+            }
+            options->scene.vibration.push_back(tone);
+            i++;
+        } else if (strcmp(arg, "--noise") == 0) {
+            options->noise = atof(value);
+            i++;
+        } else if (strcmp(arg, "--drift") == 0) {
+            options->drift = atof(value);
+            i++;
+        } else if (strcmp(arg, "--batch") == 0) {
+            options->batch = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--latency") == 0) {
+            options->latency = atof(value);
+            i++;
+        } else if (strcmp(arg, "--delay") == 0) {
+            options->delay = atof(value);
+            i++;
+        } else {
+            return false;
+        }
+    }
+    return options->seconds > VIBRATION_SETTLE + 1.0 && options->batch > 0 &&
+           options->batch * IMU_FIFO_PATTERN < IMU_FIFO_WORDS && options->latency >= 0 && options->delay >= 0 &&
+           options->drift > -0.05 &&
+           options->drift < 0.05;
+}
+
+// The accelerometer in the LSM6DSM, x along the boresight and z up, streaming into its FIFO
+class Accelerometer {
+public:
+
+    Accelerometer(const Options &options, const SceneDescription &scene, ImuFifoClock &clock, Vibration &vibration)
+            : options(options), scene(scene), clock(clock), vibration(vibration), random(options.seed),
+              noise(0.0, options.noise), latency(0.0, options.latency), delay(0.0, options.delay) {
+        period = 1e6 / (IMU_RATE * (1.0 + options.drift));
+        // The first set lands somewhere within a period of the first chirp
+        first = std::uniform_real_distribution<double>(0.0, period)(random);
+    }
+
+    // Drain the next watermark batch, returns when the gyro task would have read it
+    double drain() {
+        uint32_t edgeSet = drained + options.batch - 1;
+        double edge = time(edgeSet) + latency(random);
+        // The task reads everything written by the time it gets to the FIFO
+        double read = edge + delay(random);
+        auto newest = (uint32_t) std::floor((read - first) / period);
+        newest = newest < edgeSet ? edgeSet : newest;
+        size_t count = newest - drained + 1;
+        times.resize(count);
+        clock.stamp((int64_t) std::llround(edge), newest - edgeSet, count, times.data());
+        for (size_t i = 0; i < count; i++) {
+            float accel[3];
+            sample(drained + (uint32_t) i, accel);
+            vibration.add(times[i], accel);
+            // How far the clock put the set from when it was taken, once it has had as long as the filters to lock on
+            double error = (double) times[i] - time(drained + (uint32_t) i);
+            if (time(drained + (uint32_t) i) > VIBRATION_SETTLE * 1e6 && std::fabs(error) > worst) {
+                worst = std::fabs(error);
+            }
+        }
+        drained = newest + 1;
+        return read;
+    }
+
+    // Worst timestamp error in microseconds after the filters settle
+    double worst = 0;
+
+private:
+
+    const Options &options;
+    const SceneDescription &scene;
+    ImuFifoClock &clock;
+    Vibration &vibration;
+    std::mt19937 random;
+    std::normal_distribution<double> noise;
+    std::uniform_real_distribution<double> latency;
+    std::uniform_real_distribution<double> delay;
+    double period;
+    double first;
+    uint32_t drained = 0;
+    std::vector<int64_t> times;
+
+    // Microseconds set was taken at
+    double time(uint32_t set) const {
+        return first + (double) set * period;
+    }
+
+    // The acceleration of the vibration is the second derivative of its displacement
+    void sample(uint32_t set, float *accel) {
+        double t = time(set) * 1e-6;
+        double a = 0;
+        for (const SceneTone &tone: scene.vibration) {
+            double w = 2.0 * M_PI * tone.frequency;
+            a -= tone.amplitude * w * w * std::sin(w * t + tone.phase);
+        }
+        double g[3] = {a / VIBRATION_GRAVITY, 0.0, 1.0};
+        for (int axis = 0; axis < 3; axis++) {
+            double reading = std::round((g[axis] + noise(random)) / IMU_ACCEL_G);
+            accel[axis] = (float) reading * IMU_ACCEL_G;
+        }
+    }
+
+};
+
+// Complex amplitude of the first receiver at a range bin, Hann windowed
+static std::complex<double> rangeBin(uint16_t **lanes, int samples, int bin) {
+    std::complex<double> sum = 0;
+    for (int n = 0; n < samples; n++) {
+        double w = 0.5 - 0.5 * std::cos(2.0 * M_PI * n / samples);
+        std::complex<double> x((double) lanes[0][n] - SCENE_BIAS, (double) lanes[1][n] - SCENE_BIAS);
+        sum += w * x * std::polar(1.0, -2.0 * M_PI * bin * n / samples);
+    }
+    return sum;
+}
+
+// Doppler spectrum of the slow time series of a range bin, Hann windowed, each bin in dB against zero Doppler
+static std::vector<double> doppler(const std::vector<std::complex<double>> &series) {
+    size_t count = series.size();
+    std::vector<std::complex<double>> windowed(count);
+    for (size_t k = 0; k < count; k++) {
+        windowed[k] = series[k] * (0.5 - 0.5 * std::cos(2.0 * M_PI * (double) k / (double) count));
+    }
+    std::vector<double> levels(count);
+    for (size_t bin = 0; bin < count; bin++) {
+        std::complex<double> sum = 0;
+        for (size_t k = 0; k < count; k++) {
+            sum += windowed[k] * std::polar(1.0, -2.0 * M_PI * (double) ((bin * k) % count) / (double) count);
+        }
+        levels[bin] = 10.0 * std::log10(std::norm(sum));
+    }
+    for (size_t bin = count; bin-- > 0;) {
+        levels[bin] -= levels[0];
+    }
+    return levels;
+}
+
+// Hz of a Doppler bin
+static double binFrequency(size_t bin, size_t count, double rate) {
+    double f = (double) bin * rate / (double) count;
+    return f > rate / 2 ? f - rate : f;
+}
+
+// The strongest bin more than guard Hz from zero Doppler, closer in is the reflector itself
+static size_t strongest(const std::vector<double> &levels, double rate, double guard) {
+    size_t found = 0;
+    for (size_t bin = 1; bin < levels.size(); bin++) {
+        if (std::fabs(binFrequency(bin, levels.size(), rate)) > guard && (found == 0 || levels[bin] > levels[found])) {
+            found = bin;
+        }
+    }
+    return found;
+}
+
+int main(int argc, char **argv) {
+    Options options{};
+    if (!parseOptions(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (options.scene.targets.empty()) {
+        options.scene.targets.push_back({4.0, 0.0, 1.0, 0.0});
+    }
+    if (options.scene.vibration.empty()) {
+        // A fan on the wall behind the mount, and its second harmonic
+        options.scene.vibration.push_back({150e-6, 12.0, 0.0});
+        options.scene.vibration.push_back({60e-6, 24.0, 1.0});
+    }
+
+    SceneDescription still = options.scene;
+    still.vibration.clear();
+    Scene reference(options.chirp, options.sampling, still, options.seed);
+    Scene scene(options.chirp, options.sampling, options.scene, options.seed);
+    int samples = scene.samples();
+
+    // The firmware takes the wavelength at the bottom of the band, the axis is x
+    float axis[3] = {1.0f, 0.0f, 0.0f};
+    auto wavelength = (float) (SCENE_SPEED_OF_LIGHT / options.scene.radar.base);
+    Vibration vibration(IMU_RATE, axis, wavelength);
+    ImuFifoClock clock(IMU_RATE);
+    Accelerometer accelerometer(options, options.scene, clock, vibration);
+
+    std::vector<uint16_t> storage[2];
+    uint16_t *lanes[2][PIPELINE_LANES];
+    for (int v = 0; v < 2; v++) {
+        storage[v].resize((size_t) samples * PIPELINE_LANES);
+        for (int i = 0; i < PIPELINE_LANES; i++) {
+            lanes[v][i] = &storage[v][(size_t) i * samples];
+        }
+    }
+
+    auto chirps = (uint64_t) (options.seconds * 1e6 / options.chirp.prf);
+    std::vector<std::complex<double>> raw, corrected, calm;
+    double phaseRaw = 0, phaseCorrected = 0, phaseTruth = 0, worstWait = 0, busy = 0;
+    uint32_t compensated = 0, uncovered = 0;
+    int bin = -1;
+    double read = 0;
+    for (uint64_t c = 0; c < chirps; c++) {
+        reference.render(lanes[0]);
+        scene.render(lanes[1]);
+        auto start = (int64_t) c * options.chirp.prf;
+        int64_t stop = start + (int64_t) std::llround((double) samples * 1e6 / options.sampling.frequency);
+
+        // The frame waits on the batch that covers it, or goes uncompensated while the filters settle
+        while (!vibration.covers(stop) && read < (double) stop + 200000.0) {
+            read = accelerometer.drain();
+            if (vibration.covers(stop)) {
+                worstWait = read - (double) stop > worstWait ? read - (double) stop : worstWait;
+            }
+        }
+
+        // The range bin of the reflector, from the first frame of the reference
+        if (bin < 0) {
+            double strongest = -1;
+            for (int b = 0; b < samples; b++) {
+                double power = std::norm(rangeBin(lanes[0], samples, b));
+                if (power > strongest) {
+                    strongest = power;
+                    bin = b;
+                }
+            }
+        }
+        std::complex<double> before = rangeBin(lanes[1], samples, bin);
+
+        float excursion = 0;
+        auto began = std::chrono::steady_clock::now();
+        bool ok = vibration.compensate(lanes[1], samples, start, stop, &excursion);
+        busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+        if (!ok) {
+            uncovered++;
+            continue;
+        }
+        compensated++;
+
+        std::complex<double> truth = rangeBin(lanes[0], samples, bin);
+        std::complex<double> after = rangeBin(lanes[1], samples, bin);
+        double mid = ((double) start + (double) stop) * 0.5e-6;
+        double injected = 4.0 * M_PI * sceneDisplacement(options.scene, mid) / wavelength;
+        phaseRaw += std::pow(std::arg(before * std::conj(truth)), 2);
+        phaseCorrected += std::pow(std::arg(after * std::conj(truth)), 2);
+        phaseTruth += injected * injected;
+        raw.push_back(before);
+        corrected.push_back(after);
+        calm.push_back(truth);
+    }
+    if (compensated == 0) {
+        printf("No frame was covered by the IMU\n");
+        return 1;
+    }
+
+    double rate = 1e6 / options.chirp.prf;
+    // The reflector itself spreads across the main lobe of the window
+    double guard = 4.0 * rate / (double) compensated;
+    std::vector<double> spectra[3] = {doppler(calm), doppler(raw), doppler(corrected)};
+    const char *names[3] = {"still", "raw", "compensated"};
+    // Where the vibration shows up most
+    size_t tone = strongest(spectra[1], rate, guard);
+
+    printf("%u frames of %d samples compensated, %u waited out while the filters settled\n", compensated, samples,
+           uncovered);
+    printf("IMU timestamps within %.1f us, clock period %.2f us against %.2f us, %u outlying edges\n",
+           accelerometer.worst, clock.period(), 1e6 / (IMU_RATE * (1.0 + options.drift)), clock.outliers);
+    printf("Longest a frame waited on the IMU: %.1f ms, rms displacement %.1f um\n", worstWait / 1000,
+           (double) vibration.rms() * 1e6);
+    printf("Phase of the reflector: %.2f deg rms injected, %.2f deg raw, %.2f deg compensated\n",
+           std::sqrt(phaseTruth / compensated) * 180 / M_PI, std::sqrt(phaseRaw / compensated) * 180 / M_PI,
+           std::sqrt(phaseCorrected / compensated) * 180 / M_PI);
+    double worst[3];
+    for (int i = 0; i < 3; i++) {
+        size_t bin = strongest(spectra[i], rate, guard);
+        worst[i] = spectra[i][bin];
+        printf("Doppler %-12s %6.1f dBc at %+6.2f Hz, strongest %6.1f dBc at %+6.2f Hz\n", names[i],
+               spectra[i][tone], binFrequency(tone, compensated, rate), worst[i], binFrequency(bin, compensated, rate));
+    }
+    printf("Compensation: %.1f us per frame\n", busy * 1e6 / (compensated + uncovered));
+
+    double improvement = worst[1] - worst[2];
+    bool pass = improvement >= 10.0 || worst[2] <= worst[0] + 3.0;
+    printf("Sidebands down %.1f dB: %s\n", improvement, pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
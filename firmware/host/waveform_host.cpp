@@ -0,0 +1,308 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "check.h"
+#include "waveform.h"
+
+// Prints the timing of the chirp given, then builds the chirp tables of every shape and checks their codes step by
+// step: sawtooth ramps and their sub-chirps rise and return to the bottom, triangles peak in the middle and mirror,
+// stepped chirps hold the levels asked for, the linearization bends the ramp only when enabled and codes never leave
+// the DAC range. The waveform timing is checked against a table of chirps with known frame counts, and the command
+// words of a period are checked frame by frame. Exits with 1 if any code, timing or word comes out wrong.
+
+// As DAC_STREAM_MAX_FRAME_RATE and DAC_STREAM_MAX_BUFFER_FRAMES
+#define HOST_MAX_FRAME_RATE 312500
+#define HOST_MAX_BUFFER_FRAMES 1023
+
+typedef struct Options {
+    Chirp chirp{};
+    int32_t audible = 0;
+} Options;
+
+static void usage(const char *name) {
+    printf("Usage: %s [--prf us] [--duration us] [--steps N] [--resolution N] [--shape sawtooth|triangle|stepped] "
+           "[--levels N] [--audible N]\n", name);
+}
+
+static bool parseOptions(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            return false;
+        } else if (strcmp(arg, "--prf") == 0) {
+            options->chirp.prf = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--duration") == 0) {
+            options->chirp.duration = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--steps") == 0) {
+            options->chirp.steps = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--resolution") == 0) {
+            options->chirp.resolution = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--shape") == 0) {
+            const char *shapes[] = {"sawtooth", "triangle", "stepped"};
+            int shape = 0;
+            while (shape < 3 && strcmp(value, shapes[shape]) != 0) {
+                shape++;
+            }
+            if (shape == 3) {
+                return false;
+            }
+            options->chirp.shape = shape;
+            i++;
+        } else if (strcmp(arg, "--levels") == 0) {
+            options->chirp.levels = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--audible") == 0) {
+            options->audible = atoi(value);
+            i++;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::vector<uint16_t> table(const Chirp &chirp, const Linearization &linearization) {
+    std::vector<uint16_t> codes((size_t) chirp.steps);
+    if (buildChirpTable(chirp, linearization, codes.data(), codes.size()) != codes.size()) {
+        codes.clear();
+    }
+    return codes;
+}
+
+// The code the ramp reaches at position x of the band
+static uint16_t expected(const Chirp &chirp, float x) {
+    return (uint16_t) lroundf(x * (float) (chirpStepResolution(chirp) * (chirp.steps - 1)));
+}
+
+static int checkTables() {
+    int wrong = 0;
+    Linearization straight{};
+
+    // One code per step of the default chirp, rising to the top of the band then back to the bottom
+    Chirp sawtooth{};
+    auto codes = table(sawtooth, straight);
+    bool rising = codes.size() == 125;
+    for (int32_t step = 0; rising && step < sawtooth.steps - 1; step++) {
+        rising = codes[(size_t) step] == step;
+    }
+    wrong += check("sawtooth rises a code a step", rising && codes.back() == 0);
+
+    // Each sub-chirp sweeps the band from the bottom again
+    Chirp padded{};
+    padded.padding = 5;
+    codes = table(padded, straight);
+    bool repeats = codes.size() == 125;
+    for (int32_t step = 0; repeats && step < padded.steps - 1; step++) {
+        int32_t within = step % padded.padding;
+        repeats = codes[(size_t) step] == expected(padded, (float) (within * 25) / 124.0f) &&
+                  (within == 0 ? codes[(size_t) step] == 0 : codes[(size_t) step] > codes[(size_t) step - 1]);
+    }
+    wrong += check("sub-chirps restart at the bottom", repeats && codes.back() == 0);
+
+    // Rises to the top at the middle of the ramp and falls back along the same codes
+    Chirp triangle{};
+    triangle.shape = CHIRP_TRIANGLE;
+    codes = table(triangle, straight);
+    bool mirrored = codes.size() == 125 && codes[62] == 124 && codes[0] == 0;
+    for (int32_t step = 1; mirrored && step < triangle.steps - 1; step++) {
+        mirrored = codes[(size_t) step] == codes[(size_t) (124 - step)] &&
+                   (step <= 62 ? codes[(size_t) step] > codes[(size_t) step - 1] :
+                    codes[(size_t) step] < codes[(size_t) step - 1]);
+    }
+    wrong += check("triangle peaks in the middle and mirrors", mirrored);
+
+    // A staircase of exactly the levels asked for, each held for its share of the steps
+    for (int32_t levels: {1, 4, 8, 31}) {
+        Chirp stepped{};
+        stepped.shape = CHIRP_STEPPED;
+        stepped.levels = levels;
+        codes = table(stepped, straight);
+        int32_t distinct = 1;
+        bool climbing = codes.size() == 125;
+        for (int32_t step = 1; climbing && step < stepped.steps - 1; step++) {
+            climbing = codes[(size_t) step] >= codes[(size_t) step - 1];
+            distinct += codes[(size_t) step] != codes[(size_t) step - 1] ? 1 : 0;
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "stepped chirp holds %d levels", levels);
+        wrong += check(name, climbing && distinct == levels && codes.back() == 0);
+    }
+
+    // The curve bends the ramp only when the chirp enables it and the curve is valid
+    Linearization square{};
+    square.coefficients[1] = 0.0f;
+    square.coefficients[2] = 1.0f;
+    square.valid = 1;
+    Chirp linearized{};
+    linearized.linearize = 1;
+    codes = table(linearized, square);
+    bool bent = codes.size() == 125;
+    for (int32_t step = 0; bent && step < linearized.steps - 1; step++) {
+        float x = (float) step / 124.0f;
+        bent = codes[(size_t) step] == expected(linearized, x * x);
+    }
+    wrong += check("linearization bends the ramp", bent);
+    wrong += check("linearization off leaves the ramp", table(sawtooth, square) == table(sawtooth, straight));
+    Linearization unset = square;
+    unset.valid = 0;
+    wrong += check("invalid linearization leaves the ramp", table(linearized, unset) == table(sawtooth, straight));
+
+    // A band wider than the DAC is clamped to its largest code
+    Chirp wide{};
+    wide.resolution = 8000;
+    codes = table(wide, straight);
+    bool clamped = codes.size() == 125 && codes[123] == MCP4922_MAX_CODE && codes[1] == 64;
+    for (uint16_t code: codes) {
+        clamped = clamped && code <= MCP4922_MAX_CODE;
+    }
+    wrong += check("wide band clamps to the DAC range", clamped);
+
+    uint16_t small[16];
+    wrong += check("small table refused", buildChirpTable(sawtooth, straight, small, 16) == 0);
+
+    // Shaping the ramp keeps a linearization rising, a flat or falling curve is refused
+    Linearization flat{};
+    flat.coefficients[1] = 0.0f;
+    flat.coefficients[0] = 0.5f;
+    Linearization falling{};
+    falling.coefficients[0] = 1.0f;
+    falling.coefficients[1] = -1.0f;
+    wrong += check("curves that keep the ramp rising", linearizationMonotonic(straight) &&
+                                                       linearizationMonotonic(square) &&
+                                                       !linearizationMonotonic(flat) &&
+                                                       !linearizationMonotonic(falling));
+
+    printf("Tables: %d wrong\n", wrong);
+    return wrong;
+}
+
+typedef struct TimingCase {
+    const char *name;
+    int32_t prf;
+    int32_t duration;
+    int32_t steps;
+    bool audible;
+    bool valid;
+    uint32_t frameRate;
+    size_t rampFrames;
+    size_t bufferFrames;
+    size_t buffersPerPeriod;
+} TimingCase;
+
+static const TimingCase timings[] = {
+        {"defaults",                 12500, 12500, 125,  false, true,  10000,  125,  125, 1},
+        {"audible",                  12500, 12500, 125,  true,  true,  20000,  250,  250, 1},
+        {"idle tail",                50000, 12500, 125,  false, true,  10000,  125,  500, 1},
+        {"split into buffers",       50000, 5000,  1000, false, true,  200000, 1000, 1000, 10},
+        {"two buffers",              12500, 12500, 2000, false, true,  160000, 2000, 1000, 2},
+        {"two full buffers",         10000, 10000, 1023, true,  true,  204600, 2046, 1023, 2},
+        {"padded to whole buffers",  10235, 10000, 1000, true,  true,  200000, 2000, 683,  3},
+        {"over the frame rate",      12500, 1000,  1000, false, false, 0,      0,    0,    0},
+        {"duration past the period", 10000, 12500, 125,  false, false, 0,      0,    0,    0},
+        {"no steps",                 12500, 12500, 0,    false, false, 0,      0,    0,    0},
+};
+
+static int checkTimings() {
+    int wrong = 0;
+    for (const auto &t: timings) {
+        Chirp chirp{};
+        chirp.prf = t.prf;
+        chirp.duration = t.duration;
+        chirp.steps = t.steps;
+        WaveformTiming timing{};
+        bool valid = waveformTiming(chirp, t.audible, HOST_MAX_FRAME_RATE, HOST_MAX_BUFFER_FRAMES, &timing);
+        bool right = valid == t.valid;
+        if (valid && right) {
+            right = timing.frameRate == t.frameRate && timing.rampFrames == t.rampFrames &&
+                    timing.bufferFrames == t.bufferFrames && timing.buffersPerPeriod == t.buffersPerPeriod &&
+                    timing.periodFrames == timing.bufferFrames * timing.buffersPerPeriod &&
+                    timing.bufferFrames <= HOST_MAX_BUFFER_FRAMES;
+        }
+        if (!right) {
+            printf("%s: expected %u frames/s, %zu of %zu frames in %zu buffers, got %s%u frames/s, %zu of %zu "
+                   "frames in %zu buffers\n", t.name, t.frameRate, t.rampFrames, t.bufferFrames * t.buffersPerPeriod,
+                   t.buffersPerPeriod, valid ? "" : "invalid ", timing.frameRate, timing.rampFrames,
+                   timing.periodFrames, timing.buffersPerPeriod);
+            wrong++;
+        }
+    }
+    printf("Timings: %d of %zu right\n", (int) (sizeof(timings) / sizeof(timings[0])) - wrong,
+           sizeof(timings) / sizeof(timings[0]));
+    return wrong;
+}
+
+static int checkWaveform(int32_t audible) {
+    Chirp chirp{};
+    chirp.prf = 25000;
+    Linearization straight{};
+    auto codes = table(chirp, straight);
+    WaveformTiming timing{};
+    if (!waveformTiming(chirp, audible > 0, HOST_MAX_FRAME_RATE, HOST_MAX_BUFFER_FRAMES, &timing)) {
+        printf("Waveform: no timing\n");
+        return 1;
+    }
+    std::vector<uint16_t> words(timing.periodFrames * 2);
+    int wrong = 0;
+    wrong += check("waveform refuses a short buffer",
+                   buildWaveform(chirp, codes.data(), audible, timing, words.data(), words.size() - 1) == 0);
+    size_t built = buildWaveform(chirp, codes.data(), audible, timing, words.data(), words.size());
+    wrong += check("waveform fills the period", built == words.size());
+
+    // Both words of a frame match, the ramp carries a code a step on channel A and the buzzer between them on B
+    size_t frame = 0, ramp = 0, buzzing = 0, idle = 0;
+    bool framed = true;
+    for (int32_t step = 0; step < chirp.steps; step++) {
+        framed = framed && words[frame * 2] == words[frame * 2 + 1] &&
+                 words[frame * 2] == mcp4922Word(codes[(size_t) step], MCP4922_CHANNEL_A);
+        ramp++;
+        frame++;
+        if (timing.framesPerStep == 2) {
+            uint16_t word = words[frame * 2];
+            framed = framed && word == words[frame * 2 + 1] && (word & 0xF000) == MCP4922_CHANNEL_B;
+            buzzing += word == mcp4922Word(MCP4922_BUZZER_LEVEL, MCP4922_CHANNEL_B) ? 1 : 0;
+            frame++;
+        }
+    }
+    for (; frame < timing.periodFrames; frame++) {
+        framed = framed && words[frame * 2] == mcp4922Word(0, MCP4922_CHANNEL_A) &&
+                 words[frame * 2 + 1] == words[frame * 2];
+        idle++;
+    }
+    // The buzzer goes high on one in every audible steps
+    size_t high = audible > 1 ? (size_t) chirp.steps / (size_t) audible : audible == 1 ? (size_t) chirp.steps : 0;
+    wrong += check("waveform frames", framed && ramp == (size_t) chirp.steps && buzzing == high &&
+                                      idle == timing.periodFrames - timing.rampFrames);
+    printf("Waveform (audible %d): %zu ramp frames, %zu with the buzzer high, %zu idle, %d wrong\n", audible, ramp,
+           buzzing, idle, wrong);
+    return wrong;
+}
+
+int main(int argc, char **argv) {
+    Options options{};
+    if (!parseOptions(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+    WaveformTiming timing{};
+    if (waveformTiming(options.chirp, options.audible > 0, HOST_MAX_FRAME_RATE, HOST_MAX_BUFFER_FRAMES, &timing)) {
+        printf("%d steps of %d codes at %u frames/s, %zu ramp frames of %zu in %zu buffers of %zu\n",
+               options.chirp.steps, chirpStepResolution(options.chirp), timing.frameRate, timing.rampFrames,
+               timing.periodFrames, timing.buffersPerPeriod, timing.bufferFrames);
+    } else {
+        printf("%d steps over %d us cannot be streamed\n", options.chirp.steps, options.chirp.duration);
+    }
+
+    int wrong = checkTables();
+    wrong += checkTimings();
+    wrong += checkWaveform(0);
+    wrong += checkWaveform(1);
+    wrong += checkWaveform(5);
+    return wrong > 0 ? 1 : 0;
+}
@@ -0,0 +1,426 @@
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <random>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "websocket.h"
+
+#define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WEBSOCKET_HEADER_LIMIT 8192
+
+enum {
+    OPCODE_CONTINUATION = 0x0,
+    OPCODE_TEXT = 0x1,
+    OPCODE_BINARY = 0x2,
+    OPCODE_CLOSE = 0x8,
+    OPCODE_PING = 0x9,
+    OPCODE_PONG = 0xA,
+};
+
+static uint32_t rotate(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+// The handshake digests the key with SHA-1, which is not used for anything else
+static void sha1(const uint8_t *data, size_t length, uint8_t digest[20]) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    std::vector<uint8_t> message(data, data + length);
+    message.push_back(0x80);
+    while (message.size() % 64 != 56) {
+        message.push_back(0);
+    }
+    uint64_t bits = (uint64_t) length * 8;
+    for (int i = 7; i >= 0; i--) {
+        message.push_back((bits >> (8 * i)) & 0xFF);
+    }
+    for (size_t block = 0; block < message.size(); block += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            const uint8_t *b = &message[block + i * 4];
+            w[i] = (uint32_t) b[0] << 24 | (uint32_t) b[1] << 16 | (uint32_t) b[2] << 8 | b[3];
+        }
+        for (int i = 16; i < 80; i++) {
+            w[i] = rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32_t t = rotate(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotate(b, 30);
+            b = a;
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+    for (int i = 0; i < 5; i++) {
+        digest[i * 4] = (h[i] >> 24) & 0xFF;
+        digest[i * 4 + 1] = (h[i] >> 16) & 0xFF;
+        digest[i * 4 + 2] = (h[i] >> 8) & 0xFF;
+        digest[i * 4 + 3] = h[i] & 0xFF;
+    }
+}
+
+static std::string base64(const uint8_t *data, size_t length) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t group = (uint32_t) data[i] << 16;
+        if (i + 1 < length) {
+            group |= (uint32_t) data[i + 1] << 8;
+        }
+        if (i + 2 < length) {
+            group |= data[i + 2];
+        }
+        out += alphabet[(group >> 18) & 0x3F];
+        out += alphabet[(group >> 12) & 0x3F];
+        out += i + 1 < length ? alphabet[(group >> 6) & 0x3F] : '=';
+        out += i + 2 < length ? alphabet[group & 0x3F] : '=';
+    }
+    return out;
+}
+
+static std::string acceptKey(const std::string &key) {
+    std::string joined = key + WEBSOCKET_GUID;
+    uint8_t digest[20];
+    sha1((const uint8_t *) joined.data(), joined.size(), digest);
+    return base64(digest, sizeof(digest));
+}
+
+// Value of a header field, matched without regard to case
+static std::string headerField(const std::string &header, const char *name) {
+    size_t length = strlen(name);
+    size_t line = header.find("\r\n");
+    while (line != std::string::npos) {
+        size_t start = line + 2;
+        if (strncasecmp(header.c_str() + start, name, length) == 0 && header[start + length] == ':') {
+            size_t value = header.find_first_not_of(' ', start + length + 1);
+            if (value == std::string::npos) {
+                return "";
+            }
+            size_t stop = header.find("\r\n", start);
+            return header.substr(value, stop - value);
+        }
+        line = header.find("\r\n", start);
+    }
+    return "";
+}
+
+static void noDelay(int fd) {
+    // Frames go out as they are sent, as the module's stack does
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+WebSocket::~WebSocket() {
+    close();
+}
+
+bool WebSocket::connect(const char *host, uint16_t port, const char *path) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *addresses = nullptr;
+    std::string service = std::to_string(port);
+    if (getaddrinfo(host, service.c_str(), &hints, &addresses) != 0) {
+        return false;
+    }
+    for (addrinfo *address = addresses; address != nullptr; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (::connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+            break;
+        }
+        ::close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        return false;
+    }
+    noDelay(fd);
+    client = true;
+
+    uint8_t nonce[16];
+    std::random_device random;
+    for (uint8_t &byte: nonce) {
+        byte = (uint8_t) random();
+    }
+    std::string key = base64(nonce, sizeof(nonce));
+    std::string request = std::string("GET ") + path + " HTTP/1.1\r\n" +
+                          "Host: " + host + ":" + service + "\r\n" +
+                          "Upgrade: websocket\r\n" +
+                          "Connection: Upgrade\r\n" +
+                          "Sec-WebSocket-Key: " + key + "\r\n" +
+                          "Sec-WebSocket-Version: 13\r\n\r\n";
+    std::string response;
+    if (!writeAll((const uint8_t *) request.data(), request.size()) || !readHeader(&response)) {
+        close();
+        return false;
+    }
+    if (response.compare(0, 12, "HTTP/1.1 101") != 0 ||
+        headerField(response, "Sec-WebSocket-Accept") != acceptKey(key)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool WebSocket::accept(int socket, std::string *path) {
+    fd = socket;
+    noDelay(fd);
+    client = false;
+    std::string request;
+    if (!readHeader(&request)) {
+        close();
+        return false;
+    }
+    std::string key = headerField(request, "Sec-WebSocket-Key");
+    size_t target = request.find(' ');
+    size_t version = request.find(' ', target + 1);
+    if (request.compare(0, 4, "GET ") != 0 || key.empty() || version == std::string::npos) {
+        const char refusal[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n";
+        writeAll((const uint8_t *) refusal, sizeof(refusal) - 1);
+        close();
+        return false;
+    }
+    if (path != nullptr) {
+        *path = request.substr(target + 1, version - target - 1);
+    }
+    std::string response = std::string("HTTP/1.1 101 Switching Protocols\r\n") +
+                           "Upgrade: websocket\r\n" +
+                           "Connection: Upgrade\r\n" +
+                           "Sec-WebSocket-Accept: " + acceptKey(key) + "\r\n\r\n";
+    if (!writeAll((const uint8_t *) response.data(), response.size())) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool WebSocket::send(const uint8_t *data, size_t length, bool binary) {
+    return sendFrame(binary ? OPCODE_BINARY : OPCODE_TEXT, data, length);
+}
+
+bool WebSocket::sendFrame(uint8_t opcode, const uint8_t *data, size_t length) {
+    if (fd < 0) {
+        return false;
+    }
+    uint8_t header[14];
+    size_t size = 0;
+    header[size++] = 0x80 | opcode;
+    uint8_t mask = client ? 0x80 : 0x00;
+    if (length < 126) {
+        header[size++] = mask | (uint8_t) length;
+    } else if (length <= 0xFFFF) {
+        header[size++] = mask | 126;
+        header[size++] = (length >> 8) & 0xFF;
+        header[size++] = length & 0xFF;
+    } else {
+        header[size++] = mask | 127;
+        for (int i = 7; i >= 0; i--) {
+            header[size++] = ((uint64_t) length >> (8 * i)) & 0xFF;
+        }
+    }
+    if (!client) {
+        return writeAll(header, size) && writeAll(data, length);
+    }
+    static thread_local std::minstd_rand random(std::random_device{}());
+    uint8_t key[4];
+    for (uint8_t &byte: key) {
+        byte = (uint8_t) random();
+    }
+    memcpy(&header[size], key, sizeof(key));
+    size += sizeof(key);
+    std::vector<uint8_t> masked(data, data + length);
+    for (size_t i = 0; i < length; i++) {
+        masked[i] ^= key[i % 4];
+    }
+    return writeAll(header, size) && writeAll(masked.data(), length);
+}
+
+bool WebSocket::receive(std::vector<uint8_t> *message, bool *binary) {
+    message->clear();
+    bool started = false;
+    while (fd >= 0) {
+        uint8_t head[2];
+        if (!readExact(head, sizeof(head))) {
+            break;
+        }
+        bool fin = head[0] & 0x80;
+        uint8_t opcode = head[0] & 0x0F;
+        bool masked = head[1] & 0x80;
+        uint64_t length = head[1] & 0x7F;
+        if (length == 126 || length == 127) {
+            uint8_t extended[8];
+            size_t width = length == 126 ? 2 : 8;
+            if (!readExact(extended, width)) {
+                break;
+            }
+            length = 0;
+            for (size_t i = 0; i < width; i++) {
+                length = length << 8 | extended[i];
+            }
+        }
+        uint8_t key[4] = {0, 0, 0, 0};
+        if (masked && !readExact(key, sizeof(key))) {
+            break;
+        }
+        std::vector<uint8_t> payload(length);
+        if (!readExact(payload.data(), length)) {
+            break;
+        }
+        if (masked) {
+            for (size_t i = 0; i < length; i++) {
+                payload[i] ^= key[i % 4];
+            }
+        }
+        if (opcode == OPCODE_PING) {
+            sendFrame(OPCODE_PONG, payload.data(), payload.size());
+            continue;
+        } else if (opcode == OPCODE_PONG) {
+            continue;
+        } else if (opcode == OPCODE_CLOSE) {
+            sendFrame(OPCODE_CLOSE, payload.data(), payload.size() < 2 ? payload.size() : 2);
+            break;
+        } else if (opcode == OPCODE_TEXT || opcode == OPCODE_BINARY) {
+            *binary = opcode == OPCODE_BINARY;
+            started = true;
+            message->assign(payload.begin(), payload.end());
+        } else if (opcode == OPCODE_CONTINUATION && started) {
+            message->insert(message->end(), payload.begin(), payload.end());
+        } else {
+            break;
+        }
+        if (fin) {
+            return true;
+        }
+    }
+    close();
+    return false;
+}
+
+bool WebSocket::readable(int timeout) {
+    if (fd < 0) {
+        return false;
+    }
+    if (consumed < input.size()) {
+        return true;
+    }
+    pollfd poller = {.fd = fd, .events = POLLIN, .revents = 0};
+    return poll(&poller, 1, timeout) > 0;
+}
+
+bool WebSocket::readExact(uint8_t *dest, size_t length) {
+    // Bytes read past the http header are served first
+    size_t buffered = input.size() - consumed;
+    size_t take = buffered < length ? buffered : length;
+    if (take > 0) {
+        memcpy(dest, &input[consumed], take);
+        consumed += take;
+        dest += take;
+        length -= take;
+    }
+    while (length > 0) {
+        ssize_t got = ::recv(fd, dest, length, 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        dest += got;
+        length -= (size_t) got;
+    }
+    return true;
+}
+
+bool WebSocket::writeAll(const uint8_t *data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = ::send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        length -= (size_t) sent;
+    }
+    return true;
+}
+
+bool WebSocket::readHeader(std::string *header) {
+    input.clear();
+    consumed = 0;
+    uint8_t chunk[1024];
+    while (input.size() < WEBSOCKET_HEADER_LIMIT) {
+        ssize_t got = ::recv(fd, chunk, sizeof(chunk), 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        input.insert(input.end(), chunk, chunk + got);
+        std::string text(input.begin(), input.end());
+        size_t end = text.find("\r\n\r\n");
+        if (end != std::string::npos) {
+            *header = text.substr(0, end + 2);
+            consumed = end + 4;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WebSocket::close() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+    input.clear();
+    consumed = 0;
+}
+
+int websocketListen(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(fd, (sockaddr *) &address, sizeof(address)) != 0 || listen(fd, 1) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
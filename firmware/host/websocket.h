@@ -0,0 +1,55 @@
+#ifndef RADAR_WEBSOCKET_H
+#define RADAR_WEBSOCKET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Just enough of RFC 6455 to talk to a module as the bridge does and to stand in for a module the bridge dials:
+// unfragmented sends, reassembled receives, pings answered and closes acknowledged. Blocking, one thread per socket.
+class WebSocket {
+public:
+
+    ~WebSocket();
+
+    // Dial ws://host:port/path as a client
+    bool connect(const char *host, uint16_t port, const char *path);
+
+    // Answer the upgrade request of an accepted connection, taking ownership of fd
+    bool accept(int fd, std::string *path);
+
+    bool send(const uint8_t *data, size_t length, bool binary);
+
+    // Receive the next text or binary message. Returns false once the connection has closed.
+    bool receive(std::vector<uint8_t> *message, bool *binary);
+
+    // Wait up to timeout milliseconds for something to receive
+    bool readable(int timeout);
+
+    void close();
+
+private:
+
+    bool sendFrame(uint8_t opcode, const uint8_t *data, size_t length);
+
+    bool readExact(uint8_t *dest, size_t length);
+
+    bool writeAll(const uint8_t *data, size_t length);
+
+    // Read up to the blank line ending an http header, keeping anything after it for the frames
+    bool readHeader(std::string *header);
+
+    int fd = -1;
+    // Clients mask every frame they send, servers never do
+    bool client = false;
+    std::vector<uint8_t> input;
+    size_t consumed = 0;
+
+};
+
+// Listen for connections on every interface, returns the socket or -1
+int websocketListen(uint16_t port);
+
+
+#endif //RADAR_WEBSOCKET_H
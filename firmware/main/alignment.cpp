@@ -0,0 +1,50 @@
+#include "alignment.h"
+
+int64_t cyclesToNanoseconds(uint32_t from, uint32_t to, uint32_t cyclesPerMicrosecond) {
+    if (cyclesPerMicrosecond == 0) {
+        return 0;
+    }
+    // The counter wraps, the signed difference is correct as long as the events are within half a wrap
+    auto cycles = (int32_t) (to - from);
+    return (int64_t) cycles * 1000 / cyclesPerMicrosecond;
+}
+
+int jitterBin(int64_t jitter) {
+    if (jitter < 0) {
+        jitter = -jitter;
+    }
+    int bin = 0;
+    int64_t edge = ALIGNMENT_JITTER_BASE_NS;
+    while (jitter >= edge && bin < ALIGNMENT_JITTER_BINS - 1) {
+        edge *= 2;
+        bin++;
+    }
+    return bin;
+}
+
+void Alignment::record(int64_t skew) {
+    if (current.frames == 0) {
+        current.mean = skew;
+        current.min = skew;
+        current.max = skew;
+    }
+    current.jitter[jitterBin(skew - current.mean)]++;
+    // Exponentially weighted so the mean follows slow drift without being dragged by single outliers
+    current.mean += (skew - current.mean) / (1 << ALIGNMENT_MEAN_SHIFT);
+    if (skew < current.min) current.min = skew;
+    if (skew > current.max) current.max = skew;
+    current.last = skew;
+    current.frames++;
+    published.store(current);
+}
+
+void Alignment::reset() {
+    current = {};
+    published.store(current);
+}
+
+AlignmentStats Alignment::stats() const {
+    AlignmentStats snapshot{};
+    published.load(snapshot);
+    return snapshot;
+}
@@ -0,0 +1,53 @@
+#ifndef RADAR_ALIGNMENT_H
+#define RADAR_ALIGNMENT_H
+
+#include <cstdint>
+#include "seqlock.h"
+
+#define ALIGNMENT_JITTER_BINS 16
+// Upper edge of the first jitter bin, each following bin doubles in width
+#define ALIGNMENT_JITTER_BASE_NS 128
+// Weight of each new frame in the running mean skew, as a power of two
+#define ALIGNMENT_MEAN_SHIFT 4
+
+// Convert a cycle counter difference to nanoseconds, the difference is signed so that either event may come first
+int64_t cyclesToNanoseconds(uint32_t from, uint32_t to, uint32_t cyclesPerMicrosecond);
+
+// Histogram bin of a jitter magnitude, the last bin collects everything above the second to last edge
+int jitterBin(int64_t jitter);
+
+typedef struct AlignmentStats {
+    // Frames recorded
+    uint32_t frames;
+    // Running mean, extremes and last skew between the chirp start and the first adc conversion
+    int64_t mean;
+    int64_t min;
+    int64_t max;
+    int64_t last;
+    // Frames by absolute deviation of their skew from the running mean
+    uint32_t jitter[ALIGNMENT_JITTER_BINS];
+} AlignmentStats;
+
+// Alignment accumulates the skew between the DAC chirp start and the first ADC conversion of each frame. Frames are
+// recorded by the acquisition task, any task may take a snapshot.
+class Alignment {
+public:
+
+    // Record the skew of one frame in nanoseconds
+    void record(int64_t skew);
+
+    // Clear the statistics, the skew changes with the chirp and sampling configuration
+    void reset();
+
+    // Copy a consistent snapshot of the statistics
+    AlignmentStats stats() const;
+
+private:
+
+    AlignmentStats current{};
+    Seqlock<AlignmentStats> published{};
+
+};
+
+
+#endif //RADAR_ALIGNMENT_H
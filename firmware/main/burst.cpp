@@ -0,0 +1,22 @@
+#include "burst.h"
+
+BurstPlan planBurst(const Chirp &chirp, const Burst &burst) {
+    BurstPlan plan{};
+    plan.duty = 1.0f;
+    if (burst.chirps <= 0 || burst.duty <= 0 || burst.duty >= BURST_MAX_DUTY || chirp.prf <= 0) {
+        return plan;
+    }
+    int64_t active = BURST_SETTLE_US + (int64_t) burst.chirps * chirp.prf;
+    // Round the period up so the achieved duty never exceeds the target
+    int64_t period = (active * BURST_MAX_DUTY + burst.duty - 1) / burst.duty;
+    if (period - active < BURST_MIN_IDLE_US) {
+        return plan;
+    }
+    plan.gated = true;
+    plan.chirps = burst.chirps;
+    plan.active = active;
+    plan.period = period;
+    plan.idle = period - active;
+    plan.duty = (float) active / (float) period;
+    return plan;
+}
@@ -0,0 +1,32 @@
+#ifndef RADAR_BURST_H
+#define RADAR_BURST_H
+
+#include <cstdint>
+#include "parameters.h"
+
+// Time the K-LC7 needs after its enable line rises before the VCO and IF amplifiers settle
+#define BURST_SETTLE_US 2000
+// Idle gaps shorter than this save too little to be worth power cycling the radar
+#define BURST_MIN_IDLE_US 20000
+#define BURST_MAX_DUTY 100
+
+typedef struct BurstPlan {
+    // False when the radar stays powered and the chirp train runs continuously
+    bool gated;
+    // Chirps per burst
+    int32_t chirps;
+    // Microseconds the radar is powered per burst, including the settling time
+    int64_t active;
+    // Microseconds between the start of sequential bursts
+    int64_t period;
+    // Microseconds the radar is gated per burst
+    int64_t idle;
+    // Fraction of the time the radar is powered, 0 to 1
+    float duty;
+} BurstPlan;
+
+// Plan the burst period that keeps the radar powered for the target duty cycle of the burst configuration. Plans
+// whose idle gap would fall below BURST_MIN_IDLE_US run continuously.
+BurstPlan planBurst(const Chirp &chirp, const Burst &burst);
+
+#endif //RADAR_BURST_H
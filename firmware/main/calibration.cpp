@@ -0,0 +1,143 @@
+#include <cmath>
+#include "calibration.h"
+#include "waveform.h"
+
+float beatFrequency(const uint16_t *samples, size_t count, float sampleRate) {
+    if (count < 2 || sampleRate <= 0) {
+        return 0;
+    }
+    double mean = 0;
+    for (size_t i = 0; i < count; i++) {
+        mean += samples[i];
+    }
+    mean /= (double) count;
+    double variance = 0;
+    for (size_t i = 0; i < count; i++) {
+        variance += (samples[i] - mean) * (samples[i] - mean);
+    }
+    // Crossings only count once the signal has swung past a quarter of its deviation, so noise near zero is ignored
+    auto hysteresis = (float) (0.25 * sqrt(variance / (double) count));
+
+    int state = 0;
+    int crossings = 0;
+    float candidate = 0, first = 0, last = 0;
+    for (size_t i = 1; i < count; i++) {
+        auto a = (float) (samples[i - 1] - mean);
+        auto b = (float) (samples[i] - mean);
+        if ((a < 0) != (b < 0)) {
+            // Interpolate the position of the zero between the two samples
+            candidate = (float) (i - 1) + a / (a - b);
+        }
+        int next = state;
+        if (b > hysteresis) {
+            next = 1;
+        } else if (b < -hysteresis) {
+            next = -1;
+        }
+        if (next != state) {
+            if (state != 0) {
+                if (crossings == 0) {
+                    first = candidate;
+                }
+                last = candidate;
+                crossings++;
+            }
+            state = next;
+        }
+    }
+    if (crossings < 2 || last <= first) {
+        return 0;
+    }
+    // Two crossings per cycle
+    return (float) (crossings - 1) / 2.0f / ((last - first) / sampleRate);
+}
+
+bool polynomialFit(const float *x, const float *y, size_t count, int order, float *coefficients) {
+    const int n = order + 1;
+    if (order < 0 || order > LINEARIZATION_ORDER || count < (size_t) n) {
+        return false;
+    }
+    // Normal equations, augmented with the right hand side
+    double m[LINEARIZATION_ORDER + 1][LINEARIZATION_ORDER + 2] = {};
+    for (size_t i = 0; i < count; i++) {
+        double powers[2 * LINEARIZATION_ORDER + 1];
+        powers[0] = 1;
+        for (int p = 1; p <= 2 * order; p++) {
+            powers[p] = powers[p - 1] * x[i];
+        }
+        for (int r = 0; r < n; r++) {
+            for (int c = 0; c < n; c++) {
+                m[r][c] += powers[r + c];
+            }
+            m[r][n] += powers[r] * y[i];
+        }
+    }
+    // Gaussian elimination with partial pivoting
+    for (int col = 0; col < n; col++) {
+        int pivot = col;
+        for (int r = col + 1; r < n; r++) {
+            if (fabs(m[r][col]) > fabs(m[pivot][col])) {
+                pivot = r;
+            }
+        }
+        if (fabs(m[pivot][col]) < 1e-12) {
+            return false;
+        }
+        if (pivot != col) {
+            for (int c = 0; c <= n; c++) {
+                double t = m[col][c];
+                m[col][c] = m[pivot][c];
+                m[pivot][c] = t;
+            }
+        }
+        for (int r = col + 1; r < n; r++) {
+            double factor = m[r][col] / m[col][col];
+            for (int c = col; c <= n; c++) {
+                m[r][c] -= factor * m[col][c];
+            }
+        }
+    }
+    for (int r = n - 1; r >= 0; r--) {
+        double value = m[r][n];
+        for (int c = r + 1; c < n; c++) {
+            value -= m[r][c] * coefficients[c];
+        }
+        coefficients[r] = (float) (value / m[r][r]);
+    }
+    return true;
+}
+
+bool fitLinearization(const CalibrationSegment *segments, size_t count, Linearization *result) {
+    if (count < CALIBRATION_MIN_SEGMENTS || count > CALIBRATION_MAX_SEGMENTS) {
+        return false;
+    }
+    // Tuning curve nodes at the segment boundaries, code against swept frequency
+    float code[CALIBRATION_MAX_SEGMENTS + 1];
+    float swept[CALIBRATION_MAX_SEGMENTS + 1];
+    code[0] = segments[0].start;
+    swept[0] = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (segments[i].beat <= 0 || segments[i].width <= 0) {
+            return false;
+        }
+        code[i + 1] = segments[i].start + segments[i].width;
+        swept[i + 1] = swept[i] + segments[i].beat;
+    }
+    // Normalize both axes to the sweep so the curve maps ramp position onto ramp code
+    float codeSpan = code[count] - code[0];
+    for (size_t i = 0; i <= count; i++) {
+        code[i] = (code[i] - code[0]) / codeSpan;
+        swept[i] /= swept[count];
+    }
+
+    Linearization fitted{};
+    if (!polynomialFit(swept, code, count + 1, LINEARIZATION_ORDER, fitted.coefficients)) {
+        return false;
+    }
+    fitted.valid = 1;
+    if (!linearizationMonotonic(fitted)) {
+        return false;
+    }
+    *result = fitted;
+    return true;
+}
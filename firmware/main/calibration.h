@@ -0,0 +1,39 @@
+#ifndef RADAR_CALIBRATION_H
+#define RADAR_CALIBRATION_H
+
+#include <cstddef>
+#include <cstdint>
+#include "parameters.h"
+
+#define CALIBRATION_MIN_SEGMENTS 4
+#define CALIBRATION_MAX_SEGMENTS 64
+#define CALIBRATION_DEFAULT_SEGMENTS 16
+// Frames averaged for the beat frequency of each segment
+#define CALIBRATION_FRAMES_PER_SEGMENT 8
+
+// One short linear sub-ramp of the calibration sweep. Against a fixed reflector the beat frequency is proportional
+// to the frequency swept by the VCO over the segment, so the segments trace out the VCO tuning curve.
+typedef struct CalibrationSegment {
+    // Normalized DAC code at the start of the sub-ramp
+    float start;
+    // Normalized DAC code span of the sub-ramp
+    float width;
+    // Beat frequency measured over the sub-ramp
+    float beat;
+} CalibrationSegment;
+
+// Estimate the dominant frequency of a beat signal from its zero crossings, returns zero if fewer than two crossings
+// rise above the noise
+float beatFrequency(const uint16_t *samples, size_t count, float sampleRate);
+
+// Least squares polynomial of the given order through the points, coefficients are written lowest order first.
+// Returns false if the system is singular.
+bool polynomialFit(const float *x, const float *y, size_t count, int order, float *coefficients);
+
+// Integrate contiguous, ascending segments into the VCO tuning curve and fit its inverse, the DAC code that reaches
+// a given fraction of the swept band. Returns false if the segments do not describe a rising tuning curve or the fit
+// would not keep a rising ramp rising.
+bool fitLinearization(const CalibrationSegment *segments, size_t count, Linearization *result);
+
+
+#endif //RADAR_CALIBRATION_H
@@ -0,0 +1,52 @@
+#include <cstring>
+#include "capture.h"
+
+size_t captureEncodeHeader(uint8_t *dest, size_t capacity, uint8_t type, uint64_t sequence, int64_t time,
+                           size_t length) {
+    size_t total = captureRecordBytes(length);
+    if (capacity < total || length > UINT32_MAX) {
+        return 0;
+    }
+    CaptureRecord record = {
+            .type = type,
+            .flags = 0,
+            .reserved = 0,
+            .length = (uint32_t) length,
+            .sequence = sequence,
+            .time = time,
+    };
+    memcpy(dest, &record, sizeof(record));
+    // Zero the padding so identical captures are identical files
+    memset(dest + sizeof(record) + length, 0, total - sizeof(record) - length);
+    return total;
+}
+
+size_t captureEncodeRecord(uint8_t *dest, size_t capacity, uint8_t type, uint64_t sequence, int64_t time,
+                           const uint8_t *payload, size_t length) {
+    size_t total = captureEncodeHeader(dest, capacity, type, sequence, time, length);
+    if (total > 0 && length > 0) {
+        memcpy(dest + sizeof(CaptureRecord), payload, length);
+    }
+    return total;
+}
+
+size_t captureRecordAt(const uint8_t *buffer, size_t length, const CaptureRecord **record) {
+    if (length < sizeof(CaptureRecord)) {
+        return 0;
+    }
+    auto found = (const CaptureRecord *) buffer;
+    size_t total = captureRecordBytes(found->length);
+    if (total > length || found->type < CAPTURE_FRAME || found->type > CAPTURE_METADATA) {
+        return 0;
+    }
+    *record = found;
+    return total;
+}
+
+bool captureChunkValid(const uint8_t *buffer, size_t length) {
+    if (length < sizeof(CaptureChunk)) {
+        return false;
+    }
+    auto chunk = (const CaptureChunk *) buffer;
+    return chunk->magic == CAPTURE_CHUNK_MAGIC && chunk->bytes <= length - sizeof(CaptureChunk);
+}
@@ -0,0 +1,128 @@
+#ifndef RADAR_CAPTURE_H
+#define RADAR_CAPTURE_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Capture files hold what a module streamed: sample frames, telemetry and the settings documents, in the order they
+// arrived. The file is a header, a run of chunks and a footer. Each chunk is a chunk header followed by whole records,
+// each record is a record header followed by its payload padded to the next 8 byte boundary. Every structure is
+// little-endian and naturally aligned, so a mapped file is read in place.
+//
+// The footer points at the frame index, the file offset of every frame record in order, so frame N is found with one
+// lookup. It also points at the chunk index and the settings index, where each metadata and settings document is found
+// by the number of frames before it. A capture cut short has no footer, readers rebuild the indexes by walking the
+// chunks.
+
+#define CAPTURE_MAGIC 0x50435276 // "vRCP"
+#define CAPTURE_CHUNK_MAGIC 0x4B435276 // "vRCK"
+#define CAPTURE_FOOTER_MAGIC 0x45435276 // "vRCE"
+#define CAPTURE_VERSION 1
+#define CAPTURE_ALIGNMENT 8
+// Records are gathered into chunks of about this many bytes, a larger record gets a chunk of its own
+#define CAPTURE_CHUNK_BYTES (4 * 1024 * 1024)
+// Record times count microseconds from the module's boot rather than from the unix epoch
+#define CAPTURE_FLAG_BOOT_TIME 0x1
+
+enum CaptureRecordType {
+    // A binary sample frame exactly as streamed
+    CAPTURE_FRAME = 1,
+    // A telemetry message
+    CAPTURE_TELEMETRY = 2,
+    // The settings document after a change
+    CAPTURE_SETTINGS = 3,
+    // The metadata document the module answered the session with
+    CAPTURE_METADATA = 4,
+};
+
+typedef struct CaptureHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t chunkBytes;
+    uint32_t reserved;
+    // Microseconds since the unix epoch when the capture began
+    int64_t created;
+    // Where the capture came from, zero terminated
+    char source[40];
+} CaptureHeader;
+
+typedef struct CaptureChunk {
+    uint32_t magic;
+    uint32_t index;
+    // Sequence of the first record in the chunk
+    uint64_t sequence;
+    // Number of the first frame in the chunk
+    uint64_t frame;
+    uint32_t records;
+    // Bytes of records after the chunk header
+    uint32_t bytes;
+} CaptureChunk;
+
+typedef struct CaptureRecord {
+    uint8_t type;
+    uint8_t flags;
+    uint16_t reserved;
+    // Payload bytes, excluding the padding
+    uint32_t length;
+    // Position of the record in the capture, counting every type
+    uint64_t sequence;
+    // Microseconds since the unix epoch when the record was received
+    int64_t time;
+} CaptureRecord;
+
+typedef struct CaptureFooter {
+    uint32_t magic;
+    uint32_t chunks;
+    uint64_t records;
+    uint64_t frames;
+    // File offset of the frames uint64_t frame record offsets
+    uint64_t frameIndex;
+    // File offset of the chunks uint64_t chunk offsets
+    uint64_t chunkIndex;
+    // File offset of the settings CaptureSettings entries
+    uint64_t settingsIndex;
+    uint32_t settings;
+    uint32_t reserved;
+} CaptureFooter;
+
+typedef struct CaptureSettings {
+    // Frames recorded before the document
+    uint64_t frame;
+    // File offset of the metadata or settings record
+    uint64_t offset;
+} CaptureSettings;
+
+static_assert(sizeof(CaptureHeader) == 64, "capture header layout");
+static_assert(sizeof(CaptureChunk) == 32, "capture chunk layout");
+static_assert(sizeof(CaptureRecord) == 24, "capture record layout");
+static_assert(sizeof(CaptureFooter) == 56, "capture footer layout");
+static_assert(sizeof(CaptureSettings) == 16, "capture settings layout");
+
+// Bytes a payload occupies once padded
+static inline size_t captureAligned(size_t length) {
+    return (length + CAPTURE_ALIGNMENT - 1) & ~((size_t) CAPTURE_ALIGNMENT - 1);
+}
+
+// Bytes of a record with the given payload, header included
+static inline size_t captureRecordBytes(size_t length) {
+    return sizeof(CaptureRecord) + captureAligned(length);
+}
+
+// Write a record header for a payload of length bytes and zero the padding after it, leaving the payload to the caller.
+// Returns the bytes of the whole record or zero if dest is too small.
+size_t captureEncodeHeader(uint8_t *dest, size_t capacity, uint8_t type, uint64_t sequence, int64_t time,
+                           size_t length);
+
+// Write a record and its padded payload to dest, returns the bytes written or zero if dest is too small
+size_t captureEncodeRecord(uint8_t *dest, size_t capacity, uint8_t type, uint64_t sequence, int64_t time,
+                           const uint8_t *payload, size_t length);
+
+// Check the record at the start of buffer lies wholly within it, returns its total bytes or zero if it does not
+size_t captureRecordAt(const uint8_t *buffer, size_t length, const CaptureRecord **record);
+
+// Check a chunk header and that its records lie within length bytes of buffer
+bool captureChunkValid(const uint8_t *buffer, size_t length);
+
+
+#endif //RADAR_CAPTURE_H
@@ -7,8 +7,10 @@
 #include <freertos/task.h>
 #include <driver/timer_types_legacy.h>
 #include <esp_timer.h>
-#include <driver/gptimer.h>
+#include <esp_cpu.h>
 #include <cmath>
+#include <esp_heap_caps.h>
+#include <esp_rom_sys.h>
 #include "dac.h"
 #include "settings.h"
 
@@ -22,9 +24,8 @@
 #define SPI_HOST SPI2_HOST
 #define SPI_CLOCK 20000000
 
-#define CONFIG_UPDATE_PERIOD (1000 * 1250) // 1s
-
-esp_err_t DAC::initializeSPI() {
+// Configure the shutdown and latch pins shared by the SPI and streamed outputs
+static esp_err_t initializeControlPins() {
     // Define configuration for the Shutdown and DAC latch GPIO pins
     gpio_config_t gpioConfig = {
             .pin_bit_mask = (1ULL << SPI_SHDN) | (1ULL << SPI_LDAC),
@@ -34,11 +35,21 @@ esp_err_t DAC::initializeSPI() {
             .intr_type = GPIO_INTR_DISABLE,
     };
     // Configure the GPIO pads
-    gpio_config(&gpioConfig);
+    esp_err_t err = gpio_config(&gpioConfig);
+    if (err != ESP_OK) {
+        return err;
+    }
     // Enable the MCP4922 IC
     gpio_set_level(SPI_SHDN, 1);
-    // Initialize the latch pin
+    // Hold both lines at their levels through light sleep
+    gpio_sleep_sel_dis(SPI_SHDN);
+    gpio_sleep_sel_dis(SPI_LDAC);
+    // Initialize the latch pin, while low the outputs update on the rising edge of chip select
     gpio_set_level(SPI_LDAC, 0);
+    return ESP_OK;
+}
+
+esp_err_t DAC::initializeSPI() {
     // Define the SPI bus configuration
     spi_bus_config_t spiBusConfig = {
             .mosi_io_num = SPI_MOSI,
@@ -61,258 +72,531 @@ esp_err_t DAC::initializeSPI() {
         return ret;
     }
     // Add the MCP4922 as an SPI device on the bus
-    ret = spi_bus_add_device(SPI_HOST, &deviceInterfaceConfig, &device);
+    ret = spi_bus_add_device(SPI_HOST, &deviceInterfaceConfig, &bus.device);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    // The MCP4922 is the only device on the bus, holding it lets the timer ISR start transactions without taking the
+    // bus lock
+    ret = spi_device_acquire_bus(bus.device, portMAX_DELAY);
     if (ret != ESP_OK) {
         return ret;
     }
     return ESP_OK;
 }
 
-// 0001 ---- ---- ---- (Channel A, Unbuffered, 2x Gain, Enabled) + input data
-// 1111 ---- ---- ---- (Channel B, Buffered, 1x Gain, Enabled) + input data
-static void IRAM_ATTR transmit(spi_device_handle_t handle, uint16_t value, uint16_t mask) {
-    uint16_t data = (value & 0x0FFF) | mask;
-    gpio_set_level(SPI_LDAC, 1); // Set LDAC high
-
-    spi_transaction_t transaction = {
-            .flags = SPI_TRANS_USE_TXDATA,
-            .length = 16,
-            .tx_data = {static_cast<uint8_t>(data >> 8), static_cast<uint8_t>(data & 0xFF)}
-    };
-
-    esp_err_t ret;
-    spi_transaction_t *ret_trans;
-    ret = spi_device_queue_trans(handle, &transaction, pdMS_TO_TICKS(0.1));
-    if (ret != ESP_OK) return;
+// Bin an interrupt duration, the last bin collects everything above the second to last edge
+static int IRAM_ATTR interruptBin(uint32_t duration) {
+    int bin = 0;
+    uint32_t edge = DAC_ISR_HISTOGRAM_BASE_NS;
+    while (duration >= edge && bin < DAC_ISR_HISTOGRAM_BINS - 1) {
+        edge *= 2;
+        bin++;
+    }
+    return bin;
+}
 
-    ret = spi_device_get_trans_result(handle, &ret_trans, pdMS_TO_TICKS(0.1));
-    if (ret != ESP_OK) {
+esp_err_t DAC::configureTable(const Chirp &next, const Linearization &linearization) {
+    if (next.linearize && linearization.valid && !linearizationMonotonic(linearization)) {
+        printf("Ignoring non-monotonic VCO linearization\n");
+    }
+    // The timer ISR reads the table, so it must live in internal memory
+    auto nextTable = (uint16_t *) heap_caps_malloc(next.steps * sizeof(uint16_t), MALLOC_CAP_INTERNAL);
+    if (nextTable == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    Linearization applied = linearization;
+    applied.valid = linearization.valid && linearizationMonotonic(linearization);
+    if (buildChirpTable(next, applied, nextTable, next.steps) == 0) {
+        heap_caps_free(nextTable);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (table != nullptr) {
+        heap_caps_free(table);
     }
 
-    gpio_set_level(SPI_LDAC, 0);
-//    gpio_set_level(SPI_LDAC, 1);
-//    gpio_set_level(SPI_LDAC, 0);
+    if (startAlarm != nullptr) {
+        esp_timer_stop(startAlarm);
+        esp_timer_delete(startAlarm);
+    }
+    if (startDue != nullptr) {
+        vSemaphoreDelete(startDue);
+    }
+    table = nextTable;
+    return ESP_OK;
 }
 
-void configTimerCallback(void *params) {
-    auto dac = (DAC *) params;
-    auto settings = Settings::instance();
-    auto system = settings.getSystem();
-    auto delta = system.chirp;
+esp_err_t DAC::configure(const Chirp &next, const Linearization &linearization) {
+    if (next.steps <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = configureTable(next, linearization);
+    if (err != ESP_OK) {
+        printf("Failed to build chirp table: %s\n", esp_err_to_name(err));
+        return err;
+    }
 
-    auto newInterval = (int) round((double)delta.duration / (double)delta.steps);
-    if (dac->delay != newInterval && newInterval > 0) {
-        dac->changeChirpInterval(newInterval);
-        dac->delay = newInterval;
+    if (streaming) {
+        err = configureStream(next);
+        if (err != ESP_OK) {
+            printf("Failed to configure chirp stream: %s\n", esp_err_to_name(err));
+        }
+        return err;
+    }
+
+    auto newInterval = (int) round((double) next.duration / (double) next.steps);
+    if (delay != newInterval && newInterval > 0) {
+        err = changeChirpInterval(newInterval);
+        if (err != ESP_OK) {
+            printf("Failed to change chirp interval: %s\n", esp_err_to_name(err));
+            return err;
+        }
+        delay = newInterval;
     }
 
     // Calculate the dac steps per step
-    dac->stepResolution = (int) round((double) dac->chirp.resolution / (double) (dac->chirp.steps));
-    dac->stepResolution = dac->stepResolution <= 0 ? 1 : dac->stepResolution;
-    printf("Resolution: %ld, Delay: %ld\n", dac->stepResolution, dac->delay);
+    stepResolution = chirpStepResolution(next);
+    printf("Resolution: %ld, Delay: %ld\n", stepResolution, delay);
     // Set the chirp
 
-    dac->chirp = delta;
+    chirp = next;
+    return ESP_OK;
+}
 
+static void settingsChanged(uint32_t changes, const System &system, uint32_t generation, void *ctx) {
+    auto dac = (DAC *) ctx;
+    // The buzzer can be changed at any time, chirp changes are switched by the acquisition task at a frame boundary
     dac->audible = system.audible;
-
 }
 
 volatile int32_t alternate = 0;
 volatile int32_t power = 0;
 volatile int32_t pause = 0;
 
-static bool IRAM_ATTR chirpTriggerCallback(gptimer_handle_t timer,
-                                           const gptimer_alarm_event_data_t *ed,
-                                           void *user_ctx) {
+static bool IRAM_ATTR chirpTriggerCallback(void *ctx) {
 
-    auto dac = (DAC *) user_ctx;
+    auto dac = (DAC *) ctx;
 
     if (pause > 0) {
         pause--;
         return true;
     }
 
+    uint32_t entry = esp_cpu_get_cycle_count();
 
     power = (power + 1) % (dac->chirp.steps);
 
+    // 0x3000 => [ch0, unbuffered, gain 1x, enabled]
+    uint16_t words[2];
+    int count = 0;
+
     if (power == dac->chirp.steps - 1) {
         pause = ((dac->chirp.prf - dac->chirp.duration) / dac->delay);
-        transmit(dac->device, (uint16_t) 0, 0x3000);
+        words[count++] = mcp4922Word(0, MCP4922_CHANNEL_A);
+        dac->bus.write(words, count);
         return true;
     }
 
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
     if (power == 0) {
+        dac->chirpCycle = entry;
+        dac->chirpTime = esp_timer_get_time();
         vTaskNotifyGiveFromISR(dac->adcHandle, &xHigherPriorityTaskWoken);
     }
 
-    if (power >= 0 && power < dac->chirp.steps) {
-        // 0x3000 => [ch0, unbuffered, gain 1x, enabled]
-        auto m = (dac->chirp.steps / 2);
-//        transmit(dac->device, (uint16_t) (m - abs(m - power)) * dac->stepResolution, 0x3000);
-        if (dac->chirp.padding > 0) {
-            // 0 -> 250 (res = 1/step)
-            // 0 -> 25 (10 interphase chirps) = (red = 10/step)
-            //
-            transmit(dac->device, (uint16_t) (power % dac->chirp.padding) *
-                                  (dac->stepResolution * (dac->chirp.steps / dac->chirp.padding)), 0x3000);
-        } else {
-            transmit(dac->device, (uint16_t) (power) * (dac->stepResolution), 0x3000);
-        }
-    }
-
+    words[count++] = mcp4922Word(dac->table[power], MCP4922_CHANNEL_A);
 
     if (dac->audible > 0) {
         alternate = (alternate + 1) % dac->audible;
         if (alternate == 0) {
-            transmit(dac->device, (uint16_t) 2048, 0xF000);
+            words[count++] = mcp4922Word(MCP4922_BUZZER_LEVEL, MCP4922_CHANNEL_B);
         } else if (alternate == 1) {
-            transmit(dac->device, (uint16_t) 0, 0xF000);
+            words[count++] = mcp4922Word(0, MCP4922_CHANNEL_B);
         }
     }
 
+    dac->bus.write(words, count);
+
+    // Record how long the step took, from entry to the outputs being latched
+    uint32_t duration = (esp_cpu_get_cycle_count() - entry) * 1000 / esp_rom_get_cpu_ticks_per_us();
+    dac->interrupts.count = dac->interrupts.count + 1;
+    int bin = interruptBin(duration);
+    dac->interrupts.histogram[bin] = dac->interrupts.histogram[bin] + 1;
+    if (duration > dac->interrupts.worst) {
+        dac->interrupts.worst = duration;
+    }
+
     portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
     return true;
 }
 
+DACInterruptStats DAC::interruptStats() const {
+    DACInterruptStats stats{};
+    stats.count = interrupts.count;
+    stats.worst = interrupts.worst;
+    for (int i = 0; i < DAC_ISR_HISTOGRAM_BINS; i++) {
+        stats.histogram[i] = interrupts.histogram[i];
+    }
+    return stats;
+}
+
 esp_err_t DAC::changeChirpInterval(int32_t interval) {
     if (interval < 25) {
         interval = 25;
     };
-    gptimer_alarm_config_t alarm_on = {
-            .alarm_count = (uint64_t) interval, // period = 1s @resolution 1MHz
-            .reload_count = 0, // counter will reload with 0 on alarm event
-            .flags {
-                    .auto_reload_on_alarm = true, // enable auto-reload
-            }
-    };
-    esp_err_t err;
-    err = gptimer_set_alarm_action(chirpTimer, &alarm_on);
-    if (err != ESP_OK) {
-        return err;
+    return timer.setPeriod(interval);
+}
+
+static bool IRAM_ATTR streamSentCallback(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx) {
+    auto dac = (DAC *) user_ctx;
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    // Refill the buffer with the idle command before it goes back to the feeder, should the feeder fall behind the
+    // ring plays it rather than a shutdown command. The event points at the buffer pointer of the sent descriptor, both
+    // slots of a frame hold the same word.
+    auto frames = *(uint32_t **) event->data;
+    uint32_t idle = mcp4922Word(0, MCP4922_CHANNEL_A);
+    for (size_t i = 0; i < event->size / sizeof(uint32_t); i++) {
+        frames[i] = idle | idle << 16;
     }
-    return ESP_OK;
+    // The period is a whole number of buffers, so a chirp begins each time a full period has been sent
+    dac->sentBuffers = dac->sentBuffers + 1;
+    if (dac->sentBuffers % dac->timing.buffersPerPeriod == 0) {
+        dac->chirpCycle = esp_cpu_get_cycle_count();
+        dac->chirpTime = esp_timer_get_time();
+        vTaskNotifyGiveFromISR(dac->adcHandle, &xHigherPriorityTaskWoken);
+    }
+    return xHigherPriorityTaskWoken == pdTRUE;
 }
 
-esp_err_t DAC::initializeChirpTimer() {
+void DAC::feederTask(void *arg) {
+    auto dac = (DAC *) arg;
+    while (true) {
+        if (!dac->running || dac->waveform == nullptr) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        // Keep the dma ring full, the write blocks until a buffer has been sent
+        size_t written = 0;
+        esp_err_t err = i2s_channel_write(dac->stream, (uint8_t *) dac->waveform + dac->streamOffset,
+                                          dac->waveformBytes - dac->streamOffset, &written, pdMS_TO_TICKS(100));
+        if (err != ESP_OK && err != ESP_ERR_TIMEOUT) {
+            continue;
+        }
+        dac->streamOffset = (dac->streamOffset + written) % dac->waveformBytes;
+    }
+}
 
-    chirpTimer = {};
+esp_err_t DAC::initializeStream() {
+    // The stream feeder shares a priority with the acquisition task on the opposite core
+    if (xTaskCreatePinnedToCore(feederTask, "dacFeeder", 3072, this, tskIDLE_PRIORITY + 6, &feeder, 1) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
 
-    gptimer_config_t chirpTimerConfig = {
-            .clk_src = GPTIMER_CLK_SRC_DEFAULT,
-            .direction = GPTIMER_COUNT_UP,
-            .resolution_hz = 1 * 1000 * 1000, // 1MHz, 1 tick = 1us
-    };
+esp_err_t DAC::configureStream(const Chirp &next) {
+    WaveformTiming nextTiming{};
+    if (!waveformTiming(next, audible > 0, DAC_STREAM_MAX_FRAME_RATE, DAC_STREAM_MAX_BUFFER_FRAMES, &nextTiming)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Build the chirp period before touching the running configuration
+    size_t words = nextTiming.periodFrames * 2;
+    auto nextWaveform = (uint16_t *) heap_caps_malloc(words * sizeof(uint16_t), MALLOC_CAP_8BIT);
+    if (nextWaveform == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    buildWaveform(next, table, audible, nextTiming, nextWaveform, words);
 
     esp_err_t err;
+    // The dma buffer size is fixed when the channel is created, so the channel is rebuilt for every chirp
+    if (stream != nullptr) {
+        err = i2s_del_channel(stream);
+        if (err != ESP_OK) {
+            heap_caps_free(nextWaveform);
+            return err;
+        }
+        stream = nullptr;
+    }
 
-    err = gptimer_new_timer(&chirpTimerConfig, &chirpTimer);
+    i2s_chan_config_t channelConfig = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_AUTO, I2S_ROLE_MASTER);
+    channelConfig.dma_desc_num = DAC_STREAM_DMA_BUFFERS;
+    channelConfig.dma_frame_num = nextTiming.bufferFrames;
+    // Word select is the chip select, so a cleared buffer of zeros would be clocked in as a command that shuts DAC A
+    // down. The sent callback refills each buffer with the idle command instead, an underrun holds the ramp bottom.
+    channelConfig.auto_clear = false;
+    err = i2s_new_channel(&channelConfig, &stream, nullptr);
     if (err != ESP_OK) {
+        heap_caps_free(nextWaveform);
         return err;
     }
 
-    gptimer_alarm_config_t alarm_on = {
-            .alarm_count = 100, // period = 1s @resolution 1MHz
-            .reload_count = 0, // counter will reload with 0 on alarm event
-            .flags {
-                    .auto_reload_on_alarm = true, // enable auto-reload
-            }
+    // Word select drives chip select: the left slot is clocked into the MCP4922 while it is low and latched on the
+    // rising edge, the right slot is clocked out while the chip is deselected. MSB justified slots have no one bit
+    // delay after word select, so each left slot lines up with the 16 bit MCP4922 command.
+    i2s_std_config_t streamConfig = {
+            .clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(nextTiming.frameRate),
+            .slot_cfg = I2S_STD_MSB_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_STEREO),
+            .gpio_cfg = {
+                    .mclk = I2S_GPIO_UNUSED,
+                    .bclk = (gpio_num_t) SPI_SCLK,
+                    .ws = (gpio_num_t) SPI_CS,
+                    .dout = (gpio_num_t) SPI_MOSI,
+                    .din = I2S_GPIO_UNUSED,
+                    .invert_flags = {
+                            .mclk_inv = false,
+                            .bclk_inv = false,
+                            .ws_inv = false,
+                    },
+            },
     };
-
-    err = gptimer_set_alarm_action(chirpTimer, &alarm_on);
+    streamConfig.clk_cfg.mclk_multiple = I2S_MCLK_MULTIPLE_128;
+    err = i2s_channel_init_std_mode(stream, &streamConfig);
     if (err != ESP_OK) {
+        heap_caps_free(nextWaveform);
         return err;
     }
 
-    gptimer_event_callbacks_t alarm_on_callback = {
-            .on_alarm = chirpTriggerCallback, // register user callback
+    i2s_event_callbacks_t callbacks = {
+            .on_recv = nullptr,
+            .on_recv_q_ovf = nullptr,
+            .on_sent = streamSentCallback,
+            .on_send_q_ovf = nullptr,
     };
+    err = i2s_channel_register_event_callback(stream, &callbacks, this);
+    if (err != ESP_OK) {
+        heap_caps_free(nextWaveform);
+        return err;
+    }
 
-    err = gptimer_register_event_callbacks(chirpTimer, &alarm_on_callback, this);
+    if (waveform != nullptr) {
+        heap_caps_free(waveform);
+    }
+    waveform = nextWaveform;
+    waveformBytes = words * sizeof(uint16_t);
+    timing = nextTiming;
+    stepResolution = chirpStepResolution(next);
+    chirp = next;
+    printf("Resolution: %ld, Frame rate: %lu, Period: %u frames\n", stepResolution, timing.frameRate,
+           timing.periodFrames);
+    return ESP_OK;
+}
+
+esp_err_t DAC::stop() {
+    if (!running) {
+        return ESP_OK;
+    }
+    esp_err_t err;
+    if (streaming) {
+        running = false;
+        // The feeder returns from its pending write once the dma ring drains
+        return i2s_channel_disable(stream);
+    }
+    err = timer.stop();
     if (err != ESP_OK) {
         return err;
     }
+    running = false;
+    // Return the VCO to the bottom of the ramp while idle
+    uint16_t idle = mcp4922Word(0, MCP4922_CHANNEL_A);
+    bus.write(&idle, 1);
+    return ESP_OK;
+}
 
-    err = gptimer_enable(chirpTimer);
+esp_err_t DAC::start() {
+    if (running) {
+        return ESP_OK;
+    }
+    esp_err_t err;
+    if (streaming) {
+        if (stream == nullptr || waveform == nullptr) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        // Preload the dma ring from the first step of a chirp so buffer boundaries line up with chirp periods
+        sentBuffers = 0;
+        streamOffset = 0;
+        size_t loaded;
+        do {
+            size_t remaining = waveformBytes - streamOffset;
+            loaded = 0;
+            err = i2s_channel_preload_data(stream, (uint8_t *) waveform + streamOffset, remaining, &loaded);
+            if (err != ESP_OK) {
+                return err;
+            }
+            streamOffset = (streamOffset + loaded) % waveformBytes;
+            if (loaded < remaining) {
+                break;
+            }
+        } while (loaded > 0);
+        err = i2s_channel_enable(stream);
+        if (err != ESP_OK) {
+            return err;
+        }
+        running = true;
+        xTaskNotifyGive(feeder);
+        return ESP_OK;
+    }
+    // Begin at the last step so the next alarm starts a fresh chirp and notifies the acquisition task
+    power = chirp.steps - 1;
+    pause = 0;
+    alternate = 0;
+    err = timer.start();
     if (err != ESP_OK) {
         return err;
     }
+    running = true;
+    return ESP_OK;
+}
 
-    err = gptimer_start(chirpTimer);
+esp_err_t DAC::sleep() {
+    if (asleep) {
+        return ESP_OK;
+    }
+    esp_err_t err = stop();
     if (err != ESP_OK) {
         return err;
     }
+    // A suspended timer releases its power management lock
+    if (!streaming) {
+        err = timer.suspend();
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    gpio_set_level(SPI_SHDN, 0);
+    asleep = true;
+    return ESP_OK;
+}
 
+esp_err_t DAC::wake() {
+    if (!asleep) {
+        return ESP_OK;
+    }
+    gpio_set_level(SPI_SHDN, 1);
+    if (!streaming) {
+        esp_err_t err = timer.resume();
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    asleep = false;
     return ESP_OK;
 }
 
-DAC::DAC(TaskHandle_t handle) : adcHandle(handle) {
+void DAC::startAlarmCallback(void *arg) {
+    auto dac = (DAC *) arg;
+    xSemaphoreGive(dac->startDue);
+}
 
-    esp_err_t err;
-    // Attempt to initialize the DAC SPI device
-    err = initializeSPI();
+esp_err_t DAC::initializeStartAlarm() {
+    startDue = xSemaphoreCreateBinary();
+    if (startDue == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_timer_create_args_t args = {
+            .callback = startAlarmCallback,
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "chirpStart",
+            .skip_unhandled_events = true,
+    };
+    return esp_timer_create(&args, &startAlarm);
+}
+
+esp_err_t DAC::startAt(int64_t time) {
+    int64_t wait = time - esp_timer_get_time();
+    // A start that is already due goes out at once
+    if (wait <= 0 || startAlarm == nullptr) {
+        return start();
+    }
+    // A give left over from an alarm that came after its wait had given up
+    xSemaphoreTake(startDue, 0);
+    esp_err_t err = esp_timer_start_once(startAlarm, (uint64_t) wait);
     if (err != ESP_OK) {
-        printf("Failed to initialize DAC SPI: %s\n", esp_err_to_name(err));
-        return;
+        return err;
     }
-    // Attempt to initialize the configuration timer
-    err = initializeConfigurationTimer();
+    // The task sleeps until the alarm rather than holding the core, the time the wake takes is part of the start
+    // lead the acquisition task learns
+    if (xSemaphoreTake(startDue, pdMS_TO_TICKS(wait / 1000) + DAC_START_SLACK_TICKS) != pdTRUE) {
+        esp_timer_stop(startAlarm);
+    }
+    return start();
+}
+
+DAC::DAC(TaskHandle_t handle) : adcHandle(handle) {
+#ifdef CONFIG_vRADAR_DAC_STREAM
+    streaming = true;
+#endif
+    esp_err_t err;
+    // Attempt to initialize the shutdown and latch pins
+    err = initializeControlPins();
     if (err != ESP_OK) {
-        printf("Failed to initialize configuration timer: %s\n", esp_err_to_name(err));
+        printf("Failed to initialize DAC control pins: %s\n", esp_err_to_name(err));
         return;
     }
-    // Attempt to configure the chirp timer
-    err = initializeChirpTimer();
+    // Listen for buzzer changes
+    audible = Settings::instance().getSystem().audible;
+    if (!Settings::instance().subscribe(SETTINGS_AUDIBLE, settingsChanged, this)) {
+        printf("Failed to subscribe to buzzer settings\n");
+    }
+    // Timed starts fall back to starting at once without the alarm
+    err = initializeStartAlarm();
     if (err != ESP_OK) {
-        printf("Failed to initialize configuration timer: %s\n", esp_err_to_name(err));
+        printf("Failed to initialize the chirp start alarm: %s\n", esp_err_to_name(err));
+    }
+    // The streamed waveform and i2s channel are built once the first chirp is configured
+    if (streaming) {
+        err = initializeStream();
+        if (err != ESP_OK) {
+            printf("Failed to initialize DAC stream: %s\n", esp_err_to_name(err));
+        }
         return;
     }
-}
-
-esp_err_t DAC::initializeConfigurationTimer() {
-    configTimer = {};
-    // Define the periodic configuration timer
-    const esp_timer_create_args_t periodic_timer_args = {
-            .callback = configTimerCallback,
-            .arg = this,
-            .name = "dacConfiguration"
-    };
-    esp_err_t err;
-    // Initialize the periodic timer
-    err = esp_timer_create(&periodic_timer_args, &configTimer);
+    // Attempt to initialize the DAC SPI device
+    err = initializeSPI();
     if (err != ESP_OK) {
-        return err;
+        printf("Failed to initialize DAC SPI: %s\n", esp_err_to_name(err));
+        return;
     }
-    // Set the periodic timer to update every second
-    err = esp_timer_start_periodic(configTimer, CONFIG_UPDATE_PERIOD);
+    // Attempt to configure the chirp timer, the chirp train is started once the first chirp is configured
+    err = timer.initialize(chirpTriggerCallback, this);
     if (err != ESP_OK) {
-        return err;
+        printf("Failed to initialize configuration timer: %s\n", esp_err_to_name(err));
+        return;
     }
-
-    return ESP_OK;
 }
 
-
 DAC::~DAC() {
     esp_err_t err;
 
-    err = esp_timer_stop(configTimer);
+    err = stop();
     if (err != ESP_OK) {
         printf("Failed to stop chirpTimer: %s\n", esp_err_to_name(err));
     }
 
-    err = gptimer_stop(chirpTimer);
-    if (err != ESP_OK) {
-        printf("Failed to stop chirpTimer: %s\n", esp_err_to_name(err));
+    if (table != nullptr) {
+        heap_caps_free(table);
     }
 
-    err = gptimer_del_timer(chirpTimer);
-    if (err != ESP_OK) {
-        printf("Failed to delete chirpTimer: %s\n", esp_err_to_name(err));
+    if (streaming) {
+        if (feeder != nullptr) {
+            vTaskDelete(feeder);
+        }
+        if (stream != nullptr) {
+            err = i2s_del_channel(stream);
+            if (err != ESP_OK) {
+                printf("Failed to delete chirp stream: %s\n", esp_err_to_name(err));
+            }
+        }
+        if (waveform != nullptr) {
+            heap_caps_free(waveform);
+        }
+        return;
     }
 
-    err = spi_bus_remove_device(device);
+    // The chirp timer is released by its own destructor
+    spi_device_release_bus(bus.device);
+
+    err = spi_bus_remove_device(bus.device);
     if (err != ESP_OK) {
         printf("Failed to remove SPI device: %s\n", esp_err_to_name(err));
     }
@@ -7,9 +7,37 @@
 
 
 #include <driver/spi_master.h>
-#include <driver/gptimer_types.h>
+#include <driver/i2s_std.h>
 #include <freertos/ringbuf.h>
+#include <freertos/semphr.h>
+#include <esp_timer.h>
 #include "settings.h"
+#include "waveform.h"
+#include "hal_esp.h"
+
+// The MCP4922 needs 40ns of chip select setup before the first rising clock edge, half a bit at 10MHz
+#define DAC_STREAM_MAX_BCLK 10000000
+// Each streamed frame is two 16-bit slots
+#define DAC_STREAM_FRAME_BITS 32
+#define DAC_STREAM_MAX_FRAME_RATE (DAC_STREAM_MAX_BCLK / DAC_STREAM_FRAME_BITS)
+// Largest dma buffer the i2s driver accepts, in frames of 4 bytes
+#define DAC_STREAM_MAX_BUFFER_FRAMES 1023
+#define DAC_STREAM_DMA_BUFFERS 4
+
+#define DAC_ISR_HISTOGRAM_BINS 12
+// Upper edge of the first ISR duration bin, each following bin doubles in width
+#define DAC_ISR_HISTOGRAM_BASE_NS 1000
+// Ticks past its alarm a timed start waits before it gives up on the alarm and starts late
+#define DAC_START_SLACK_TICKS 2
+
+typedef struct DACInterruptStats {
+    // Chirp timer interrupts that stepped the ramp
+    uint32_t count;
+    // Longest interrupt since boot, in nanoseconds
+    uint32_t worst;
+    // Interrupts by duration
+    uint32_t histogram[DAC_ISR_HISTOGRAM_BINS];
+} DACInterruptStats;
 
 class DAC {
 public:
@@ -17,7 +45,8 @@ public:
 
     ~DAC();
 
-    spi_device_handle_t device{};
+    // Concrete so the chirp interrupt calls the IRAM write directly
+    EspDacBus bus{(gpio_num_t) CONFIG_vRADAR_DAC_LDAC};
     TaskHandle_t adcHandle{};
 
     int32_t audible = 0;
@@ -27,18 +56,82 @@ public:
 
     Chirp chirp{};
 
+    // True when the chirp is streamed from a precomputed waveform, false when stepped from the timer ISR
+    bool streaming = false;
+
+    // Frame timing of the streamed waveform
+    WaveformTiming timing{};
+
+    // Output buffers sent since the stream was started
+    volatile size_t sentBuffers = 0;
+
+    // Cycle count and time since boot of the most recent chirp start, captured in the chirp interrupt
+    volatile uint32_t chirpCycle = 0;
+    volatile int64_t chirpTime = 0;
+
     esp_err_t changeChirpInterval(int32_t interval);
 
+    // DAC code of every step of the active chirp
+    uint16_t *table = nullptr;
+
+    // Switch to a new chirp, the chirp train must be stopped. A chirp that fails part way leaves the DAC unusable
+    // until a chirp is configured successfully, the previous chirp can always be configured again.
+    esp_err_t configure(const Chirp &next, const Linearization &linearization);
+
+    // Duration of the chirp timer interrupts, updated from the interrupt
+    volatile DACInterruptStats interrupts{};
+
+    // Copy the chirp timer interrupt statistics, empty while streaming
+    DACInterruptStats interruptStats() const;
+
+    // Halt the chirp train at the current step
+    esp_err_t stop();
+
+    // Restart the chirp train from the first step of a chirp
+    esp_err_t start();
+
+    // Restart the chirp train at the given time since boot in microseconds
+    esp_err_t startAt(int64_t time);
+
+    // Halt the chirp train, shut the MCP4922 down and release the chirp timer so the CPUs may sleep
+    esp_err_t sleep();
+
+    // Undo sleep, the chirp train must then be started again
+    esp_err_t wake();
+
 private:
 
-    gptimer_handle_t chirpTimer{};
-    esp_timer_handle_t configTimer{};
+    EspChirpTimer timer{};
+
+    bool running = false;
 
-    int initializeConfigurationTimer();
+    bool asleep = false;
+
+    i2s_chan_handle_t stream{};
+    TaskHandle_t feeder{};
+    // One chirp period of MCP4922 command words
+    uint16_t *waveform = nullptr;
+    size_t waveformBytes = 0;
+    // Byte offset of the next waveform write into the stream
+    size_t streamOffset = 0;
 
     esp_err_t initializeSPI();
 
-    esp_err_t initializeChirpTimer();
+    esp_err_t initializeStream();
+
+    esp_err_t configureTable(const Chirp &next, const Linearization &linearization);
+
+    esp_err_t configureStream(const Chirp &next);
+
+    static void feederTask(void *arg);
+
+    // One shot alarm of a timed start, the starting task blocks on the semaphore it gives
+    esp_timer_handle_t startAlarm{};
+    SemaphoreHandle_t startDue{};
+
+    esp_err_t initializeStartAlarm();
+
+    static void startAlarmCallback(void *arg);
 
 
 };
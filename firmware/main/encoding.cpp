@@ -0,0 +1,151 @@
+#include <cstring>
+#include "encoding.h"
+
+// Collect pointers to the persisted fields in blob order, fields must only ever be appended to this list
+static int systemFields(System *system, int32_t **fields) {
+    int count = 0;
+    fields[count++] = &system->audible;
+    fields[count++] = &system->enabled;
+    fields[count++] = &system->gyro;
+    fields[count++] = &system->chirp.prf;
+    fields[count++] = &system->chirp.duration;
+    fields[count++] = &system->chirp.steps;
+    fields[count++] = &system->chirp.padding;
+    fields[count++] = &system->chirp.resolution;
+    fields[count++] = &system->sampling.frequency;
+    fields[count++] = &system->sampling.samples;
+    fields[count++] = &system->sampling.attenuation;
+    fields[count++] = &system->chirp.shape;
+    fields[count++] = &system->chirp.levels;
+    fields[count++] = &system->chirp.linearize;
+    fields[count++] = &system->schedule.mode;
+    fields[count++] = &system->schedule.slot;
+    fields[count++] = &system->schedule.slots;
+    fields[count++] = &system->interference;
+    fields[count++] = &system->burst.chirps;
+    fields[count++] = &system->burst.duty;
+    fields[count++] = &system->vibration;
+    return count;
+}
+
+static void putLittleEndian(uint8_t *dest, uint32_t value, size_t width) {
+    for (size_t i = 0; i < width; i++) {
+        dest[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint32_t getLittleEndian(const uint8_t *src, size_t width) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < width; i++) {
+        value |= (uint32_t) src[i] << (8 * i);
+    }
+    return value;
+}
+
+uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length) {
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+size_t encodeSystem(const System &system, uint8_t *dest, size_t length) {
+    System copy = system;
+    int32_t *fields[ENCODING_SYSTEM_MAX_FIELDS];
+    int count = systemFields(&copy, fields);
+
+    size_t size = ENCODING_SYSTEM_HEADER_SIZE + count * sizeof(int32_t) + sizeof(uint32_t);
+    if (length < size) {
+        return 0;
+    }
+
+    putLittleEndian(&dest[0], ENCODING_SYSTEM_MAGIC, 4);
+    putLittleEndian(&dest[4], ENCODING_SYSTEM_VERSION, 2);
+    putLittleEndian(&dest[6], count, 2);
+    size_t offset = ENCODING_SYSTEM_HEADER_SIZE;
+    for (int i = 0; i < count; i++) {
+        putLittleEndian(&dest[offset], (uint32_t) *fields[i], 4);
+        offset += sizeof(int32_t);
+    }
+    // The crc covers the header and every field
+    putLittleEndian(&dest[offset], crc32(0, dest, offset), 4);
+    return size;
+}
+
+bool decodeSystem(const uint8_t *src, size_t length, System *dest) {
+    if (length < ENCODING_SYSTEM_HEADER_SIZE + sizeof(uint32_t)) {
+        return false;
+    }
+    if (getLittleEndian(&src[0], 4) != ENCODING_SYSTEM_MAGIC) {
+        return false;
+    }
+    size_t stored = getLittleEndian(&src[6], 2);
+    size_t size = ENCODING_SYSTEM_HEADER_SIZE + stored * sizeof(int32_t) + sizeof(uint32_t);
+    if (length < size) {
+        return false;
+    }
+    size_t crcOffset = size - sizeof(uint32_t);
+    if (getLittleEndian(&src[crcOffset], 4) != crc32(0, src, crcOffset)) {
+        return false;
+    }
+
+    int32_t *fields[ENCODING_SYSTEM_MAX_FIELDS];
+    size_t count = systemFields(dest, fields);
+    // Blobs written by newer firmware may carry trailing fields this build does not know about
+    if (stored < count) {
+        count = stored;
+    }
+    size_t offset = ENCODING_SYSTEM_HEADER_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        *fields[i] = (int32_t) getLittleEndian(&src[offset], 4);
+        offset += sizeof(int32_t);
+    }
+    return true;
+}
+
+size_t encodeLinearization(const Linearization &linearization, uint8_t *dest, size_t length) {
+    if (length < ENCODING_LINEARIZATION_SIZE) {
+        return 0;
+    }
+    putLittleEndian(&dest[0], ENCODING_LINEARIZATION_MAGIC, 4);
+    putLittleEndian(&dest[4], ENCODING_LINEARIZATION_VERSION, 2);
+    putLittleEndian(&dest[6], LINEARIZATION_ORDER + 1, 2);
+    size_t offset = ENCODING_SYSTEM_HEADER_SIZE;
+    for (int i = 0; i <= LINEARIZATION_ORDER; i++) {
+        // Coefficients are stored as their IEEE-754 bit patterns
+        uint32_t bits;
+        memcpy(&bits, &linearization.coefficients[i], sizeof(bits));
+        putLittleEndian(&dest[offset], bits, 4);
+        offset += sizeof(uint32_t);
+    }
+    putLittleEndian(&dest[offset], crc32(0, dest, offset), 4);
+    return ENCODING_LINEARIZATION_SIZE;
+}
+
+bool decodeLinearization(const uint8_t *src, size_t length, Linearization *dest) {
+    if (length < ENCODING_LINEARIZATION_SIZE) {
+        return false;
+    }
+    if (getLittleEndian(&src[0], 4) != ENCODING_LINEARIZATION_MAGIC) {
+        return false;
+    }
+    if (getLittleEndian(&src[6], 2) != LINEARIZATION_ORDER + 1) {
+        return false;
+    }
+    size_t crcOffset = ENCODING_LINEARIZATION_SIZE - sizeof(uint32_t);
+    if (getLittleEndian(&src[crcOffset], 4) != crc32(0, src, crcOffset)) {
+        return false;
+    }
+    size_t offset = ENCODING_SYSTEM_HEADER_SIZE;
+    for (int i = 0; i <= LINEARIZATION_ORDER; i++) {
+        uint32_t bits = getLittleEndian(&src[offset], 4);
+        memcpy(&dest->coefficients[i], &bits, sizeof(bits));
+        offset += sizeof(uint32_t);
+    }
+    dest->valid = 1;
+    return true;
+}
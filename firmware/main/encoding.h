@@ -0,0 +1,41 @@
+#ifndef RADAR_ENCODING_H
+#define RADAR_ENCODING_H
+
+#include <cstddef>
+#include <cstdint>
+#include "parameters.h"
+
+// Leading magic of the persisted settings blob ('vRSB')
+#define ENCODING_SYSTEM_MAGIC 0x76525342
+// Bump whenever fields are appended to the persisted field list
+#define ENCODING_SYSTEM_VERSION 6
+// magic(4) version(2) count(2) fields(count * 4) crc(4)
+#define ENCODING_SYSTEM_HEADER_SIZE 8
+#define ENCODING_SYSTEM_MAX_FIELDS 32
+#define ENCODING_SYSTEM_MAX_SIZE (ENCODING_SYSTEM_HEADER_SIZE + ENCODING_SYSTEM_MAX_FIELDS * 4 + 4)
+
+// Leading magic of the persisted VCO linearization blob ('vRVL')
+#define ENCODING_LINEARIZATION_MAGIC 0x7652564C
+#define ENCODING_LINEARIZATION_VERSION 1
+// magic(4) version(2) count(2) coefficients(count * 4) crc(4)
+#define ENCODING_LINEARIZATION_SIZE (ENCODING_SYSTEM_HEADER_SIZE + (LINEARIZATION_ORDER + 1) * 4 + 4)
+
+// Standard reflected CRC-32 (polynomial 0xEDB88320), crc is the running value, starting at zero
+uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length);
+
+// Serialize the system settings into dest, returns the encoded length or zero if dest is too small
+size_t encodeSystem(const System &system, uint8_t *dest, size_t length);
+
+// Deserialize a blob produced by encodeSystem into dest. Fields missing from older versions keep the value already
+// held by dest. Returns false if the blob is truncated, corrupt or not a settings blob.
+bool decodeSystem(const uint8_t *src, size_t length, System *dest);
+
+// Serialize the VCO linearization into dest, returns the encoded length or zero if dest is too small
+size_t encodeLinearization(const Linearization &linearization, uint8_t *dest, size_t length);
+
+// Deserialize a blob produced by encodeLinearization into dest and mark it valid. Returns false if the blob is
+// truncated, corrupt or of a different polynomial order.
+bool decodeLinearization(const uint8_t *src, size_t length, Linearization *dest);
+
+
+#endif //RADAR_ENCODING_H
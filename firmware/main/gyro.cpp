@@ -2,233 +2,235 @@
 // Created by Braden Nicholson on 4/19/23.
 //
 
+#include <driver/gpio.h>
+#include <esp_timer.h>
+#include <cmath>
 #include "gyro.h"
 #include "settings.h"
 
-#define I2C_MASTER_SDA_IO CONFIG_vRADAR_GYRO_SDA
-#define I2C_MASTER_SCL_IO CONFIG_vRADAR_GYRO_SCL
-
-#define I2C_MASTER_NUM I2C_NUM_0
-#define I2C_MASTER_FREQ_HZ 100000
-#define LSM6DSM_I2C_ADDRESS 0x6B
-#define GYRO_CONFIG_UPDATE_PERIOD (1000*1000)
-#define GYRO_POLL_PERIOD (1000*500)
-
-int32_t platform_read(void *handle, uint8_t reg, uint8_t *bufp, uint16_t len) {
-    i2c_port_t i2c_num = *((i2c_port_t *) handle);
-
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (LSM6DSM_I2C_ADDRESS << 1) | I2C_MASTER_WRITE, true);
-    i2c_master_write_byte(cmd, reg, true);
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (LSM6DSM_I2C_ADDRESS << 1) | I2C_MASTER_READ, true);
-    i2c_master_read(cmd, bufp, len, I2C_MASTER_LAST_NACK);
-    i2c_master_stop(cmd);
-    esp_err_t ret = i2c_master_cmd_begin(i2c_num, cmd, 1000 / portTICK_PERIOD_MS);
-    i2c_cmd_link_delete(cmd);
-
-    return ret;
-}
-
-int32_t platform_write(void *handle, uint8_t reg, const uint8_t *bufp, uint16_t len) {
-    i2c_port_t i2c_num = *((i2c_port_t *) handle);
-
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (LSM6DSM_I2C_ADDRESS << 1) | I2C_MASTER_WRITE, true);
-    i2c_master_write_byte(cmd, reg, true);
-    i2c_master_write(cmd, bufp, len, true);
-    i2c_master_stop(cmd);
-    esp_err_t ret = i2c_master_cmd_begin(i2c_num, cmd, 1000 / portTICK_PERIOD_MS);
-    i2c_cmd_link_delete(cmd);
+#define GYRO_SDA ((gpio_num_t) CONFIG_vRADAR_GYRO_SDA)
+#define GYRO_SCL ((gpio_num_t) CONFIG_vRADAR_GYRO_SCL)
+#define GYRO_INT ((gpio_num_t) CONFIG_vRADAR_GYRO_INT)
+
+// Sample sets per batch, a batch is read every half second
+#define GYRO_FIFO_BATCH 208
+// Sample sets per batch while frames are compensated for vibration, every 38 ms so they wait little on the IMU
+#define GYRO_VIBRATION_BATCH 16
+// Least time between reports of the orientation, a little under the half second batch so each of those still goes out
+#define GYRO_PUBLISH_MS 400
+// Drain the FIFO anyway if the watermark edge has not come in this long
+#define GYRO_FIFO_TIMEOUT_MS 1000
+// Longest a motion report waits for room in the ring buffer
+#define GYRO_MOTION_WAIT_MS 50
 
-    return ret;
+esp_err_t Gyro::initializeGyroDevice() {
+    // The bus and its device handle stay up for the life of the gyro
+    esp_err_t err = bus.initialize();
+    if (err != ESP_OK) {
+        return err;
+    }
+    batch = GYRO_FIFO_BATCH;
+    return imu.configure(batch, CONFIG_vRADAR_GYRO_WAKE);
 }
 
-esp_err_t Gyro::initializeGyroDevice() {
+void Gyro::settingsChanged(uint32_t changes, const System &system, uint32_t generation, void *ctx) {
+    auto *gyro = (Gyro *) ctx;
 
-    i2c_config_t conf = {
-            .mode = I2C_MODE_MASTER,
-            .sda_io_num = I2C_MASTER_SDA_IO,
-            .scl_io_num = I2C_MASTER_SCL_IO,
-            .sda_pullup_en = GPIO_PULLUP_ENABLE,
-            .scl_pullup_en = GPIO_PULLUP_ENABLE,
-    };
+    gyro->enabled = system.gyro > 0;
+    gyro->compensating = system.vibration == VIBRATION_COMPENSATE;
 
-    conf.master.clk_speed = I2C_MASTER_FREQ_HZ, i2c_param_config(I2C_MASTER_NUM, &conf);
+    // The gyro task starts or stops the FIFO, the bus is only ever used from there
+    if (gyro->task != nullptr) {
+        xTaskNotifyGive(gyro->task);
+    }
+}
 
-    esp_err_t err;
-    err = i2c_driver_install(I2C_MASTER_NUM, conf.mode, 0, 0, 0);
+esp_err_t Gyro::setStreaming(bool stream) {
+    // Bypass mode empties the FIFO and holds it empty
+    esp_err_t err = imu.stream(stream);
     if (err != ESP_OK) {
         return err;
     }
-
-    auto *p = (i2c_port_t *) malloc(sizeof(i2c_port_t));
-    if (p == nullptr) {
-        printf("Failed to allocate memory for i2c_port_t\n");
-        return ESP_ERR_NO_MEM;
+    streaming = stream;
+    // Whatever the clock and the vibration filters had counted up to is gone with the FIFO
+    clock.reset();
+    if (vibration != nullptr) {
+        vibration->reset();
+    }
+    if (stream) {
+        // The gyroscope was powered down, and the module may have been moved meanwhile
+        orientation.realign();
     }
-
-    *p = I2C_NUM_0;
-
-    device = {};
-    device.write_reg = platform_write;
-    device.read_reg = platform_read;
-    device.handle = (void *) p;
-
-    // Configure Accelerometer data rate
-    lsm6dsm_xl_data_rate_set(&device, LSM6DSM_XL_ODR_104Hz);
-    lsm6dsm_xl_full_scale_set(&device, LSM6DSM_2g);
-
-    // Configure gyroscope data rate
-    lsm6dsm_gy_data_rate_set(&device, LSM6DSM_GY_ODR_104Hz);
-    lsm6dsm_gy_full_scale_set(&device, LSM6DSM_2000dps);
-
     return ESP_OK;
-
-
 }
 
-void lsm6dsm_read_data(stmdev_ctx_t *dev_ctx,
-                       int16_t *ax, int16_t *ay, int16_t *az, int16_t *gx, int16_t *gy, int16_t *gz) {
-
-    uint8_t data_raw_accel[6];
-    uint8_t data_raw_gyro[6];
+bool Gyro::drain(int64_t edge) {
+    size_t parsed = 0;
+    uint32_t overruns = imu.overruns;
+    uint64_t discarded = imu.parser.discarded;
+    esp_err_t err = imu.drain(samples, sizeof(samples) / sizeof(ImuSample), &parsed);
+    // Sets went missing, counting on from the last edge would put the rest in the wrong place
+    if (err != ESP_OK || imu.overruns != overruns || imu.parser.discarded != discarded) {
+        clock.reset();
+        if (vibration != nullptr) {
+            vibration->reset();
+        }
+    }
+    if (err != ESP_OK || parsed == 0) {
+        return false;
+    }
 
-    // Read accelerometer and gyroscope data
-    lsm6dsm_acceleration_raw_get(dev_ctx, reinterpret_cast<int16_t *>(data_raw_accel));
-    lsm6dsm_angular_rate_raw_get(dev_ctx, reinterpret_cast<int16_t *>(data_raw_gyro));
+    // INT1 also rises on motion, the edge marks the watermark only if the FIFO had reached it. The newest set parsed
+    // is the last the status counted, the sets past the watermark came in after the edge.
+    auto sets = (uint32_t) (imu.status.words / IMU_FIFO_PATTERN);
+    bool watermark = edge != 0 && imu.status.watermark && sets >= batch;
+    bool timed = clock.stamp(watermark ? edge : 0, watermark ? sets - batch : 0, parsed, times);
+
+    // The temperature comes in while the batch runs through the filter
+    bool reading = imu.beginOutputs() == ESP_OK;
+
+    // Every sample goes through the filter, only where the batch leaves it is published
+    for (size_t i = 0; i < parsed; i++) {
+        float gyro[3], accel[3];
+        for (int axis = 0; axis < 3; axis++) {
+            gyro[axis] = (float) samples[i].gyro[axis] * IMU_GYRO_RADIANS;
+            accel[axis] = (float) samples[i].accel[axis] * IMU_ACCEL_G;
+        }
+        orientation.update(gyro, accel);
+        if (vibration != nullptr && timed) {
+            vibration->add(times[i], accel);
+        }
+    }
 
-    // Convert raw data to int16_t
-    *ax = (int16_t) (data_raw_accel[0] | (data_raw_accel[1] << 8));
-    *ay = (int16_t) (data_raw_accel[2] | (data_raw_accel[3] << 8));
-    *az = (int16_t) (data_raw_accel[4] | (data_raw_accel[5] << 8));
-    *gx = (int16_t) (data_raw_gyro[0] | (data_raw_gyro[1] << 8));
-    *gy = (int16_t) (data_raw_gyro[2] | (data_raw_gyro[3] << 8));
-    *gz = (int16_t) (data_raw_gyro[4] | (data_raw_gyro[5] << 8));
+    ImuOutputs outputs{};
+    if (reading && imu.finishOutputs(&outputs, ESP_I2C_TIMEOUT_MS) == ESP_OK) {
+        temperature = outputs.temperature;
+    }
+    return true;
 }
 
+void Gyro::publish(uint8_t detected) {
+    EulerAngles angles = orientation.angles();
+    Quaternion q = orientation.quaternion();
+    I2CStats stats = bus.stats();
+    GyroData data = {
+            .roll = angles.roll,
+            .pitch = angles.pitch,
+            .yaw = angles.yaw,
+            .quaternion = {q.w, q.x, q.y, q.z},
+            .settled = orientation.settled(),
+            .temperature = temperature,
+            .errors = (uint32_t) (stats.nacks + stats.timeouts + stats.errors),
+            .motion = detected,
+            .motions = motions,
+    };
 
-void calculate_angles(int16_t ax, int16_t ay, int16_t az, float *roll, float *pitch) {
-    float scale = 0.061;
-
-    float ax_g = (float) ax * scale / 1000.0f; // Convert to g (assuming ±2g scale)
-    float ay_g = (float) ay * scale / 1000.0f; // Convert to g (assuming ±2g scale)
-    float az_g = (float) az * scale / 1000.0f; // Convert to g (assuming ±2g scale)
-
-    *roll = (float) atan2(-ay_g, -az_g) * 180.0f / (float) M_PI;
-    *pitch = (float) atan2(ax_g, sqrt(ay_g * ay_g + az_g * az_g)) * 180.0f / (float) M_PI;
+    // Motion is worth waiting on room for, a missed batch is not
+    TickType_t wait = detected != 0 ? pdMS_TO_TICKS(GYRO_MOTION_WAIT_MS) : 0;
+    xRingbufferSend(ringBuffer, (void *) &data, sizeof(GyroData), wait);
 }
 
-void Gyro::configTimerCallback(void *params) {
+void Gyro::gyroTask(void *params) {
     auto *gyro = (Gyro *) params;
 
-    auto settings = Settings::instance();
-    auto system = settings.getSystem();
-
-    if (gyro->rate != system.gyro) {
-
-        esp_err_t err;
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(GYRO_FIFO_TIMEOUT_MS));
 
-        bool active = esp_timer_is_active(gyro->taskTimer);
-
-        if (active) {
-            err = esp_timer_stop(gyro->taskTimer);
+        bool enable = gyro->enabled;
+        if (enable != gyro->streaming) {
+            esp_err_t err = gyro->setStreaming(enable);
             if (err != ESP_OK) {
-                printf("Failed to stop periodic taskTimer: %s\n", esp_err_to_name(err));
-                return;
+                printf("Failed to set the gyro FIFO mode: %s\n", esp_err_to_name(err));
+                continue;
             }
         }
 
-        if (system.gyro <= 0) {
-            gyro->rate = system.gyro;
-            return;
+        // Small batches while frames wait on the IMU to be compensated, the clock counts from the new watermark
+        uint16_t wanted = gyro->compensating ? GYRO_VIBRATION_BATCH : GYRO_FIFO_BATCH;
+        if (wanted != gyro->batch && gyro->imu.watermark(wanted) == ESP_OK) {
+            gyro->batch = wanted;
+            gyro->clock.reset();
         }
 
-        err = esp_timer_start_periodic(gyro->taskTimer, gyro->rate * 250);
-        if (err != ESP_OK) {
-            printf("Failed to start periodic taskTimer: %s\n", esp_err_to_name(err));
-            return;
+        // INT1 stays up while motion is latched, so its sources are read on every wake
+        uint8_t detected = 0;
+        if (gyro->imu.motion(&detected) == ESP_OK && detected != 0) {
+            gyro->motions++;
+            // The mount was bumped or moved, the orientation before it no longer holds
+            gyro->orientation.realign();
         }
 
-        gyro->rate = system.gyro;
-
+        bool filtered = gyro->streaming && gyro->drain(gyro->takeEdge());
+        int64_t now = esp_timer_get_time();
+        if (detected != 0 || (filtered && now - gyro->published >= (int64_t) GYRO_PUBLISH_MS * 1000)) {
+            gyro->publish(detected);
+            gyro->published = now;
+        }
     }
-
-
 }
 
-void Gyro::taskTimerCallback(void *params) {
-    auto *gyro = (Gyro *) params;
-
-    if (gyro->rate <= 0) return;
-
-    int16_t ax, ay, az, gx, gy, gz;
-    float roll, pitch;
-
-    GyroData data{};
-
-    lsm6dsm_read_data(&gyro->device, &ax, &ay, &az, &gx, &gy, &gz);
-    calculate_angles(ax, ay, az, &roll, &pitch);
-
-    data.roll = roll;
-    data.pitch = pitch;
-
-    xRingbufferSend(gyro->ringBuffer, (void *) &data, sizeof(GyroData), 0);
+void IRAM_ATTR Gyro::int1Interrupt(void *arg) {
+    auto *gyro = (Gyro *) arg;
+    // The edge pins down when the watermark set was written, the task is only woken up by it
+    int64_t now = esp_timer_get_time();
+    taskENTER_CRITICAL_ISR(&gyro->edgeLock);
+    gyro->edge = now;
+    taskEXIT_CRITICAL_ISR(&gyro->edgeLock);
+    BaseType_t mustYield = pdFALSE;
+    vTaskNotifyGiveFromISR(gyro->task, &mustYield);
+    portYIELD_FROM_ISR(mustYield);
 }
 
-esp_err_t Gyro::initializeConfigurationTimer() {
-    configTimer = {};
-    // Define the periodic configuration timer
-    const esp_timer_create_args_t periodic_timer_args = {
-            .callback = configTimerCallback,
-            .arg = this,
-            .name = "gyroConfiguration"
-    };
-    esp_err_t err;
-    // Initialize the periodic timer
-    err = esp_timer_create(&periodic_timer_args, &configTimer);
-    if (err != ESP_OK) {
-        return err;
-    }
-    // Set the periodic timer to update every second
-    err = esp_timer_start_periodic(configTimer, GYRO_CONFIG_UPDATE_PERIOD);
-    if (err != ESP_OK) {
-        return err;
-    }
-
-    return ESP_OK;
+int64_t Gyro::takeEdge() {
+    taskENTER_CRITICAL(&edgeLock);
+    int64_t taken = edge;
+    edge = 0;
+    taskEXIT_CRITICAL(&edgeLock);
+    return taken;
 }
 
-esp_err_t Gyro::initializeTaskTimer() {
-    taskTimer = {};
-    rate = GYRO_POLL_PERIOD / 1000;
-    // Define the periodic configuration timer
-    const esp_timer_create_args_t periodic_timer_args = {
-            .callback = taskTimerCallback,
-            .arg = this,
-            .name = "gyroTask"
+esp_err_t Gyro::initializeInterrupt() {
+    gpio_config_t io_conf = {
+            .pin_bit_mask = (1ULL << GYRO_INT),
+            .mode = GPIO_MODE_INPUT,
+            .pull_up_en = GPIO_PULLUP_DISABLE,
+            .pull_down_en = GPIO_PULLDOWN_ENABLE,
+            .intr_type = GPIO_INTR_POSEDGE,
     };
 
     esp_err_t err;
 
-    // Initialize the periodic timer
-    err = esp_timer_create(&periodic_timer_args, &taskTimer);
+    err = gpio_config(&io_conf);
     if (err != ESP_OK) {
         return err;
     }
 
-    // Set the periodic timer to update every second
-    err = esp_timer_start_periodic(taskTimer, rate * 1000);
-    if (err != ESP_OK) {
+    // The service may already be installed by another driver
+    err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
         return err;
     }
 
+    return gpio_isr_handler_add(GYRO_INT, int1Interrupt, this);
+}
+
+esp_err_t Gyro::initializeSubscription() {
+    auto &settings = Settings::instance();
+    // Apply the persisted enable
+    System system{};
+    uint32_t current = settings.getSystem(&system);
+    settingsChanged(SETTINGS_GYRO | SETTINGS_VIBRATION, system, current, this);
+    // Start or stop the FIFO whenever the gyro setting is published, and resize its batches with the vibration one
+    if (!settings.subscribe(SETTINGS_GYRO | SETTINGS_VIBRATION, settingsChanged, this)) {
+        return ESP_ERR_NO_MEM;
+    }
+
     return ESP_OK;
 }
 
-Gyro::Gyro(RingbufHandle_t handle) : ringBuffer(handle) {
+Gyro::Gyro(RingbufHandle_t handle, Vibration *vibration)
+        : bus(I2C_NUM_0, GYRO_SDA, GYRO_SCL, CONFIG_vRADAR_GYRO_I2C_HZ), imu(bus), ringBuffer(handle),
+          vibration(vibration), orientation(IMU_RATE) {
 
     esp_err_t err;
 
@@ -238,41 +240,34 @@ Gyro::Gyro(RingbufHandle_t handle) : ringBuffer(handle) {
         return;
     }
 
-    err = initializeConfigurationTimer();
-    if (err != ESP_OK) {
-        printf("Failed to initialize config timers: %s\n", esp_err_to_name(err));
+    // Bus transfers happen here rather than in the esp_timer task, where they would hold up every other timer
+    if (xTaskCreate(gyroTask, "gyroTask", 4096, this, tskIDLE_PRIORITY + 2, &task) != pdPASS) {
+        printf("Failed to create the gyro task\n");
         return;
     }
 
-    err = initializeTaskTimer();
+    err = initializeInterrupt();
     if (err != ESP_OK) {
-        printf("Failed to initialize task timer: %s\n", esp_err_to_name(err));
-        return;
+        printf("Failed to initialize the gyro interrupt: %s\n", esp_err_to_name(err));
     }
 
-}
-
-Gyro::~Gyro() {
-
-    esp_err_t err;
-    err = esp_timer_stop(configTimer);
+    err = initializeSubscription();
     if (err != ESP_OK) {
-        printf("Failed to stop configuration timer: %s\n", esp_err_to_name(err));
+        printf("Failed to subscribe to gyro settings: %s\n", esp_err_to_name(err));
+        return;
     }
 
-    err = esp_timer_stop(taskTimer);
-    if (err != ESP_OK) {
-        printf("Failed to stop task timer: %s\n", esp_err_to_name(err));
-    }
+}
 
-    err = i2c_master_stop(device.handle);
-    if (err != ESP_OK) {
-        printf("Failed to stop i2c master bus: %s\n", esp_err_to_name(err));
-    }
+I2CStats Gyro::busStats() {
+    return bus.stats();
+}
 
-    err = i2c_driver_delete(I2C_MASTER_NUM);
-    if (err != ESP_OK) {
-        printf("Failed to initialize the i2c driver: %s\n", esp_err_to_name(err));
+Gyro::~Gyro() {
+
+    gpio_isr_handler_remove(GYRO_INT);
+    if (task != nullptr) {
+        vTaskDelete(task);
     }
 
 }
@@ -5,35 +5,52 @@
 #ifndef RADAR_GYRO_H
 #define RADAR_GYRO_H
 
-#include <esp_timer.h>
+#include <atomic>
 #include <cstdio>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/ringbuf.h"
-#include "lsm6dsm_reg.h"
-#include "driver/i2c.h"
-
-static int32_t platform_write(void *handle, uint8_t reg, const uint8_t *bufp,
-                              uint16_t len);
-
-static int32_t platform_read(void *handle, uint8_t reg, uint8_t *bufp,
-                             uint16_t len);
+#include "settings.h"
+#include "hal_esp.h"
+#include "imu.h"
+#include "orientation.h"
+#include "vibration.h"
 
 typedef struct GyroData {
+    // Degrees
     float roll;
     float pitch;
+    float yaw;
+    // w, x, y, z
+    float quaternion[4];
+    // Whether the gyroscope bias has been estimated, until then the angles are the accelerometer tilt
+    bool settled;
+    // Die temperature of the LSM6DSM in degrees Celsius
+    float temperature;
+    // Failed transfers on the gyro bus since boot
+    uint32_t errors;
+    // IMU_MOTION bits detected since the last report, reported as soon as they come in
+    uint8_t motion;
+    // Motion detected since boot
+    uint32_t motions;
 } GyroData;
 
 class Gyro {
 
 public:
 
-    explicit Gyro(RingbufHandle_t handle);
+    // Accelerometer samples are also fed to vibration when it is given, timed on the esp_timer clock
+    explicit Gyro(RingbufHandle_t handle, Vibration *vibration = nullptr);
 
     ~Gyro();
 
+    I2CStats busStats();
+
 private:
-    stmdev_ctx_t device{};
+
+    EspI2CBus bus;
+
+    Imu imu;
 
     TaskHandle_t task{};
 
@@ -41,19 +58,49 @@ private:
 
     RingbufHandle_t ringBuffer;
 
-    esp_timer_handle_t configTimer{};
+    esp_err_t initializeSubscription();
+
+    // Set by the settings subscriber, applied to the FIFO by the gyro task which owns the bus
+    std::atomic<bool> enabled{true};
+    std::atomic<bool> compensating{false};
+    bool streaming = false;
+    // Sets per batch the watermark is at
+    uint16_t batch = 0;
+
+    static void settingsChanged(uint32_t changes, const System &system, uint32_t generation, void *ctx);
+
+    esp_err_t initializeInterrupt();
+
+    static void int1Interrupt(void *arg);
+
+    // When INT1 last rose, taken by the gyro task. A 64-bit store is not atomic here, so the ISR holds a spinlock.
+    portMUX_TYPE edgeLock = portMUX_INITIALIZER_UNLOCKED;
+    int64_t edge = 0;
+
+    // The edge since the last call, zero if INT1 has not risen
+    int64_t takeEdge();
 
-    esp_timer_handle_t taskTimer{};
+    esp_err_t setStreaming(bool stream);
 
-    esp_err_t initializeConfigurationTimer();
+    // Burst read everything in the FIFO and run each sample through the filter, false if there was nothing. edge is
+    // when INT1 rose ahead of the drain, zero if it did not.
+    bool drain(int64_t edge);
 
-    int32_t rate = 0;
+    // Send where the filter is with the motion just detected
+    void publish(uint8_t detected);
 
-    static void configTimerCallback(void *params);
+    uint32_t motions = 0;
+    // When the orientation was last published
+    int64_t published = 0;
 
-    esp_err_t initializeTaskTimer();
+    static void gyroTask(void *params);
 
-    static void taskTimerCallback(void *params);
+    ImuSample samples[IMU_FIFO_WORDS / IMU_FIFO_PATTERN + 1]{};
+    int64_t times[IMU_FIFO_WORDS / IMU_FIFO_PATTERN + 1]{};
+    ImuFifoClock clock{IMU_RATE};
+    Vibration *vibration;
+    Orientation orientation;
+    float temperature = 0;
 };
 
 
@@ -0,0 +1,137 @@
+#ifndef RADAR_HAL_H
+#define RADAR_HAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <esp_err.h>
+
+// Thin interfaces over the peripherals the acquisition pipeline touches. The firmware implements them with the ESP-IDF
+// drivers (hal_esp.h), the host build implements them with simulations so the same pipeline logic runs on a
+// workstation.
+
+// AdcSource produces TYPE2 conversion words from the four IF lanes
+class AdcSource {
+public:
+
+    virtual ~AdcSource() = default;
+
+    // Begin converting, the first words belong to the start of a frame
+    virtual esp_err_t start() = 0;
+
+    // Block until conversion words are available and copy up to length bytes of them into dest
+    virtual esp_err_t read(uint8_t *dest, uint32_t length, uint32_t *read) = 0;
+
+    virtual esp_err_t stop() = 0;
+
+};
+
+// DacBus shifts MCP4922 command words out and latches them together
+class DacBus {
+public:
+
+    virtual ~DacBus() = default;
+
+    virtual void write(const uint16_t *words, int count) = 0;
+
+};
+
+// Called from the chirp timer at every period, returns true if a higher priority task was woken
+typedef bool (*ChirpAlarm)(void *ctx);
+
+// ChirpTimer calls an alarm at a fixed period in microseconds
+class ChirpTimer {
+public:
+
+    virtual ~ChirpTimer() = default;
+
+    virtual esp_err_t initialize(ChirpAlarm alarm, void *ctx) = 0;
+
+    virtual esp_err_t setPeriod(uint32_t period) = 0;
+
+    // Restart counting from zero, the first alarm follows one full period
+    virtual esp_err_t start() = 0;
+
+    virtual esp_err_t stop() = 0;
+
+    // Release the timer while the chirp train is idle, it must be resumed before it is started again
+    virtual esp_err_t suspend() = 0;
+
+    virtual esp_err_t resume() = 0;
+
+};
+
+typedef struct I2CStats {
+    uint64_t transfers;
+    // Register and payload bytes moved, not counting the address bytes
+    uint64_t bytes;
+    // Transfers the device did not acknowledge, that ran out of time, and that failed otherwise
+    uint64_t nacks;
+    uint64_t timeouts;
+    uint64_t errors;
+    // Microseconds the bus spent on transfers
+    uint64_t busy;
+} I2CStats;
+
+// I2CBus reads and writes the registers of devices on the bus
+class I2CBus {
+public:
+
+    virtual ~I2CBus() = default;
+
+    virtual esp_err_t read(uint8_t address, uint8_t reg, uint8_t *dest, size_t length) = 0;
+
+    virtual esp_err_t write(uint8_t address, uint8_t reg, const uint8_t *src, size_t length) = 0;
+
+    // Start reading registers and return before the transfer completes, finish waits up to timeout milliseconds for
+    // it. One read is in flight at a time and dest must stay valid until it has finished. A bus without asynchronous
+    // transfers reads here and finishes at once.
+    virtual esp_err_t begin(uint8_t address, uint8_t reg, uint8_t *dest, size_t length) {
+        pending = read(address, reg, dest, length);
+        return ESP_OK;
+    }
+
+    virtual esp_err_t finish(uint32_t timeout) {
+        return pending;
+    }
+
+    virtual I2CStats stats() = 0;
+
+protected:
+
+    esp_err_t pending = ESP_OK;
+
+};
+
+// Transport delivers frames and telemetry to the connected client
+class Transport {
+public:
+
+    virtual ~Transport() = default;
+
+    // True while a client is connected
+    virtual bool connected() = 0;
+
+    virtual esp_err_t send(const uint8_t *data, size_t length, bool binary) = 0;
+
+};
+
+// Storage keeps values by key in flash, writes are not durable until committed
+class Storage {
+public:
+
+    virtual ~Storage() = default;
+
+    // Read an integer, dest is set to fallback if the key was never written
+    virtual esp_err_t readInt(const char *key, int32_t *dest, int32_t fallback) = 0;
+
+    // Read a blob into dest, length holds the capacity of dest and is set to the stored length
+    virtual esp_err_t readBlob(const char *key, void *dest, size_t *length) = 0;
+
+    virtual esp_err_t writeBlob(const char *key, const void *value, size_t length) = 0;
+
+    virtual esp_err_t commit() = 0;
+
+};
+
+
+#endif //RADAR_HAL_H
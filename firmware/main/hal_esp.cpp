@@ -0,0 +1,367 @@
+#include <cstring>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <hal/gpio_ll.h>
+#include <esp_timer.h>
+#include "hal_esp.h"
+
+EspAdcSource::EspAdcSource(adc_continuous_handle_t *handle) : handle(handle) {}
+
+esp_err_t EspAdcSource::start() {
+    return adc_continuous_start(*handle);
+}
+
+esp_err_t EspAdcSource::read(uint8_t *dest, uint32_t length, uint32_t *read) {
+    // Wait for the conversion to complete
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    // Read the info from DMA into the local stack memory
+    esp_err_t err = adc_continuous_read(*handle, dest, length, read, portMAX_DELAY);
+    if (err == ESP_ERR_TIMEOUT) {
+        vTaskDelay(1);
+    }
+    return err;
+}
+
+esp_err_t EspAdcSource::stop() {
+    return adc_continuous_stop(*handle);
+}
+
+EspDacBus::EspDacBus(gpio_num_t latch) : latch(latch) {}
+
+// Shift one MCP4922 command word out with a polling transaction, one chip select cycle
+static void IRAM_ATTR writeWord(spi_device_handle_t handle, uint16_t word) {
+    spi_transaction_t transaction = {
+            .flags = SPI_TRANS_USE_TXDATA,
+            .length = 16,
+            .tx_data = {static_cast<uint8_t>(word >> 8), static_cast<uint8_t>(word & 0xFF)}
+    };
+    // The bus is already acquired, so neither call waits on a lock or a queue
+    if (spi_device_polling_start(handle, &transaction, 0) != ESP_OK) {
+        return;
+    }
+    spi_device_polling_end(handle, portMAX_DELAY);
+}
+
+// Write the given command words and latch them together, channel A and B change on the same LDAC edge
+void IRAM_ATTR EspDacBus::write(const uint16_t *words, int count) {
+    // Hold the outputs while the words are shifted in
+    gpio_ll_set_level(&GPIO, latch, 1);
+    for (int i = 0; i < count; i++) {
+        writeWord(device, words[i]);
+    }
+    gpio_ll_set_level(&GPIO, latch, 0);
+}
+
+EspChirpTimer::~EspChirpTimer() {
+    if (timer == nullptr) {
+        return;
+    }
+    esp_err_t err;
+    if (enabled) {
+        err = gptimer_disable(timer);
+        if (err != ESP_OK) {
+            printf("Failed to disable chirpTimer: %s\n", esp_err_to_name(err));
+        }
+    }
+    err = gptimer_del_timer(timer);
+    if (err != ESP_OK) {
+        printf("Failed to delete chirpTimer: %s\n", esp_err_to_name(err));
+    }
+}
+
+bool IRAM_ATTR EspChirpTimer::onAlarm(gptimer_handle_t handle, const gptimer_alarm_event_data_t *event, void *user) {
+    auto chirpTimer = (EspChirpTimer *) user;
+    return chirpTimer->alarm(chirpTimer->ctx);
+}
+
+esp_err_t EspChirpTimer::initialize(ChirpAlarm next, void *nextCtx) {
+    alarm = next;
+    ctx = nextCtx;
+
+    gptimer_config_t chirpTimerConfig = {
+            .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+            .direction = GPTIMER_COUNT_UP,
+            .resolution_hz = 1 * 1000 * 1000, // 1MHz, 1 tick = 1us
+    };
+
+    esp_err_t err;
+
+    err = gptimer_new_timer(&chirpTimerConfig, &timer);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = setPeriod(100);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    gptimer_event_callbacks_t alarm_on_callback = {
+            .on_alarm = onAlarm, // register user callback
+    };
+
+    err = gptimer_register_event_callbacks(timer, &alarm_on_callback, this);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    return resume();
+}
+
+esp_err_t EspChirpTimer::setPeriod(uint32_t period) {
+    gptimer_alarm_config_t alarm_on = {
+            .alarm_count = period,
+            .reload_count = 0, // counter will reload with 0 on alarm event
+            .flags {
+                    .auto_reload_on_alarm = true, // enable auto-reload
+            }
+    };
+    return gptimer_set_alarm_action(timer, &alarm_on);
+}
+
+esp_err_t EspChirpTimer::start() {
+    esp_err_t err = gptimer_set_raw_count(timer, 0);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return gptimer_start(timer);
+}
+
+esp_err_t EspChirpTimer::stop() {
+    return gptimer_stop(timer);
+}
+
+esp_err_t EspChirpTimer::suspend() {
+    if (!enabled) {
+        return ESP_OK;
+    }
+    // A disabled timer releases its power management lock
+    esp_err_t err = gptimer_disable(timer);
+    if (err != ESP_OK) {
+        return err;
+    }
+    enabled = false;
+    return ESP_OK;
+}
+
+esp_err_t EspChirpTimer::resume() {
+    if (enabled) {
+        return ESP_OK;
+    }
+    esp_err_t err = gptimer_enable(timer);
+    if (err != ESP_OK) {
+        return err;
+    }
+    enabled = true;
+    return ESP_OK;
+}
+
+EspI2CBus::EspI2CBus(i2c_port_num_t port, gpio_num_t sda, gpio_num_t scl, uint32_t frequency) : port(port), sda(sda),
+                                                                                              scl(scl),
+                                                                                              frequency(frequency) {}
+
+EspI2CBus::~EspI2CBus() {
+    for (int i = 0; i < attached; i++) {
+        i2c_master_bus_rm_device(devices[i].handle);
+    }
+    if (bus != nullptr) {
+        i2c_del_master_bus(bus);
+    }
+    if (done != nullptr) {
+        vSemaphoreDelete(done);
+    }
+}
+
+esp_err_t EspI2CBus::initialize() {
+    done = xSemaphoreCreateBinary();
+    if (done == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    i2c_master_bus_config_t config = {
+            .i2c_port = port,
+            .sda_io_num = sda,
+            .scl_io_num = scl,
+            .clk_source = I2C_CLK_SRC_DEFAULT,
+            .glitch_ignore_cnt = 7,
+            .intr_priority = 0,
+            .trans_queue_depth = ESP_I2C_QUEUE_DEPTH,
+            .flags = {
+                    .enable_internal_pullup = true,
+            },
+    };
+    return i2c_new_master_bus(&config, &bus);
+}
+
+bool IRAM_ATTR EspI2CBus::onDone(i2c_master_dev_handle_t handle, const i2c_master_event_data_t *event, void *user) {
+    auto *self = (EspI2CBus *) user;
+    self->event = event->event;
+    self->completed = esp_timer_get_time();
+    BaseType_t mustYield = pdFALSE;
+    xSemaphoreGiveFromISR(self->done, &mustYield);
+    return mustYield == pdTRUE;
+}
+
+i2c_master_dev_handle_t EspI2CBus::device(uint8_t address) {
+    for (int i = 0; i < attached; i++) {
+        if (devices[i].address == address) {
+            return devices[i].handle;
+        }
+    }
+    if (bus == nullptr || attached == ESP_I2C_DEVICES) {
+        return nullptr;
+    }
+    i2c_device_config_t config = {
+            .dev_addr_length = I2C_ADDR_BIT_LEN_7,
+            .device_address = address,
+            .scl_speed_hz = frequency,
+    };
+    i2c_master_dev_handle_t handle = nullptr;
+    if (i2c_master_bus_add_device(bus, &config, &handle) != ESP_OK) {
+        return nullptr;
+    }
+    // Every transfer on the device completes through the callback
+    i2c_master_event_callbacks_t callbacks = {
+            .on_trans_done = onDone,
+    };
+    if (i2c_master_register_event_callbacks(handle, &callbacks, this) != ESP_OK) {
+        i2c_master_bus_rm_device(handle);
+        return nullptr;
+    }
+    devices[attached++] = {address, handle};
+    return handle;
+}
+
+esp_err_t EspI2CBus::start(uint8_t address, size_t writing, uint8_t *dest, size_t length) {
+    i2c_master_dev_handle_t handle = device(address);
+    if (handle == nullptr) {
+        current.errors++;
+        published.store(current);
+        return ESP_ERR_INVALID_STATE;
+    }
+    // Clear a completion left over from a transfer that was given up on
+    xSemaphoreTake(done, 0);
+    bytes = writing + length;
+    started = esp_timer_get_time();
+    esp_err_t err = length > 0 ? i2c_master_transmit_receive(handle, scratch, writing, dest, length, -1)
+                               : i2c_master_transmit(handle, scratch, writing, -1);
+    if (err != ESP_OK) {
+        current.errors++;
+        published.store(current);
+        return err;
+    }
+    inflight = true;
+    return ESP_OK;
+}
+
+esp_err_t EspI2CBus::begin(uint8_t address, uint8_t reg, uint8_t *dest, size_t length) {
+    if (inflight) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    scratch[0] = reg;
+    return start(address, 1, dest, length);
+}
+
+esp_err_t EspI2CBus::finish(uint32_t timeout) {
+    if (!inflight) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    inflight = false;
+    esp_err_t err = ESP_OK;
+    if (xSemaphoreTake(done, pdMS_TO_TICKS(timeout)) != pdTRUE) {
+        // Let the queue run dry before the buffers of the transfer are reused
+        i2c_master_bus_wait_all_done(bus, ESP_I2C_TIMEOUT_MS);
+        current.timeouts++;
+        err = ESP_ERR_TIMEOUT;
+    } else if (event == I2C_EVENT_NACK) {
+        current.nacks++;
+        err = ESP_FAIL;
+    } else if (event != I2C_EVENT_DONE) {
+        current.errors++;
+        err = ESP_FAIL;
+    }
+    current.transfers++;
+    current.bytes += bytes;
+    // Time on the wire, not the time the caller took to come back for it
+    current.busy += (uint64_t) ((err == ESP_ERR_TIMEOUT ? esp_timer_get_time() : completed) - started);
+    published.store(current);
+    return err;
+}
+
+esp_err_t EspI2CBus::read(uint8_t address, uint8_t reg, uint8_t *dest, size_t length) {
+    esp_err_t err = begin(address, reg, dest, length);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return finish(ESP_I2C_TIMEOUT_MS);
+}
+
+esp_err_t EspI2CBus::write(uint8_t address, uint8_t reg, const uint8_t *src, size_t length) {
+    if (inflight) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (length + 1 > sizeof(scratch)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    // The register address and the payload go out in one transaction
+    scratch[0] = reg;
+    memcpy(scratch + 1, src, length);
+    esp_err_t err = start(address, length + 1, nullptr, 0);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return finish(ESP_I2C_TIMEOUT_MS);
+}
+
+I2CStats EspI2CBus::stats() {
+    I2CStats snapshot{};
+    published.load(snapshot);
+    return snapshot;
+}
+
+void EspSocketTransport::open(httpd_req_t *req) {
+    server = req->handle;
+    socket = httpd_req_to_sockfd(req);
+}
+
+bool EspSocketTransport::connected() {
+    return socket >= 0;
+}
+
+esp_err_t EspSocketTransport::send(const uint8_t *data, size_t length, bool binary) {
+    int session = socket;
+    if (session < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    httpd_ws_frame_t frame;
+    memset(&frame, 0, sizeof(httpd_ws_frame_t));
+    frame.payload = (uint8_t *) data;
+    frame.len = length;
+    frame.type = binary ? HTTPD_WS_TYPE_BINARY : HTTPD_WS_TYPE_TEXT;
+    esp_err_t err = httpd_ws_send_frame_async(server, session, &frame);
+    if (err != ESP_OK) {
+        // The client is gone, wait for the next one to open a session
+        socket = -1;
+    }
+    return err;
+}
+
+EspStorage::EspStorage(Persistent &persistent) : persistent(persistent) {}
+
+esp_err_t EspStorage::readInt(const char *key, int32_t *dest, int32_t fallback) {
+    // A missing key leaves dest untouched
+    *dest = fallback;
+    persistent.readInt(key, dest, fallback);
+    return ESP_OK;
+}
+
+esp_err_t EspStorage::readBlob(const char *key, void *dest, size_t *length) {
+    return persistent.readBlob(key, dest, length);
+}
+
+esp_err_t EspStorage::writeBlob(const char *key, const void *value, size_t length) {
+    return persistent.writeBlob(key, value, length);
+}
+
+esp_err_t EspStorage::commit() {
+    return persistent.commit();
+}
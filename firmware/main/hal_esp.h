@@ -0,0 +1,185 @@
+#ifndef RADAR_HAL_ESP_H
+#define RADAR_HAL_ESP_H
+
+#include <atomic>
+#include <driver/gpio.h>
+#include <driver/gptimer.h>
+#include <driver/i2c_master.h>
+#include <driver/spi_master.h>
+#include <esp_adc/adc_continuous.h>
+#include <esp_http_server.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "hal.h"
+#include "persistent.h"
+#include "seqlock.h"
+
+// Reads the continuous adc driver, the conversion done callback must notify the reading task
+class EspAdcSource final : public AdcSource {
+public:
+
+    // The handle is owned by the caller and may be recreated between frames
+    explicit EspAdcSource(adc_continuous_handle_t *handle);
+
+    esp_err_t start() override;
+
+    esp_err_t read(uint8_t *dest, uint32_t length, uint32_t *read) override;
+
+    esp_err_t stop() override;
+
+private:
+
+    adc_continuous_handle_t *handle;
+
+};
+
+// Writes the MCP4922 with polling transactions on an acquired SPI bus. Called on the concrete class from the chirp
+// timer interrupt, so the write runs from IRAM without reading a vtable from flash.
+class EspDacBus final : public DacBus {
+public:
+
+    explicit EspDacBus(gpio_num_t latch);
+
+    spi_device_handle_t device{};
+
+    void write(const uint16_t *words, int count) override;
+
+private:
+
+    gpio_num_t latch;
+
+};
+
+// A 1MHz gptimer that reloads at every alarm
+class EspChirpTimer final : public ChirpTimer {
+public:
+
+    ~EspChirpTimer() override;
+
+    esp_err_t initialize(ChirpAlarm alarm, void *ctx) override;
+
+    esp_err_t setPeriod(uint32_t period) override;
+
+    esp_err_t start() override;
+
+    esp_err_t stop() override;
+
+    esp_err_t suspend() override;
+
+    esp_err_t resume() override;
+
+private:
+
+    gptimer_handle_t timer{};
+    bool enabled = false;
+    ChirpAlarm alarm = nullptr;
+    void *ctx = nullptr;
+
+    static bool onAlarm(gptimer_handle_t handle, const gptimer_alarm_event_data_t *event, void *user);
+
+};
+
+// Devices the bus keeps a handle for, and the bytes of the largest register write
+#define ESP_I2C_DEVICES 4
+#define ESP_I2C_SCRATCH 32
+// Transfers queued on the bus in asynchronous mode
+#define ESP_I2C_QUEUE_DEPTH 4
+#define ESP_I2C_TIMEOUT_MS 100
+
+// Register access over the i2c_master driver in asynchronous mode. Each device gets a handle on its first transfer that
+// is kept for the life of the bus, and every transfer is queued and completes from the driver's interrupt, so begin
+// returns as soon as a read is on the wire.
+class EspI2CBus final : public I2CBus {
+public:
+
+    EspI2CBus(i2c_port_num_t port, gpio_num_t sda, gpio_num_t scl, uint32_t frequency);
+
+    ~EspI2CBus() override;
+
+    esp_err_t initialize();
+
+    esp_err_t read(uint8_t address, uint8_t reg, uint8_t *dest, size_t length) override;
+
+    esp_err_t write(uint8_t address, uint8_t reg, const uint8_t *src, size_t length) override;
+
+    esp_err_t begin(uint8_t address, uint8_t reg, uint8_t *dest, size_t length) override;
+
+    esp_err_t finish(uint32_t timeout) override;
+
+    I2CStats stats() override;
+
+private:
+
+    i2c_master_dev_handle_t device(uint8_t address);
+
+    // Queue a transfer of the scratch bytes, reading length bytes into dest if there are any
+    esp_err_t start(uint8_t address, size_t writing, uint8_t *dest, size_t length);
+
+    static bool onDone(i2c_master_dev_handle_t handle, const i2c_master_event_data_t *event, void *user);
+
+    i2c_port_num_t port;
+    gpio_num_t sda;
+    gpio_num_t scl;
+    uint32_t frequency;
+    i2c_master_bus_handle_t bus = nullptr;
+    struct {
+        uint8_t address;
+        i2c_master_dev_handle_t handle;
+    } devices[ESP_I2C_DEVICES]{};
+    int attached = 0;
+
+    SemaphoreHandle_t done = nullptr;
+    std::atomic<int> event{I2C_EVENT_DONE};
+    bool inflight = false;
+    // The register address and payload, which must outlive the call that queues them
+    uint8_t scratch[ESP_I2C_SCRATCH]{};
+    size_t bytes = 0;
+    int64_t started = 0;
+    // Set from the interrupt before the completion is given
+    volatile int64_t completed = 0;
+
+    I2CStats current{};
+    Seqlock<I2CStats> published{};
+
+};
+
+// Sends websocket frames to the session opened by the most recent client
+class EspSocketTransport final : public Transport {
+public:
+
+    // Adopt the websocket of the request as the session
+    void open(httpd_req_t *req);
+
+    bool connected() override;
+
+    esp_err_t send(const uint8_t *data, size_t length, bool binary) override;
+
+private:
+
+    httpd_handle_t server{};
+    std::atomic<int> socket{-1};
+
+};
+
+// The storage namespace of the non-volatile storage, through Persistent
+class EspStorage final : public Storage {
+public:
+
+    explicit EspStorage(Persistent &persistent);
+
+    esp_err_t readInt(const char *key, int32_t *dest, int32_t fallback) override;
+
+    esp_err_t readBlob(const char *key, void *dest, size_t *length) override;
+
+    esp_err_t writeBlob(const char *key, const void *value, size_t length) override;
+
+    esp_err_t commit() override;
+
+private:
+
+    Persistent &persistent;
+
+};
+
+
+#endif //RADAR_HAL_ESP_H
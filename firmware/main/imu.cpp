@@ -0,0 +1,155 @@
+#include "imu.h"
+
+// The driver context carries the bus, so the same register access runs against a simulated device on the host
+static int32_t platform_read(void *handle, uint8_t reg, uint8_t *bufp, uint16_t len) {
+    return ((I2CBus *) handle)->read(IMU_ADDRESS, reg, bufp, len);
+}
+
+static int32_t platform_write(void *handle, uint8_t reg, const uint8_t *bufp, uint16_t len) {
+    return ((I2CBus *) handle)->write(IMU_ADDRESS, reg, bufp, len);
+}
+
+ImuOutputs imuOutputs(const uint8_t *block) {
+    auto word = [&](int index) { return (int16_t) (block[2 * index] | block[2 * index + 1] << 8); };
+    ImuOutputs next{};
+    next.temperature = (float) word(0) / 256.0f + 25.0f;
+    for (int axis = 0; axis < 3; axis++) {
+        next.sample.gyro[axis] = word(1 + axis);
+        next.sample.accel[axis] = word(4 + axis);
+    }
+    return next;
+}
+
+uint8_t imuMotion(uint8_t wakeSource, uint8_t functionSource) {
+    auto wake = (const lsm6dsm_wake_up_src_t *) &wakeSource;
+    auto function = (const lsm6dsm_func_src1_t *) &functionSource;
+    uint8_t detected = 0;
+    detected |= wake->wu_ia ? IMU_MOTION_WAKE : 0;
+    detected |= function->tilt_ia ? IMU_MOTION_TILT : 0;
+    detected |= function->sign_motion_ia ? IMU_MOTION_SIGNIFICANT : 0;
+    return detected;
+}
+
+Imu::Imu(I2CBus &bus) : bus(bus) {
+    device.write_reg = platform_write;
+    device.read_reg = platform_read;
+    device.handle = &bus;
+}
+
+esp_err_t Imu::configure(uint16_t sets, uint8_t wake) {
+    int32_t ret = 0;
+    // Burst reads walk the registers, and FIFO_DATA_OUT wraps back on itself to pop the next word
+    ret |= lsm6dsm_auto_increment_set(&device, PROPERTY_ENABLE);
+    ret |= lsm6dsm_block_data_update_set(&device, PROPERTY_ENABLE);
+
+    ret |= lsm6dsm_xl_data_rate_set(&device, LSM6DSM_XL_ODR_416Hz);
+    ret |= lsm6dsm_xl_full_scale_set(&device, LSM6DSM_2g);
+    ret |= lsm6dsm_gy_data_rate_set(&device, LSM6DSM_GY_ODR_416Hz);
+    ret |= lsm6dsm_gy_full_scale_set(&device, LSM6DSM_2000dps);
+
+    // Batch both sensors at their data rate, the gyroscope first in each set
+    ret |= lsm6dsm_fifo_mode_set(&device, LSM6DSM_BYPASS_MODE);
+    ret |= lsm6dsm_fifo_gy_batch_set(&device, LSM6DSM_FIFO_GY_NO_DEC);
+    ret |= lsm6dsm_fifo_xl_batch_set(&device, LSM6DSM_FIFO_XL_NO_DEC);
+    ret |= lsm6dsm_fifo_data_rate_set(&device, LSM6DSM_FIFO_416Hz);
+    ret |= lsm6dsm_fifo_watermark_set(&device, (uint16_t) (sets * IMU_FIFO_PATTERN));
+
+    // Any axis past the threshold for one sample is a wake-up, the embedded functions run on the accelerometer alone
+    ret |= lsm6dsm_wkup_threshold_set(&device, wake);
+    ret |= lsm6dsm_wkup_dur_set(&device, 0);
+    ret |= lsm6dsm_tilt_sens_set(&device, PROPERTY_ENABLE);
+    ret |= lsm6dsm_motion_sens_set(&device, PROPERTY_ENABLE);
+    // Motion holds INT1 until its source is read, so none is missed between batches
+    ret |= lsm6dsm_int_notification_set(&device, LSM6DSM_INT_LATCHED);
+
+    // Raise INT1 at the watermark and on motion
+    lsm6dsm_int1_route_t route{};
+    route.int1_fth = 1;
+    route.int1_wu = 1;
+    route.int1_tilt = 1;
+    route.int1_sign_mot = 1;
+    ret |= lsm6dsm_pin_int1_route_set(&device, route);
+    return ret == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t Imu::watermark(uint16_t sets) {
+    int32_t ret = lsm6dsm_fifo_watermark_set(&device, (uint16_t) (sets * IMU_FIFO_PATTERN));
+    return ret == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t Imu::stream(bool enable) {
+    int32_t ret = 0;
+    if (enable) {
+        ret |= lsm6dsm_gy_data_rate_set(&device, LSM6DSM_GY_ODR_416Hz);
+    }
+    ret |= lsm6dsm_fifo_mode_set(&device, enable ? LSM6DSM_STREAM_MODE : LSM6DSM_BYPASS_MODE);
+    if (!enable) {
+        ret |= lsm6dsm_gy_data_rate_set(&device, LSM6DSM_GY_ODR_OFF);
+    }
+    if (ret != 0) {
+        return ESP_FAIL;
+    }
+    parser.reset();
+    return ESP_OK;
+}
+
+esp_err_t Imu::drain(ImuSample *dest, size_t capacity, size_t *count) {
+    *count = 0;
+    uint8_t registers[IMU_FIFO_STATUS_BYTES];
+    esp_err_t err = bus.read(IMU_ADDRESS, LSM6DSM_FIFO_STATUS1, registers, sizeof(registers));
+    if (err != ESP_OK) {
+        return err;
+    }
+    ImuFifoStatus fifo = imuFifoStatus(registers);
+    status = fifo;
+    if (fifo.overrun) {
+        overruns++;
+    }
+    if (fifo.empty || fifo.words == 0) {
+        return ESP_OK;
+    }
+
+    // The whole batch comes out in one transfer
+    size_t length = fifo.words < IMU_FIFO_WORDS ? fifo.words : IMU_FIFO_WORDS;
+    err = bus.read(IMU_ADDRESS, LSM6DSM_FIFO_DATA_OUT_L, words, length * 2);
+    if (err != ESP_OK) {
+        // Whatever was popped before the failure is lost
+        parser.reset();
+        return err;
+    }
+    *count = parser.parse(words, length, fifo, dest, capacity);
+    return ESP_OK;
+}
+
+esp_err_t Imu::motion(uint8_t *detected) {
+    *detected = 0;
+    // Reading each source clears its latch
+    uint8_t wake, function;
+    esp_err_t err = bus.read(IMU_ADDRESS, LSM6DSM_WAKE_UP_SRC, &wake, 1);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = bus.read(IMU_ADDRESS, LSM6DSM_FUNC_SRC1, &function, 1);
+    if (err != ESP_OK) {
+        return err;
+    }
+    *detected = imuMotion(wake, function);
+    return ESP_OK;
+}
+
+esp_err_t Imu::beginOutputs() {
+    return bus.begin(IMU_ADDRESS, LSM6DSM_OUT_TEMP_L, outputs, sizeof(outputs));
+}
+
+esp_err_t Imu::finishOutputs(ImuOutputs *dest, uint32_t timeout) {
+    esp_err_t err = bus.finish(timeout);
+    if (err != ESP_OK) {
+        return err;
+    }
+    *dest = imuOutputs(outputs);
+    return ESP_OK;
+}
+
+stmdev_ctx_t *Imu::context() {
+    return &device;
+}
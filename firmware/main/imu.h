@@ -0,0 +1,89 @@
+#ifndef RADAR_IMU_H
+#define RADAR_IMU_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include "hal.h"
+#include "imu_fifo.h"
+#include "lsm6dsm_reg.h"
+
+#define IMU_ADDRESS 0x6B
+// Output data rate of both sensors and of the FIFO, fast enough to follow vibration of the mount
+#define IMU_RATE 416
+// Full scale sensitivities at 2000 dps and 2 g, 70 mdps and 0.061 mg per least significant bit
+#define IMU_GYRO_RADIANS (0.070f * (float) M_PI / 180.0f)
+#define IMU_ACCEL_G 0.000061f
+// OUT_TEMP_L through OUTZ_H_XL, the temperature, gyroscope and accelerometer outputs read together
+#define IMU_OUTPUT_BYTES 14
+// Wake-up threshold in 1/64 of the accelerometer full scale, 62.5 mg at 2 g
+#define IMU_WAKE_THRESHOLD 2
+
+// Motion the embedded functions detected, latched until the sources are read
+#define IMU_MOTION_WAKE 0x01
+#define IMU_MOTION_TILT 0x02
+#define IMU_MOTION_SIGNIFICANT 0x04
+
+typedef struct ImuOutputs {
+    ImuSample sample;
+    // Degrees Celsius
+    float temperature;
+} ImuOutputs;
+
+// Decode the output registers from OUT_TEMP_L on
+ImuOutputs imuOutputs(const uint8_t *block);
+
+// The IMU_MOTION bits set in WAKE_UP_SRC and FUNC_SRC1
+uint8_t imuMotion(uint8_t wakeSource, uint8_t functionSource);
+
+// Imu drives the LSM6DSM through the ST register driver, whose context reads and writes through the bus. Both sensors
+// are batched into the FIFO and read back in bursts: the four status registers in one transfer, then every word
+// waiting in another, as reads of FIFO_DATA_OUT wrap around to pop the next word.
+//
+// The embedded functions watch for motion in the accelerometer: a wake-up when any axis moves past the threshold, a
+// tilt when the module comes to rest more than 35 degrees from where it last rested, and the pedometer's significant
+// motion when it is carried. They share INT1 with the watermark and latch until motion reads their sources.
+class Imu {
+public:
+
+    explicit Imu(I2CBus &bus);
+
+    // Configure both sensors at IMU_RATE into the FIFO, raising INT1 once sets are waiting or the mount moves. The
+    // FIFO is left bypassed.
+    esp_err_t configure(uint16_t sets, uint8_t wake = IMU_WAKE_THRESHOLD);
+
+    // Raise INT1 once this many sets are waiting
+    esp_err_t watermark(uint16_t sets);
+
+    // Stream into the FIFO, or bypass it, which empties it and powers the gyroscope down. Motion is still detected.
+    esp_err_t stream(bool enable);
+
+    // Read and clear the motion detected since the last call, as IMU_MOTION bits
+    esp_err_t motion(uint8_t *detected);
+
+    // Burst read everything in the FIFO, count is the sample sets completed into dest
+    esp_err_t drain(ImuSample *dest, size_t capacity, size_t *count);
+
+    // Start reading the output registers, finishOutputs waits for them
+    esp_err_t beginOutputs();
+
+    esp_err_t finishOutputs(ImuOutputs *outputs, uint32_t timeout);
+
+    stmdev_ctx_t *context();
+
+    ImuFifoParser parser{};
+    uint32_t overruns = 0;
+    // The FIFO as the last drain found it
+    ImuFifoStatus status{};
+
+private:
+
+    I2CBus &bus;
+    stmdev_ctx_t device{};
+    uint8_t words[IMU_FIFO_WORDS * 2]{};
+    uint8_t outputs[IMU_OUTPUT_BYTES]{};
+
+};
+
+
+#endif //RADAR_IMU_H
@@ -0,0 +1,100 @@
+#include <cmath>
+#include "imu_fifo.h"
+
+ImuFifoStatus imuFifoStatus(const uint8_t *status) {
+    ImuFifoStatus next{};
+    // DIFF_FIFO spans FIFO_STATUS1 and the low three bits of FIFO_STATUS2, the pattern FIFO_STATUS3 and two bits of 4
+    next.words = (uint16_t) (status[0] | (status[1] & 0x07) << 8);
+    next.empty = (status[1] & 0x10) != 0;
+    next.overrun = (status[1] & 0x40) != 0;
+    next.watermark = (status[1] & 0x80) != 0;
+    next.pattern = (uint16_t) (status[2] | (status[3] & 0x03) << 8);
+    return next;
+}
+
+size_t ImuFifoParser::parse(const uint8_t *data, size_t words, const ImuFifoStatus &status, ImuSample *dest,
+                            size_t capacity) {
+    // An overrun may drop whole sets and leave the pattern where it was, either way the words held no longer line up
+    if (status.overrun || status.pattern != position) {
+        discarded += held;
+        held = 0;
+        position = status.pattern % IMU_FIFO_PATTERN;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < words; i++) {
+        set[position++] = (int16_t) (data[2 * i] | data[2 * i + 1] << 8);
+        held++;
+        if (position < IMU_FIFO_PATTERN) {
+            continue;
+        }
+        // A set is whole when every word since its first has been read
+        bool whole = held == IMU_FIFO_PATTERN;
+        position = 0;
+        if (!whole || count == capacity) {
+            discarded += held;
+            held = 0;
+            continue;
+        }
+        held = 0;
+        ImuSample &sample = dest[count++];
+        for (int axis = 0; axis < 3; axis++) {
+            sample.gyro[axis] = set[axis];
+            sample.accel[axis] = set[3 + axis];
+        }
+    }
+    samples += count;
+    return count;
+}
+
+void ImuFifoParser::reset() {
+    discarded += held;
+    held = 0;
+    position = 0;
+}
+
+ImuFifoClock::ImuFifoClock(double rate) : nominal(1e6 / rate), interval(1e6 / rate) {
+}
+
+bool ImuFifoClock::stamp(int64_t edge, uint32_t past, size_t count, int64_t *times) {
+    if (count == 0) {
+        return anchored;
+    }
+    double predicted = newest + (double) count * interval;
+    if (edge != 0) {
+        double observed = (double) edge + (double) past * interval;
+        double error = observed - predicted;
+        if (!anchored || misses >= IMU_CLOCK_MISSES) {
+            newest = observed;
+            anchored = true;
+            misses = 0;
+        } else if (std::fabs(error) > IMU_CLOCK_TOLERANCE * interval) {
+            // A late interrupt or a set lost without an overrun, one edge is not enough to go on
+            outliers++;
+            misses++;
+            newest = predicted;
+        } else {
+            misses = 0;
+            interval += IMU_CLOCK_RATE_GAIN * error / (double) count;
+            double low = nominal * (1.0 - IMU_CLOCK_RANGE), high = nominal * (1.0 + IMU_CLOCK_RANGE);
+            interval = interval < low ? low : (interval > high ? high : interval);
+            newest = predicted + IMU_CLOCK_PHASE_GAIN * error;
+        }
+    } else if (anchored) {
+        newest = predicted;
+    } else {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        times[i] = (int64_t) std::llround(newest - (double) (count - 1 - i) * interval);
+    }
+    return true;
+}
+
+void ImuFifoClock::reset() {
+    anchored = false;
+    misses = 0;
+}
+
+double ImuFifoClock::period() const {
+    return interval;
+}
@@ -0,0 +1,106 @@
+#ifndef RADAR_IMU_FIFO_H
+#define RADAR_IMU_FIFO_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Words of each sample set in the FIFO pattern, the gyroscope is the first data set and the accelerometer the second,
+// both batched without decimation
+#define IMU_FIFO_PATTERN 6
+// The FIFO holds 4 KiB of 16-bit words
+#define IMU_FIFO_WORDS 2048
+// FIFO_STATUS1 to FIFO_STATUS4, read in one transfer ahead of the data
+#define IMU_FIFO_STATUS_BYTES 4
+
+typedef struct ImuSample {
+    int16_t gyro[3];
+    int16_t accel[3];
+} ImuSample;
+
+typedef struct ImuFifoStatus {
+    // Unread words
+    uint16_t words;
+    // Position in the pattern of the next word read
+    uint16_t pattern;
+    bool watermark;
+    bool overrun;
+    bool empty;
+} ImuFifoStatus;
+
+// Decode the FIFO_STATUS1 to FIFO_STATUS4 registers
+ImuFifoStatus imuFifoStatus(const uint8_t *status);
+
+// ImuFifoParser assembles the little-endian words burst read from FIFO_DATA_OUT into sample sets. A set may be split
+// across reads, the words already in are kept until the rest arrive. The status read ahead of each burst says where
+// its first word falls in the pattern and whether the FIFO overran since the last read, so a set whose words were
+// lost is discarded rather than completed with words of another.
+class ImuFifoParser {
+public:
+
+    // Parse words read right after status, returns the sample sets completed into dest
+    size_t parse(const uint8_t *data, size_t words, const ImuFifoStatus &status, ImuSample *dest, size_t capacity);
+
+    // Forget any partial set, the FIFO was emptied
+    void reset();
+
+    // Sets completed, and words dropped with an incomplete set or for want of room in dest
+    uint64_t samples = 0;
+    uint64_t discarded = 0;
+
+private:
+
+    int16_t set[IMU_FIFO_PATTERN]{};
+    uint16_t position = 0;
+    // Words read into the set being filled, fewer than its position if its start was lost
+    uint16_t held = 0;
+
+};
+
+
+// Periods an edge may land from where the clock expects it before it is taken for a glitch
+#define IMU_CLOCK_TOLERANCE 3
+// Edges in a row that may miss before the clock gives up its estimate and starts over from the latest
+#define IMU_CLOCK_MISSES 3
+// Share of the error at each edge taken up by the time of the newest set and by the period
+#define IMU_CLOCK_PHASE_GAIN 0.2
+#define IMU_CLOCK_RATE_GAIN 0.02
+// Farthest the period may stray from nominal, the LSM6DSM oscillator is good to a few percent
+#define IMU_CLOCK_RANGE 0.05
+
+// ImuFifoClock times the sets drained from the FIFO on the host clock. The FIFO carries no timestamps, but INT1 rises
+// as the set that reaches the watermark is written, so the edge time from the interrupt pins that set down. Every
+// other set lies a whole number of periods before or after it, with the period itself tracked from the spacing of the
+// edges to follow the sensor's oscillator. Between edges, or for a read without one, the sets are counted on from the
+// last at the estimated period.
+class ImuFifoClock {
+public:
+
+    // Nominal rate in Hz
+    explicit ImuFifoClock(double rate);
+
+    // Time the count sets of a drain, oldest first, into times in microseconds. edge is when INT1 rose for the
+    // watermark, zero if the drain was not for one, and past the sets written after the one that reached it. False
+    // until an edge has anchored the clock.
+    bool stamp(int64_t edge, uint32_t past, size_t count, int64_t *times);
+
+    // Sets were lost, the next edge anchors the clock again
+    void reset();
+
+    // Microseconds between sets
+    double period() const;
+
+    // Edges too far from the estimate to be followed
+    uint32_t outliers = 0;
+
+private:
+
+    double nominal;
+    double interval;
+    // Time of the newest set stamped
+    double newest = 0;
+    bool anchored = false;
+    uint32_t misses = 0;
+
+};
+
+#endif //RADAR_IMU_FIFO_H
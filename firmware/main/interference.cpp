@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "interference.h"
+
+// Scale from the median absolute deviation to the standard deviation of normally distributed noise
+#define MAD_SCALE 1.4826f
+
+float InterferenceDetector::flagLane(const uint16_t *lane, int samples) {
+    // Second differences, the curvature of a beat is its step scaled down by the normalized beat frequency again,
+    // while broadband interference is amplified
+    int steps = samples - 2;
+    for (int i = 0; i < steps; i++) {
+        scratch[i] = (float) lane[i + 2] - 2.0f * (float) lane[i + 1] + (float) lane[i];
+    }
+
+    // Fourth standardized moment of the steps
+    double m2 = 0, m4 = 0, mean = 0;
+    for (int i = 0; i < steps; i++) {
+        mean += scratch[i];
+    }
+    mean /= steps;
+    for (int i = 0; i < steps; i++) {
+        double d = scratch[i] - mean;
+        m2 += d * d;
+        m4 += d * d * d * d;
+    }
+    m2 /= steps;
+    m4 /= steps;
+    float kurtosis = m2 > 0 ? (float) (m4 / (m2 * m2)) : 0;
+
+    // Robust center and spread, the copy is reordered by the selections
+    memcpy(sorted, scratch, steps * sizeof(float));
+    std::nth_element(sorted, sorted + steps / 2, sorted + steps);
+    float center = sorted[steps / 2];
+    for (int i = 0; i < steps; i++) {
+        sorted[i] = fabsf(scratch[i] - center);
+    }
+    std::nth_element(sorted, sorted + steps / 2, sorted + steps);
+    float spread = sorted[steps / 2] * MAD_SCALE;
+    // Quantization alone gives a spread of about one code
+    if (spread < 1.0f) {
+        spread = 1.0f;
+    }
+
+    float limit = INTERFERENCE_THRESHOLD * spread;
+    for (int i = 0; i < steps; i++) {
+        if (fabsf(scratch[i] - center) <= limit) {
+            continue;
+        }
+        // All three samples of an outlying difference are suspect, widened by the guard
+        int from = std::max(0, i - INTERFERENCE_GUARD);
+        int to = std::min(samples - 1, i + 2 + INTERFERENCE_GUARD);
+        for (int j = from; j <= to; j++) {
+            mask[j] = 1;
+        }
+    }
+    return kurtosis;
+}
+
+uint16_t InterferenceDetector::median(const uint16_t *lane, int samples) {
+    for (int i = 0; i < samples; i++) {
+        scratch[i] = lane[i];
+    }
+    std::nth_element(scratch, scratch + samples / 2, scratch + samples);
+    return (uint16_t) scratch[samples / 2];
+}
+
+void InterferenceDetector::repair(uint16_t *lane, int samples, InterferenceMode mode) {
+    uint16_t level = median(lane, samples);
+    int i = 0;
+    while (i < samples) {
+        if (!mask[i]) {
+            i++;
+            continue;
+        }
+        int start = i;
+        while (i < samples && mask[i]) {
+            i++;
+        }
+        int end = i;
+        // Clean neighbours of the segment, a segment touching the edge of the frame extends the other neighbour
+        bool hasBefore = start > 0;
+        bool hasAfter = end < samples;
+        if (mode == INTERFERENCE_ZERO || (!hasBefore && !hasAfter)) {
+            for (int j = start; j < end; j++) {
+                lane[j] = level;
+            }
+            continue;
+        }
+        float before = hasBefore ? lane[start - 1] : lane[end];
+        float after = hasAfter ? lane[end] : lane[start - 1];
+        for (int j = start; j < end; j++) {
+            float t = (float) (j - start + 1) / (float) (end - start + 1);
+            lane[j] = (uint16_t) lroundf(before + (after - before) * t);
+        }
+    }
+}
+
+InterferenceReport InterferenceDetector::inspect(uint16_t **lanes, int lanesCount, int samples,
+                                                 InterferenceMode mode) {
+    InterferenceReport report{};
+    if (mode == INTERFERENCE_OFF || samples < 8 || samples > INTERFERENCE_MAX_SAMPLES) {
+        return report;
+    }
+    memset(mask, 0, samples);
+    for (int lane = 0; lane < lanesCount && lane < INTERFERENCE_LANES; lane++) {
+        if (lanes[lane] == nullptr) {
+            continue;
+        }
+        float kurtosis = flagLane(lanes[lane], samples);
+        if (kurtosis > report.kurtosis) {
+            report.kurtosis = kurtosis;
+        }
+    }
+    for (int i = 0; i < samples; i++) {
+        if (!mask[i]) {
+            continue;
+        }
+        report.corrupted++;
+        if (i == 0 || !mask[i - 1]) {
+            report.segments++;
+        }
+    }
+    if (report.corrupted == 0 || (mode != INTERFERENCE_REPAIR && mode != INTERFERENCE_ZERO)) {
+        return report;
+    }
+    for (int lane = 0; lane < lanesCount && lane < INTERFERENCE_LANES; lane++) {
+        if (lanes[lane] != nullptr) {
+            repair(lanes[lane], samples, mode);
+        }
+    }
+    return report;
+}
+
+bool InterferenceMonitor::record(bool corrupted) {
+    flagged -= history[next];
+    history[next] = corrupted ? 1 : 0;
+    flagged += history[next];
+    next = (next + 1) % INTERFERENCE_WINDOW;
+    if (flagged < INTERFERENCE_HOP_FRAMES) {
+        return false;
+    }
+    // Start a fresh window so the new phase gets a full window to prove itself
+    memset(history, 0, sizeof(history));
+    flagged = 0;
+    return true;
+}
@@ -0,0 +1,78 @@
+#ifndef RADAR_INTERFERENCE_H
+#define RADAR_INTERFERENCE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define INTERFERENCE_MAX_SAMPLES 1024
+#define INTERFERENCE_LANES 4
+// Second differences beyond this many robust deviations are interference
+#define INTERFERENCE_THRESHOLD 6.0f
+// Samples either side of a flagged step that are also treated as corrupted
+#define INTERFERENCE_GUARD 2
+// Sustained interference: this many flagged frames within the window trigger a chirp phase hop
+#define INTERFERENCE_WINDOW 32
+#define INTERFERENCE_HOP_FRAMES 8
+
+enum InterferenceMode {
+    INTERFERENCE_OFF = 0,
+    // Count corrupted frames, leave the samples untouched
+    INTERFERENCE_DETECT = 1,
+    // Interpolate across corrupted segments from the clean samples either side
+    INTERFERENCE_REPAIR = 2,
+    // Replace corrupted segments with the median level of the lane
+    INTERFERENCE_ZERO = 3,
+    // Discard frames with corrupted segments
+    INTERFERENCE_DROP = 4,
+};
+
+typedef struct InterferenceReport {
+    // Samples per lane flagged as corrupted, including the guard samples
+    uint32_t corrupted;
+    // Contiguous corrupted segments
+    uint32_t segments;
+    // Largest kurtosis of the second differences across the lanes, about 3 for noise and lower for clean beats
+    float kurtosis;
+} InterferenceReport;
+
+// InterferenceDetector finds the large transients another radar chirping across the band leaves in the IF samples.
+// The second difference of the samples is compared against a robust (median absolute deviation) estimate of its
+// spread, a beat signal curves smoothly while interference jumps far outside that spread.
+class InterferenceDetector {
+public:
+
+    // Inspect a frame of lanes, repairing it in place according to mode. Interference reaches every lane at once, so
+    // a sample flagged on any lane is corrupted on all of them.
+    InterferenceReport inspect(uint16_t **lanes, int lanesCount, int samples, InterferenceMode mode);
+
+private:
+
+    float scratch[INTERFERENCE_MAX_SAMPLES]{};
+    float sorted[INTERFERENCE_MAX_SAMPLES]{};
+    uint8_t mask[INTERFERENCE_MAX_SAMPLES]{};
+
+    float flagLane(const uint16_t *lane, int samples);
+
+    uint16_t median(const uint16_t *lane, int samples);
+
+    void repair(uint16_t *lane, int samples, InterferenceMode mode);
+
+};
+
+// InterferenceMonitor decides when interference is sustained rather than a passing transient
+class InterferenceMonitor {
+public:
+
+    // Record whether a frame was corrupted, returns true when the chirp phase should hop
+    bool record(bool corrupted);
+
+private:
+
+    uint8_t history[INTERFERENCE_WINDOW]{};
+    int next = 0;
+    int flagged = 0;
+
+};
+
+
+#endif //RADAR_INTERFERENCE_H
@@ -0,0 +1,204 @@
+#include <cstdio>
+#include <cstring>
+#include <cJSON.h>
+#include <esp_mac.h>
+#include <esp_timer.h>
+#include "metadata.h"
+
+// Write an unsigned value into the buffer in big-endian order, returns the next offset
+static size_t putBigEndian(uint8_t *buffer, size_t offset, uint64_t value, size_t width) {
+    for (size_t i = 0; i < width; i++) {
+        buffer[offset + i] = (value >> (8 * (width - 1 - i))) & 0xFF;
+    }
+    return offset + width;
+}
+
+Metadata &Metadata::instance() {
+    static Metadata the_instance;
+    return the_instance;
+}
+
+Metadata::Metadata() {
+    lock = xSemaphoreCreateMutex();
+    // The mac address is fixed, so the derived strings are generated once
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    // Generate the module human-readable name
+    snprintf(name, 12, "vRadar %02x%02x", mac[1], mac[4]);
+    // Generate the mac address string
+    snprintf(macAddress, sizeof(macAddress), "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3],
+             mac[4], mac[5]);
+
+    refresh();
+}
+
+void Metadata::refresh() {
+    auto &settings = Settings::instance();
+    if (settings.generation() == generation && !stale) {
+        return;
+    }
+    stale = false;
+    System system{};
+    uint32_t current = settings.getSystem(&system);
+    update(system);
+    generation = current;
+}
+
+void Metadata::plan(const StreamPlan &next) {
+    if (xSemaphoreTake(lock, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    stream = next;
+    xSemaphoreGive(lock);
+    stale = true;
+}
+
+void Metadata::update(const System &system) {
+    if (xSemaphoreTake(lock, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    StreamPlan plan = stream;
+    xSemaphoreGive(lock);
+
+    // Initialize a json object
+    auto obj = cJSON_CreateObject();
+    // Add generated variables to the object
+    cJSON_AddStringToObject(obj, "name", name);
+    cJSON_AddStringToObject(obj, "mac", macAddress);
+    // Add compiled config metadata to the object
+    cJSON_AddNumberToObject(obj, "base", CONFIG_vRADAR_BASE_FREQUENCY);
+    cJSON_AddNumberToObject(obj, "xFov", CONFIG_vRADAR_FOV_X);
+    cJSON_AddNumberToObject(obj, "yFov", CONFIG_vRADAR_FOV_Y);
+
+    cJSON_AddNumberToObject(obj, "enabled", system.enabled);
+    cJSON_AddNumberToObject(obj, "audible", system.audible);
+    cJSON_AddNumberToObject(obj, "gyro", system.gyro);
+    cJSON_AddNumberToObject(obj, "interference", system.interference);
+    cJSON_AddNumberToObject(obj, "vibration", system.vibration);
+
+    cJSON *chirpObj = cJSON_CreateObject();
+    cJSON_AddNumberToObject(chirpObj, "prf", system.chirp.prf);
+    cJSON_AddNumberToObject(chirpObj, "duration", system.chirp.duration);
+    cJSON_AddNumberToObject(chirpObj, "steps", system.chirp.steps);
+    cJSON_AddNumberToObject(chirpObj, "padding", system.chirp.padding);
+    cJSON_AddNumberToObject(chirpObj, "resolution", system.chirp.resolution);
+    cJSON_AddNumberToObject(chirpObj, "shape", system.chirp.shape);
+    cJSON_AddNumberToObject(chirpObj, "levels", system.chirp.levels);
+    cJSON_AddNumberToObject(chirpObj, "linearize", system.chirp.linearize);
+
+    cJSON *samplingObj = cJSON_CreateObject();
+    cJSON_AddNumberToObject(samplingObj, "frequency", system.sampling.frequency);
+    cJSON_AddNumberToObject(samplingObj, "samples", system.sampling.samples);
+    cJSON_AddNumberToObject(samplingObj, "attenuation", system.sampling.attenuation);
+
+    cJSON *scheduleObj = cJSON_CreateObject();
+    cJSON_AddNumberToObject(scheduleObj, "mode", system.schedule.mode);
+    cJSON_AddNumberToObject(scheduleObj, "slot", system.schedule.slot);
+    cJSON_AddNumberToObject(scheduleObj, "slots", system.schedule.slots);
+
+    cJSON_AddItemToObject(obj, "sampling", samplingObj);
+    cJSON_AddItemToObject(obj, "chirp", chirpObj);
+    cJSON_AddItemToObject(obj, "schedule", scheduleObj);
+
+    cJSON *burstObj = cJSON_CreateObject();
+    cJSON_AddNumberToObject(burstObj, "chirps", system.burst.chirps);
+    cJSON_AddNumberToObject(burstObj, "duty", system.burst.duty);
+    cJSON_AddItemToObject(obj, "burst", burstObj);
+
+    // Bytes per second the stream is planned to send of the demand, against the throughput last measured
+    cJSON *streamObj = cJSON_CreateObject();
+    cJSON_AddStringToObject(streamObj, "format", streamFormatName(plan.format));
+    cJSON_AddNumberToObject(streamObj, "decimation", plan.decimation);
+    cJSON_AddNumberToObject(streamObj, "rate", plan.rate);
+    cJSON_AddNumberToObject(streamObj, "demand", plan.demand);
+    cJSON_AddNumberToObject(streamObj, "throughput", plan.throughput);
+    cJSON_AddBoolToObject(streamObj, "fits", plan.fits);
+    cJSON_AddItemToObject(obj, "stream", streamObj);
+
+    char serialized[METADATA_DOCUMENT_SIZE];
+    bool printed = cJSON_PrintPreallocated(obj, serialized, METADATA_DOCUMENT_SIZE - 32, false);
+    cJSON_Delete(obj);
+    if (!printed) {
+        printf("Metadata document exceeds %d bytes\n", METADATA_DOCUMENT_SIZE);
+        return;
+    }
+
+    if (xSemaphoreTake(lock, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    // Drop the closing brace and append a fixed-width "updated" field, the timestamp is right-aligned with leading
+    // whitespace so each request can overwrite it without moving the rest of the document
+    size_t length = strlen(serialized) - 1;
+    memcpy(document, serialized, length);
+    length += snprintf(&document[length], METADATA_DOCUMENT_SIZE - length, ",\"updated\":");
+    updatedOffset = length;
+    length += snprintf(&document[length], METADATA_DOCUMENT_SIZE - length, "%*d}", METADATA_UPDATED_WIDTH, 0);
+    documentLength = length;
+
+    // Pack the compact binary form, multibyte fields are big-endian to match the sample frames
+    size_t offset = 0;
+    offset = putBigEndian(packet, offset, METADATA_PACKET_MAGIC, 4);
+    offset = putBigEndian(packet, offset, METADATA_PACKET_VERSION, 2);
+    memcpy(&packet[offset], mac, sizeof(mac));
+    offset += sizeof(mac);
+    offset = putBigEndian(packet, offset, (uint64_t) CONFIG_vRADAR_BASE_FREQUENCY, 8);
+    offset = putBigEndian(packet, offset, CONFIG_vRADAR_FOV_X, 2);
+    offset = putBigEndian(packet, offset, CONFIG_vRADAR_FOV_Y, 2);
+    offset = putBigEndian(packet, offset, (uint8_t) system.enabled, 1);
+    offset = putBigEndian(packet, offset, (uint8_t) system.audible, 1);
+    offset = putBigEndian(packet, offset, (uint8_t) system.gyro, 1);
+    offset = putBigEndian(packet, offset, (uint8_t) system.chirp.shape, 1);
+    offset = putBigEndian(packet, offset, (uint32_t) system.chirp.prf, 4);
+    offset = putBigEndian(packet, offset, (uint32_t) system.chirp.duration, 4);
+    offset = putBigEndian(packet, offset, (uint32_t) system.chirp.steps, 4);
+    offset = putBigEndian(packet, offset, (uint32_t) system.chirp.padding, 4);
+    offset = putBigEndian(packet, offset, (uint32_t) system.chirp.resolution, 4);
+    offset = putBigEndian(packet, offset, (uint32_t) system.sampling.frequency, 4);
+    offset = putBigEndian(packet, offset, (uint32_t) system.sampling.samples, 4);
+    offset = putBigEndian(packet, offset, (uint32_t) system.sampling.attenuation, 4);
+    offset = putBigEndian(packet, offset, (uint32_t) system.chirp.levels, 4);
+    offset = putBigEndian(packet, offset, (uint32_t) system.chirp.linearize, 4);
+    offset = putBigEndian(packet, offset, (uint32_t) system.schedule.mode, 4);
+    offset = putBigEndian(packet, offset, (uint32_t) system.schedule.slot, 4);
+    offset = putBigEndian(packet, offset, (uint32_t) system.schedule.slots, 4);
+    offset = putBigEndian(packet, offset, (uint32_t) system.interference, 4);
+    offset = putBigEndian(packet, offset, (uint32_t) system.burst.chirps, 4);
+    offset = putBigEndian(packet, offset, (uint32_t) system.burst.duty, 4);
+    putBigEndian(packet, offset, (uint32_t) system.vibration, 4);
+
+    xSemaphoreGive(lock);
+}
+
+size_t Metadata::json(char *dest, size_t length) {
+    refresh();
+    if (xSemaphoreTake(lock, portMAX_DELAY) != pdTRUE) {
+        return 0;
+    }
+    if (length < documentLength + 1) {
+        xSemaphoreGive(lock);
+        return 0;
+    }
+    size_t written = documentLength;
+    size_t offset = updatedOffset;
+    memcpy(dest, document, documentLength + 1);
+    xSemaphoreGive(lock);
+
+    // Patch the timestamp in the caller's copy, the closing brace overwritten by snprintf is restored after
+    snprintf(&dest[offset], METADATA_UPDATED_WIDTH + 1, "%*lld", METADATA_UPDATED_WIDTH, esp_timer_get_time());
+    dest[offset + METADATA_UPDATED_WIDTH] = '}';
+    return written;
+}
+
+size_t Metadata::binary(uint8_t *dest, size_t length) {
+    if (length < METADATA_PACKET_SIZE) {
+        return 0;
+    }
+    refresh();
+    if (xSemaphoreTake(lock, portMAX_DELAY) != pdTRUE) {
+        return 0;
+    }
+    memcpy(dest, packet, METADATA_PACKET_SIZE);
+    xSemaphoreGive(lock);
+
+    putBigEndian(dest, METADATA_PACKET_SIZE - 8, (uint64_t) esp_timer_get_time(), 8);
+    return METADATA_PACKET_SIZE;
+}
@@ -0,0 +1,74 @@
+#ifndef RADAR_METADATA_H
+#define RADAR_METADATA_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "settings.h"
+#include "planner.h"
+
+// Upper bound for the serialized json metadata document
+#define METADATA_DOCUMENT_SIZE 768
+// Character width reserved for the in-place patched "updated" timestamp
+#define METADATA_UPDATED_WIDTH 20
+// Leading magic of the binary metadata packet ('vRMD')
+#define METADATA_PACKET_MAGIC 0x76524D44
+// Bumped whenever a field is added or changes meaning, version 1 had no chirp shape and ended at sampling
+#define METADATA_PACKET_VERSION 2
+// magic(4) version(2) mac(6) base(8) xFov(2) yFov(2) enabled(1) audible(1) gyro(1) shape(1)
+// chirp(5 * 4) sampling(3 * 4) levels(4) linearize(4) schedule(3 * 4) interference(4) burst(2 * 4) vibration(4)
+// updated(8)
+#define METADATA_PACKET_SIZE 104
+
+class Metadata {
+public:
+
+    static Metadata &instance();
+
+    Metadata(const Metadata &) = delete;
+
+    Metadata &operator=(const Metadata &) = delete;
+
+    // Copy the cached json document into dest with the current timestamp, returns the length written
+    size_t json(char *dest, size_t length);
+
+    // Copy the cached binary packet into dest with the current timestamp, returns the length written
+    size_t binary(uint8_t *dest, size_t length);
+
+    // Report the stream plan, the json document carries it from the next copy on
+    void plan(const StreamPlan &next);
+
+private:
+
+    Metadata();
+
+    // Re-serialize the cached documents if the settings generation or the stream plan has moved on
+    void refresh();
+
+    void update(const System &system);
+
+    SemaphoreHandle_t lock;
+
+    // Settings generation the cached documents were serialized from
+    uint32_t generation = 0;
+
+    StreamPlan stream{STREAM_RAW, 1, 0, 0, 0, true};
+    // The stream plan changed since the documents were serialized
+    std::atomic<bool> stale{false};
+
+    uint8_t mac[6]{};
+    char name[16]{};
+    char macAddress[18]{};
+
+    char document[METADATA_DOCUMENT_SIZE]{};
+    size_t documentLength = 0;
+    size_t updatedOffset = 0;
+
+    uint8_t packet[METADATA_PACKET_SIZE]{};
+
+};
+
+
+#endif //RADAR_METADATA_H
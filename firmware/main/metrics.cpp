@@ -0,0 +1,133 @@
+#include <cinttypes>
+#include <cstdio>
+#include "metrics.h"
+
+int metricsBin(uint64_t nanoseconds) {
+    int bin = 0;
+    uint64_t edge = METRICS_HISTOGRAM_BASE_NS;
+    while (nanoseconds >= edge && bin < METRICS_HISTOGRAM_BINS - 1) {
+        edge *= 2;
+        bin++;
+    }
+    return bin;
+}
+
+uint64_t metricsBinEdge(int bin) {
+    if (bin < 0 || bin >= METRICS_HISTOGRAM_BINS - 1) {
+        return 0;
+    }
+    return (uint64_t) METRICS_HISTOGRAM_BASE_NS << bin;
+}
+
+void Counter::add(int core, uint32_t amount) {
+    shards[core % METRICS_CORES].fetch_add(amount, std::memory_order_relaxed);
+}
+
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    for (const auto &shard: shards) {
+        total += shard.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void Histogram::record(int core, uint64_t nanoseconds) {
+    HistogramShard &shard = shards[core % METRICS_CORES];
+    uint32_t seq = shard.sequence.load(std::memory_order_relaxed);
+    shard.sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    shard.count++;
+    shard.sum += nanoseconds;
+    shard.bins[metricsBin(nanoseconds)]++;
+    shard.sequence.store(seq + 2, std::memory_order_release);
+}
+
+HistogramSnapshot Histogram::snapshot() const {
+    HistogramSnapshot total{};
+    for (const auto &shard: shards) {
+        uint32_t count;
+        uint64_t sum;
+        uint32_t bins[METRICS_HISTOGRAM_BINS];
+        uint32_t before, after;
+        do {
+            before = shard.sequence.load(std::memory_order_acquire);
+            count = shard.count;
+            sum = shard.sum;
+            for (int i = 0; i < METRICS_HISTOGRAM_BINS; i++) {
+                bins[i] = shard.bins[i];
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = shard.sequence.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+        total.count += count;
+        total.sum += sum;
+        for (int i = 0; i < METRICS_HISTOGRAM_BINS; i++) {
+            total.bins[i] += bins[i];
+        }
+    }
+    return total;
+}
+
+uint64_t histogramQuantile(const HistogramSnapshot &snapshot, float quantile) {
+    if (snapshot.count == 0) {
+        return 0;
+    }
+    auto rank = (uint64_t) ((float) snapshot.count * quantile);
+    uint64_t seen = 0;
+    for (int i = 0; i < METRICS_HISTOGRAM_BINS - 1; i++) {
+        seen += snapshot.bins[i];
+        if (seen > rank) {
+            return metricsBinEdge(i);
+        }
+    }
+    // Past the last bounded edge, the best estimate is that edge
+    return metricsBinEdge(METRICS_HISTOGRAM_BINS - 2);
+}
+
+// Append formatted text at offset, returns false once the text no longer fits
+static bool append(size_t capacity, size_t *offset, int written) {
+    if (written < 0 || *offset + (size_t) written >= capacity) {
+        return false;
+    }
+    *offset += (size_t) written;
+    return true;
+}
+
+size_t formatCounter(char *dest, size_t capacity, const char *name, const char *help, uint64_t value) {
+    size_t offset = 0;
+    int written = snprintf(dest, capacity, "# HELP %s %s\n# TYPE %s counter\n%s %" PRIu64 "\n", name, help, name, name,
+                           value);
+    if (!append(capacity, &offset, written)) {
+        return 0;
+    }
+    return offset;
+}
+
+size_t formatHistogram(char *dest, size_t capacity, const char *name, const char *help,
+                       const HistogramSnapshot &snapshot) {
+    size_t offset = 0;
+    int written = snprintf(dest, capacity, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    if (!append(capacity, &offset, written)) {
+        return 0;
+    }
+    uint64_t cumulative = 0;
+    for (int i = 0; i < METRICS_HISTOGRAM_BINS; i++) {
+        cumulative += snapshot.bins[i];
+        if (i == METRICS_HISTOGRAM_BINS - 1) {
+            written = snprintf(dest + offset, capacity - offset, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", name,
+                               cumulative);
+        } else {
+            written = snprintf(dest + offset, capacity - offset, "%s_bucket{le=\"%g\"} %" PRIu64 "\n", name,
+                               (double) metricsBinEdge(i) / 1e9, cumulative);
+        }
+        if (!append(capacity, &offset, written)) {
+            return 0;
+        }
+    }
+    written = snprintf(dest + offset, capacity - offset, "%s_sum %.9f\n%s_count %" PRIu64 "\n", name,
+                       (double) snapshot.sum / 1e9, name, snapshot.count);
+    if (!append(capacity, &offset, written)) {
+        return 0;
+    }
+    return offset;
+}
@@ -0,0 +1,76 @@
+#ifndef RADAR_METRICS_H
+#define RADAR_METRICS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Each core accumulates into its own shard, readers sum the shards
+#define METRICS_CORES 2
+#define METRICS_HISTOGRAM_BINS 18
+// Upper edge of the first latency bin, each following bin doubles in width and the last bin is unbounded
+#define METRICS_HISTOGRAM_BASE_NS 1000
+
+// Histogram bin of a latency, the last bin collects everything above the second to last edge
+int metricsBin(uint64_t nanoseconds);
+
+// Upper edge of a histogram bin in nanoseconds, zero for the unbounded last bin
+uint64_t metricsBinEdge(int bin);
+
+// Counter is a monotonically increasing count, incremented from any task on either core
+class Counter {
+public:
+
+    void add(int core, uint32_t amount = 1);
+
+    uint64_t value() const;
+
+private:
+
+    std::atomic<uint32_t> shards[METRICS_CORES]{};
+
+};
+
+typedef struct HistogramSnapshot {
+    uint64_t count;
+    // Sum of all recorded latencies in nanoseconds
+    uint64_t sum;
+    uint64_t bins[METRICS_HISTOGRAM_BINS];
+} HistogramSnapshot;
+
+typedef struct HistogramShard {
+    // Odd while the shard is being written
+    std::atomic<uint32_t> sequence;
+    uint32_t count;
+    uint64_t sum;
+    uint32_t bins[METRICS_HISTOGRAM_BINS];
+} HistogramShard;
+
+// Histogram counts latencies in power of two bins. Each shard is written in place by the tasks of one core, so a
+// histogram must only be recorded by one task per core. Readers retry a shard until they copy it between two matching
+// even sequence numbers.
+class Histogram {
+public:
+
+    void record(int core, uint64_t nanoseconds);
+
+    HistogramSnapshot snapshot() const;
+
+private:
+
+    HistogramShard shards[METRICS_CORES]{};
+
+};
+
+// Estimate a quantile of the snapshot in nanoseconds from the upper edge of the bin it falls in
+uint64_t histogramQuantile(const HistogramSnapshot &snapshot, float quantile);
+
+// Write a counter in the Prometheus text format, returns the bytes written or zero if it does not fit
+size_t formatCounter(char *dest, size_t capacity, const char *name, const char *help, uint64_t value);
+
+// Write a histogram in the Prometheus text format with cumulative buckets in seconds, returns the bytes written or
+// zero if it does not fit
+size_t formatHistogram(char *dest, size_t capacity, const char *name, const char *help,
+                       const HistogramSnapshot &snapshot);
+
+#endif //RADAR_METRICS_H
@@ -676,8 +676,13 @@ esp_err_t Network::startSTA(Credentials credentials) {
     if (err != ESP_OK) {
         return err;
     }
+#ifdef CONFIG_vRADAR_BURST_LIGHT_SLEEP
+    // The modem must sleep between beacons for the CPUs to enter light sleep between chirp bursts
+    esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
+#else
     // Disable power saving, it's already a hog to begin with
     esp_wifi_set_ps(WIFI_PS_NONE);
+#endif
 
     // Wait for the
     EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
@@ -0,0 +1,118 @@
+#include <cmath>
+#include "orientation.h"
+
+#define DEGREES (180.0f / (float) M_PI)
+
+Orientation::Orientation(float rate, float beta) : period(1.0f / rate), beta(beta) {}
+
+void Orientation::level(const float *accel) {
+    // The rotation with no heading that tilts the reference gravity onto the measured one
+    float roll = atan2f(accel[1], accel[2]);
+    float pitch = atan2f(-accel[0], sqrtf(accel[1] * accel[1] + accel[2] * accel[2]));
+    float cr = cosf(roll / 2), sr = sinf(roll / 2);
+    float cp = cosf(pitch / 2), sp = sinf(pitch / 2);
+    q = {cr * cp, sr * cp, cr * sp, -sr * sp};
+}
+
+void Orientation::settle(const float *gyro, const float *accel) {
+    level(accel);
+    for (int axis = 0; axis < 3; axis++) {
+        sum[axis] += gyro[axis];
+        squares[axis] += (double) gyro[axis] * gyro[axis];
+    }
+    if (++still < ORIENTATION_SETTLE) {
+        return;
+    }
+    bool moved = false;
+    double mean[3];
+    for (int axis = 0; axis < 3; axis++) {
+        mean[axis] = sum[axis] / still;
+        double variance = squares[axis] / still - mean[axis] * mean[axis];
+        moved = moved || variance > (double) ORIENTATION_STILL * ORIENTATION_STILL;
+    }
+    if (moved) {
+        // Start over, the module was handled while settling
+        realign();
+        return;
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        offset[axis] = (float) mean[axis];
+    }
+}
+
+void Orientation::realign() {
+    // The bias is kept until a new one settles
+    still = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        sum[axis] = 0;
+        squares[axis] = 0;
+    }
+}
+
+void Orientation::update(const float *gyro, const float *accel) {
+    if (!settled()) {
+        settle(gyro, accel);
+        return;
+    }
+
+    float gx = gyro[0] - offset[0], gy = gyro[1] - offset[1], gz = gyro[2] - offset[2];
+    float w = q.w, x = q.x, y = q.y, z = q.z;
+
+    // Rate of change of the quaternion from the gyroscope
+    float dw = 0.5f * (-x * gx - y * gy - z * gz);
+    float dx = 0.5f * (w * gx + y * gz - z * gy);
+    float dy = 0.5f * (w * gy - x * gz + z * gx);
+    float dz = 0.5f * (w * gz + x * gy - y * gx);
+
+    float norm = sqrtf(accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2]);
+    if (norm > 0) {
+        float ax = accel[0] / norm, ay = accel[1] / norm, az = accel[2] / norm;
+        // Gradient descent step on the error between the estimated and measured direction of gravity
+        float fx = 2 * (x * z - w * y) - ax;
+        float fy = 2 * (w * x + y * z) - ay;
+        float fz = 2 * (0.5f - x * x - y * y) - az;
+        float sw = -2 * y * fx + 2 * x * fy;
+        float sx = 2 * z * fx + 2 * w * fy - 4 * x * fz;
+        float sy = -2 * w * fx + 2 * z * fy - 4 * y * fz;
+        float sz = 2 * x * fx + 2 * y * fy;
+        float step = sqrtf(sw * sw + sx * sx + sy * sy + sz * sz);
+        if (step > 0) {
+            dw -= beta * sw / step;
+            dx -= beta * sx / step;
+            dy -= beta * sy / step;
+            dz -= beta * sz / step;
+        }
+    }
+
+    w += dw * period;
+    x += dx * period;
+    y += dy * period;
+    z += dz * period;
+    float length = sqrtf(w * w + x * x + y * y + z * z);
+    q = {w / length, x / length, y / length, z / length};
+}
+
+bool Orientation::settled() const {
+    return still >= ORIENTATION_SETTLE;
+}
+
+Quaternion Orientation::quaternion() const {
+    return q;
+}
+
+EulerAngles Orientation::angles() const {
+    // Gravity as the accelerometer would measure it at rest in this orientation
+    float gx = 2 * (q.x * q.z - q.w * q.y);
+    float gy = 2 * (q.w * q.x + q.y * q.z);
+    float gz = 1 - 2 * (q.x * q.x + q.y * q.y);
+    EulerAngles angles{};
+    // Tilt from the sensor as mounted, as the accelerometer alone reported it
+    angles.roll = atan2f(-gy, -gz) * DEGREES;
+    angles.pitch = atan2f(gx, sqrtf(gy * gy + gz * gz)) * DEGREES;
+    angles.yaw = atan2f(2 * (q.w * q.z + q.x * q.y), 1 - 2 * (q.y * q.y + q.z * q.z)) * DEGREES;
+    return angles;
+}
+
+const float *Orientation::bias() const {
+    return offset;
+}
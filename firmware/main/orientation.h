@@ -0,0 +1,74 @@
+#ifndef RADAR_ORIENTATION_H
+#define RADAR_ORIENTATION_H
+
+#include <cstdint>
+
+// Gain of the accelerometer correction in rad/s, the gyroscope error the filter trusts the accelerometer to remove
+#define ORIENTATION_BETA 0.05f
+// Still samples averaged into the gyroscope bias before the filter starts integrating, two seconds at 416 Hz
+#define ORIENTATION_SETTLE 832
+// Largest standard deviation of any gyroscope axis, in rad/s, over the settling samples for them to count as still
+#define ORIENTATION_STILL 0.02f
+
+typedef struct Quaternion {
+    float w;
+    float x;
+    float y;
+    float z;
+} Quaternion;
+
+// Degrees, roll and pitch as the accelerometer tilt was reported before the filter. Yaw is the heading since the
+// filter settled, nothing corrects its drift without a magnetometer.
+typedef struct EulerAngles {
+    float roll;
+    float pitch;
+    float yaw;
+} EulerAngles;
+
+// Orientation fuses the gyroscope and accelerometer with a Madgwick filter at a fixed sample rate. The gyroscope is
+// integrated each step and the accelerometer pulls the estimate of gravity back toward the one it measures, so the
+// tilt holds under vibration that would throw an accelerometer reading around.
+//
+// Until the first ORIENTATION_SETTLE samples in a row are still, the gyroscope is averaged for its bias rather than
+// integrated and the orientation follows the accelerometer alone.
+class Orientation {
+public:
+
+    explicit Orientation(float rate, float beta = ORIENTATION_BETA);
+
+    // One sample, the gyroscope in rad/s and the accelerometer in any unit
+    void update(const float *gyro, const float *accel);
+
+    // Whether the gyroscope bias has been estimated and the filter is integrating
+    bool settled() const;
+
+    Quaternion quaternion() const;
+
+    EulerAngles angles() const;
+
+    // Estimated gyroscope bias in rad/s
+    const float *bias() const;
+
+    // Settle again from the accelerometer, once the module has been moved and may rest at another angle
+    void realign();
+
+private:
+
+    // Settle on the bias, following the accelerometer meanwhile
+    void settle(const float *gyro, const float *accel);
+
+    void level(const float *accel);
+
+    float period;
+    float beta;
+    Quaternion q{1, 0, 0, 0};
+    float offset[3]{};
+    // Gyroscope sums over the samples settled so far
+    uint32_t still = 0;
+    double sum[3]{};
+    double squares[3]{};
+
+};
+
+
+#endif //RADAR_ORIENTATION_H
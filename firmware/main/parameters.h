@@ -0,0 +1,93 @@
+#ifndef RADAR_PARAMETERS_H
+#define RADAR_PARAMETERS_H
+
+#include <cstdint>
+
+typedef struct Sampling {
+    int32_t frequency = 20000;
+    int32_t samples = 1;
+    int32_t attenuation = 0;
+} Sampling;
+
+
+// PRF = delay between start of each chirp
+// stepDuration = duration of each level
+// steps = number of steps per chirp
+// padding = number of steps to add on each side of the chirp, subtracting from the total number of steps
+//
+
+// PRF = 2ms
+// duration = 1ms (1000us)
+// steps = 100 (step duration = 10us)
+
+enum ChirpShape {
+    // Linear ramp from the bottom of the band to the top
+    CHIRP_SAWTOOTH = 0,
+    // Linear ramp up to the top of the band and back down
+    CHIRP_TRIANGLE = 1,
+    // Staircase of discrete frequency levels, each held for an equal share of the steps
+    CHIRP_STEPPED = 2,
+};
+
+typedef struct Chirp {
+    // microseconds between the start of each sequential chirp
+    int32_t prf = 12500;
+    // microsecond duration of the chirp
+    int32_t duration = 12500; // assert(duration <= prf)
+    // dac changes per duration
+    int32_t steps = 125; // assert(steps <= duration)
+    // steps to subtract from pos and neg edge of the chirp
+    int32_t padding = 0; // assert(padding*2 < steps)
+    // bandwidth resolution over step range
+    int32_t resolution = 125;
+    // ChirpShape of the ramp
+    int32_t shape = CHIRP_SAWTOOTH;
+    // discrete frequency levels of a stepped chirp
+    int32_t levels = 8;
+    // correct the ramp with the stored VCO linearization when non-zero
+    int32_t linearize = 0;
+} Chirp;
+
+#define LINEARIZATION_ORDER 3
+
+// Maps the normalized position along the ramp to the normalized DAC code that produces a linear frequency sweep,
+// code(x) = c0 + c1 x + c2 x^2 + c3 x^3
+typedef struct Linearization {
+    float coefficients[LINEARIZATION_ORDER + 1] = {0.0f, 1.0f, 0.0f, 0.0f};
+    int32_t valid = 0;
+} Linearization;
+
+
+typedef struct Schedule {
+    // SyncMode of the module
+    int32_t mode = 0;
+    // TDMA slot this module chirps in
+    int32_t slot = 0;
+    // TDMA slots per chirp period, zero leaves the chirp train free running
+    int32_t slots = 0;
+} Schedule;
+
+typedef struct Burst {
+    // chirps per burst, zero runs the chirp train continuously
+    int32_t chirps = 0;
+    // target percentage of the time the radar is powered
+    int32_t duty = 100;
+} Burst;
+
+typedef struct System {
+//    int32_t chirp = 1;
+    int32_t audible = 0;
+    int32_t enabled = 1;
+    int32_t gyro = 1;
+    Chirp chirp{};
+    Sampling sampling{};
+    Schedule schedule{};
+    // InterferenceMode applied to every captured frame
+    int32_t interference = 1;
+    Burst burst{};
+    // VibrationMode applied to every captured frame
+    int32_t vibration = 0;
+} System;
+
+
+#endif //RADAR_PARAMETERS_H
@@ -59,3 +59,16 @@ void Persistent::readInt(const char *key, int32_t *dest, int32_t defaultValue) c
     }
 
 }
+
+// Write a binary blob to non-volatile storage, the write is not durable until committed
+esp_err_t Persistent::writeBlob(const char *key, const void *value, size_t length) const {
+    return nvs_set_blob(handle, key, value, length);
+}
+
+esp_err_t Persistent::readBlob(const char *key, void *dest, size_t *length) const {
+    return nvs_get_blob(handle, key, dest, length);
+}
+
+esp_err_t Persistent::commit() const {
+    return nvs_commit(handle);
+}
@@ -25,6 +25,14 @@ public:
 
     void readInt(const char *key, int32_t *dest, int32_t defaultValue) const;
 
+    esp_err_t writeBlob(const char *key, const void *value, size_t length) const;
+
+    // Read a blob into dest, length holds the capacity of dest and is set to the stored length
+    esp_err_t readBlob(const char *key, void *dest, size_t *length) const;
+
+    // Flush pending writes to flash
+    esp_err_t commit() const;
+
 private:
     nvs_handle_t handle = 0;
     Persistent();
@@ -0,0 +1,153 @@
+#include "pipeline.h"
+
+uint32_t conversionWord(uint16_t value, uint32_t channel, uint32_t unit) {
+    return (value & 0xFFF) | ((channel & 0xF) << 13) | ((unit & 0x1) << 17);
+}
+
+size_t decodeConversions(const uint8_t *buffer, size_t length, uint16_t **lanes, int *offsets, int samples) {
+    size_t placed = 0;
+    for (size_t i = 0; i + PIPELINE_CONVERSION_BYTES <= length; i += PIPELINE_CONVERSION_BYTES) {
+        // The dma writes results in the native little-endian byte order
+        uint32_t word = (uint32_t) buffer[i] | (uint32_t) buffer[i + 1] << 8 | (uint32_t) buffer[i + 2] << 16 |
+                        (uint32_t) buffer[i + 3] << 24;
+        // Only adc1 is sampled, anything else is a stray result
+        if (PIPELINE_WORD_UNIT(word) != 0) {
+            continue;
+        }
+        int lane = (int) PIPELINE_WORD_CHANNEL(word) - PIPELINE_FIRST_CHANNEL;
+        if (lane < 0 || lane >= PIPELINE_LANES) {
+            continue;
+        }
+        // Prevent writing out of bounds
+        if (offsets[lane] >= samples) {
+            continue;
+        }
+        lanes[lane][offsets[lane]++] = (uint16_t) PIPELINE_WORD_DATA(word);
+        placed++;
+    }
+    return placed;
+}
+
+size_t encodeConversions(uint16_t *const *lanes, int samples, uint8_t *dest, size_t capacity) {
+    size_t total = (size_t) samples * PIPELINE_LANES * PIPELINE_CONVERSION_BYTES;
+    if (capacity < total) {
+        return 0;
+    }
+    for (int n = 0; n < samples; n++) {
+        for (int lane = 0; lane < PIPELINE_LANES; lane++) {
+            uint32_t word = conversionWord(lanes[lane][n], PIPELINE_FIRST_CHANNEL + lane, 0);
+            uint8_t *out = &dest[((size_t) n * PIPELINE_LANES + lane) * PIPELINE_CONVERSION_BYTES];
+            // The dma writes results in the native little-endian byte order
+            out[0] = word & 0xFF;
+            out[1] = (word >> 8) & 0xFF;
+            out[2] = (word >> 16) & 0xFF;
+            out[3] = (word >> 24) & 0xFF;
+        }
+    }
+    return total;
+}
+
+esp_err_t captureFrame(AdcSource &source, int samples, uint16_t **lanes, uint8_t *buffer, uint32_t capacity) {
+    esp_err_t err = source.start();
+    if (err != ESP_OK) {
+        return err;
+    }
+    int offsets[PIPELINE_LANES] = {0, 0, 0, 0};
+    while (true) {
+        // Calculate the remaining samples needed across all channels
+        uint32_t remain = 0;
+        for (int offset: offsets) {
+            remain += (samples - offset) * PIPELINE_CONVERSION_BYTES;
+        }
+        // Return if there are no more samples to be collected
+        if (remain == 0) {
+            break;
+        }
+        // Cap the number of samples at the read buffer size
+        remain = remain > capacity ? capacity : remain;
+        uint32_t length = 0;
+        err = source.read(buffer, remain, &length);
+        if (err != ESP_OK) {
+            continue;
+        }
+        decodeConversions(buffer, length, lanes, offsets, samples);
+    }
+    return source.stop();
+}
+
+size_t frameBytes(int samples) {
+    return samples * PIPELINE_LANES * sizeof(uint16_t) + SAMPLE_FRAME_TRAILER_SIZE;
+}
+
+static void putBigEndian(uint8_t *dest, uint64_t value, size_t width) {
+    for (size_t i = 0; i < width; i++) {
+        dest[i] = (value >> (8 * (width - 1 - i))) & 0xFF;
+    }
+}
+
+size_t serializeFrame(const SampleData &frame, uint8_t *dest, size_t capacity) {
+    size_t total = frameBytes(frame.size);
+    if (capacity < total) {
+        return 0;
+    }
+    for (int i = 0; i < PIPELINE_LANES; i++) {
+        if (frame.data[i] == nullptr) {
+            return 0;
+        }
+        uint8_t *lane = &dest[i * frame.size * sizeof(uint16_t)];
+        for (int j = 0; j < frame.size; ++j) {
+            putBigEndian(&lane[j * sizeof(uint16_t)], frame.data[i][j], sizeof(uint16_t));
+        }
+    }
+    // The adc start and stop stay last, where older bridges read them
+    const int64_t trailer[] = {frame.configuration, frame.chirpStart, frame.chirpStop, frame.skew, frame.epoch,
+                               frame.start, frame.stop};
+    uint8_t *end = &dest[PIPELINE_LANES * frame.size * sizeof(uint16_t)];
+    for (size_t i = 0; i < sizeof(trailer) / sizeof(int64_t); i++) {
+        putBigEndian(&end[i * sizeof(int64_t)], (uint64_t) trailer[i], sizeof(int64_t));
+    }
+    return total;
+}
+
+static uint64_t getBigEndian(const uint8_t *src, size_t width) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < width; i++) {
+        value = value << 8 | src[i];
+    }
+    return value;
+}
+
+bool deserializeFrame(const uint8_t *src, size_t length, SampleData *frame, int capacity) {
+    if (length < SAMPLE_FRAME_TRAILER_SIZE) {
+        return false;
+    }
+    size_t laneBytes = length - SAMPLE_FRAME_TRAILER_SIZE;
+    if (laneBytes % (PIPELINE_LANES * sizeof(uint16_t)) != 0) {
+        return false;
+    }
+    int samples = (int) (laneBytes / (PIPELINE_LANES * sizeof(uint16_t)));
+    if (samples > capacity) {
+        return false;
+    }
+    for (int i = 0; i < PIPELINE_LANES; i++) {
+        const uint8_t *lane = &src[i * samples * sizeof(uint16_t)];
+        for (int j = 0; j < samples; ++j) {
+            frame->data[i][j] = (uint16_t) getBigEndian(&lane[j * sizeof(uint16_t)], sizeof(uint16_t));
+        }
+    }
+    int64_t trailer[SAMPLE_FRAME_TRAILER_SIZE / sizeof(int64_t)];
+    const uint8_t *end = &src[laneBytes];
+    for (size_t i = 0; i < sizeof(trailer) / sizeof(int64_t); i++) {
+        trailer[i] = (int64_t) getBigEndian(&end[i * sizeof(int64_t)], sizeof(int64_t));
+    }
+    frame->size = samples;
+    frame->configuration = (uint32_t) trailer[0];
+    frame->chirpStart = trailer[1];
+    frame->chirpStop = trailer[2];
+    frame->skew = trailer[3];
+    frame->epoch = trailer[4];
+    frame->start = trailer[5];
+    frame->stop = trailer[6];
+    frame->enqueued = 0;
+    return true;
+}
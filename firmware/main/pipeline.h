@@ -0,0 +1,65 @@
+#ifndef RADAR_PIPELINE_H
+#define RADAR_PIPELINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include "hal.h"
+
+#define PIPELINE_LANES 4
+// Bytes of each TYPE2 conversion result
+#define PIPELINE_CONVERSION_BYTES 4
+// ADC1 channel of the first lane, the lanes are the consecutive channels of GPIO4 to GPIO7 on the ESP32-S3
+#define PIPELINE_FIRST_CHANNEL 3
+
+// ESP32-S3 TYPE2 conversion result: 12 data bits, a reserved bit, 4 channel bits and the unit bit
+#define PIPELINE_WORD_DATA(word) ((word) & 0xFFF)
+#define PIPELINE_WORD_CHANNEL(word) (((word) >> 13) & 0xF)
+#define PIPELINE_WORD_UNIT(word) (((word) >> 17) & 0x1)
+
+// Bytes appended to each binary sample frame: configuration id, chirp start, chirp stop, skew, epoch, start and stop
+#define SAMPLE_FRAME_TRAILER_SIZE (sizeof(int64_t) * 7)
+
+typedef struct SampleData {
+    uint16_t **data;
+    int size;
+    int64_t start;
+    int64_t stop;
+    int64_t chirpStart;
+    int64_t chirpStop;
+    // Nanoseconds from the chirp start to the first adc conversion of the frame
+    int64_t skew;
+    // Chirp start on the clock shared by synchronized modules, zero while unsynchronized
+    int64_t epoch;
+    // Id of the chirp and sampling configuration the frame was captured with
+    uint32_t configuration;
+    // Microseconds since boot when the frame entered the ring buffer
+    int64_t enqueued;
+} SampleData;
+
+// Encode one conversion result the way the adc dma writes it
+uint32_t conversionWord(uint16_t value, uint32_t channel, uint32_t unit);
+
+// Sort the conversion results in buffer into their lanes, advancing each lane's offset until it holds samples values.
+// Returns the number of results placed, results of unknown channels or full lanes are skipped.
+size_t decodeConversions(const uint8_t *buffer, size_t length, uint16_t **lanes, int *offsets, int samples);
+
+// Write the lanes as the adc dma would, one conversion result per lane in turn. Returns the bytes written or zero if
+// dest is too small.
+size_t encodeConversions(uint16_t *const *lanes, int samples, uint8_t *dest, size_t capacity);
+
+// Read conversion results from the source until every lane holds samples values, using buffer as the dma read chunk
+esp_err_t captureFrame(AdcSource &source, int samples, uint16_t **lanes, uint8_t *buffer, uint32_t capacity);
+
+// Bytes of a serialized frame of the given samples per lane
+size_t frameBytes(int samples);
+
+// Serialize a frame for the websocket: the lanes back to back as big-endian 16-bit values, then the trailer of
+// big-endian 64-bit integers. Returns the bytes written or zero if a lane is missing or dest is too small.
+size_t serializeFrame(const SampleData &frame, uint8_t *dest, size_t capacity);
+
+// Parse a serialized frame back into frame, whose data must point at lanes of at least the frame's samples. Returns
+// false if length is not the size of a whole frame or the lanes are too short.
+bool deserializeFrame(const uint8_t *src, size_t length, SampleData *frame, int capacity);
+
+
+#endif //RADAR_PIPELINE_H
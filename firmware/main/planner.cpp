@@ -0,0 +1,192 @@
+#include "burst.h"
+#include "pipeline.h"
+#include "planner.h"
+#include "reconfigure.h"
+
+const char *streamFormatName(StreamFormat format) {
+    switch (format) {
+        case STREAM_RAW:
+            return "raw";
+        case STREAM_PACKED:
+            return "packed";
+        case STREAM_COMPRESSED:
+            return "compressed";
+        case STREAM_SPECTRA:
+            return "spectra";
+        case STREAM_DETECTIONS:
+            return "detections";
+        default:
+            return "unknown";
+    }
+}
+
+size_t streamFrameBytes(StreamFormat format, int32_t samples) {
+    auto count = (size_t) (samples > 0 ? samples : 0);
+    switch (format) {
+        case STREAM_RAW:
+            return frameBytes((int) count);
+        case STREAM_PACKED:
+            return count * PIPELINE_LANES * 12 / 8 + SAMPLE_FRAME_TRAILER_SIZE;
+        case STREAM_COMPRESSED:
+            return (count * PIPELINE_LANES * PLAN_COMPRESSED_BITS + 7) / 8 + SAMPLE_FRAME_TRAILER_SIZE;
+        case STREAM_SPECTRA:
+            // Half the bins of each receiver's complex transform, the other half mirror them
+            return 2 * (count / 2) * sizeof(uint16_t) + SAMPLE_FRAME_TRAILER_SIZE;
+        case STREAM_DETECTIONS:
+            return PLAN_MAX_DETECTIONS * PLAN_DETECTION_BYTES + SAMPLE_FRAME_TRAILER_SIZE;
+        default:
+            return 0;
+    }
+}
+
+StreamDemand streamDemand(const Chirp &chirp, const Sampling &sampling, const Burst &burst) {
+    StreamDemand demand{};
+    demand.samples = frameSamples(chirp, sampling);
+    if (chirp.prf <= 0) {
+        return demand;
+    }
+    demand.frameRate = 1e6 / chirp.prf;
+    // A burst sends its chirps then falls quiet, the ring buffer carries the burst across the idle gap
+    BurstPlan burstPlan = planBurst(chirp, burst);
+    if (burstPlan.gated) {
+        demand.frameRate = 1e6 * burstPlan.chirps / (double) burstPlan.period;
+    }
+    return demand;
+}
+
+StreamPlan planStream(const StreamDemand &demand, double throughput, uint32_t formats, double headroom) {
+    StreamPlan plan{};
+    plan.format = STREAM_RAW;
+    plan.decimation = 1;
+    plan.demand = (double) streamFrameBytes(STREAM_RAW, demand.samples) * demand.frameRate;
+    plan.rate = plan.demand;
+    plan.throughput = throughput;
+    plan.fits = true;
+    if (throughput <= 0) {
+        return plan;
+    }
+    if (!(formats & (STREAM_FORMAT(STREAM_FORMATS) - 1))) {
+        formats = STREAM_FORMAT(STREAM_RAW);
+    }
+    double budget = throughput * headroom;
+    // Every frame in a cheaper format before fewer frames in a richer one
+    for (int decimation = 1; decimation <= PLAN_MAX_DECIMATION; decimation++) {
+        for (int format = STREAM_RAW; format < STREAM_FORMATS; format++) {
+            if (!(formats & STREAM_FORMAT(format))) {
+                continue;
+            }
+            auto candidate = (StreamFormat) format;
+            double rate = (double) streamFrameBytes(candidate, demand.samples) * demand.frameRate / decimation;
+            if (rate <= budget) {
+                plan.format = candidate;
+                plan.decimation = decimation;
+                plan.rate = rate;
+                return plan;
+            }
+        }
+    }
+    // Nothing fits, the least the stream can be is the cheapest format at the most decimation
+    for (int format = STREAM_RAW; format < STREAM_FORMATS; format++) {
+        auto candidate = (StreamFormat) format;
+        if ((formats & STREAM_FORMAT(format)) && (!(formats & STREAM_FORMAT(plan.format)) ||
+                                                  streamFrameBytes(candidate, demand.samples) <=
+                                                  streamFrameBytes(plan.format, demand.samples))) {
+            plan.format = candidate;
+        }
+    }
+    plan.decimation = PLAN_MAX_DECIMATION;
+    plan.rate = (double) streamFrameBytes(plan.format, demand.samples) * demand.frameRate / PLAN_MAX_DECIMATION;
+    plan.fits = false;
+    return plan;
+}
+
+bool streamRicher(const StreamPlan &a, const StreamPlan &b) {
+    if (a.decimation != b.decimation) {
+        return a.decimation < b.decimation;
+    }
+    return a.format < b.format;
+}
+
+void LinkMeter::record(size_t sent, uint64_t nanoseconds) {
+    // A plain mean until the window fills, then an exponential one over it
+    count++;
+    double weight = count < PLAN_LINK_SENDS ? 1.0 / count : 1.0 / PLAN_LINK_SENDS;
+    bytes += ((double) sent - bytes) * weight;
+    seconds += ((double) nanoseconds / 1e9 - seconds) * weight;
+}
+
+double LinkMeter::throughput() const {
+    if (count == 0 || seconds <= 0) {
+        return 0;
+    }
+    return bytes / seconds;
+}
+
+uint32_t LinkMeter::sends() const {
+    return count;
+}
+
+void LinkMeter::reset() {
+    bytes = 0;
+    seconds = 0;
+    count = 0;
+}
+
+StreamPlanner::StreamPlanner(uint32_t formats) : formats(formats) {
+    current = planStream(demand, 0, formats);
+}
+
+const StreamPlan &StreamPlanner::configure(const StreamDemand &next, int64_t now) {
+    demand = next;
+    current = planStream(demand, link.throughput(), formats);
+    since = now;
+    upgraded = false;
+    return current;
+}
+
+void StreamPlanner::sent(size_t bytes, uint64_t nanoseconds) {
+    link.record(bytes, nanoseconds);
+}
+
+bool StreamPlanner::update(int64_t now) {
+    if (link.sends() == 0) {
+        return false;
+    }
+    StreamPlan next = planStream(demand, link.throughput(), formats);
+    bool held = now - since >= holding;
+    // A richer plan that lasted the hold has proven itself, the next try waits the shortest hold again
+    if (upgraded && held) {
+        upgraded = false;
+        holding = PLAN_HOLD_US;
+    }
+    if (streamRicher(current, next)) {
+        if (upgraded) {
+            holding = holding * 2 < PLAN_MAX_HOLD_US ? holding * 2 : PLAN_MAX_HOLD_US;
+        }
+        current = next;
+        since = now;
+        upgraded = false;
+        return true;
+    }
+    if (streamRicher(next, current) && held) {
+        current = next;
+        since = now;
+        upgraded = true;
+        return true;
+    }
+    current.throughput = next.throughput;
+    current.fits = current.rate <= next.throughput * PLAN_HEADROOM;
+    return false;
+}
+
+const StreamPlan &StreamPlanner::plan() const {
+    return current;
+}
+
+double StreamPlanner::throughput() const {
+    return link.throughput();
+}
+
+int64_t StreamPlanner::hold() const {
+    return holding;
+}
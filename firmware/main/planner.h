@@ -0,0 +1,139 @@
+#ifndef RADAR_PLANNER_H
+#define RADAR_PLANNER_H
+
+#include <cstddef>
+#include <cstdint>
+#include "parameters.h"
+
+// Largest factor the frame rate is divided by before the link is taken for too slow to follow
+#define PLAN_MAX_DECIMATION 16
+// Fraction of the measured throughput a plan may use, the rest absorbs bursts and retransmissions
+#define PLAN_HEADROOM 0.8
+// Sends the throughput estimate averages over
+#define PLAN_LINK_SENDS 64
+// Microseconds a plan has to keep fitting before a richer one is tried, and the most a failed try stretches it to
+#define PLAN_HOLD_US 10000000
+#define PLAN_MAX_HOLD_US 160000000
+// Bits per sample a lane predicted from the previous sample is expected to entropy code to
+#define PLAN_COMPRESSED_BITS 7
+// Targets reported per frame of detections, each range, velocity, angle and magnitude at 16 bits
+#define PLAN_MAX_DETECTIONS 16
+#define PLAN_DETECTION_BYTES 8
+
+// Payloads a frame can go out as, from the most to the least faithful
+enum StreamFormat {
+    // Every lane at 16 bits, as the bridge parses them
+    STREAM_RAW = 0,
+    // Lanes packed to their 12 significant bits
+    STREAM_PACKED,
+    // Packed lanes, delta coded and entropy coded
+    STREAM_COMPRESSED,
+    // Range magnitudes of both receivers at 16 bits
+    STREAM_SPECTRA,
+    // The strongest targets of the frame alone
+    STREAM_DETECTIONS,
+    STREAM_FORMATS,
+};
+
+#define STREAM_FORMAT(format) (1u << (format))
+
+typedef struct StreamDemand {
+    // Samples per lane of every frame
+    int32_t samples;
+    // Frames per second averaged over a burst period
+    double frameRate;
+} StreamDemand;
+
+typedef struct StreamPlan {
+    StreamFormat format;
+    // One in this many frames is sent
+    int32_t decimation;
+    // Bytes per second the plan sends
+    double rate;
+    // Bytes per second every frame sent raw would take
+    double demand;
+    // Bytes per second the link was measured to carry, zero before the first send
+    double throughput;
+    // False when even the cheapest plan overruns the link
+    bool fits;
+} StreamPlan;
+
+const char *streamFormatName(StreamFormat format);
+
+// Bytes one frame of samples per lane takes in format, trailer included
+size_t streamFrameBytes(StreamFormat format, int32_t samples);
+
+// The frames the chirp train and burst schedule produce
+StreamDemand streamDemand(const Chirp &chirp, const Sampling &sampling, const Burst &burst);
+
+// The most faithful plan that fits the budget of headroom times throughput, trying the formats allowed (STREAM_FORMAT
+// bits) at each decimation before sending fewer frames. Without a measurement every frame goes out raw.
+StreamPlan planStream(const StreamDemand &demand, double throughput, uint32_t formats,
+                      double headroom = PLAN_HEADROOM);
+
+// Whether plan a sends more of the frames than plan b
+bool streamRicher(const StreamPlan &a, const StreamPlan &b);
+
+// LinkMeter estimates the throughput of the link from the bytes each send carried over the time it blocked for, the
+// mean of the last PLAN_LINK_SENDS sends.
+class LinkMeter {
+public:
+
+    void record(size_t bytes, uint64_t nanoseconds);
+
+    // Bytes per second, zero until the first send
+    double throughput() const;
+
+    uint32_t sends() const;
+
+    void reset();
+
+private:
+
+    double bytes = 0;
+    double seconds = 0;
+    uint32_t count = 0;
+
+};
+
+// StreamPlanner follows the link with the plan. A send blocks while the link is full, but returns as soon as the
+// socket takes the frame while it is not, so the meter reads the link fairly when it is overrun and high when it has
+// room. A poorer plan is taken as soon as the current one overruns the link, a richer one only once the current one
+// has fit for the hold, and each richer plan that overruns within the hold doubles it.
+class StreamPlanner {
+public:
+
+    explicit StreamPlanner(uint32_t formats);
+
+    // Plan new settings against the throughput measured so far, times are in microseconds
+    const StreamPlan &configure(const StreamDemand &demand, int64_t now);
+
+    // A frame of bytes took nanoseconds to send
+    void sent(size_t bytes, uint64_t nanoseconds);
+
+    // Plan again against the link, true if the plan changed
+    bool update(int64_t now);
+
+    const StreamPlan &plan() const;
+
+    // Bytes per second the link was measured to carry, zero before the first send
+    double throughput() const;
+
+    // Microseconds a plan has to fit before a richer one is tried
+    int64_t hold() const;
+
+private:
+
+    uint32_t formats;
+    StreamDemand demand{};
+    StreamPlan current{};
+    LinkMeter link{};
+    // When the current plan was taken, and whether it was richer than the one before
+    int64_t since = 0;
+    bool upgraded = false;
+    int64_t holding = PLAN_HOLD_US;
+
+};
+
+
+#endif //RADAR_PLANNER_H
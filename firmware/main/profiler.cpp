@@ -0,0 +1,221 @@
+#include <cJSON.h>
+#include <cstring>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include "profiler.h"
+
+Profiler &Profiler::instance() {
+    static Profiler the_instance = Profiler();
+    return the_instance;
+}
+
+Profiler::Profiler() {
+#ifdef CONFIG_vRADAR_PROFILER
+    status = (TaskStatus_t *) heap_caps_malloc(sizeof(TaskStatus_t) * PROFILER_MAX_TASKS, MALLOC_CAP_INTERNAL);
+    if (status == nullptr) {
+        printf("Failed to allocate profiler task table\n");
+        return;
+    }
+    // Lowest priority above idle, so the profiler never delays the pipeline it is measuring
+    xTaskCreate(profilerTask, "profiler", 3072, this, tskIDLE_PRIORITY + 1, nullptr);
+#endif
+}
+
+bool Profiler::watch(const char *name, RingbufHandle_t ring, size_t size) {
+    int count = watchedCount.load();
+    if (ring == nullptr || count >= PROFILER_MAX_RINGS) {
+        return false;
+    }
+    watched[count] = {
+            .name = name,
+            .ring = ring,
+            .size = size,
+    };
+    // Publish the entry only once it is complete
+    watchedCount.store(count + 1);
+    return true;
+}
+
+void Profiler::profilerTask(void *arg) {
+    auto profiler = (Profiler *) arg;
+    TickType_t wake = xTaskGetTickCount();
+    while (true) {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(PROFILER_INTERVAL_MS));
+        profiler->sample();
+    }
+}
+
+#ifdef CONFIG_vRADAR_PROFILER
+static HeapProfile heapProfile(uint32_t caps) {
+    return {
+            .free = (uint32_t) heap_caps_get_free_size(caps),
+            .minimum = (uint32_t) heap_caps_get_minimum_free_size(caps),
+            .largest = (uint32_t) heap_caps_get_largest_free_block(caps),
+    };
+}
+#endif
+
+void Profiler::sample() {
+#ifdef CONFIG_vRADAR_PROFILER
+    uint32_t total = 0;
+    // Zero when there are more tasks than the table holds
+    UBaseType_t count = uxTaskGetSystemState(status, PROFILER_MAX_TASKS, &total);
+    if (count == 0) {
+        return;
+    }
+    // The first pass only primes the run time counters
+    bool primed = previousTotal != 0;
+    // The run time counter wraps, unsigned differences stay correct across one wrap
+    uint32_t elapsed = total - previousTotal;
+
+    ProfileSnapshot &next = current;
+    next.time = esp_timer_get_time();
+    next.interval = elapsed;
+    next.taskCount = 0;
+    for (uint32_t &core: next.cores) {
+        core = 0;
+    }
+
+    TaskHandle_t handles[PROFILER_MAX_TASKS];
+    uint32_t runtimes[PROFILER_MAX_TASKS];
+    for (UBaseType_t i = 0; i < count; i++) {
+        const TaskStatus_t &task = status[i];
+        handles[i] = task.xHandle;
+        runtimes[i] = task.ulRunTimeCounter;
+
+        // Tasks created during the interval are measured from zero
+        uint32_t previous = 0;
+        for (int j = 0; j < previousCount; j++) {
+            if (previousHandles[j] == task.xHandle) {
+                previous = previousRuntime[j];
+                break;
+            }
+        }
+        uint32_t load = 0;
+        if (primed && elapsed > 0) {
+            load = (uint32_t) ((uint64_t) (task.ulRunTimeCounter - previous) * 1000 / elapsed);
+        }
+
+        BaseType_t affinity = xTaskGetAffinity(task.xHandle);
+        TaskProfile &profile = next.tasks[next.taskCount++];
+        strncpy(profile.name, task.pcTaskName, PROFILER_NAME_LENGTH - 1);
+        profile.name[PROFILER_NAME_LENGTH - 1] = 0;
+        profile.core = affinity == tskNO_AFFINITY ? -1 : (int32_t) affinity;
+        profile.priority = task.uxCurrentPriority;
+        profile.load = load;
+        profile.stack = task.usStackHighWaterMark;
+        profile.state = task.eCurrentState;
+    }
+
+    // Each core is busy whenever its idle task is not running
+    for (int core = 0; core < PROFILER_CORES; core++) {
+        TaskHandle_t idle = xTaskGetIdleTaskHandleForCPU(core);
+        for (uint32_t i = 0; i < next.taskCount; i++) {
+            if (handles[i] == idle) {
+                next.cores[core] = next.tasks[i].load < 1000 ? 1000 - next.tasks[i].load : 0;
+                break;
+            }
+        }
+    }
+
+    next.internal = heapProfile(MALLOC_CAP_INTERNAL);
+    next.spiram = heapProfile(MALLOC_CAP_SPIRAM);
+
+    int rings = watchedCount.load();
+    next.ringCount = rings;
+    for (int i = 0; i < rings; i++) {
+        UBaseType_t items = 0;
+        vRingbufferGetInfo(watched[i].ring, nullptr, nullptr, nullptr, nullptr, &items);
+        size_t free = xRingbufferGetCurFreeSize(watched[i].ring);
+        next.rings[i] = {
+                .name = watched[i].name,
+                .size = (uint32_t) watched[i].size,
+                .used = free < watched[i].size ? (uint32_t) (watched[i].size - free) : 0,
+                .items = (uint32_t) items,
+        };
+    }
+
+    memcpy(previousHandles, handles, sizeof(TaskHandle_t) * count);
+    memcpy(previousRuntime, runtimes, sizeof(uint32_t) * count);
+    previousCount = (int) count;
+    previousTotal = total;
+    if (!primed) {
+        return;
+    }
+    published.store(next);
+#endif
+}
+
+uint32_t Profiler::snapshot(ProfileSnapshot *dest) const {
+    return published.load(*dest);
+}
+
+uint32_t Profiler::generation() const {
+    return published.generation();
+}
+
+static cJSON *heapJson(const HeapProfile &heap) {
+    auto obj = cJSON_CreateObject();
+    cJSON_AddNumberToObject(obj, "free", heap.free);
+    cJSON_AddNumberToObject(obj, "minimum", heap.minimum);
+    cJSON_AddNumberToObject(obj, "largest", heap.largest);
+    return obj;
+}
+
+size_t Profiler::json(char *dest, size_t capacity) const {
+    // Too large for the stack of the http server task
+    auto profile = (ProfileSnapshot *) malloc(sizeof(ProfileSnapshot));
+    if (profile == nullptr) {
+        return 0;
+    }
+    snapshot(profile);
+
+    auto obj = cJSON_CreateObject();
+    cJSON_AddNumberToObject(obj, "time", (double) profile->time);
+    cJSON_AddNumberToObject(obj, "interval", profile->interval);
+    auto cores = cJSON_CreateArray();
+    for (uint32_t load: profile->cores) {
+        cJSON_AddItemToArray(cores, cJSON_CreateNumber(load));
+    }
+    cJSON_AddItemToObject(obj, "cores", cores);
+
+    auto heap = cJSON_CreateObject();
+    cJSON_AddItemToObject(heap, "internal", heapJson(profile->internal));
+    cJSON_AddItemToObject(heap, "spiram", heapJson(profile->spiram));
+    cJSON_AddItemToObject(obj, "heap", heap);
+
+    auto rings = cJSON_CreateArray();
+    for (uint32_t i = 0; i < profile->ringCount; i++) {
+        const RingProfile &ring = profile->rings[i];
+        auto entry = cJSON_CreateObject();
+        cJSON_AddStringToObject(entry, "name", ring.name);
+        cJSON_AddNumberToObject(entry, "size", ring.size);
+        cJSON_AddNumberToObject(entry, "used", ring.used);
+        cJSON_AddNumberToObject(entry, "items", ring.items);
+        cJSON_AddItemToArray(rings, entry);
+    }
+    cJSON_AddItemToObject(obj, "rings", rings);
+
+    // One row per task keeps the document small: name, core, priority, load, stack, state
+    auto tasks = cJSON_CreateArray();
+    for (uint32_t i = 0; i < profile->taskCount; i++) {
+        const TaskProfile &task = profile->tasks[i];
+        auto row = cJSON_CreateArray();
+        cJSON_AddItemToArray(row, cJSON_CreateString(task.name));
+        cJSON_AddItemToArray(row, cJSON_CreateNumber(task.core));
+        cJSON_AddItemToArray(row, cJSON_CreateNumber(task.priority));
+        cJSON_AddItemToArray(row, cJSON_CreateNumber(task.load));
+        cJSON_AddItemToArray(row, cJSON_CreateNumber(task.stack));
+        cJSON_AddItemToArray(row, cJSON_CreateNumber(task.state));
+        cJSON_AddItemToArray(tasks, row);
+    }
+    cJSON_AddItemToObject(obj, "tasks", tasks);
+    free(profile);
+
+    bool printed = cJSON_PrintPreallocated(obj, dest, (int) capacity, false);
+    cJSON_Delete(obj);
+    if (!printed) {
+        return 0;
+    }
+    return strlen(dest);
+}
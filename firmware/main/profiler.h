@@ -0,0 +1,112 @@
+#ifndef RADAR_PROFILER_H
+#define RADAR_PROFILER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/ringbuf.h>
+#include "seqlock.h"
+
+#define PROFILER_MAX_TASKS 32
+#define PROFILER_MAX_RINGS 4
+#define PROFILER_CORES 2
+#define PROFILER_NAME_LENGTH 16
+#define PROFILER_INTERVAL_MS 1000
+// Large enough for the json document with every task slot in use
+#define PROFILER_DOCUMENT_SIZE 4096
+
+typedef struct TaskProfile {
+    char name[PROFILER_NAME_LENGTH];
+    // Core the task is pinned to, -1 when it may run on either
+    int32_t core;
+    uint32_t priority;
+    // Share of one core over the last interval, in tenths of a percent
+    uint32_t load;
+    // Fewest bytes of stack left free since the task started
+    uint32_t stack;
+    // eTaskState when the snapshot was taken
+    uint32_t state;
+} TaskProfile;
+
+typedef struct HeapProfile {
+    uint32_t free;
+    // Lowest free size since boot
+    uint32_t minimum;
+    // Largest block that can currently be allocated
+    uint32_t largest;
+} HeapProfile;
+
+typedef struct RingProfile {
+    const char *name;
+    uint32_t size;
+    // Bytes taken by items, approximated from the largest item that still fits
+    uint32_t used;
+    uint32_t items;
+} RingProfile;
+
+typedef struct ProfileSnapshot {
+    // Microseconds since boot when the snapshot was taken, and the microseconds it covers
+    int64_t time;
+    uint32_t interval;
+    // Busy share of each core, in tenths of a percent
+    uint32_t cores[PROFILER_CORES];
+    HeapProfile internal;
+    HeapProfile spiram;
+    uint32_t ringCount;
+    RingProfile rings[PROFILER_MAX_RINGS];
+    uint32_t taskCount;
+    TaskProfile tasks[PROFILER_MAX_TASKS];
+} ProfileSnapshot;
+
+// Profiler samples the FreeRTOS run time counters, stack high-water marks, heap by capability and the fill level of
+// the watched ring buffers once per interval from a low priority task. Any task may read the latest snapshot.
+class Profiler {
+public:
+
+    static Profiler &instance();
+
+    // Include the fill level of a ring buffer in the snapshots, rings must be watched before they are deleted
+    bool watch(const char *name, RingbufHandle_t ring, size_t size);
+
+    // Copy the latest snapshot, returns its generation
+    uint32_t snapshot(ProfileSnapshot *dest) const;
+
+    // Generation of the latest snapshot, zero until the first interval has been sampled
+    uint32_t generation() const;
+
+    // Serialize the latest snapshot as compact json, returns the length or zero if it does not fit
+    size_t json(char *dest, size_t capacity) const;
+
+private:
+
+    Profiler();
+
+    static void profilerTask(void *arg);
+
+    void sample();
+
+    typedef struct RingWatch {
+        const char *name;
+        RingbufHandle_t ring;
+        size_t size;
+    } RingWatch;
+
+    RingWatch watched[PROFILER_MAX_RINGS]{};
+    std::atomic<int> watchedCount{0};
+
+    // Run time counters of the previous interval, matched to the current one by task handle
+    TaskHandle_t previousHandles[PROFILER_MAX_TASKS]{};
+    uint32_t previousRuntime[PROFILER_MAX_TASKS]{};
+    int previousCount = 0;
+    uint32_t previousTotal = 0;
+
+    TaskStatus_t *status = nullptr;
+    ProfileSnapshot current{};
+    Seqlock<ProfileSnapshot> published{};
+
+};
+
+
+#endif //RADAR_PROFILER_H
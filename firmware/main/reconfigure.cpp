@@ -0,0 +1,77 @@
+#include <cmath>
+#include "reconfigure.h"
+
+int32_t frameSamples(const Chirp &chirp, const Sampling &sampling) {
+    if (sampling.frequency <= 0) {
+        return FRAME_MIN_SAMPLES;
+    }
+    auto samples = (int32_t) ceil(((double) chirp.prf / 1000.0) / (1000.0 / (double) sampling.frequency));
+    if (samples < FRAME_MIN_SAMPLES) samples = FRAME_MIN_SAMPLES;
+    if (samples > FRAME_MAX_SAMPLES) samples = FRAME_MAX_SAMPLES;
+    return samples;
+}
+
+int32_t rampSamples(const Chirp &chirp, const Sampling &sampling) {
+    int32_t samples = frameSamples(chirp, sampling);
+    if (chirp.steps <= 1 || sampling.frequency <= 0) {
+        return samples;
+    }
+    // Steps last duration / steps microseconds, the last of them is the flyback
+    double ramp = (double) chirp.duration * (double) (chirp.steps - 1) / (double) chirp.steps;
+    auto before = (int32_t) floor(ramp * (double) sampling.frequency / 1e6);
+    return before < samples ? before : samples;
+}
+
+void Reconfigure::stage() {
+    staged = true;
+}
+
+const FrameConfiguration &Reconfigure::beginFrame() {
+    inFlight++;
+    return configuration;
+}
+
+void Reconfigure::endFrame() {
+    inFlight--;
+}
+
+bool Reconfigure::drain() {
+    if (current == RECONFIGURE_ACTIVE) {
+        if (!staged) {
+            return false;
+        }
+        current = RECONFIGURE_STAGED;
+    }
+    if (current == RECONFIGURE_STAGED) {
+        // Frames started before the change was staged keep the configuration they were started with
+        if (inFlight > 0) {
+            return false;
+        }
+        // Changes staged after this point are applied on the next boundary
+        staged = false;
+        current = RECONFIGURE_DRAINED;
+    }
+    return true;
+}
+
+uint32_t Reconfigure::commit(const Chirp &chirp, const Sampling &sampling) {
+    configuration.id++;
+    configuration.chirp = chirp;
+    configuration.sampling = sampling;
+    configuration.samples = frameSamples(chirp, sampling);
+    configuration.ramp = rampSamples(chirp, sampling);
+    current = RECONFIGURE_ACTIVE;
+    return configuration.id;
+}
+
+void Reconfigure::abort() {
+    current = RECONFIGURE_ACTIVE;
+}
+
+ReconfigureState Reconfigure::state() const {
+    return current;
+}
+
+const FrameConfiguration &Reconfigure::active() const {
+    return configuration;
+}
@@ -0,0 +1,77 @@
+#ifndef RADAR_RECONFIGURE_H
+#define RADAR_RECONFIGURE_H
+
+#include <atomic>
+#include <cstdint>
+#include "parameters.h"
+
+#define FRAME_MIN_SAMPLES 32
+#define FRAME_MAX_SAMPLES 1024
+
+// Calculate the number of samples per lane captured during one chirp period
+int32_t frameSamples(const Chirp &chirp, const Sampling &sampling);
+
+// Samples per lane captured before the final step of the chirp returns the VCO to the bottom of the band
+int32_t rampSamples(const Chirp &chirp, const Sampling &sampling);
+
+typedef struct FrameConfiguration {
+    // Monotonically increasing id, stamped into every frame captured with this configuration
+    uint32_t id = 0;
+    Chirp chirp{};
+    Sampling sampling{};
+    int32_t samples = FRAME_MIN_SAMPLES;
+    // Samples of the frame on the ramp, the rest see the flyback and the rest of the period
+    int32_t ramp = FRAME_MIN_SAMPLES;
+} FrameConfiguration;
+
+enum ReconfigureState {
+    // Frames are captured with the active configuration
+    RECONFIGURE_ACTIVE = 0,
+    // A new configuration has been published, in-flight frames finish with the active configuration
+    RECONFIGURE_STAGED,
+    // No frames are in flight, the chirp and sampling hardware may be switched
+    RECONFIGURE_DRAINED,
+};
+
+// Reconfigure sequences chirp and sampling changes so that every frame is captured with exactly one configuration.
+// Changes are staged from any task, the acquisition task drains in-flight frames, switches the hardware and commits
+// the new configuration before the next frame begins.
+class Reconfigure {
+public:
+
+    // Phase one: record that a new configuration has been published, safe to call from any task
+    void stage();
+
+    // Acquisition task: a frame capture is starting, returns the configuration to capture and stamp it with
+    const FrameConfiguration &beginFrame();
+
+    // Acquisition task: the frame capture has finished or been abandoned
+    void endFrame();
+
+    // Acquisition task: advances a staged change to drained once no frames are in flight, returns true when the
+    // hardware must be switched before the next frame
+    bool drain();
+
+    // Phase two: adopt the configuration the hardware has been switched to, returns the new configuration id
+    uint32_t commit(const Chirp &chirp, const Sampling &sampling);
+
+    // Phase two failed: the hardware kept the active configuration, frames go on with it. Changes staged since the
+    // drain are still applied at the next boundary.
+    void abort();
+
+    ReconfigureState state() const;
+
+    const FrameConfiguration &active() const;
+
+private:
+
+    std::atomic<bool> staged{false};
+    std::atomic<int> inFlight{0};
+    std::atomic<ReconfigureState> current{RECONFIGURE_ACTIVE};
+
+    FrameConfiguration configuration{};
+
+};
+
+
+#endif //RADAR_RECONFIGURE_H
@@ -0,0 +1,249 @@
+#include <climits>
+#include <cstring>
+#include "recorder.h"
+
+// Frame offsets written to the sink at a time while dumping the frame index
+#define RECORDER_INDEX_BATCH 64
+
+FlightRecorder::FlightRecorder(uint8_t *arena, size_t bytes, size_t blockBytes) : arena(arena), blockBytes(blockBytes) {
+    size_t count = arena != nullptr && blockBytes > sizeof(CaptureChunk) ? bytes / blockBytes : 0;
+    blocks = (uint32_t) (count < RECORDER_MAX_BLOCKS ? count : RECORDER_MAX_BLOCKS);
+}
+
+CaptureChunk *FlightRecorder::block(uint32_t index) {
+    return (CaptureChunk *) (arena + (size_t) index * blockBytes);
+}
+
+void FlightRecorder::advance(int64_t time) {
+    if (used == blocks) {
+        evicted += block(oldest)->records;
+        oldest = (oldest + 1) % blocks;
+        used--;
+    }
+    uint32_t head = (oldest + used) % blocks;
+    used++;
+    CaptureChunk *chunk = block(head);
+    *chunk = {
+            .magic = CAPTURE_CHUNK_MAGIC,
+            .index = 0,
+            .sequence = sequence,
+            .frame = frames,
+            .records = 0,
+            .bytes = 0,
+    };
+    begins[head] = time;
+    ends[head] = time;
+}
+
+bool FlightRecorder::append(const SampleData &frame, int64_t time) {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t length = frameBytes(frame.size);
+    size_t bytes = captureRecordBytes(length);
+    if (current == RECORDER_FROZEN || blocks == 0 || bytes > blockBytes - sizeof(CaptureChunk)) {
+        refused++;
+        return false;
+    }
+    if (used == 0) {
+        advance(time);
+    }
+    uint32_t head = (oldest + used - 1) % blocks;
+    if (sizeof(CaptureChunk) + block(head)->bytes + bytes > blockBytes) {
+        advance(time);
+        head = (oldest + used - 1) % blocks;
+    }
+    CaptureChunk *chunk = block(head);
+    uint8_t *dest = (uint8_t *) (chunk + 1) + chunk->bytes;
+    // Serialize in place, the record is the frame exactly as the websocket carries it
+    captureEncodeHeader(dest, bytes, CAPTURE_FRAME, sequence, time, length);
+    if (serializeFrame(frame, dest + sizeof(CaptureRecord), length) == 0) {
+        refused++;
+        return false;
+    }
+    chunk->records++;
+    chunk->bytes += (uint32_t) bytes;
+    ends[head] = time;
+    sequence++;
+    frames++;
+    if (current == RECORDER_TRIGGERED && time >= until) {
+        current = RECORDER_FROZEN;
+    }
+    return true;
+}
+
+bool FlightRecorder::trigger(int64_t time, int64_t pre, int64_t post) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (current != RECORDER_RECORDING) {
+        return false;
+    }
+    from = time - pre;
+    until = time + post;
+    triggers++;
+    current = post > 0 ? RECORDER_TRIGGERED : RECORDER_FROZEN;
+    return true;
+}
+
+void FlightRecorder::freeze(int64_t time) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (current == RECORDER_RECORDING) {
+        from = INT64_MIN;
+        until = time;
+        triggers++;
+        current = RECORDER_FROZEN;
+    } else if (current == RECORDER_TRIGGERED) {
+        until = time;
+        current = RECORDER_FROZEN;
+    }
+}
+
+bool FlightRecorder::release() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (dumping) {
+        return false;
+    }
+    current = RECORDER_RECORDING;
+    return true;
+}
+
+uint32_t FlightRecorder::window(uint32_t *first) {
+    // Blocks are in time order, the window starts at the first block that ends inside it
+    for (uint32_t i = 0; i < used; i++) {
+        uint32_t index = (oldest + i) % blocks;
+        if (ends[index] >= from) {
+            *first = index;
+            return used - i;
+        }
+    }
+    *first = oldest;
+    return 0;
+}
+
+bool FlightRecorder::dump(RecorderSink sink, void *ctx, const char *metadata, size_t length, const char *source) {
+    uint32_t first = 0, count = 0;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        bool idle = false;
+        if (current != RECORDER_FROZEN || !dumping.compare_exchange_strong(idle, true)) {
+            return false;
+        }
+        count = window(&first);
+    }
+    // Frozen blocks are not written again until released, so they are read without the lock
+
+    CaptureHeader header{};
+    header.magic = CAPTURE_MAGIC;
+    header.version = CAPTURE_VERSION;
+    header.flags = CAPTURE_FLAG_BOOT_TIME;
+    header.chunkBytes = (uint32_t) blockBytes;
+    strncpy(header.source, source, sizeof(header.source) - 1);
+    bool ok = sink((const uint8_t *) &header, sizeof(header), ctx);
+
+    // The metadata document opens the capture in a chunk of its own, so a replay can open a session with it
+    static const uint8_t zeros[CAPTURE_ALIGNMENT]{};
+    size_t padding = captureAligned(length) - length;
+    CaptureChunk opening = {
+            .magic = CAPTURE_CHUNK_MAGIC,
+            .index = 0,
+            .sequence = 0,
+            .frame = 0,
+            .records = 1,
+            .bytes = (uint32_t) captureRecordBytes(length),
+    };
+    CaptureRecord document = {
+            .type = CAPTURE_METADATA,
+            .flags = 0,
+            .reserved = 0,
+            .length = (uint32_t) length,
+            .sequence = 0,
+            .time = begins[first],
+    };
+    uint64_t metadataOffset = sizeof(header) + sizeof(CaptureChunk);
+    ok = ok && sink((const uint8_t *) &opening, sizeof(opening), ctx);
+    ok = ok && sink((const uint8_t *) &document, sizeof(document), ctx);
+    ok = ok && sink((const uint8_t *) metadata, length, ctx);
+    ok = ok && (padding == 0 || sink(zeros, padding, ctx));
+
+    // Each block goes out as a chunk, its header renumbered for its place in the capture
+    uint64_t offset = metadataOffset + captureRecordBytes(length);
+    uint64_t records = 1, frameCount = 0;
+    for (uint32_t i = 0; i < count && ok; i++) {
+        CaptureChunk *chunk = block((first + i) % blocks);
+        CaptureChunk renumbered = *chunk;
+        renumbered.index = i + 1;
+        renumbered.frame = frameCount;
+        ok = sink((const uint8_t *) &renumbered, sizeof(renumbered), ctx) &&
+             sink((const uint8_t *) (chunk + 1), chunk->bytes, ctx);
+        offset += sizeof(CaptureChunk) + chunk->bytes;
+        records += chunk->records;
+        frameCount += chunk->records;
+    }
+
+    // Every record in a block is a frame, so the index is the running offset of each record
+    uint64_t batch[RECORDER_INDEX_BATCH];
+    uint32_t batched = 0;
+    uint64_t position = metadataOffset + captureRecordBytes(length);
+    for (uint32_t i = 0; i < count && ok; i++) {
+        CaptureChunk *chunk = block((first + i) % blocks);
+        auto data = (const uint8_t *) (chunk + 1);
+        position += sizeof(CaptureChunk);
+        size_t at = 0;
+        while (at < chunk->bytes && ok) {
+            batch[batched++] = position + at;
+            at += captureRecordBytes(((const CaptureRecord *) (data + at))->length);
+            if (batched == RECORDER_INDEX_BATCH) {
+                ok = sink((const uint8_t *) batch, sizeof(batch), ctx);
+                batched = 0;
+            }
+        }
+        position += chunk->bytes;
+    }
+    ok = ok && (batched == 0 || sink((const uint8_t *) batch, batched * sizeof(uint64_t), ctx));
+
+    uint64_t chunkOffset = sizeof(header);
+    ok = ok && sink((const uint8_t *) &chunkOffset, sizeof(chunkOffset), ctx);
+    chunkOffset = metadataOffset + captureRecordBytes(length);
+    for (uint32_t i = 0; i < count && ok; i++) {
+        ok = sink((const uint8_t *) &chunkOffset, sizeof(chunkOffset), ctx);
+        chunkOffset += sizeof(CaptureChunk) + block((first + i) % blocks)->bytes;
+    }
+
+    CaptureSettings settings = {
+            .frame = 0,
+            .offset = metadataOffset,
+    };
+    ok = ok && sink((const uint8_t *) &settings, sizeof(settings), ctx);
+
+    CaptureFooter footer{};
+    footer.magic = CAPTURE_FOOTER_MAGIC;
+    footer.chunks = count + 1;
+    footer.records = records;
+    footer.frames = frameCount;
+    footer.frameIndex = offset;
+    footer.chunkIndex = footer.frameIndex + frameCount * sizeof(uint64_t);
+    footer.settingsIndex = footer.chunkIndex + footer.chunks * sizeof(uint64_t);
+    footer.settings = 1;
+    ok = ok && sink((const uint8_t *) &footer, sizeof(footer), ctx);
+
+    dumping = false;
+    return ok;
+}
+
+RecorderState FlightRecorder::state() const {
+    return (RecorderState) current.load();
+}
+
+RecorderStatus FlightRecorder::status() {
+    std::lock_guard<std::mutex> guard(lock);
+    RecorderStatus next{};
+    next.state = current;
+    for (uint32_t i = 0; i < used; i++) {
+        next.frames += block((oldest + i) % blocks)->records;
+    }
+    if (used > 0) {
+        next.span = ends[(oldest + used - 1) % blocks] - begins[oldest];
+    }
+    next.recorded = frames;
+    next.evicted = evicted;
+    next.refused = refused;
+    next.triggers = triggers;
+    return next;
+}
@@ -0,0 +1,112 @@
+#ifndef RADAR_RECORDER_H
+#define RADAR_RECORDER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "capture.h"
+#include "pipeline.h"
+
+// Bytes of each recorder block, a chunk of the dumped capture. The largest frame, 1024 samples per lane, takes about
+// 8 KiB, so a block holds several of them.
+#define RECORDER_BLOCK_BYTES (64 * 1024)
+#define RECORDER_MAX_BLOCKS 64
+
+enum RecorderState {
+    // Recording, the oldest block is overwritten when the ring is full
+    RECORDER_RECORDING = 0,
+    // Recording until the frames after the trigger are in
+    RECORDER_TRIGGERED = 1,
+    // Holding the window around the trigger until it has been dumped
+    RECORDER_FROZEN = 2,
+};
+
+// Called with each piece of a dump in order, returns false to abandon the dump
+typedef bool (*RecorderSink)(const uint8_t *data, size_t length, void *ctx);
+
+typedef struct RecorderStatus {
+    int32_t state;
+    // Frames held and the microseconds they span
+    uint32_t frames;
+    int64_t span;
+    // Frames recorded since boot, lost with an evicted block, and refused while frozen or too large
+    uint64_t recorded;
+    uint64_t evicted;
+    uint64_t refused;
+    uint32_t triggers;
+} RecorderStatus;
+
+// FlightRecorder keeps the most recent frames in a ring of fixed blocks carved out of one arena, allocated once. A frame
+// is serialized straight into the current block as a capture record, so recording is a pointer bump and a copy. When a
+// frame does not fit in what is left of the block, recording moves on to the next block and the oldest block is
+// dropped whole once the ring is full. Each block starts with the chunk header it is dumped with.
+//
+// A trigger marks a moment and how much before and after it to keep. Recording goes on until the frames after it are
+// in, then the ring is frozen and refuses frames until the window has been dumped as a capture and released.
+class FlightRecorder {
+public:
+
+    FlightRecorder(uint8_t *arena, size_t bytes, size_t blockBytes = RECORDER_BLOCK_BYTES);
+
+    FlightRecorder(const FlightRecorder &) = delete;
+
+    FlightRecorder &operator=(const FlightRecorder &) = delete;
+
+    // Record a frame received at time, returns false if it was refused
+    bool append(const SampleData &frame, int64_t time);
+
+    // Keep the frames from pre microseconds before time to post microseconds after it. Returns false if a trigger is
+    // already pending or the ring is frozen.
+    bool trigger(int64_t time, int64_t pre, int64_t post);
+
+    // Freeze the ring now, keeping the frames of a pending trigger window, or the whole ring if there is none
+    void freeze(int64_t time);
+
+    // Write the frozen window as a capture: the metadata document, a chunk for each block in the window and the
+    // indexes. Returns false if the ring is not frozen or the sink gave up.
+    bool dump(RecorderSink sink, void *ctx, const char *metadata, size_t length, const char *source);
+
+    // Resume recording over the oldest blocks. Returns false while a dump is in progress.
+    bool release();
+
+    RecorderState state() const;
+
+    RecorderStatus status();
+
+private:
+
+    CaptureChunk *block(uint32_t index);
+
+    // Move on to a fresh block, dropping the oldest when the ring is full
+    void advance(int64_t time);
+
+    // Blocks holding frames of the window, oldest first
+    uint32_t window(uint32_t *first);
+
+    std::mutex lock;
+    uint8_t *arena;
+    size_t blockBytes;
+    uint32_t blocks;
+    // Ring of blocks in use, from the oldest to the one being written
+    uint32_t oldest = 0;
+    uint32_t used = 0;
+    // Times of the first and last record of each block
+    int64_t begins[RECORDER_MAX_BLOCKS]{};
+    int64_t ends[RECORDER_MAX_BLOCKS]{};
+    std::atomic<int32_t> current{RECORDER_RECORDING};
+    // Set while a dump reads the frozen blocks, which must not be released under it
+    std::atomic<bool> dumping{false};
+    int64_t from = 0;
+    int64_t until = 0;
+    // Sequence zero is the metadata document of a dump
+    uint64_t sequence = 1;
+    uint64_t frames = 0;
+    uint64_t evicted = 0;
+    uint64_t refused = 0;
+    uint32_t triggers = 0;
+
+};
+
+
+#endif //RADAR_RECORDER_H
@@ -11,6 +11,7 @@
 #include "network.h"
 #include "persistent.h"
 #include "indicator.h"
+#include "pipeline.h"
 
 
 enum RuntimeState {
@@ -19,14 +20,6 @@ enum RuntimeState {
     CONNECTING = 2,
     RUNNING = 3,
 };
-typedef struct SampleData {
-    uint16_t **data;
-    int size;
-    int64_t start;
-    int64_t stop;
-    int64_t chirpStart;
-    int64_t chirpStop;
-} SampleData;
 class Runtime {
 
 public:
@@ -3,6 +3,8 @@
 //
 
 #include <cstring>
+#include <esp_cpu.h>
+#include <esp_rom_sys.h>
 #include "sample.h"
 
 static TaskHandle_t adcTaskHandle;
@@ -11,6 +13,12 @@ static TaskHandle_t adcTaskHandle;
 
 static bool IRAM_ATTR adcConversionDone(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void
 *user_data) {
+    auto sample = (Sample *) user_data;
+    // Timestamp the first dma completion of the frame before anything else runs
+    if (sample->awaitingConversion) {
+        sample->conversionCycle = esp_cpu_get_cycle_count();
+        sample->awaitingConversion = false;
+    }
     BaseType_t mustYield = pdTRUE;
     vTaskNotifyGiveFromISR(adcTaskHandle, &mustYield);
     portYIELD_FROM_ISR(mustYield);
@@ -25,93 +33,22 @@ esp_err_t Sample::listen(int64_t chirpDuration, uint16_t **out) {
 
     adcTaskHandle = xTaskGetCurrentTaskHandle();
 
-    esp_err_t err;
-    err = adc_continuous_start(adcContinuousHandle);
-    if (err != ESP_OK) {
-//        destructContinuousAdc();
-        xSemaphoreGive(runtime);
-        return err;
-    }
-//    err = initializeContinuousAdc();
-//    if(err != ESP_OK) {
-//        return err;
-//    }
-    const uint32_t maxLength = SAMPLE_CONVERSION_FRAME_SIZE;
-
-    uint8_t buffer[maxLength] = {0};
-    memset(buffer, 0x00, maxLength);
-
-    uint32_t resolvedLength = 0;
-    int offsets[4] = {0, 0, 0, 0};
-
-    uint32_t remain;
-
-    while (true) {
-        remain = 0;
-        // Calculate the remaining samples needed across all channels
-        for (int offset: offsets) {
-            int channelRemain = ((int) chirpDuration - offset);
-            remain += channelRemain * SOC_ADC_DIGI_RESULT_BYTES;
-        }
-        // Return if there are no more samples to be collected
-        if (remain == 0) {
-            break;
-        }
-        // Cap the number of samples at the local stack buffer size
-        remain = remain > maxLength ? maxLength : remain;
-        // Wait for the conversion to complete
-        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
-        // Read the info from DMA into the local stack memory
-        err = adc_continuous_read(adcContinuousHandle, buffer, remain, &resolvedLength, portMAX_DELAY);
-        if (err != ESP_OK) {
-            if (err == ESP_ERR_TIMEOUT) {
-                vTaskDelay(1);
-                continue;
-            }
-            continue;
-        }
-        // Process the raw ADC conversion data
-        for (int i = 0; i < resolvedLength; i += SOC_ADC_DIGI_RESULT_BYTES) {
-            auto data = (adc_digi_output_data_t *) &buffer[i];
-            uint32_t channel = data->type2.channel;
-            uint32_t value = data->type2.data;
-            uint32_t unit = data->type2.unit;
-            // Ensure there are no erroneous channels
-            if (channel >= SOC_ADC_CHANNEL_NUM(unit)) {
-                printf("Skipping unknown channel: %lu\n", channel);
-                continue;
-            }
-            int voltage = 0;
-            // Convert the raw ADC data to a voltage using the built-in ADC calibration profile
-            adc_cali_raw_to_voltage(calHandle, (int) value, &voltage);
-            // Convert the ADC channel to the pad number
-            int idx = 0;
-            err = adc_continuous_channel_to_io((adc_unit_t) unit, (adc_channel_t) channel, &idx);
-            if (err != ESP_OK) {
-                continue;
-            }
-            // Find the array index based on the pad number
-            int index = idx - 4;
-            // Reject indexes out of bounds
-            if (index > 3 || index < 0) {
-                continue;
-            }
-            // Prevent writing out of bounds
-            if (offsets[index] >= (int) chirpDuration) {
-                continue;
-            }
-            // Write the voltage value to the buffer
-            out[index][offsets[index]] = (uint16_t) value;
-            // Increment the offset index for the next iteration
-            offsets[index]++;
-        }
-    }
-    // Stop the ADC from listening and free DMA memory
-//    adc_continuous_stop(adcContinuousHandle);
-//    destructContinuousAdc();
-    adc_continuous_stop(adcContinuousHandle);
+    uint8_t buffer[SAMPLE_CONVERSION_FRAME_SIZE] = {0};
+
+    awaitingConversion = true;
+    esp_err_t err = captureFrame(source, (int) chirpDuration, out, buffer, SAMPLE_CONVERSION_FRAME_SIZE);
     xSemaphoreGive(runtime);
-    return ESP_OK;
+    return err;
+}
+
+uint32_t Sample::firstConversionCycle() const {
+    if (sampling.frequency <= 0) {
+        return conversionCycle;
+    }
+    // The first dma completion follows a whole conversion frame, back it up to the first conversion
+    uint64_t frameCycles = (uint64_t) SAMPLE_CONVERSIONS_PER_FRAME * esp_rom_get_cpu_ticks_per_us() * 1000000 /
+                           (uint64_t) sampling.frequency;
+    return conversionCycle - (uint32_t) frameCycles;
 }
 
 esp_err_t initializeRadarGpio() {
@@ -136,6 +73,12 @@ esp_err_t initializeRadarGpio() {
         return err;
     }
 
+    // Keep driving the enable line through light sleep instead of switching the pad to its sleep configuration
+    err = gpio_sleep_sel_dis(static_cast<gpio_num_t>(CONFIG_vRADAR_ENABLE));
+    if (err != ESP_OK) {
+        return err;
+    }
+
     return ESP_OK;
 }
 
@@ -217,6 +160,7 @@ esp_err_t Sample::initializeContinuousAdc() {
     err = adc_continuous_config(adcContinuousHandle, &adcContinuousConfig);
     if (err != ESP_OK) {
         printf("Failed to configure continuous ADC: %s\n", esp_err_to_name(err));
+        destructContinuousAdc();
         return err;
     }
 
@@ -224,9 +168,10 @@ esp_err_t Sample::initializeContinuousAdc() {
             .on_conv_done = adcConversionDone
     };
 
-    err = adc_continuous_register_event_callbacks(adcContinuousHandle, &adcContinuousEvtCbs, nullptr);
+    err = adc_continuous_register_event_callbacks(adcContinuousHandle, &adcContinuousEvtCbs, this);
     if (err != ESP_OK) {
         printf("Failed to register continuous adc event: %s\n", esp_err_to_name(err));
+        destructContinuousAdc();
         return err;
     }
 
@@ -251,23 +196,32 @@ esp_err_t Sample::initializeCalibrationProfile() {
 }
 
 esp_err_t Sample::destructContinuousAdc() {
+    // Already torn down by a switch that failed part way
+    if (adcContinuousHandle == nullptr) {
+        return ESP_OK;
+    }
 
     esp_err_t err;
     err = adc_continuous_deinit(adcContinuousHandle);
     if (err != ESP_OK) {
         return err;
     }
+    adcContinuousHandle = nullptr;
 
     return ESP_OK;
 }
 
 esp_err_t Sample::destructCalibrationProfile() {
+    if (calHandle == nullptr) {
+        return ESP_OK;
+    }
 
     esp_err_t err;
     err = adc_cali_delete_scheme_curve_fitting(calHandle);
     if (err != ESP_OK) {
         return err;
     }
+    calHandle = nullptr;
 
     return ESP_OK;
 }
@@ -282,9 +236,9 @@ Sample::Sample() {
         printf("Failed to initialize the radar enable gpio: %s\n", esp_err_to_name(err));
     }
 
-    err = initializeConfigurationTimer();
+    err = initializeSubscription();
     if (err != ESP_OK) {
-        printf("Failed to initialize the sample configuration timer: %s\n", esp_err_to_name(err));
+        printf("Failed to subscribe to sampling settings: %s\n", esp_err_to_name(err));
     }
 
     err = initializeContinuousAdc();
@@ -301,65 +255,59 @@ Sample::Sample() {
 
 }
 
-void sampleConfigTimerCallback(void *params) {
-    auto sample = (Sample *) params;
-
-    auto settings = Settings::instance();
-    auto sampling = settings.getSystem().sampling;
-
-    bool runtimeChanged = false;
+// The radar is powered while it is enabled and not gated between bursts
+static void driveEnable(const Sample *sample, int32_t enabled) {
+    gpio_set_level(static_cast<gpio_num_t>(CONFIG_vRADAR_ENABLE), enabled == 0 || sample->gated ? 0 : 1);
+}
 
-    if(settings.getSystem().enabled == 0){
-        gpio_set_level(static_cast<gpio_num_t>(CONFIG_vRADAR_ENABLE), 0);
-    }else{
-        gpio_set_level(static_cast<gpio_num_t>(CONFIG_vRADAR_ENABLE), 1);
-    }
+static void settingsChanged(uint32_t changes, const System &system, uint32_t generation, void *ctx) {
+    // The radar enable line can be switched at any time, sampling changes are switched by the acquisition task at a
+    // frame boundary
+    driveEnable((Sample *) ctx, system.enabled);
+}
 
-    if (sample->sampling.attenuation != sampling.attenuation) {
-        runtimeChanged = true;
-    }
+void Sample::gate(bool idle) {
+    gated = idle;
+    driveEnable(this, Settings::instance().getSystem().enabled);
+}
 
-    if (sample->sampling.samples != sampling.samples) {
-        runtimeChanged = true;
+esp_err_t Sample::configure(const Sampling &next) {
+    if (memcmp(&sampling, &next, sizeof(Sampling)) == 0) {
+        return ESP_OK;
     }
-
-    if (sample->sampling.frequency != sampling.frequency) {
-        runtimeChanged = true;
+    // Refuse what the adc cannot convert before anything is torn down
+    uint32_t rate = 4 * (uint32_t) next.frequency;
+    if (next.frequency <= 0 || rate < SOC_ADC_SAMPLE_FREQ_THRES_LOW || rate > SOC_ADC_SAMPLE_FREQ_THRES_HIGH ||
+        next.attenuation < ADC_ATTEN_DB_0 || next.attenuation > ADC_ATTEN_DB_11) {
+        return ESP_ERR_INVALID_ARG;
     }
-
-    if (runtimeChanged) {
-        esp_err_t err;
-        err = sample->reinitialize();
-        if (err != ESP_OK) {
-            printf("Sample reinitialization failed: %s\n", esp_err_to_name(err));
-            return;
+    Sampling previous = sampling;
+    // The adc and calibration profile are configured from the sampling member
+    sampling = next;
+    esp_err_t err;
+    err = reinitialize();
+    if (err != ESP_OK) {
+        printf("Sample reinitialization failed: %s\n", esp_err_to_name(err));
+        // Whatever was torn down is brought back up with the previous sampling
+        sampling = previous;
+        esp_err_t restored = reinitialize();
+        if (restored != ESP_OK) {
+            printf("Failed to restore sampling: %s\n", esp_err_to_name(restored));
         }
-        sample->sampling = sampling;
+        return err;
     }
-
+    return ESP_OK;
 }
 
-esp_err_t Sample::initializeConfigurationTimer() {
-    auto settings = Settings::instance();
-    sampling = settings.getSystem().sampling;
+esp_err_t Sample::initializeSubscription() {
+    System system{};
+    Settings::instance().getSystem(&system);
+    sampling = system.sampling;
+    // Apply the persisted enable state
+    driveEnable(this, system.enabled);
 
-    configTimer = {};
-    // Define the periodic configuration timer
-    const esp_timer_create_args_t periodic_timer_args = {
-            .callback = sampleConfigTimerCallback,
-            .arg = this,
-            .name = "sampleConfiguration"
-    };
-    esp_err_t err;
-    // Initialize the periodic timer
-    err = esp_timer_create(&periodic_timer_args, &configTimer);
-    if (err != ESP_OK) {
-        return err;
-    }
-    // Set the periodic timer to update every second
-    err = esp_timer_start_periodic(configTimer, 1000 * 1125);
-    if (err != ESP_OK) {
-        return err;
+    if (!Settings::instance().subscribe(SETTINGS_ENABLED, settingsChanged, this)) {
+        return ESP_ERR_NO_MEM;
     }
 
     return ESP_OK;
@@ -378,15 +326,5 @@ Sample::~Sample() {
         printf("Failed to destruct continuous adc: %s\n", esp_err_to_name(err));
     }
 
-    err = esp_timer_stop(configTimer);
-    if (err != ESP_OK) {
-        printf("Failed to stop sample configuration timer: %s\n", esp_err_to_name(err));
-    }
-
-    err = esp_timer_delete(configTimer);
-    if (err != ESP_OK) {
-        printf("Failed to destruct sample config timer: %s\n", esp_err_to_name(err));
-    }
-
     vSemaphoreDelete(runtime);
 }
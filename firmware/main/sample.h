@@ -16,6 +16,8 @@
 #include <freertos/ringbuf.h>
 #include <freertos/semphr.h>
 #include "settings.h"
+#include "hal_esp.h"
+#include "pipeline.h"
 
 #define SAMPLE_CHANNEL_COUNT 4
 #define SAMPLE_CONVERSIONS_PER_FRAME 32
@@ -32,16 +34,32 @@ public:
 
     Sampling sampling{};
 
-
     esp_err_t reinitialize();
 
+    // Switch the adc to new sampling parameters, must only be called between frames
+    esp_err_t configure(const Sampling &next);
+
+    // Cycle count of the first conversion of the last frame, derived from its first dma completion
+    uint32_t firstConversionCycle() const;
+
+    // Set when a frame starts, cleared by the conversion callback once it has captured conversionCycle
+    volatile bool awaitingConversion = false;
+    // Cycle count of the first dma completion of the last frame
+    volatile uint32_t conversionCycle = 0;
+
+    // True while the radar is powered down between chirp bursts
+    volatile bool gated = false;
+
+    // Power the radar down between bursts, or back up if it is enabled
+    void gate(bool idle);
+
 private:
 
-    esp_timer_handle_t configTimer{};
     adc_continuous_handle_t adcContinuousHandle{};
+    EspAdcSource source{&adcContinuousHandle};
     adc_cali_handle_t calHandle{};
     SemaphoreHandle_t runtime;
-    esp_err_t initializeConfigurationTimer();
+    esp_err_t initializeSubscription();
 
     esp_err_t initializeCalibrationProfile();
 
@@ -0,0 +1,92 @@
+#ifndef RADAR_SEQLOCK_H
+#define RADAR_SEQLOCK_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <thread>
+#endif
+
+// Times a reader retries a write in progress before it gives up the core
+#define SEQLOCK_SPINS 64
+
+// Back off a reader that keeps finding a write in progress. A writer on another core is done within a few spins, but
+// one preempted on the same core by a higher priority reader only finishes once the reader blocks, yielding would
+// hand the core straight back to the reader.
+static inline void seqlockBackoff(uint32_t attempt) {
+    if (attempt < SEQLOCK_SPINS) {
+        return;
+    }
+#ifdef ESP_PLATFORM
+    if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) {
+        vTaskDelay(1);
+    }
+#else
+    std::this_thread::yield();
+#endif
+}
+
+// Seqlock holds a trivially copyable value that can be read without locking. The sequence is odd while a write is in
+// progress, readers retry until they copy the value between two matching even sequence numbers. The generation is
+// half the sequence and increases by one for every published value.
+template<typename T>
+class Seqlock {
+    static_assert(std::is_trivially_copyable<T>::value, "Seqlock values must be trivially copyable");
+
+public:
+
+    Seqlock() = default;
+
+    explicit Seqlock(const T &initial) : value(initial) {}
+
+    Seqlock(const Seqlock &) = delete;
+
+    Seqlock &operator=(const Seqlock &) = delete;
+
+    // Publish a new value, concurrent writers must be serialized by the caller
+    uint32_t store(const T &next) {
+        uint32_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(&value, &next, sizeof(T));
+        sequence.store(seq + 2, std::memory_order_release);
+        return (seq + 2) / 2;
+    }
+
+    // Copy a consistent snapshot into dest, returns the generation the snapshot belongs to. Not for interrupts, a
+    // reader that keeps losing to the writer blocks.
+    uint32_t load(T &dest) const {
+        for (uint32_t attempt = 0;; attempt++) {
+            uint32_t before = sequence.load(std::memory_order_acquire);
+            if (!(before & 1)) {
+                std::memcpy(&dest, &value, sizeof(T));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                uint32_t after = sequence.load(std::memory_order_relaxed);
+                if (before == after) {
+                    return before / 2;
+                }
+            }
+            seqlockBackoff(attempt);
+        }
+    }
+
+    // The generation of the most recently published value
+    uint32_t generation() const {
+        return sequence.load(std::memory_order_acquire) / 2;
+    }
+
+private:
+
+    std::atomic<uint32_t> sequence{0};
+    T value{};
+
+};
+
+
+#endif //RADAR_SEQLOCK_H
@@ -5,9 +5,13 @@
 
 #include <string>
 #include <sstream>
-#include <esp_mac.h>
 #include <lwip/sockets.h>
 #include <iomanip>
+#include <atomic>
+#include <esp_rom_sys.h>
+#include <esp_random.h>
+#include <esp_pm.h>
+#include <esp_cpu.h>
 #include <hal/gpio_types.h>
 #include <driver/temperature_sensor.h>
 #include <driver/gptimer.h>
@@ -21,64 +25,229 @@
 #include "dac.h"
 #include "gyro.h"
 #include "runtime.h"
+#include "metadata.h"
+#include "reconfigure.h"
+#include "calibration.h"
+#include "alignment.h"
+#include "timesync.h"
+#include "interference.h"
+#include "burst.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "pipeline.h"
+#include "hal_esp.h"
+#include "recorder.h"
+#include "vibration.h"
+#include "planner.h"
 
 static RingbufHandle_t adc_buffer{};
 static RingbufHandle_t dac_buffer{};
 static RingbufHandle_t gyro_buffer{};
 
+// The websocket session of the connected bridge
+static EspSocketTransport transport;
+
+#define ADC_BUFFER_SIZE ((sizeof(SampleData *)) * (256 + 64))
+#define GYRO_BUFFER_SIZE (sizeof(GyroData) * 20)
+
+// Frame counts and stage latencies along the acquisition pipeline
+static struct {
+    Counter captured;
+    // Frames the ring buffer had no room for
+    Counter overflowed;
+    // Frames dropped for interference
+    Counter dropped;
+    Counter sent;
+    Counter failed;
+    // Frames left unsent for the stream plan to fit the link
+    Counter decimated;
+    // Chirp start to the end of the adc capture
+    Histogram capture;
+    // End of the adc capture to the frame entering the ring buffer
+    Histogram enqueue;
+    // Ring buffer to the sending task, on the boot clock since the frame crosses cores
+    Histogram queue;
+    // Frame to websocket payload
+    Histogram serialize;
+    // Websocket send call
+    Histogram send;
+    // Chirp start to send complete, on the boot clock
+    Histogram frame;
+} pipeline;
+
+// Recent frames kept in PSRAM, null if the arena could not be allocated
+static FlightRecorder *recorder = nullptr;
+
+#define RECORDER_PRE_US ((int64_t) CONFIG_vRADAR_RECORDER_PRE_MS * 1000)
+#define RECORDER_POST_US ((int64_t) CONFIG_vRADAR_RECORDER_POST_MS * 1000)
+
+static Gyro *gyro = nullptr;
+
+// Displacement of the mount from the accelerometer, fed by the gyro task
+static Vibration *vibration = nullptr;
+static std::atomic<int32_t> vibrationMode{VIBRATION_OFF};
+
+#ifdef CONFIG_vRADAR_VIBRATION_REVERSED
+#define VIBRATION_DIRECTION (-1.0f)
+#else
+#define VIBRATION_DIRECTION 1.0f
+#endif
+// IMU samples older than this mean the gyro is not streaming, frames are not held up waiting on it
+#define VIBRATION_STALE_US 250000
+
+// Payload formats put on the wire. The bridge parses raw frames alone, so the planner follows the link by decimation
+// until it decodes the others.
+#define STREAM_FORMATS_SENT STREAM_FORMAT(STREAM_RAW)
+// Microseconds between checks of the stream plan against the link
+#define STREAM_REPLAN_US 1000000
+
+// Plan of the stream to the bridge, made by the watcher for new settings and as the link is measured
+static struct {
+    SemaphoreHandle_t lock;
+    StreamPlanner *planner;
+    // One in this many frames is sent
+    std::atomic<int32_t> decimation{1};
+    // Set by the settings listener, which must not block, the watcher plans the new settings before the next frame
+    std::atomic<bool> reconfigured{false};
+    // The planner's throughput, written by the watcher after each send and read by the settings handler without the
+    // lock the send may be holding up
+    Seqlock<double> throughput{};
+} stream;
+
+// Nanoseconds elapsed on this core's cycle counter since the given cycle count
+static uint64_t elapsedNanoseconds(uint32_t from) {
+    int64_t elapsed = cyclesToNanoseconds(from, esp_cpu_get_cycle_count(), esp_rom_get_cpu_ticks_per_us());
+    return elapsed > 0 ? (uint64_t) elapsed : 0;
+}
 
-static char *generateMetadata() {
+// Chunk size of the /metrics response, large enough for one histogram
+#define METRICS_CHUNK_SIZE 2048
 
-    // Initialize a json object
-    auto obj = cJSON_CreateObject();
-    // Get the system mac address
-    uint8_t mac[6];
-    esp_read_mac(mac, ESP_MAC_WIFI_STA);
-    // Generate the module human-readable name
-    char name[32];
-    snprintf((char *) name, 12, "vRadar %02x%02x", mac[1], mac[4]);
-    // Generate the mac address string
-    char macAddr[32];
-    snprintf((char *) macAddr, 18, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-    // Add generated variables to the object
-    cJSON_AddStringToObject(obj, "name", name);
-    cJSON_AddStringToObject(obj, "mac", macAddr);
-    // Add compiled config metadata to the object
-    cJSON_AddNumberToObject(obj, "base", CONFIG_vRADAR_BASE_FREQUENCY);
-    cJSON_AddNumberToObject(obj, "xFov", CONFIG_vRADAR_FOV_X);
-    cJSON_AddNumberToObject(obj, "yFov", CONFIG_vRADAR_FOV_Y);
-    // Generate the ADC parameters
-    auto adc = cJSON_CreateObject();
-    auto settings = Settings::instance();
-
-    auto system = settings.getSystem();
-    cJSON_AddNumberToObject(obj, "enabled", system.enabled);
-    cJSON_AddNumberToObject(obj, "audible", system.audible);
-    cJSON_AddNumberToObject(obj, "gyro", system.gyro);
-
-    cJSON *chirpObj = cJSON_CreateObject();
-    cJSON_AddNumberToObject(chirpObj, "prf", system.chirp.prf);
-    cJSON_AddNumberToObject(chirpObj, "duration", system.chirp.duration);
-    cJSON_AddNumberToObject(chirpObj, "steps", system.chirp.steps);
-    cJSON_AddNumberToObject(chirpObj, "padding", system.chirp.padding);
-    cJSON_AddNumberToObject(chirpObj, "resolution", system.chirp.resolution);
-
-    cJSON *samplingObj = cJSON_CreateObject();
-    cJSON_AddNumberToObject(samplingObj, "frequency", system.sampling.frequency);
-    cJSON_AddNumberToObject(samplingObj, "samples", system.sampling.samples);
-    cJSON_AddNumberToObject(samplingObj, "attenuation", system.sampling.attenuation);
-    cJSON_AddNumberToObject(obj, "updated", (double) esp_timer_get_time());
-
-    cJSON_AddItemToObject(obj, "sampling", samplingObj);
-    cJSON_AddItemToObject(obj, "chirp", chirpObj);
-
-    // Marshal the object to json as a string
-    char *out = cJSON_PrintUnformatted(obj);
-    // Free the memory used to create the object
-    cJSON_Delete(obj);
-    return out;
+static esp_err_t tasksHandler(httpd_req_t *req) {
+    // Send payload type header
+    httpd_resp_set_type(req, "application/json");
+    // Allow Cross-Origin Access
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Headers", "*");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    auto buf = (char *) malloc(PROFILER_DOCUMENT_SIZE);
+    if (buf == nullptr) {
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
+    size_t length = Profiler::instance().json(buf, PROFILER_DOCUMENT_SIZE);
+    if (length == 0) {
+        free(buf);
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
+    httpd_resp_send(req, buf, (ssize_t) length);
+    free(buf);
+    return ESP_OK;
 }
 
+static esp_err_t metricsHandler(httpd_req_t *req) {
+    // Send payload type header, the Prometheus text exposition format
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    // Allow Cross-Origin Access
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Headers", "*");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    const struct {
+        const char *name;
+        const char *help;
+        const Counter *counter;
+    } counters[] = {
+            {"radar_frames_captured_total", "Frames captured from the adc", &pipeline.captured},
+            {"radar_frames_overflowed_total", "Frames lost to a full ring buffer", &pipeline.overflowed},
+            {"radar_frames_dropped_total", "Frames dropped for interference", &pipeline.dropped},
+            {"radar_frames_sent_total", "Frames sent over the websocket", &pipeline.sent},
+            {"radar_frames_failed_total", "Frames the websocket failed to send", &pipeline.failed},
+            {"radar_frames_decimated_total", "Frames left unsent to fit the link", &pipeline.decimated},
+    };
+    const struct {
+        const char *name;
+        const char *help;
+        const Histogram *histogram;
+    } histograms[] = {
+            {"radar_capture_seconds", "Chirp start to the end of the adc capture", &pipeline.capture},
+            {"radar_enqueue_seconds", "End of the adc capture to the frame entering the ring buffer",
+             &pipeline.enqueue},
+            {"radar_queue_seconds", "Time frames wait in the ring buffer", &pipeline.queue},
+            {"radar_serialize_seconds", "Time to build the websocket payload of a frame", &pipeline.serialize},
+            {"radar_send_seconds", "Time to send a frame over the websocket", &pipeline.send},
+            {"radar_frame_seconds", "Chirp start to send complete", &pipeline.frame},
+    };
+
+    auto buf = (char *) malloc(METRICS_CHUNK_SIZE);
+    if (buf == nullptr) {
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
+    // Each metric is sent as its own chunk, so the whole document never has to fit in memory
+    for (const auto &metric: counters) {
+        size_t length = formatCounter(buf, METRICS_CHUNK_SIZE, metric.name, metric.help, metric.counter->value());
+        if (length > 0 && httpd_resp_send_chunk(req, buf, (ssize_t) length) != ESP_OK) {
+            free(buf);
+            return ESP_FAIL;
+        }
+    }
+    for (const auto &metric: histograms) {
+        size_t length = formatHistogram(buf, METRICS_CHUNK_SIZE, metric.name, metric.help,
+                                        metric.histogram->snapshot());
+        if (length > 0 && httpd_resp_send_chunk(req, buf, (ssize_t) length) != ESP_OK) {
+            free(buf);
+            return ESP_FAIL;
+        }
+    }
+    if (recorder != nullptr) {
+        RecorderStatus status = recorder->status();
+        const struct {
+            const char *name;
+            const char *help;
+            uint64_t value;
+        } recorded[] = {
+                {"radar_recorder_frames_total", "Frames kept by the flight recorder", status.recorded},
+                {"radar_recorder_evicted_total", "Recorded frames overwritten by newer ones", status.evicted},
+                {"radar_recorder_refused_total", "Frames the recorder refused while frozen", status.refused},
+                {"radar_recorder_triggers_total", "Recordings triggered", status.triggers},
+        };
+        for (const auto &metric: recorded) {
+            size_t length = formatCounter(buf, METRICS_CHUNK_SIZE, metric.name, metric.help, metric.value);
+            if (length > 0 && httpd_resp_send_chunk(req, buf, (ssize_t) length) != ESP_OK) {
+                free(buf);
+                return ESP_FAIL;
+            }
+        }
+    }
+    if (gyro != nullptr) {
+        I2CStats bus = gyro->busStats();
+        const struct {
+            const char *name;
+            const char *help;
+            uint64_t value;
+        } transfers[] = {
+                {"radar_i2c_transfers_total", "Transfers on the gyro bus", bus.transfers},
+                {"radar_i2c_bytes_total", "Register and payload bytes moved on the gyro bus", bus.bytes},
+                {"radar_i2c_nacks_total", "Gyro bus transfers the device did not acknowledge", bus.nacks},
+                {"radar_i2c_timeouts_total", "Gyro bus transfers that ran out of time", bus.timeouts},
+                {"radar_i2c_errors_total", "Gyro bus transfers that failed otherwise", bus.errors},
+                {"radar_i2c_busy_microseconds_total", "Time the gyro bus spent on transfers", bus.busy},
+        };
+        for (const auto &metric: transfers) {
+            size_t length = formatCounter(buf, METRICS_CHUNK_SIZE, metric.name, metric.help, metric.value);
+            if (length > 0 && httpd_resp_send_chunk(req, buf, (ssize_t) length) != ESP_OK) {
+                free(buf);
+                return ESP_FAIL;
+            }
+        }
+    }
+    free(buf);
+    // Terminate the chunked response
+    return httpd_resp_send_chunk(req, nullptr, 0);
+}
+
+
 static esp_err_t options_handler(httpd_req_t *req) {
     // Send payload type header
     httpd_resp_set_type(req, "application/json");
@@ -102,27 +271,203 @@ static esp_err_t systemConfigHandler(httpd_req_t *req) {
 
     const int size = 1024;
     char buf[size];
-    int i = httpd_req_recv(req, buf, size);
+    int i = httpd_req_recv(req, buf, size - 1);
     if (i <= 0) {
-        httpd_resp_send(req, "Bad Request", HTTPD_RESP_USE_STRLEN);
-        // Send the status OK message
         httpd_resp_set_status(req, HTTPD_400);
+        httpd_resp_send(req, "Bad Request", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
     }
+    buf[i] = 0;
 
     auto s = &Settings::instance();
-    s->systemFromJson(buf);
+    System current = s->getSystem();
+    StreamDemand previous = streamDemand(current.chirp, current.sampling, current.burst);
+    const char *reason = nullptr;
+    if (!s->systemFromJson(buf, &reason)) {
+        printf("Refused settings: %s\n", reason);
+        httpd_resp_set_status(req, HTTPD_400);
+        httpd_resp_set_type(req, "text/plain");
+        httpd_resp_send(req, reason, HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
     s->push();
+    // The watcher plans new frame settings before their first frame, the response carries the same plan now
+    System system = s->getSystem();
+    StreamDemand demand = streamDemand(system.chirp, system.sampling, system.burst);
+    if (demand.samples != previous.samples || demand.frameRate != previous.frameRate) {
+        double throughput = 0;
+        stream.throughput.load(throughput);
+        Metadata::instance().plan(planStream(demand, throughput, STREAM_FORMATS_SENT));
+    }
+    char md[METADATA_DOCUMENT_SIZE];
+    size_t length = Metadata::instance().json(md, sizeof(md));
+
+    httpd_resp_send(req, md, (ssize_t) length);
+    // Send the status OK message
+    httpd_resp_set_status(req, HTTPD_200);
+    // Return without error
+
+    return ESP_OK;
+}
+
+static esp_err_t linearizationHandler(httpd_req_t *req) {
+    // Send payload type header
+    httpd_resp_set_type(req, "application/json");
+    // Allow Cross-Origin Access
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Headers", "*");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    const int size = 256;
+    char buf[size];
+    int i = httpd_req_recv(req, buf, size - 1);
+    if (i <= 0) {
+        httpd_resp_set_status(req, HTTPD_400);
+        httpd_resp_send(req, "Bad Request", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
+    buf[i] = 0;
+
+    // The new curve is applied to the chirp table at the next frame boundary
+    if (!Settings::instance().linearizationFromJson(buf)) {
+        httpd_resp_set_status(req, HTTPD_400);
+        httpd_resp_send(req, "Invalid Linearization", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
 
-    auto md = generateMetadata();
+    httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+    // Return without error
+    return ESP_OK;
+}
 
+// Segments of a requested VCO calibration sweep, zero when none is pending
+static std::atomic<int32_t> calibrationSegments{0};
 
-    httpd_resp_send(req, md, HTTPD_RESP_USE_STRLEN);
+static esp_err_t calibrateHandler(httpd_req_t *req) {
+    // Send payload type header
+    httpd_resp_set_type(req, "application/json");
+    // Allow Cross-Origin Access
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Headers", "*");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    int32_t segments = CALIBRATION_DEFAULT_SEGMENTS;
+    const int size = 128;
+    char buf[size];
+    int i = httpd_req_recv(req, buf, size - 1);
+    if (i > 0) {
+        buf[i] = 0;
+        auto request = cJSON_Parse(buf);
+        cJSON *item = cJSON_GetObjectItem(request, "segments");
+        if (cJSON_IsNumber(item)) {
+            segments = item->valueint;
+        }
+        cJSON_Delete(request);
+    }
+    if (segments < CALIBRATION_MIN_SEGMENTS || segments > CALIBRATION_MAX_SEGMENTS) {
+        httpd_resp_set_status(req, HTTPD_400);
+        httpd_resp_send(req, "Invalid Segments", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
+
+    // The acquisition task runs the sweep between frames
+    calibrationSegments = segments;
+    httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+    // Return without error
+    return ESP_OK;
+}
+
+static esp_err_t recordingTriggerHandler(httpd_req_t *req) {
+    // Send payload type header
+    httpd_resp_set_type(req, "application/json");
+    // Allow Cross-Origin Access
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Headers", "*");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    if (recorder == nullptr) {
+        httpd_resp_set_status(req, HTTPD_404);
+        httpd_resp_send(req, "No Recorder", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
+    int64_t pre = RECORDER_PRE_US;
+    int64_t post = RECORDER_POST_US;
+    const int size = 128;
+    char buf[size];
+    int i = httpd_req_recv(req, buf, size - 1);
+    if (i > 0) {
+        buf[i] = 0;
+        auto request = cJSON_Parse(buf);
+        cJSON *item = cJSON_GetObjectItem(request, "pre");
+        if (cJSON_IsNumber(item) && item->valueint >= 0) {
+            pre = (int64_t) item->valueint * 1000;
+        }
+        item = cJSON_GetObjectItem(request, "post");
+        if (cJSON_IsNumber(item) && item->valueint >= 0) {
+            post = (int64_t) item->valueint * 1000;
+        }
+        cJSON_Delete(request);
+    }
+    if (!recorder->trigger(esp_timer_get_time(), pre, post)) {
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_send(req, "Recording Pending", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
+    httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+static bool sendRecording(const uint8_t *data, size_t length, void *ctx) {
+    return httpd_resp_send_chunk((httpd_req_t *) ctx, (const char *) data, (ssize_t) length) == ESP_OK;
+}
+
+static esp_err_t recordingHandler(httpd_req_t *req) {
+    // Allow Cross-Origin Access
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Headers", "*");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    if (recorder == nullptr) {
+        httpd_resp_set_status(req, HTTPD_404);
+        httpd_resp_send(req, "No Recorder", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
+    // Give a pending trigger the frames after it, then take whatever the ring holds
+    int64_t deadline = esp_timer_get_time() + RECORDER_POST_US + 1000000;
+    while (recorder->state() == RECORDER_TRIGGERED && esp_timer_get_time() < deadline) {
+        vTaskDelay(pdMS_TO_TICKS(50));
+    }
+    recorder->freeze(esp_timer_get_time());
+
+    char metadata[METADATA_DOCUMENT_SIZE];
+    size_t length = Metadata::instance().json(metadata, sizeof(metadata));
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"recording.cap\"");
+
+    // Stream at low priority, in whatever time the acquisition and the live stream leave
+    UBaseType_t priority = uxTaskPriorityGet(nullptr);
+    vTaskPrioritySet(nullptr, tskIDLE_PRIORITY + 1);
+    bool ok = recorder->dump(sendRecording, req, metadata, length, "flight recorder");
+    vTaskPrioritySet(nullptr, priority);
+    recorder->release();
+    if (!ok) {
+        return ESP_FAIL;
+    }
+    // Terminate the chunked response
+    return httpd_resp_send_chunk(req, nullptr, 0);
+}
+
+static esp_err_t metadataHandler(httpd_req_t *req) {
+    // Send payload type header
+    httpd_resp_set_type(req, "application/octet-stream");
+    // Allow Cross-Origin Access
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Headers", "*");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    uint8_t packet[METADATA_PACKET_SIZE];
+    size_t length = Metadata::instance().binary(packet, sizeof(packet));
+
+    httpd_resp_send(req, (const char *) packet, (ssize_t) length);
     // Send the status OK message
     httpd_resp_set_status(req, HTTPD_200);
     // Return without error
 
-    free(md);
-
     return ESP_OK;
 }
 
@@ -143,7 +488,7 @@ static esp_err_t configHandler(httpd_req_t *req) {
         httpd_resp_set_status(req, HTTPD_400);
     }
 
-    auto s = Settings::instance();
+    auto &s = Settings::instance();
     s.fromJson(buf);
     s.push();
 
@@ -174,18 +519,6 @@ static esp_err_t restart(httpd_req_t *req) {
     return ESP_OK;
 }
 
-void int64ToUint8Array(int64_t input, uint8_t *output) {
-    output[0] = (input >> 56) & 0xFF;
-    output[1] = (input >> 48) & 0xFF;
-    output[2] = (input >> 40) & 0xFF;
-    output[3] = (input >> 32) & 0xFF;
-    output[4] = (input >> 24) & 0xFF;
-    output[5] = (input >> 16) & 0xFF;
-    output[6] = (input >> 8) & 0xFF;
-    output[7] = input & 0xFF;
-}
-
-
 // Socket handler is the http method handler for requests made to the /ws endpoint
 static esp_err_t socket_get_handler(httpd_req_t *req) {
     // If the connection is a http GET request, initialize a new connection
@@ -220,24 +553,23 @@ static esp_err_t socket_get_handler(httpd_req_t *req) {
         }
         // If the packet type remains text, parse it.
         if (ws_pkt.type == HTTPD_WS_TYPE_TEXT) {
-            // Generate the metadata json payload
-            char *metadata = generateMetadata();
+            // Copy the cached metadata json payload
+            char metadata[METADATA_DOCUMENT_SIZE];
+            size_t length = Metadata::instance().json(metadata, sizeof(metadata));
             // Initialize a websocket frame
             httpd_ws_frame_t out_packer;
             memset(&out_packer, 0, sizeof(httpd_ws_frame_t));
             // Configure the packet as an outgoing text message
             out_packer.payload = (uint8_t *) metadata;
-            out_packer.len = strlen(metadata);
+            out_packer.len = length;
             out_packer.type = HTTPD_WS_TYPE_TEXT;
             // Send the packet
             ret = httpd_ws_send_frame(req, &out_packer);
             if (ret != ESP_OK) {
                 printf("Frame send failed!\n");
             }
-            // Free the metadata string
-            cJSON_free(metadata);
             // Configure the session
-            setSession(req);
+            transport.open(req);
             printf("Session started.\n");
         }
         // Free the buffer allocated earlier
@@ -247,105 +579,230 @@ static esp_err_t socket_get_handler(httpd_req_t *req) {
     return 0;
 }
 
-void uint16ToUint8Array(uint16_t input, uint8_t *output) {
-    output[0] = (input >> 8) & 0xFF;
-    output[1] = input & 0xFF;
-}
-
 SemaphoreHandle_t wsLock;
 
 static void callback(SampleData *sd) {
-    if (fd < 0) {
+    if (!transport.connected()) {
         return;
     }
-    httpd_ws_frame_t out_packer;
-    memset(&out_packer, 0, sizeof(httpd_ws_frame_t));
+    int core = esp_cpu_get_core_id();
+    uint32_t serializeCycle = esp_cpu_get_cycle_count();
 
-    size_t total_len = sd->size * 4 * sizeof(uint16_t) + sizeof(int64_t) * 2;
+    size_t total = frameBytes(sd->size);
     // Allocate memory for the binary data buffer
-    auto *binary_data = (uint8_t *) malloc(total_len);
-
-    for (int i = 0; i < 4; i++) {
-        // Convert the pointer array into a hex buffer for transport
-        if (sd->data[i] == nullptr) {
-            free(binary_data);
-            return;
-        }
-
-        for (int j = 0; j < sd->size; ++j) {
-            uint16ToUint8Array(sd->data[i][j], &binary_data[i * sd->size * sizeof(uint16_t) +
-                                                            j * sizeof(uint16_t)]);
-        }
+    auto *binary = (uint8_t *) malloc(total);
+    if (binary == nullptr) {
+        return;
+    }
+    if (serializeFrame(*sd, binary, total) == 0) {
+        free(binary);
+        return;
     }
 
-    int64ToUint8Array(sd->start, &binary_data[4 * sd->size * sizeof(uint16_t)]);
-    int64ToUint8Array(sd->stop, &binary_data[4 * sd->size * sizeof(uint16_t) + sizeof(int64_t)]);
-//    int64ToUint8Array(sd->chirpStart, &binary_data[4 * sd->size * sizeof(uint16_t) + sizeof(int64_t) * 2]);
-//    int64ToUint8Array(sd->chirpStop, &binary_data[4 * sd->size * sizeof(uint16_t) + sizeof(int64_t) * 3]);
-
-    out_packer.payload = (uint8_t *) binary_data;
-    out_packer.len = total_len;
-    out_packer.type = HTTPD_WS_TYPE_BINARY;
+    pipeline.serialize.record(core, elapsedNanoseconds(serializeCycle));
 
-//    send_websocket_frame_using_queue(hd, fd, &out_packer);
     if (xSemaphoreTake(wsLock, portMAX_DELAY) != pdTRUE) {
-        free(binary_data);
+        free(binary);
         return;
     }
-    auto ret = httpd_ws_send_frame_async(hd, fd, &out_packer);
+    uint32_t sendCycle = esp_cpu_get_cycle_count();
+    esp_err_t ret = transport.send(binary, total, true);
     if (ret != ESP_OK) {
         printf("Send to bridge failed!\n");
-        fd = -1;
+        pipeline.failed.add(core);
+    } else {
+        uint64_t sendTime = elapsedNanoseconds(sendCycle);
+        pipeline.send.record(core, sendTime);
+        pipeline.frame.record(core, (uint64_t) (esp_timer_get_time() - sd->chirpStart) * 1000);
+        pipeline.sent.add(core);
+        // How long the send blocked measures the link
+        if (xSemaphoreTake(stream.lock, portMAX_DELAY) == pdTRUE) {
+            stream.planner->sent(total, sendTime);
+            stream.throughput.store(stream.planner->throughput());
+            xSemaphoreGive(stream.lock);
+        }
     }
 
-    free(binary_data);
+    free(binary);
     xSemaphoreGive(wsLock);
 
 }
 
 
+// Chirp to adc skew of the captured frames
+static Alignment alignment;
+// Created by the acquisition task
+static DAC *chirpDac = nullptr;
+
+// Frames inspected for interference and what was done about it
+static struct {
+    std::atomic<uint32_t> frames;
+    std::atomic<uint32_t> corrupted;
+    std::atomic<uint32_t> samples;
+    std::atomic<uint32_t> repaired;
+    std::atomic<uint32_t> dropped;
+    std::atomic<uint32_t> hops;
+} interference{};
+
+// Chirp bursts run since boot, and the milliseconds the radar spent powered and gated across them
+static struct {
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> powered;
+    std::atomic<uint32_t> gated;
+} bursts{};
+
+// Frames the vibration of the mount was taken out of, those the IMU had not covered in time, and the largest
+// displacement within the last frame corrected
+static struct {
+    std::atomic<uint32_t> corrected;
+    std::atomic<uint32_t> late;
+    std::atomic<float> excursion;
+} vibrations{};
+
 static void sendMetadata(GyroData *gd, float temperature, int8_t rssi) {
-    if (fd < 0) {
+    if (!transport.connected()) {
         vTaskDelay(1);
         return;
     }
 
-    httpd_ws_frame_t out_packer;
-    memset(&out_packer, 0, sizeof(httpd_ws_frame_t));
-//    char over[1024]{};
-//    vTaskGetRunTimeStats(over);
-
     auto obj = cJSON_CreateObject();
     cJSON_AddNumberToObject(obj, "pitch", gd->pitch);
     cJSON_AddNumberToObject(obj, "roll", gd->roll);
+    cJSON_AddNumberToObject(obj, "yaw", gd->yaw);
+    auto quaternion = cJSON_CreateArray();
+    for (float component: gd->quaternion) {
+        cJSON_AddItemToArray(quaternion, cJSON_CreateNumber(component));
+    }
+    cJSON_AddItemToObject(obj, "quaternion", quaternion);
+    cJSON_AddBoolToObject(obj, "settled", gd->settled);
+    auto imu = cJSON_CreateObject();
+    cJSON_AddNumberToObject(imu, "temperature", gd->temperature);
+    cJSON_AddNumberToObject(imu, "errors", gd->errors);
+    cJSON_AddItemToObject(obj, "imu", imu);
+    auto motion = cJSON_CreateObject();
+    cJSON_AddBoolToObject(motion, "wake", (gd->motion & IMU_MOTION_WAKE) != 0);
+    cJSON_AddBoolToObject(motion, "tilt", (gd->motion & IMU_MOTION_TILT) != 0);
+    cJSON_AddBoolToObject(motion, "significant", (gd->motion & IMU_MOTION_SIGNIFICANT) != 0);
+    cJSON_AddNumberToObject(motion, "count", gd->motions);
+    cJSON_AddItemToObject(obj, "motion", motion);
     cJSON_AddNumberToObject(obj, "temperature", temperature);
     cJSON_AddNumberToObject(obj, "rssi", rssi);
-//    cJSON_AddStringToObject(obj, "buffer", over);
 
-    char *buf = (char *) malloc(sizeof(char) * 512);
+    AlignmentStats stats = alignment.stats();
+    auto skew = cJSON_CreateObject();
+    cJSON_AddNumberToObject(skew, "frames", stats.frames);
+    cJSON_AddNumberToObject(skew, "mean", (double) stats.mean);
+    cJSON_AddNumberToObject(skew, "min", (double) stats.min);
+    cJSON_AddNumberToObject(skew, "max", (double) stats.max);
+    auto jitter = cJSON_CreateArray();
+    for (uint32_t count: stats.jitter) {
+        cJSON_AddItemToArray(jitter, cJSON_CreateNumber(count));
+    }
+    cJSON_AddItemToObject(skew, "jitter", jitter);
+    cJSON_AddItemToObject(obj, "skew", skew);
+
+    auto detected = cJSON_CreateObject();
+    cJSON_AddNumberToObject(detected, "frames", interference.frames);
+    cJSON_AddNumberToObject(detected, "corrupted", interference.corrupted);
+    cJSON_AddNumberToObject(detected, "samples", interference.samples);
+    cJSON_AddNumberToObject(detected, "repaired", interference.repaired);
+    cJSON_AddNumberToObject(detected, "dropped", interference.dropped);
+    cJSON_AddNumberToObject(detected, "hops", interference.hops);
+    cJSON_AddItemToObject(obj, "interference", detected);
+
+    auto mount = cJSON_CreateObject();
+    cJSON_AddNumberToObject(mount, "corrected", vibrations.corrected);
+    cJSON_AddNumberToObject(mount, "late", vibrations.late);
+    // Micrometers along the boresight
+    cJSON_AddNumberToObject(mount, "excursion", (double) vibrations.excursion.load() * 1e6);
+    cJSON_AddNumberToObject(mount, "rms", vibration != nullptr ? (double) vibration->rms() * 1e6 : 0.0);
+    cJSON_AddItemToObject(obj, "vibration", mount);
+
+    // Frames sent per second since the previous telemetry message
+    static int64_t lastTelemetry = 0;
+    static uint64_t lastSent = 0;
+    int64_t now = esp_timer_get_time();
+    uint64_t sent = pipeline.sent.value();
+    double rate = lastTelemetry > 0 ? (double) (sent - lastSent) * 1e6 / (double) (now - lastTelemetry) : 0;
+    lastTelemetry = now;
+    lastSent = sent;
+    HistogramSnapshot latency = pipeline.frame.snapshot();
+    auto stages = cJSON_CreateObject();
+    cJSON_AddNumberToObject(stages, "rate", rate);
+    cJSON_AddNumberToObject(stages, "captured", (double) pipeline.captured.value());
+    cJSON_AddNumberToObject(stages, "sent", (double) sent);
+    cJSON_AddNumberToObject(stages, "overflowed", (double) pipeline.overflowed.value());
+    cJSON_AddNumberToObject(stages, "dropped", (double) pipeline.dropped.value());
+    cJSON_AddNumberToObject(stages, "failed", (double) pipeline.failed.value());
+    cJSON_AddNumberToObject(stages, "decimated", (double) pipeline.decimated.value());
+    cJSON_AddNumberToObject(stages, "decimation", stream.decimation);
+    cJSON_AddNumberToObject(stages, "p50", (double) histogramQuantile(latency, 0.5f) / 1000);
+    cJSON_AddNumberToObject(stages, "p99", (double) histogramQuantile(latency, 0.99f) / 1000);
+    cJSON_AddItemToObject(obj, "pipeline", stages);
+
+    // The profile changes once per profiler interval, so it rides along only when a new one has been sampled
+    static uint32_t lastProfile = 0;
+    auto &profiler = Profiler::instance();
+    if (profiler.generation() != lastProfile) {
+        auto profile = (ProfileSnapshot *) malloc(sizeof(ProfileSnapshot));
+        if (profile != nullptr) {
+            lastProfile = profiler.snapshot(profile);
+            auto summary = cJSON_CreateObject();
+            auto cores = cJSON_CreateArray();
+            for (uint32_t load: profile->cores) {
+                cJSON_AddItemToArray(cores, cJSON_CreateNumber(load));
+            }
+            cJSON_AddItemToObject(summary, "cores", cores);
+            cJSON_AddNumberToObject(summary, "internal", profile->internal.free);
+            cJSON_AddNumberToObject(summary, "spiram", profile->spiram.free);
+            auto rings = cJSON_CreateArray();
+            for (uint32_t i = 0; i < profile->ringCount; i++) {
+                cJSON_AddItemToArray(rings, cJSON_CreateNumber(profile->rings[i].used));
+            }
+            cJSON_AddItemToObject(summary, "rings", rings);
+            cJSON_AddItemToObject(obj, "profile", summary);
+            free(profile);
+        }
+    }
 
-    if (!cJSON_PrintPreallocated(obj, buf, 512, false)) {
-        cJSON_Delete(obj);
+    auto burst = cJSON_CreateObject();
+    cJSON_AddNumberToObject(burst, "bursts", bursts.count);
+    cJSON_AddNumberToObject(burst, "powered", bursts.powered);
+    cJSON_AddNumberToObject(burst, "gated", bursts.gated);
+    cJSON_AddItemToObject(obj, "burst", burst);
+
+    if (chirpDac != nullptr && !chirpDac->streaming) {
+        DACInterruptStats interrupts = chirpDac->interruptStats();
+        auto isr = cJSON_CreateObject();
+        cJSON_AddNumberToObject(isr, "count", interrupts.count);
+        cJSON_AddNumberToObject(isr, "worst", interrupts.worst);
+        auto histogram = cJSON_CreateArray();
+        for (uint32_t count: interrupts.histogram) {
+            cJSON_AddItemToArray(histogram, cJSON_CreateNumber(count));
+        }
+        cJSON_AddItemToObject(isr, "histogram", histogram);
+        cJSON_AddItemToObject(obj, "isr", isr);
+    }
+
+    // Sized by cJSON, the isr and profile objects take the message past any fixed buffer worth reserving
+    char *buf = cJSON_PrintUnformatted(obj);
+    cJSON_Delete(obj);
+    if (buf == nullptr) {
+        printf("Failed to print telemetry\n");
         return;
     }
 
-    out_packer.payload = (uint8_t *) buf;
-    out_packer.len = strlen(buf);
-    out_packer.type = HTTPD_WS_TYPE_TEXT;
-    if (xSemaphoreTake(wsLock, pdMS_TO_TICKS(100)) != pdTRUE) {
+    // Motion waits out a frame send rather than be dropped behind it
+    TickType_t wait = pdMS_TO_TICKS(gd->motion != 0 ? 1000 : 100);
+    if (xSemaphoreTake(wsLock, wait) != pdTRUE) {
         free(buf);
         return;
     }
-//    send_websocket_frame_using_queue(hd, fd, &out_packer);
-    auto ret = httpd_ws_send_frame_async(hd, fd, &out_packer);
+    esp_err_t ret = transport.send((uint8_t *) buf, strlen(buf), false);
     free(buf);
     if (ret != ESP_OK) {
         printf("Send to bridge failed!\n");
-        fd = -1;
-        xSemaphoreGive(wsLock);
-        return;
     }
-    cJSON_Delete(obj);
     xSemaphoreGive(wsLock);
 }
 
@@ -379,6 +836,55 @@ static const httpd_uri_t systemConf = {
 };
 
 
+static const httpd_uri_t metadataGet = {
+        .uri       = "/metadata",
+        .method    = HTTP_GET,
+        .handler   = metadataHandler,
+        .is_websocket = false,
+};
+
+static const httpd_uri_t linearizationPost = {
+        .uri       = "/linearization",
+        .method    = HTTP_POST,
+        .handler   = linearizationHandler,
+        .is_websocket = false,
+};
+
+static const httpd_uri_t calibratePost = {
+        .uri       = "/calibrate",
+        .method    = HTTP_POST,
+        .handler   = calibrateHandler,
+        .is_websocket = false,
+};
+
+static const httpd_uri_t metricsGet = {
+        .uri       = "/metrics",
+        .method    = HTTP_GET,
+        .handler   = metricsHandler,
+        .is_websocket = false,
+};
+
+static const httpd_uri_t tasksGet = {
+        .uri       = "/debug/tasks",
+        .method    = HTTP_GET,
+        .handler   = tasksHandler,
+        .is_websocket = false,
+};
+
+static const httpd_uri_t recordingPost = {
+        .uri       = "/recording",
+        .method    = HTTP_POST,
+        .handler   = recordingTriggerHandler,
+        .is_websocket = false,
+};
+
+static const httpd_uri_t recordingGet = {
+        .uri       = "/recording",
+        .method    = HTTP_GET,
+        .handler   = recordingHandler,
+        .is_websocket = false,
+};
+
 static const httpd_uri_t reboot = {
         .uri       = "/reboot",
         .method    = HTTP_POST,
@@ -405,6 +911,10 @@ void gyroWatcher(void *arg) {
         }
 
         auto *data = (GyroData *) dat;
+        // Keep the frames around a bump, the mount may have been knocked out of alignment
+        if (data->motion != 0 && recorder != nullptr) {
+            recorder->trigger(esp_timer_get_time(), RECORDER_PRE_US, RECORDER_POST_US);
+        }
         // Enable temperature sensor
         ESP_ERROR_CHECK(temperature_sensor_enable(temp_handle));
         // Get converted sensor data
@@ -430,7 +940,75 @@ void gyroWatcher(void *arg) {
     }
 }
 
+// Rotate the phase the vibration of the mount added back out of a frame. The IMU batch covering the end of the frame
+// may still be on its way, it is waited on for a while as long as the IMU is streaming at all.
+static void compensateVibration(SampleData *data) {
+    int64_t deadline = esp_timer_get_time() + (int64_t) CONFIG_vRADAR_VIBRATION_WAIT_MS * 1000;
+    while (!vibration->covers(data->stop)) {
+        int64_t now = esp_timer_get_time();
+        int64_t newest = vibration->newest();
+        if (now >= deadline || newest == 0 || now - newest > VIBRATION_STALE_US) {
+            break;
+        }
+        vTaskDelay(1);
+    }
+    float excursion = 0;
+    if (!vibration->compensate(data->data, data->size, data->start, data->stop, &excursion)) {
+        vibrations.late++;
+        return;
+    }
+    vibrations.corrected++;
+    vibrations.excursion = excursion;
+}
+
+// Put a plan into effect, the metadata reports it before the frames it was made for are sent
+static void applyPlan(const StreamPlan &plan) {
+#ifdef CONFIG_vRADAR_STREAM_DECIMATE
+    stream.decimation = plan.decimation;
+#endif
+    Metadata::instance().plan(plan);
+    printf("Stream plan: %s, one in %ld frames, %.0f of %.0f B/s%s\n", streamFormatName(plan.format),
+           plan.decimation, plan.rate, plan.throughput, plan.fits ? "" : ", the link is overrun");
+}
+
+// Plan new frame settings against the link as it was last measured. Frames captured with them are queued behind the
+// frame that brings the watcher here, so the metadata reports the plan before they are sent.
+static void followSettings() {
+    if (!stream.reconfigured.exchange(false)) {
+        return;
+    }
+    System system = Settings::instance().getSystem();
+    StreamDemand demand = streamDemand(system.chirp, system.sampling, system.burst);
+    if (xSemaphoreTake(stream.lock, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    StreamPlan plan = stream.planner->configure(demand, esp_timer_get_time());
+    xSemaphoreGive(stream.lock);
+    applyPlan(plan);
+}
+
+// Take a richer or poorer plan as the link measures up
+static void followLink() {
+    static int64_t lastPlanned = 0;
+    int64_t now = esp_timer_get_time();
+    if (now - lastPlanned < STREAM_REPLAN_US) {
+        return;
+    }
+    lastPlanned = now;
+    if (xSemaphoreTake(stream.lock, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    bool changed = stream.planner->update(now);
+    StreamPlan plan = stream.planner->plan();
+    xSemaphoreGive(stream.lock);
+    if (changed) {
+        applyPlan(plan);
+    }
+}
+
 void watcher(void *arg) {
+    // Frames since the last one sent
+    int32_t unsent = 0;
     while (1) {
 
         size_t size = -1;
@@ -440,9 +1018,26 @@ void watcher(void *arg) {
             continue;
         }
         auto data = (SampleData *) dat;
+        pipeline.queue.record(esp_cpu_get_core_id(), (uint64_t) (esp_timer_get_time() - data->enqueued) * 1000);
 
-//        callback(data);
-        callback(data);
+        if (vibration != nullptr && vibrationMode == VIBRATION_COMPENSATE) {
+            compensateVibration(data);
+        }
+
+        // Every frame is recorded, whether or not a bridge is connected
+        if (recorder != nullptr) {
+            recorder->append(*data, data->chirpStart);
+        }
+
+        followSettings();
+        // Frames the link has no room for are recorded but not sent
+        if (++unsent >= stream.decimation) {
+            unsent = 0;
+            callback(data);
+        } else if (transport.connected()) {
+            pipeline.decimated.add(esp_cpu_get_core_id());
+        }
+        followLink();
 //        printf("Sending Data... (%lu)\n", esp_get_free_heap_size());
 
         for (int i = 0; i < 4; i++) {
@@ -461,43 +1056,317 @@ static int64_t last = 0;
 static int64_t loop = 0;
 
 
+static int64_t syncClock(void *ctx) {
+    return esp_timer_get_time();
+}
+
+// Shares the chirp clock with the other modules
+static SyncNode syncNode(syncClock, nullptr);
+
+static void scheduleChanged(uint32_t changes, const System &system, uint32_t generation, void *ctx) {
+    xTaskNotifyGive((TaskHandle_t) ctx);
+}
+
+void syncTask(void *arg) {
+    auto &settings = Settings::instance();
+    settings.subscribe(SETTINGS_SCHEDULE, scheduleChanged, xTaskGetCurrentTaskHandle());
+    bool changed = true;
+    while (true) {
+        if (changed) {
+            System system{};
+            settings.getSystem(&system);
+            if (system.schedule.mode != syncNode.mode()) {
+                // Followers broadcast their requests so they find the master without configuration
+                if (!syncNode.open((SyncMode) system.schedule.mode, SYNC_PORT, "255.255.255.255", SYNC_PORT)) {
+                    printf("Failed to open time sync socket\n");
+                }
+            }
+        }
+        if (syncNode.mode() == SYNC_OFF) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            changed = true;
+            continue;
+        }
+        syncNode.poll(50);
+        changed = ulTaskNotifyTake(pdTRUE, 0) > 0;
+    }
+}
+
+// Microseconds between an aligned start and the first chirp start the DAC reports, learned from the first frame
+static int64_t startLead = 0;
+static bool measureLead = false;
+
+// Start the chirp train at the start of this module's first slot on the shared clock from the given time since boot,
+// delayed by phase. Modules that are not scheduled or not yet synchronized start phase microseconds after it.
+static void startChirps(DAC *dac, const Schedule &schedule, int32_t prf, int32_t phase, int64_t after) {
+    ClockModel model = syncNode.model();
+    if (schedule.slots <= 0 || !model.locked) {
+        if (after + phase > esp_timer_get_time()) {
+            dac->startAt(after + phase);
+        } else {
+            dac->start();
+        }
+        return;
+    }
+    int64_t earliest = esp_timer_get_time() + SYNC_START_MARGIN_US;
+    int64_t shared = sharedTime(model, after > earliest ? after : earliest);
+    int64_t slot = nextSlotStart(shared, prf, schedule.slot, schedule.slots, phase);
+    dac->startAt(localTime(model, slot) - startLead);
+    measureLead = true;
+}
+
+// Longest random chirp phase hop that keeps the chirp inside the module's share of the period
+static int32_t phaseLimit(const Chirp &chirp, const Schedule &schedule) {
+    if (schedule.slots > 0) {
+        return chirp.prf / schedule.slots - chirp.duration;
+    }
+    return chirp.prf;
+}
+
+#ifdef CONFIG_vRADAR_BURST_LIGHT_SLEEP
+// Let the CPUs enter light sleep whenever no driver holds a power management lock. The frequency stays fixed, so the
+// cycle counter keeps the rate the chirp to ADC skew is measured with.
+static esp_err_t initializeLightSleep() {
+    esp_pm_config_t config = {
+            .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+            .min_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+            .light_sleep_enable = true,
+    };
+    return esp_pm_configure(&config);
+}
+#endif
+
+static void chirpSettingsChanged(uint32_t changes, const System &system, uint32_t generation, void *ctx) {
+    auto reconfigure = (Reconfigure *) ctx;
+    reconfigure->stage();
+}
+
+static void interferenceChanged(uint32_t changes, const System &system, uint32_t generation, void *ctx) {
+    auto mode = (std::atomic<int32_t> *) ctx;
+    *mode = system.interference;
+}
+
+static void vibrationChanged(uint32_t changes, const System &system, uint32_t generation, void *ctx) {
+    auto mode = (std::atomic<int32_t> *) ctx;
+    *mode = system.vibration;
+}
+
+// New frame settings are left for the watcher to plan, the listener must not wait on the stream lock
+static void streamSettingsChanged(uint32_t changes, const System &system, uint32_t generation, void *ctx) {
+    stream.reconfigured = true;
+}
+
+// Sweep the configured chirp range in short linear sub-ramps against a fixed reflector, fit the VCO linearization
+// from the beat frequency of each sub-ramp and store it. The chirp train is left stopped.
+static esp_err_t calibrate(DAC *dac, Sample *s, int32_t segments) {
+    auto &settings = Settings::instance();
+    System system{};
+    settings.getSystem(&system);
+
+    // Plain sawtooth sub-ramps, so the beat of each segment only depends on the VCO slope across it
+    Chirp chirp = system.chirp;
+    chirp.shape = CHIRP_SAWTOOTH;
+    chirp.padding = 0;
+    chirp.linearize = 1;
+    int32_t samples = frameSamples(chirp, system.sampling);
+
+    uint16_t *lanes[4]{};
+    for (auto &lane: lanes) {
+        lane = (uint16_t *) heap_caps_malloc(sizeof(uint16_t) * samples, MALLOC_CAP_SPIRAM);
+        if (lane == nullptr) {
+            for (auto &allocated: lanes) {
+                if (allocated != nullptr) heap_caps_free(allocated);
+            }
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    CalibrationSegment results[CALIBRATION_MAX_SEGMENTS];
+    esp_err_t err = ESP_OK;
+    for (int32_t i = 0; i < segments && err == ESP_OK; i++) {
+        // Confine the whole ramp to one segment of the DAC range with a linear window
+        Linearization window{};
+        window.coefficients[0] = (float) i / (float) segments;
+        window.coefficients[1] = 1.0f / (float) segments;
+        window.valid = 1;
+
+        dac->stop();
+        err = dac->configure(chirp, window);
+        if (err != ESP_OK) {
+            break;
+        }
+        ulTaskNotifyTake(pdTRUE, 0);
+        dac->start();
+
+        float beat = 0;
+        for (int frame = 0; frame < CALIBRATION_FRAMES_PER_SEGMENT; frame++) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            err = s->listen(samples, lanes);
+            if (err != ESP_OK) {
+                break;
+            }
+            beat += beatFrequency(lanes[0], samples, (float) system.sampling.frequency);
+        }
+        results[i] = {
+                .start = window.coefficients[0],
+                .width = window.coefficients[1],
+                .beat = beat / CALIBRATION_FRAMES_PER_SEGMENT,
+        };
+        printf("Calibration segment %ld: %.1f Hz\n", i, results[i].beat);
+    }
+    dac->stop();
+    for (auto &lane: lanes) {
+        heap_caps_free(lane);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    Linearization curve{};
+    if (!fitLinearization(results, segments, &curve)) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    printf("Linearization: %f %f %f %f\n", curve.coefficients[0], curve.coefficients[1], curve.coefficients[2],
+           curve.coefficients[3]);
+    // Persists the curve and stages a reconfiguration with it
+    settings.setLinearization(curve);
+    return ESP_OK;
+}
+
 void adcTask(void *arg) {
     auto s = new Sample();
 
-    new DAC(xTaskGetCurrentTaskHandle());
+    auto dac = new DAC(xTaskGetCurrentTaskHandle());
+    chirpDac = dac;
+    auto reconfigure = new Reconfigure();
+    auto &settings = Settings::instance();
+    // Chirp and sampling changes are staged, then switched together between frames. The buzzer is part of the
+    // streamed chirp waveform and the linearization is part of the chirp table, so both are switched the same way.
+    settings.subscribe(SETTINGS_CHIRP | SETTINGS_SAMPLING | SETTINGS_AUDIBLE | SETTINGS_LINEARIZATION,
+                       chirpSettingsChanged, reconfigure);
+    // A new slot or burst plan is taken up at the next frame boundary
+    settings.subscribe(SETTINGS_SCHEDULE | SETTINGS_BURST, chirpSettingsChanged, reconfigure);
+    Schedule schedule{};
+    BurstPlan plan{};
+    // Chirps captured since the radar was last powered up, and when that was
+    int32_t burstChirps = 0;
+    int64_t burstStart = 0;
+#ifdef CONFIG_vRADAR_BURST_LIGHT_SLEEP
+    esp_err_t sleepErr = initializeLightSleep();
+    if (sleepErr != ESP_OK) {
+        printf("Failed to enable light sleep: %s\n", esp_err_to_name(sleepErr));
+    }
+#endif
+    bool realign = false;
+    // Random delay of the chirp starts, hopped on sustained interference
+    int32_t chirpPhase = 0;
+
+    auto detector = new InterferenceDetector();
+    InterferenceMonitor monitor{};
+    static std::atomic<int32_t> interferenceMode{settings.getSystem().interference};
+    settings.subscribe(SETTINGS_INTERFERENCE, interferenceChanged, &interferenceMode);
+    // Stage the persisted configuration so the first pass starts the chirp train
+    reconfigure->stage();
     last = esp_timer_get_time();
-    int samples = 256;
     while (true) {
-        auto settings = Settings::instance();
-        auto chirp = settings.getSystem().chirp;
+        int32_t segments = calibrationSegments.exchange(0);
+        if (segments > 0) {
+            // Frames are only captured by this task, so none are in flight here
+            esp_err_t err = calibrate(dac, s, segments);
+            if (err != ESP_OK) {
+                printf("Failed to calibrate: %s\n", esp_err_to_name(err));
+            }
+            // Restore the configured chirp
+            reconfigure->stage();
+        }
 
-        samples = (int) ceil(((double) chirp.prf / 1000.0) / (double) (1000.0 / settings.getSystem().sampling
-                .frequency));
-//        printf("Capturing: %d\n", samples);
-        if (samples < 32) samples = 32;
-        if (samples > 1024) samples = 1024;
+        if (plan.gated && burstChirps >= plan.chirps) {
+            // The burst is complete, power the radar down until it has to settle for the next one
+            int64_t gatedAt = esp_timer_get_time();
+            dac->sleep();
+            s->gate(true);
+            int64_t wait = burstStart + plan.period - gatedAt;
+            if (wait >= 1000) {
+                // Nothing on this core holds a power management lock while the chirps are stopped, so with tickless
+                // idle the CPUs may enter light sleep for the whole delay
+                vTaskDelay(pdMS_TO_TICKS(wait / 1000));
+            }
+            s->gate(false);
+            dac->wake();
+            int64_t now = esp_timer_get_time();
+            bursts.count++;
+            bursts.powered += (uint32_t) ((gatedAt - burstStart) / 1000);
+            bursts.gated += (uint32_t) ((now - gatedAt) / 1000);
+            burstStart = now;
+            burstChirps = 0;
+            // Chirps restart once the radar has settled, which also realigns them
+            ulTaskNotifyTake(pdTRUE, 0);
+            startChirps(dac, schedule, reconfigure->active().chirp.prf, chirpPhase, now + BURST_SETTLE_US);
+            realign = false;
+        }
 
-//        auto itemSize = xRingbufferGetMaxItemSize(adc_buffer);
-//        auto freeSize = xRingbufferGetCurFreeSize(adc_buffer);
-//
-//        if (freeSize < itemSize) {
-//            size_t size = 0;
-//            auto *item = xRingbufferReceive(adc_buffer, &size, 1);
-//            if (item != nullptr) {
-//                auto *data = (SampleData *) item;
-//                if (data->data != nullptr) {
-//                    for (int i = 0; i < 4; ++i) {
-//                        if (data->data[i] != nullptr) heap_caps_free(data->data[i]);
-//                    }
-//                    heap_caps_free(data->data);
-//                }
-//                vRingbufferReturnItem(adc_buffer, item);
-//            }
-//        }
+        if (realign) {
+            // The previous frame has ended, so restarting the chirp train here splits no frame
+            dac->stop();
+            ulTaskNotifyTake(pdTRUE, 0);
+            startChirps(dac, schedule, reconfigure->active().chirp.prf, chirpPhase, esp_timer_get_time());
+            realign = false;
+        }
+
+        if (reconfigure->drain()) {
+            // Halt the chirp train so no frame straddles the switch
+            dac->stop();
+            System system{};
+            settings.getSystem(&system);
+            FrameConfiguration previous = reconfigure->active();
+            Linearization linearization = settings.getLinearization();
+            // The adc is switched first, it keeps its sampling when it refuses the change
+            esp_err_t err = s->configure(system.sampling);
+            if (err == ESP_OK) {
+                err = dac->configure(system.chirp, linearization);
+                if (err != ESP_OK) {
+                    // Put both sides back on the configuration the frames are still stamped with
+                    esp_err_t restored = s->configure(previous.sampling);
+                    if (restored == ESP_OK) {
+                        restored = dac->configure(previous.chirp, linearization);
+                    }
+                    if (restored != ESP_OK) {
+                        printf("Failed to restore configuration %lu: %s\n", previous.id, esp_err_to_name(restored));
+                    }
+                }
+            }
+            if (err == ESP_OK) {
+                uint32_t id = reconfigure->commit(system.chirp, system.sampling);
+                // The skew depends on the chirp and sampling configuration
+                alignment.reset();
+                printf("Configuration %lu: %ld samples\n", id, reconfigure->active().samples);
+            } else {
+                reconfigure->abort();
+                printf("Configuration aborted, %lu kept: %s\n", reconfigure->active().id, esp_err_to_name(err));
+            }
+            const Chirp &chirp = reconfigure->active().chirp;
+            if (chirp.prf != previous.chirp.prf || memcmp(&schedule, &system.schedule, sizeof(Schedule)) != 0) {
+                // The lead was learned for the previous period and slot, the next aligned start learns it again
+                startLead = 0;
+                measureLead = false;
+            }
+            schedule = system.schedule;
+            chirpPhase = 0;
+            // Discard any chirp start notification raised under the previous configuration
+            ulTaskNotifyTake(pdTRUE, 0);
+            plan = planBurst(chirp, system.burst);
+            burstChirps = 0;
+            burstStart = esp_timer_get_time();
+            startChirps(dac, schedule, chirp.prf, chirpPhase, burstStart);
+        }
+
+        const FrameConfiguration &frame = reconfigure->beginFrame();
+        int samples = frame.samples;
 
         auto **data = (uint16_t **) heap_caps_malloc(sizeof(uint16_t *) * 4, MALLOC_CAP_SPIRAM);
         if (data == nullptr) {
             printf("No Memory\n");
+            reconfigure->endFrame();
             vTaskDelay(pdMS_TO_TICKS(1));
             continue;
         }
@@ -512,9 +1381,13 @@ void adcTask(void *arg) {
         }
 
         ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        // Latch the chirp start before the next chirp interrupt can overwrite it
+        uint32_t chirpCycle = dac->chirpCycle;
+        int64_t chirpStart = dac->chirpTime;
 
         int64_t start = esp_timer_get_time();
         esp_err_t err = s->listen(samples, data);
+        reconfigure->endFrame();
         if (err != ESP_OK) {
             printf("ERROR: %s\n", esp_err_to_name(err));
             for (int i = 0; i < 4; ++i) {
@@ -526,26 +1399,97 @@ void adcTask(void *arg) {
         }
 
         int64_t end = esp_timer_get_time();
-        int64_t cStart = 0;
-        int64_t cStop = 0;
+        uint32_t captureCycle = esp_cpu_get_cycle_count();
+        int core = esp_cpu_get_core_id();
+        pipeline.captured.add(core);
+        pipeline.capture.record(core, elapsedNanoseconds(chirpCycle));
+        burstChirps++;
+        // The chirp, dma and acquisition interrupts are all allocated from this task, so they share the cycle
+        // counter of this core
+        int64_t skew = cyclesToNanoseconds(chirpCycle, s->firstConversionCycle(), esp_rom_get_cpu_ticks_per_us());
+        alignment.record(skew);
+
+        int64_t epoch = 0;
+        ClockModel model = syncNode.model();
+        if (model.locked) {
+            epoch = sharedTime(model, chirpStart);
+            if (schedule.slots > 0) {
+                int64_t error = slotError(epoch, frame.chirp.prf, schedule.slot, schedule.slots, chirpPhase);
+                if (measureLead) {
+                    // Whatever the DAC adds between the requested start and its first chirp start is constant. A
+                    // frame that came out of the wrong slot must not push the start past its margin.
+                    startLead += error;
+                    if (startLead < 0) {
+                        startLead = 0;
+                    } else if (startLead > SYNC_START_MARGIN_US / 2) {
+                        startLead = SYNC_START_MARGIN_US / 2;
+                    }
+                    measureLead = false;
+                } else if (error > SYNC_MAX_SLOT_ERROR_US || error < -SYNC_MAX_SLOT_ERROR_US) {
+                    // The local clock has drifted out of the slot, the next pass restarts the train in it
+                    realign = true;
+                }
+            }
+        }
+
+        auto mode = (InterferenceMode) interferenceMode.load();
+        if (mode != INTERFERENCE_OFF) {
+            // The flyback at the end of the ramp jumps like interference, only the ramp is inspected
+            InterferenceReport report = detector->inspect(data, 4, frame.ramp, mode);
+            bool corrupted = report.corrupted > 0;
+            interference.frames++;
+            if (corrupted) {
+                interference.corrupted++;
+                interference.samples += report.corrupted;
+                if (mode == INTERFERENCE_REPAIR || mode == INTERFERENCE_ZERO) {
+                    interference.repaired++;
+                }
+            }
+            int32_t limit = phaseLimit(frame.chirp, schedule);
+            if (monitor.record(corrupted) && limit > 0) {
+                // Another radar keeps chirping over ours, move our chirps somewhere else in the period
+                chirpPhase = (int32_t) (esp_random() % (uint32_t) limit);
+                interference.hops++;
+                realign = true;
+                // Keep the frames around the interference for a look at what the other radar is doing
+                if (recorder != nullptr) {
+                    recorder->trigger(chirpStart, RECORDER_PRE_US, RECORDER_POST_US);
+                }
+            }
+            if (corrupted && mode == INTERFERENCE_DROP) {
+                interference.dropped++;
+                pipeline.dropped.add(core);
+                for (int i = 0; i < 4; ++i) {
+                    if (data[i] != nullptr) heap_caps_free(data[i]);
+                }
+                heap_caps_free(data);
+                continue;
+            }
+        }
 
         SampleData sd = {
                 .data = data,
                 .size = samples,
                 .start = start,
                 .stop = end,
-                .chirpStart = cStart,
-                .chirpStop = cStop,
+                .chirpStart = chirpStart,
+                .chirpStop = chirpStart + frame.chirp.duration,
+                .skew = skew,
+                .epoch = epoch,
+                .configuration = frame.id,
+                .enqueued = esp_timer_get_time(),
         };
 
 
         if (xRingbufferSend(adc_buffer, (void *) &sd, sizeof(sd), pdMS_TO_TICKS(0.5)) != pdTRUE) {
             printf("Overflow :< \n");
+            pipeline.overflowed.add(core);
             for (int i = 0; i < 4; ++i) {
                 if (data[i] != nullptr) heap_caps_free(data[i]);
             }
             heap_caps_free(data);
         } else {
+            pipeline.enqueue.record(core, elapsedNanoseconds(captureCycle));
 //            if (loop == 0) {
 //                printf("Collected Sample: Duration=%lld, Interval=%lld Last: %d\n", end - start, esp_timer_get_time() -
 //                last, sd.data[3][511]);
@@ -556,6 +1500,7 @@ void adcTask(void *arg) {
 
 
     }
+    delete reconfigure;
     delete s;
 }
 
@@ -584,6 +1529,7 @@ Server::Server() {
 
     server = nullptr;
     httpd_config_t httpdConf = HTTPD_DEFAULT_CONFIG();
+    httpdConf.max_uri_handlers = 16;
 
     esp_err_t ret = httpd_start(&server, &httpdConf);
     if (ESP_OK != ret) {
@@ -591,13 +1537,21 @@ Server::Server() {
     }
 
     Settings::instance();
+    Metadata::instance();
     httpd_register_uri_handler(server, &config);
     httpd_register_uri_handler(server, &reboot);
     httpd_register_uri_handler(server, &options);
     httpd_register_uri_handler(server, &socket_get);
     httpd_register_uri_handler(server, &systemConf);
-
-    adc_buffer = xRingbufferCreate((sizeof(SampleData *)) * (256+64), RINGBUF_TYPE_NOSPLIT);
+    httpd_register_uri_handler(server, &metadataGet);
+    httpd_register_uri_handler(server, &linearizationPost);
+    httpd_register_uri_handler(server, &calibratePost);
+    httpd_register_uri_handler(server, &metricsGet);
+    httpd_register_uri_handler(server, &tasksGet);
+    httpd_register_uri_handler(server, &recordingPost);
+    httpd_register_uri_handler(server, &recordingGet);
+
+    adc_buffer = xRingbufferCreate(ADC_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
     if (adc_buffer == nullptr) {
         printf("Failed to create ring buffer\n");
     }
@@ -607,19 +1561,50 @@ Server::Server() {
         printf("Failed to create ring buffer\n");
     }
 
-    gyro_buffer = xRingbufferCreate(sizeof(GyroData) * 20, RINGBUF_TYPE_NOSPLIT);
+    gyro_buffer = xRingbufferCreate(GYRO_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
     if (gyro_buffer == nullptr) {
         printf("Failed to create ring buffer\n");
     }
 
     printf("RingBuffers initialized...\n");
 
-    new Gyro(gyro_buffer);
+    // The recorder arena is taken from PSRAM once and never freed
+    size_t recorderBytes = (size_t) CONFIG_vRADAR_RECORDER_KB * 1024;
+    auto arena = (uint8_t *) heap_caps_malloc(recorderBytes, MALLOC_CAP_SPIRAM);
+    if (recorderBytes > 0 && arena == nullptr) {
+        printf("Failed to allocate the flight recorder\n");
+    } else if (arena != nullptr) {
+        recorder = new FlightRecorder(arena, recorderBytes);
+    }
+
+    // Start sampling task statistics
+    auto &profiler = Profiler::instance();
+    profiler.watch("adc", adc_buffer, ADC_BUFFER_SIZE);
+    profiler.watch("gyro", gyro_buffer, GYRO_BUFFER_SIZE);
+
+    // The boresight in the accelerometer frame, and the wavelength at the bottom of the band
+    float boresight[3] = {0, 0, 0};
+    boresight[CONFIG_vRADAR_VIBRATION_AXIS] = VIBRATION_DIRECTION;
+    vibration = new Vibration(IMU_RATE, boresight, VIBRATION_SPEED_OF_LIGHT / (float) CONFIG_vRADAR_BASE_FREQUENCY);
+    vibrationMode = Settings::instance().getSystem().vibration;
+    Settings::instance().subscribe(SETTINGS_VIBRATION, vibrationChanged, &vibrationMode);
+
+    gyro = new Gyro(gyro_buffer, vibration);
+
+    // Subscribed ahead of the capture, so each change is flagged before the frames captured with it are queued. The
+    // persisted settings are planned here, before the watcher starts.
+    stream.lock = xSemaphoreCreateMutex();
+    stream.planner = new StreamPlanner(STREAM_FORMATS_SENT);
+    stream.reconfigured = true;
+    followSettings();
+    Settings::instance().subscribe(SETTINGS_CHIRP | SETTINGS_SAMPLING | SETTINGS_BURST, streamSettingsChanged,
+                                   nullptr);
 
     TaskHandle_t adcTaskHandle{};
     xTaskCreatePinnedToCore(watcher, "watcherTask", 8192, nullptr, tskIDLE_PRIORITY + 5, nullptr, 1);
     xTaskCreate(gyroWatcher, "gyroWatcher", 8192, nullptr, tskIDLE_PRIORITY + 3, nullptr);
     xTaskCreatePinnedToCore(adcTask, "adcTask", 8192, nullptr, tskIDLE_PRIORITY + 6, &adcTaskHandle, 0);
+    xTaskCreatePinnedToCore(syncTask, "syncTask", 4096, nullptr, tskIDLE_PRIORITY + 5, nullptr, 1);
 
 //    xTaskCreate(dacTask, "dacTask", 24000, &adcTaskHandle, tskIDLE_PRIORITY + 3, nullptr);
 
@@ -11,14 +11,6 @@
 #include <esp_http_server.h>
 #include <cJSON.h>
 #include <esp_timer.h>
-static httpd_handle_t hd{};
-static int fd = -1;
-
-static void setSession(httpd_req_t *ses) {
-    hd = ses->handle;
-    fd = httpd_req_to_sockfd(ses);
-}
-
 class Server{
 
 
@@ -3,9 +3,53 @@
 //
 
 #include <cJSON.h>
+#include <cstring>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include "settings.h"
-#include "persistent.h"
+#include "waveform.h"
+
+// Read an optional integer member, falling back when the member is missing
+static int jsonInt(const cJSON *object, const char *key, int fallback) {
+    cJSON *item = cJSON_GetObjectItem(object, key);
+    if (!cJSON_IsNumber(item)) {
+        return fallback;
+    }
+    return item->valueint;
+}
+
+// Determine which field groups differ between two system snapshots
+static uint32_t changedFields(const System &previous, const System &next) {
+    uint32_t changes = 0;
+    if (memcmp(&previous.chirp, &next.chirp, sizeof(Chirp)) != 0) {
+        changes |= SETTINGS_CHIRP;
+    }
+    if (memcmp(&previous.sampling, &next.sampling, sizeof(Sampling)) != 0) {
+        changes |= SETTINGS_SAMPLING;
+    }
+    if (previous.audible != next.audible) {
+        changes |= SETTINGS_AUDIBLE;
+    }
+    if (previous.enabled != next.enabled) {
+        changes |= SETTINGS_ENABLED;
+    }
+    if (previous.gyro != next.gyro) {
+        changes |= SETTINGS_GYRO;
+    }
+    if (memcmp(&previous.schedule, &next.schedule, sizeof(Schedule)) != 0) {
+        changes |= SETTINGS_SCHEDULE;
+    }
+    if (previous.interference != next.interference) {
+        changes |= SETTINGS_INTERFERENCE;
+    }
+    if (memcmp(&previous.burst, &next.burst, sizeof(Burst)) != 0) {
+        changes |= SETTINGS_BURST;
+    }
+    if (previous.vibration != next.vibration) {
+        changes |= SETTINGS_VIBRATION;
+    }
+    return changes;
+}
 
 Settings &Settings::instance() {
     static Settings the_instance = Settings();
@@ -15,78 +59,59 @@ Settings &Settings::instance() {
 Settings::Settings() {
     lock = xSemaphoreCreateMutex();
     pull();
+    // Flash writes happen on a low priority task so they stall neither the request path nor acquisition
+    xTaskCreate(writerTask, "settingsWriter", 3072, this, tskIDLE_PRIORITY + 1, &writer);
 }
 
 void Settings::pull() {
+    Linearization curve{};
+    if (store.loadLinearization(&curve)) {
+        linearization.store(curve);
+    }
 
-    auto p = Persistent::instance();
-
-    int32_t audible = 0, gyro = 0, enabled = 0;
-
-    p.readInt("audible", &audible, 0);
-    p.readInt("gyro", &gyro, 1);
-    p.readInt("enable", &enabled, 1);
-
-
-    int32_t prf = 0, duration = 0, steps = 0, padding = 0, resolution = 0;
-    p.readInt("prf", &prf, 12500);
-    p.readInt("duration", &duration, 12500);
-    p.readInt("steps", &steps, 125);
-    p.readInt("padding", &padding, 0);
-    p.readInt("resolution", &resolution, 125);
-
-    int32_t frequency = 0, samples = 0, attenuation = 0;
-    p.readInt("frequency", &frequency, 20480);
-    p.readInt("samples", &samples, 1);
-    p.readInt("attenuation", &attenuation, 0);
-
+    // Settings read from the keys of older firmware are migrated to the blob by the next push
+    System stored{};
+    store.loadSystem(&stored);
 
-    if (xSemaphoreTake(lock, pdMS_TO_TICKS(1)) != pdTRUE) {
+    if (xSemaphoreTake(lock, portMAX_DELAY) != pdTRUE) {
         return;
     }
-
-    system.sampling = {
-            .frequency = frequency,
-            .samples = samples,
-            .attenuation = attenuation
-    };
-
-    system.chirp = {
-            .prf = prf,
-            .duration = duration,
-            .steps = steps,
-            .padding = padding,
-            .resolution = resolution,
-    };
-
-    system.audible = audible;
-    system.enabled = enabled;
-    system.gyro = gyro;
-
+    system.store(stored);
     xSemaphoreGive(lock);
 }
 
 void Settings::push() const {
-    if (xSemaphoreTake(lock, pdMS_TO_TICKS(1)) != pdTRUE) {
+    if (writer == nullptr) {
         printf("Could not push\n");
         return;
     }
-    auto p = Persistent::instance();
-
-    p.writeInt("prf", system.chirp.prf);
-    p.writeInt("duration", system.chirp.duration);
-    p.writeInt("steps", system.chirp.steps);
-    p.writeInt("padding", system.chirp.padding);
-    p.writeInt("resolution", system.chirp.resolution);
+    // Restart the debounce window of the writer task
+    xTaskNotifyGive(writer);
+}
 
-    p.writeInt("frequency", system.sampling.frequency);
-    p.writeInt("samples", system.sampling.samples);
-    p.writeInt("attenuation", system.sampling.attenuation);
+void Settings::writerTask(void *arg) {
+    auto settings = (Settings *) arg;
+    Debounce debounce((int64_t) SETTINGS_WRITE_DEBOUNCE_MS * 1000);
+    while (true) {
+        // Sleep until pushed while nothing is pending, then until the pushes have been quiet for the full period
+        int64_t remaining = debounce.remaining(esp_timer_get_time());
+        TickType_t wait = remaining < 0 ? portMAX_DELAY : pdMS_TO_TICKS(remaining / 1000) + 1;
+        if (ulTaskNotifyTake(pdTRUE, wait) > 0) {
+            debounce.push(esp_timer_get_time());
+            continue;
+        }
+        if (debounce.due(esp_timer_get_time())) {
+            settings->write();
+        }
+    }
+}
 
-    p.writeInt("audible", system.audible);
-    p.writeInt("gyro", system.gyro);
-    p.writeInt("enable", system.enabled);
-    xSemaphoreGive(lock);
+void Settings::write() {
+    System current{};
+    system.load(current);
+    Linearization curve{};
+    linearization.load(curve);
+    store.save(current, curve);
 }
 
 void Settings::fromJson(const char *json) {
@@ -103,41 +128,154 @@ void Settings::fromJson(const char *json) {
     xSemaphoreGive(lock);
 }
 
-void Settings::systemFromJson(const char *json) {
+bool Settings::systemFromJson(const char *json, const char **reason) {
     auto request = cJSON_Parse(json);
+    if (!cJSON_IsObject(request)) {
+        cJSON_Delete(request);
+        *reason = "not a JSON object";
+        return false;
+    }
+
+    // Members left out of the request keep their current value
+    System current = getSystem();
+    System next{};
 
     cJSON *chirp = cJSON_GetObjectItem(request, "chirp");
+    next.chirp = {
+            .prf = jsonInt(chirp, "prf", current.chirp.prf),
+            .duration = jsonInt(chirp, "duration", current.chirp.duration),
+            .steps = jsonInt(chirp, "steps", current.chirp.steps),
+            .padding = jsonInt(chirp, "padding", current.chirp.padding),
+            .resolution = jsonInt(chirp, "resolution", current.chirp.resolution),
+            .shape = jsonInt(chirp, "shape", current.chirp.shape),
+            .levels = jsonInt(chirp, "levels", current.chirp.levels),
+            .linearize = jsonInt(chirp, "linearize", current.chirp.linearize),
+    };
+
     cJSON *sample = cJSON_GetObjectItem(request, "sampling");
-    int audible = cJSON_GetObjectItem(request, "audible")->valueint;
-    int gyro = cJSON_GetObjectItem(request, "gyro")->valueint;
-    int enable = cJSON_GetObjectItem(request, "enable")->valueint;
+    next.sampling = {
+            .frequency = jsonInt(sample, "frequency", current.sampling.frequency),
+            .samples = jsonInt(sample, "samples", current.sampling.samples),
+            .attenuation = jsonInt(sample, "attenuation", current.sampling.attenuation),
+    };
 
-    if (xSemaphoreTake(lock, pdMS_TO_TICKS(10)) != pdTRUE) {
-        cJSON_Delete(request);
-        return;
-    }
+    next.audible = jsonInt(request, "audible", current.audible);
+    next.gyro = jsonInt(request, "gyro", current.gyro);
+    next.enabled = jsonInt(request, "enable", current.enabled);
 
-    system.chirp = {
-            .prf = cJSON_GetObjectItem(chirp, "prf")->valueint,
-            .duration = cJSON_GetObjectItem(chirp, "duration")->valueint,
-            .steps = cJSON_GetObjectItem(chirp, "steps")->valueint,
-            .padding = cJSON_GetObjectItem(chirp, "padding")->valueint,
-            .resolution = cJSON_GetObjectItem(chirp, "resolution")->valueint,
+    cJSON *schedule = cJSON_GetObjectItem(request, "schedule");
+    next.schedule = {
+            .mode = jsonInt(schedule, "mode", current.schedule.mode),
+            .slot = jsonInt(schedule, "slot", current.schedule.slot),
+            .slots = jsonInt(schedule, "slots", current.schedule.slots),
     };
+    next.interference = jsonInt(request, "interference", current.interference);
 
-    system.sampling = {
-            .frequency = cJSON_GetObjectItem(sample, "frequency")->valueint,
-            .samples = cJSON_GetObjectItem(sample, "samples")->valueint,
-            .attenuation =cJSON_GetObjectItem(sample, "attenuation")->valueint
+    cJSON *burst = cJSON_GetObjectItem(request, "burst");
+    next.burst = {
+            .chirps = jsonInt(burst, "chirps", current.burst.chirps),
+            .duty = jsonInt(burst, "duty", current.burst.duty),
     };
+    next.vibration = jsonInt(request, "vibration", current.vibration);
+
+    cJSON_Delete(request);
+
+    // Refused here rather than persisted and failing in the chirp or sampling switch
+    if (!validateSystem(next, reason)) {
+        return false;
+    }
+
+    // Writers only hold the lock to compare, store and notify listeners that do not block, so waiting for it never
+    // stalls for long. Listeners see the generations in order.
+    if (xSemaphoreTake(lock, portMAX_DELAY) != pdTRUE) {
+        *reason = "settings are busy";
+        return false;
+    }
+    System previous{};
+    system.load(previous);
+    uint32_t changes = changedFields(previous, next);
+    if (changes == 0) {
+        xSemaphoreGive(lock);
+        return true;
+    }
+    uint32_t generation = system.store(next);
+    publish(changes, next, generation);
+    xSemaphoreGive(lock);
+    return true;
+}
 
-    system.audible = audible;
-    system.gyro = gyro;
-    system.enabled = enable;
+Linearization Settings::getLinearization() {
+    Linearization current{};
+    linearization.load(current);
+    return current;
+}
 
+bool Settings::setLinearization(const Linearization &next) {
+    if (next.valid && !linearizationMonotonic(next)) {
+        return false;
+    }
+    if (xSemaphoreTake(lock, pdMS_TO_TICKS(10)) != pdTRUE) {
+        return false;
+    }
+    linearization.store(next);
+    System current{};
+    uint32_t generation = system.load(current);
+    publish(SETTINGS_LINEARIZATION, current, generation);
     xSemaphoreGive(lock);
 
+    push();
+    return true;
+}
+
+bool Settings::linearizationFromJson(const char *json) {
+    auto request = cJSON_Parse(json);
+    cJSON *coefficients = cJSON_GetObjectItem(request, "coefficients");
+    if (!cJSON_IsArray(coefficients) || cJSON_GetArraySize(coefficients) != LINEARIZATION_ORDER + 1) {
+        cJSON_Delete(request);
+        return false;
+    }
+
+    Linearization next{};
+    for (int i = 0; i <= LINEARIZATION_ORDER; i++) {
+        next.coefficients[i] = (float) cJSON_GetArrayItem(coefficients, i)->valuedouble;
+    }
+    next.valid = 1;
     cJSON_Delete(request);
+
+    return setLinearization(next);
+}
+
+bool Settings::subscribe(uint32_t fields, SettingsListener listener, void *ctx) {
+    if (xSemaphoreTake(lock, portMAX_DELAY) != pdTRUE) {
+        return false;
+    }
+    if (subscriberCount >= SETTINGS_MAX_SUBSCRIBERS) {
+        xSemaphoreGive(lock);
+        return false;
+    }
+    subscribers[subscriberCount++] = {
+            .fields = fields,
+            .listener = listener,
+            .ctx = ctx,
+    };
+    xSemaphoreGive(lock);
+    return true;
+}
+
+void Settings::publish(uint32_t changes, const System &next, uint32_t generation) {
+    // A snapshot older than one already published would roll the listeners back
+    if (generation < published) {
+        return;
+    }
+    published = generation;
+    int count = subscriberCount;
+    for (int i = 0; i < count; i++) {
+        auto &subscriber = subscribers[i];
+        if ((subscriber.fields & changes) == 0) {
+            continue;
+        }
+        subscriber.listener(changes, next, generation, subscriber.ctx);
+    }
 }
 
 Sampling Settings::getSampling() {
@@ -145,5 +283,15 @@ Sampling Settings::getSampling() {
 }
 
 System Settings::getSystem() {
-    return system;
+    System current{};
+    system.load(current);
+    return current;
+}
+
+uint32_t Settings::getSystem(System *dest) {
+    return system.load(*dest);
+}
+
+uint32_t Settings::generation() {
+    return system.generation();
 }
@@ -6,77 +6,110 @@
 #define RADAR_SETTINGS_H
 
 #include <cstdint>
+#include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "hal_esp.h"
+#include "seqlock.h"
+#include "settings_store.h"
+#include "parameters.h"
+
+
+// Groups of System fields a subscriber can be notified about
+enum SettingsField {
+    SETTINGS_CHIRP = 1 << 0,
+    SETTINGS_SAMPLING = 1 << 1,
+    SETTINGS_AUDIBLE = 1 << 2,
+    SETTINGS_ENABLED = 1 << 3,
+    SETTINGS_GYRO = 1 << 4,
+    // The stored VCO linearization, not part of System
+    SETTINGS_LINEARIZATION = 1 << 5,
+    SETTINGS_SCHEDULE = 1 << 6,
+    SETTINGS_INTERFERENCE = 1 << 7,
+    SETTINGS_BURST = 1 << 8,
+    SETTINGS_VIBRATION = 1 << 9,
+};
 
+#define SETTINGS_MAX_SUBSCRIBERS 12
+// Quiet period after the last push before the settings are written to flash
+#define SETTINGS_WRITE_DEBOUNCE_MS 2000
 
-typedef struct Sampling {
-    int32_t frequency = 20000;
-    int32_t samples = 1;
-    int32_t attenuation = 0;
-} Sampling;
-
-
-// PRF = delay between start of each chirp
-// stepDuration = duration of each level
-// steps = number of steps per chirp
-// padding = number of steps to add on each side of the chirp, subtracting from the total number of steps
-//
+// Called from the publishing task with the changed fields and the new snapshot, listeners must not block
+typedef void (*SettingsListener)(uint32_t changes, const System &system, uint32_t generation, void *ctx);
 
-// PRF = 2ms
-// duration = 1ms (1000us)
-// steps = 100 (step duration = 10us)
-
-typedef struct Chirp {
-    // microseconds between the start of each sequential chirp
-    int32_t prf = 12500;
-    // microsecond duration of the chirp
-    int32_t duration = 12500; // assert(duration <= prf)
-    // dac changes per duration
-    int32_t steps = 125; // assert(steps <= duration)
-    // steps to subtract from pos and neg edge of the chirp
-    int32_t padding = 0; // assert(padding*2 < steps)
-    // bandwidth resolution over step range
-    int32_t resolution = 125;
-} Chirp;
-
-
-typedef struct System {
-//    int32_t chirp = 1;
-    int32_t audible = 0;
-    int32_t enabled = 1;
-    int32_t gyro = 1;
-    Chirp chirp{};
-    Sampling sampling{};
-} System;
+typedef struct SettingsSubscriber {
+    uint32_t fields;
+    SettingsListener listener;
+    void *ctx;
+} SettingsSubscriber;
 
 class Settings {
 public:
     static Settings &instance();
 
-    Settings(const Settings &) = default;
+    Settings(const Settings &) = delete;
 
     Settings &operator=(const Settings &) = delete;
 
     void fromJson(const char *json);
 
+    // Schedule the current settings to be persisted, bursts of pushes are coalesced into a single flash write
     void push() const;
 
     Sampling getSampling();
 
+    // Copy a consistent snapshot of the system settings without locking
     System getSystem();
 
+    // Copy a snapshot of the system settings into dest, returns the generation of the snapshot
+    uint32_t getSystem(System *dest);
+
+    // Monotonically increasing counter, incremented every time the system settings change
+    uint32_t generation();
+
+
+    // Apply a settings request, members left out keep their current value. Returns false with reason set if it is not
+    // a JSON object or a value is out of range, nothing is applied then.
+    bool systemFromJson(const char *json, const char **reason);
+
+    // Copy the stored VCO linearization, valid is zero until one has been set
+    Linearization getLinearization();
 
-    void systemFromJson(const char *json);
+    // Replace the stored VCO linearization, returns false if it does not keep a rising ramp rising
+    bool setLinearization(const Linearization &next);
+
+    bool linearizationFromJson(const char *json);
+
+    // Register a listener for changes to the given SettingsField mask
+    bool subscribe(uint32_t fields, SettingsListener listener, void *ctx);
 
 private:
     Settings();
 
+    // Serializes writers and their publication, readers go through the seqlock
     SemaphoreHandle_t lock;
     Sampling sampling;
-    System system{};
+    Seqlock<System> system{};
+    Seqlock<Linearization> linearization{};
+
+    SettingsSubscriber subscribers[SETTINGS_MAX_SUBSCRIBERS]{};
+    int subscriberCount = 0;
+    // Generation listeners were last given
+    uint32_t published = 0;
+
+    EspStorage storage{Persistent::instance()};
+    SettingsStore store{storage};
+    TaskHandle_t writer{};
 
     void pull();
 
+    static void writerTask(void *arg);
+
+    void write();
+
+    // Notify the listeners, the writer lock must be held
+    void publish(uint32_t changes, const System &next, uint32_t generation);
+
 };
 
 
@@ -0,0 +1,192 @@
+#include <cstdio>
+#include <cstring>
+#include "burst.h"
+#include "encoding.h"
+#include "interference.h"
+#include "timesync.h"
+#include "vibration.h"
+#include "settings_store.h"
+
+Debounce::Debounce(int64_t period) : period(period) {}
+
+void Debounce::push(int64_t now) {
+    last = now;
+    pending = true;
+}
+
+int64_t Debounce::remaining(int64_t now) const {
+    if (!pending) {
+        return -1;
+    }
+    int64_t left = last + period - now;
+    return left > 0 ? left : 0;
+}
+
+bool Debounce::due(int64_t now) {
+    if (!pending || now - last < period) {
+        return false;
+    }
+    pending = false;
+    return true;
+}
+
+SettingsStore::SettingsStore(Storage &storage) : storage(storage) {}
+
+bool SettingsStore::loadLinearization(Linearization *dest) {
+    uint8_t blob[ENCODING_LINEARIZATION_SIZE];
+    size_t length = sizeof(blob);
+    return storage.readBlob(SETTINGS_KEY_LINEARIZATION, blob, &length) == ESP_OK &&
+           decodeLinearization(blob, length, dest);
+}
+
+bool SettingsStore::loadSystem(System *dest) {
+    uint8_t blob[ENCODING_SYSTEM_MAX_SIZE];
+    size_t length = sizeof(blob);
+    System stored{};
+    if (storage.readBlob(SETTINGS_KEY_SYSTEM, blob, &length) == ESP_OK && decodeSystem(blob, length, &stored)) {
+        *dest = stored;
+        return true;
+    }
+
+    // Fall back to the individual keys written by older firmware
+
+    int32_t audible = 0, gyro = 0, enabled = 0;
+    storage.readInt("audible", &audible, 0);
+    storage.readInt("gyro", &gyro, 1);
+    storage.readInt("enable", &enabled, 1);
+
+    int32_t prf = 0, duration = 0, steps = 0, padding = 0, resolution = 0;
+    storage.readInt("prf", &prf, 12500);
+    storage.readInt("duration", &duration, 12500);
+    storage.readInt("steps", &steps, 125);
+    storage.readInt("padding", &padding, 0);
+    storage.readInt("resolution", &resolution, 125);
+
+    int32_t frequency = 0, samples = 0, attenuation = 0;
+    storage.readInt("frequency", &frequency, 20480);
+    storage.readInt("samples", &samples, 1);
+    storage.readInt("attenuation", &attenuation, 0);
+
+    System next{};
+
+    next.sampling = {
+            .frequency = frequency,
+            .samples = samples,
+            .attenuation = attenuation
+    };
+
+    next.chirp = {
+            .prf = prf,
+            .duration = duration,
+            .steps = steps,
+            .padding = padding,
+            .resolution = resolution,
+    };
+
+    next.audible = audible;
+    next.enabled = enabled;
+    next.gyro = gyro;
+
+    *dest = next;
+    return false;
+}
+
+int SettingsStore::save(const System &system, const Linearization &linearization) {
+    int written = 0;
+    uint8_t blob[ENCODING_SYSTEM_MAX_SIZE];
+    size_t length = encodeSystem(system, blob, sizeof(blob));
+    if (length == 0) {
+        return written;
+    }
+    written += writeBlob(SETTINGS_KEY_SYSTEM, blob, length) ? 1 : 0;
+
+    if (linearization.valid) {
+        uint8_t curve[ENCODING_LINEARIZATION_SIZE];
+        length = encodeLinearization(linearization, curve, sizeof(curve));
+        written += writeBlob(SETTINGS_KEY_LINEARIZATION, curve, length) ? 1 : 0;
+    }
+    return written;
+}
+
+bool SettingsStore::writeBlob(const char *key, const uint8_t *blob, size_t length) {
+    // Skip the flash write entirely if nothing changed since the last one
+    uint8_t stored[ENCODING_SYSTEM_MAX_SIZE];
+    size_t storedLength = sizeof(stored);
+    if (storage.readBlob(key, stored, &storedLength) == ESP_OK && storedLength == length &&
+        memcmp(stored, blob, length) == 0) {
+        return false;
+    }
+
+    esp_err_t err;
+    err = storage.writeBlob(key, blob, length);
+    if (err != ESP_OK) {
+        printf("Failed to write %s: %s\n", key, esp_err_to_name(err));
+        return false;
+    }
+    err = storage.commit();
+    if (err != ESP_OK) {
+        printf("Failed to commit %s: %s\n", key, esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+// Set the reason and fail
+static bool refuse(const char **reason, const char *message) {
+    if (reason != nullptr) {
+        *reason = message;
+    }
+    return false;
+}
+
+bool validateSystem(const System &system, const char **reason) {
+    const Chirp &chirp = system.chirp;
+    if (chirp.duration <= 0) {
+        return refuse(reason, "chirp.duration must be positive");
+    }
+    if (chirp.steps <= 0 || chirp.steps > chirp.duration) {
+        return refuse(reason, "chirp.steps must be from 1 to the duration");
+    }
+    if (chirp.prf < chirp.duration) {
+        return refuse(reason, "chirp.prf must be at least the duration");
+    }
+    if (chirp.padding < 0 || chirp.padding * 2 >= chirp.steps) {
+        return refuse(reason, "chirp.padding must be under half the steps");
+    }
+    if (chirp.resolution <= 0) {
+        return refuse(reason, "chirp.resolution must be positive");
+    }
+    if (chirp.shape < CHIRP_SAWTOOTH || chirp.shape > CHIRP_STEPPED) {
+        return refuse(reason, "chirp.shape is not a chirp shape");
+    }
+    if (chirp.levels <= 0) {
+        return refuse(reason, "chirp.levels must be positive");
+    }
+
+    // The four lanes are converted one after another
+    int64_t rate = 4 * (int64_t) system.sampling.frequency;
+    if (rate < SETTINGS_ADC_MIN_RATE || rate > SETTINGS_ADC_MAX_RATE) {
+        return refuse(reason, "sampling.frequency is outside the adc's range");
+    }
+    if (system.sampling.attenuation < 0 || system.sampling.attenuation > SETTINGS_MAX_ATTENUATION) {
+        return refuse(reason, "sampling.attenuation is not an adc attenuation");
+    }
+
+    const Schedule &schedule = system.schedule;
+    if (schedule.mode < SYNC_OFF || schedule.mode > SYNC_FOLLOWER) {
+        return refuse(reason, "schedule.mode is not a sync mode");
+    }
+    if (schedule.slots < 0 || (schedule.slots > 0 && (schedule.slot < 0 || schedule.slot >= schedule.slots))) {
+        return refuse(reason, "schedule.slot must be one of the slots");
+    }
+    if (system.interference < INTERFERENCE_OFF || system.interference > INTERFERENCE_DROP) {
+        return refuse(reason, "interference is not an interference mode");
+    }
+    if (system.vibration < VIBRATION_OFF || system.vibration > VIBRATION_COMPENSATE) {
+        return refuse(reason, "vibration is not a vibration mode");
+    }
+    if (system.burst.chirps < 0 || system.burst.duty < 0 || system.burst.duty > BURST_MAX_DUTY) {
+        return refuse(reason, "burst.chirps and burst.duty are out of range");
+    }
+    return true;
+}
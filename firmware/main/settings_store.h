@@ -0,0 +1,72 @@
+#ifndef RADAR_SETTINGS_STORE_H
+#define RADAR_SETTINGS_STORE_H
+
+#include <cstdint>
+#include "hal.h"
+#include "parameters.h"
+
+#define SETTINGS_KEY_SYSTEM "system"
+#define SETTINGS_KEY_LINEARIZATION "vco"
+
+// Conversions per second of the continuous adc, SOC_ADC_SAMPLE_FREQ_THRES_LOW and _HIGH, shared by the four lanes
+#define SETTINGS_ADC_MIN_RATE 611
+#define SETTINGS_ADC_MAX_RATE 83333
+// Highest adc attenuation, ADC_ATTEN_DB_11
+#define SETTINGS_MAX_ATTENUATION 3
+
+// Check settings against what the chirp, sampling and capture can run. Returns false with reason set to the first
+// value out of range.
+bool validateSystem(const System &system, const char **reason);
+
+// Debounce coalesces a burst of pushes into a single write once the pushes have been quiet for the period, times are
+// in microseconds
+class Debounce {
+public:
+
+    explicit Debounce(int64_t period);
+
+    // Restart the quiet period
+    void push(int64_t now);
+
+    // Microseconds until the write is due, -1 while nothing is pending
+    int64_t remaining(int64_t now) const;
+
+    // True once the pushes have been quiet for the period, which takes the pending write
+    bool due(int64_t now);
+
+private:
+
+    int64_t period;
+    int64_t last = 0;
+    bool pending = false;
+
+};
+
+// SettingsStore keeps the system settings and the VCO linearization in storage as CRC protected blobs, and reads the
+// individual keys older firmware wrote the settings to
+class SettingsStore {
+public:
+
+    explicit SettingsStore(Storage &storage);
+
+    // Read the stored linearization into dest, returns false if none is stored
+    bool loadLinearization(Linearization *dest);
+
+    // Read the stored settings into dest, from the blob or else the legacy keys. Returns false if they came from the
+    // legacy keys, the next save migrates them to the blob.
+    bool loadSystem(System *dest);
+
+    // Write the settings and a valid linearization, skipping blobs identical to the stored ones. Returns the number of
+    // blobs written.
+    int save(const System &system, const Linearization &linearization);
+
+private:
+
+    Storage &storage;
+
+    bool writeBlob(const char *key, const uint8_t *blob, size_t length);
+
+};
+
+
+#endif //RADAR_SETTINGS_STORE_H
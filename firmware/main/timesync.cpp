@@ -0,0 +1,309 @@
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cstring>
+#include "timesync.h"
+
+static size_t putBigEndian(uint8_t *dest, size_t offset, uint64_t value, size_t width) {
+    for (size_t i = 0; i < width; i++) {
+        dest[offset + i] = (value >> (8 * (width - 1 - i))) & 0xFF;
+    }
+    return offset + width;
+}
+
+static uint64_t getBigEndian(const uint8_t *src, size_t offset, size_t width) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < width; i++) {
+        value = (value << 8) | src[offset + i];
+    }
+    return value;
+}
+
+size_t encodeSyncMessage(const SyncMessage &message, uint8_t *dest, size_t length) {
+    if (length < SYNC_MESSAGE_SIZE) {
+        return 0;
+    }
+    size_t offset = 0;
+    offset = putBigEndian(dest, offset, SYNC_MAGIC, 4);
+    offset = putBigEndian(dest, offset, SYNC_VERSION, 1);
+    offset = putBigEndian(dest, offset, message.type, 1);
+    offset = putBigEndian(dest, offset, 0, 2);
+    offset = putBigEndian(dest, offset, message.sequence, 4);
+    offset = putBigEndian(dest, offset, (uint64_t) message.t1, 8);
+    offset = putBigEndian(dest, offset, (uint64_t) message.t2, 8);
+    putBigEndian(dest, offset, (uint64_t) message.t3, 8);
+    return SYNC_MESSAGE_SIZE;
+}
+
+bool decodeSyncMessage(const uint8_t *src, size_t length, SyncMessage *dest) {
+    if (length < SYNC_MESSAGE_SIZE) {
+        return false;
+    }
+    if (getBigEndian(src, 0, 4) != SYNC_MAGIC || getBigEndian(src, 4, 1) != SYNC_VERSION) {
+        return false;
+    }
+    dest->type = (uint8_t) getBigEndian(src, 5, 1);
+    dest->sequence = (uint32_t) getBigEndian(src, 8, 4);
+    dest->t1 = (int64_t) getBigEndian(src, 12, 8);
+    dest->t2 = (int64_t) getBigEndian(src, 20, 8);
+    dest->t3 = (int64_t) getBigEndian(src, 28, 8);
+    return true;
+}
+
+int64_t sharedTime(const ClockModel &model, int64_t local) {
+    return local + model.offset + (int64_t) (model.drift * (double) (local - model.anchor));
+}
+
+int64_t localTime(const ClockModel &model, int64_t shared) {
+    // Invert shared = local + offset + drift * (local - anchor)
+    return (int64_t) (((double) (shared - model.offset) + model.drift * (double) model.anchor) / (1.0 + model.drift));
+}
+
+// Offset of the slot start within the chirp period
+static int64_t slotOffset(int32_t prf, int32_t slot, int32_t slots, int32_t phase) {
+    if (slots <= 0) {
+        slots = 1;
+    }
+    return ((int64_t) slot * prf / slots + phase) % prf;
+}
+
+int64_t nextSlotStart(int64_t shared, int32_t prf, int32_t slot, int32_t slots, int32_t phase) {
+    if (prf <= 0) {
+        return shared;
+    }
+    int64_t offset = slotOffset(prf, slot, slots, phase);
+    int64_t periods = (shared - offset) / prf;
+    int64_t start = offset + periods * prf;
+    while (start < shared) {
+        start += prf;
+    }
+    return start;
+}
+
+int64_t slotError(int64_t shared, int32_t prf, int32_t slot, int32_t slots, int32_t phase) {
+    if (prf <= 0) {
+        return 0;
+    }
+    int64_t error = (shared - slotOffset(prf, slot, slots, phase)) % prf;
+    if (error < 0) {
+        error += prf;
+    }
+    if (error >= prf / 2) {
+        error -= prf;
+    }
+    return error;
+}
+
+bool ClockServo::sample(int64_t t1, int64_t t2, int64_t t3, int64_t t4) {
+    int64_t delay = (t4 - t1) - (t3 - t2);
+    if (delay < 0) {
+        return false;
+    }
+    offsets[next] = ((t2 - t1) + (t3 - t4)) / 2;
+    delays[next] = delay;
+    received[next] = t4;
+    next = (next + 1) % SYNC_WINDOW;
+    if (count < SYNC_WINDOW) {
+        count++;
+    }
+
+    // Queueing only ever adds delay, so the exchange with the shortest round trip has the least asymmetric error
+    int best = 0;
+    for (int i = 1; i < count; i++) {
+        if (delays[i] < delays[best]) {
+            best = i;
+        }
+    }
+    // Each exchange is only used once
+    if (received[best] <= lastUsed) {
+        return false;
+    }
+    lastUsed = received[best];
+    lastDelay = delays[best];
+
+    // The offset was measured half way through the exchange
+    int64_t local = received[best] - delays[best] / 2;
+    int64_t predicted = sharedTime(current, local) - local;
+    int64_t error = offsets[best] - predicted;
+
+    if (!current.locked || error > SYNC_STEP_THRESHOLD_US || error < -SYNC_STEP_THRESHOLD_US) {
+        if (!current.locked) {
+            current.drift = 0;
+        }
+        current.offset = offsets[best];
+        current.anchor = local;
+        current.locked = true;
+        return true;
+    }
+
+    int64_t elapsed = local - current.anchor;
+    if (elapsed > 0) {
+        current.drift += SYNC_SERVO_KI * (double) error / (double) elapsed;
+    }
+    current.offset = predicted + (int64_t) (SYNC_SERVO_KP * (double) error);
+    current.anchor = local;
+    return true;
+}
+
+void ClockServo::reset() {
+    current = {};
+    lastDelay = 0;
+    count = 0;
+    next = 0;
+    lastUsed = 0;
+}
+
+const ClockModel &ClockServo::model() const {
+    return current;
+}
+
+int64_t ClockServo::delay() const {
+    return lastDelay;
+}
+
+SyncNode::SyncNode(SyncClock clock, void *ctx) : clock(clock), ctx(ctx) {
+}
+
+SyncNode::~SyncNode() {
+    close();
+}
+
+bool SyncNode::open(SyncMode mode, uint16_t port, const char *target, uint16_t destinationPort) {
+    close();
+    if (mode == SYNC_OFF) {
+        return true;
+    }
+
+    int fd = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd < 0) {
+        return false;
+    }
+    int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (sockaddr *) &address, sizeof(address)) < 0) {
+        ::close(fd);
+        return false;
+    }
+
+    in_addr destination{};
+    if (mode == SYNC_FOLLOWER && inet_aton(target, &destination) == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    socket = fd;
+    current = mode;
+    targetAddress = destination.s_addr;
+    targetPort = destinationPort;
+    lastRequest = 0;
+    servo.reset();
+
+    ClockModel model{};
+    // The master's own clock is the shared clock
+    model.locked = mode == SYNC_MASTER;
+    published.store(model);
+    return true;
+}
+
+void SyncNode::close() {
+    if (socket >= 0) {
+        ::close(socket);
+        socket = -1;
+    }
+    current = SYNC_OFF;
+    published.store(ClockModel{});
+}
+
+void SyncNode::poll(int timeoutMs) {
+    if (socket < 0) {
+        return;
+    }
+    int64_t now = clock(ctx);
+    if (current == SYNC_FOLLOWER && now - lastRequest >= SYNC_INTERVAL_US) {
+        request(now);
+    }
+
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(socket, &readable);
+    timeval timeout = {
+            .tv_sec = timeoutMs / 1000,
+            .tv_usec = (timeoutMs % 1000) * 1000,
+    };
+    if (select(socket + 1, &readable, nullptr, nullptr, &timeout) > 0) {
+        receive();
+    }
+}
+
+void SyncNode::request(int64_t now) {
+    SyncMessage message = {
+            .type = SYNC_REQUEST,
+            .sequence = ++sequence,
+            .t1 = now,
+            .t2 = 0,
+            .t3 = 0,
+    };
+    uint8_t packet[SYNC_MESSAGE_SIZE];
+    encodeSyncMessage(message, packet, sizeof(packet));
+
+    sockaddr_in destination{};
+    destination.sin_family = AF_INET;
+    destination.sin_port = htons(targetPort);
+    destination.sin_addr.s_addr = targetAddress;
+    pendingT1 = now;
+    lastRequest = now;
+    sendto(socket, packet, sizeof(packet), 0, (sockaddr *) &destination, sizeof(destination));
+}
+
+void SyncNode::receive() {
+    uint8_t packet[SYNC_MESSAGE_SIZE];
+    sockaddr_in source{};
+    socklen_t sourceLength = sizeof(source);
+    ssize_t length = recvfrom(socket, packet, sizeof(packet), 0, (sockaddr *) &source, &sourceLength);
+    // Timestamp as close to the wire as this layer allows
+    int64_t now = clock(ctx);
+    SyncMessage message{};
+    if (length <= 0 || !decodeSyncMessage(packet, (size_t) length, &message)) {
+        return;
+    }
+
+    if (current == SYNC_MASTER && message.type == SYNC_REQUEST) {
+        message.type = SYNC_RESPONSE;
+        message.t2 = now;
+        message.t3 = clock(ctx);
+        encodeSyncMessage(message, packet, sizeof(packet));
+        sendto(socket, packet, sizeof(packet), 0, (sockaddr *) &source, sourceLength);
+        return;
+    }
+
+    // Responses to requests other than the most recent one are stale
+    if (current == SYNC_FOLLOWER && message.type == SYNC_RESPONSE && message.sequence == sequence &&
+        message.t1 == pendingT1) {
+        if (servo.sample(message.t1, message.t2, message.t3, now)) {
+            published.store(servo.model());
+            lastDelay = servo.delay();
+        }
+    }
+}
+
+SyncMode SyncNode::mode() const {
+    return current;
+}
+
+ClockModel SyncNode::model() const {
+    ClockModel snapshot{};
+    published.load(snapshot);
+    return snapshot;
+}
+
+int64_t SyncNode::delay() const {
+    return lastDelay;
+}
@@ -0,0 +1,169 @@
+#ifndef RADAR_TIMESYNC_H
+#define RADAR_TIMESYNC_H
+
+#include <cstddef>
+#include <cstdint>
+#include "seqlock.h"
+
+#define SYNC_PORT 5120
+// Leading magic of every sync message ('vRTS')
+#define SYNC_MAGIC 0x76525453
+#define SYNC_VERSION 1
+// magic(4) version(1) type(1) reserved(2) sequence(4) t1(8) t2(8) t3(8)
+#define SYNC_MESSAGE_SIZE 36
+// Microseconds between requests sent by a follower
+#define SYNC_INTERVAL_US 250000
+// Exchanges kept by the follower, the one with the shortest round trip is used
+#define SYNC_WINDOW 8
+// Offset errors beyond this are stepped instead of slewed
+#define SYNC_STEP_THRESHOLD_US 1000
+// Chirp starts further than this from their slot restart the chirp train in the slot
+#define SYNC_MAX_SLOT_ERROR_US 50
+// Time allowed between scheduling an aligned start and the start itself
+#define SYNC_START_MARGIN_US 5000
+// Proportional and integral gains of the clock servo
+#define SYNC_SERVO_KP 0.5
+#define SYNC_SERVO_KI 0.1
+
+enum SyncMode {
+    SYNC_OFF = 0,
+    // Answers requests, its clock is the shared clock
+    SYNC_MASTER = 1,
+    // Disciplines its shared clock to the master
+    SYNC_FOLLOWER = 2,
+};
+
+enum SyncMessageType {
+    SYNC_REQUEST = 1,
+    SYNC_RESPONSE = 2,
+};
+
+// Delay request-response exchange: the follower sends at t1, the master receives at t2 and replies at t3, the
+// follower receives the reply at t4. t1 is on the follower clock, t2 and t3 on the master clock.
+typedef struct SyncMessage {
+    uint8_t type;
+    uint32_t sequence;
+    int64_t t1;
+    int64_t t2;
+    int64_t t3;
+} SyncMessage;
+
+// Serialize a message in network byte order, returns the encoded length or zero if dest is too small
+size_t encodeSyncMessage(const SyncMessage &message, uint8_t *dest, size_t length);
+
+// Deserialize a message, returns false if it is truncated or not a sync message
+bool decodeSyncMessage(const uint8_t *src, size_t length, SyncMessage *dest);
+
+// Linear model of the shared clock in terms of the local clock
+typedef struct ClockModel {
+    // Shared minus local time at the anchor
+    int64_t offset;
+    // Local time the offset was measured at
+    int64_t anchor;
+    // Rate of the shared clock relative to the local clock, minus one
+    double drift;
+    bool locked;
+} ClockModel;
+
+// Convert between local and shared time with a clock model
+int64_t sharedTime(const ClockModel &model, int64_t local);
+
+int64_t localTime(const ClockModel &model, int64_t shared);
+
+// Shared time of the first chirp start at or after shared, when the chirp period is divided into slots and this
+// module chirps at the start of its slot, delayed by phase microseconds
+int64_t nextSlotStart(int64_t shared, int32_t prf, int32_t slot, int32_t slots, int32_t phase);
+
+// Signed distance of a chirp start from the nearest start of its slot, in [-prf / 2, prf / 2)
+int64_t slotError(int64_t shared, int32_t prf, int32_t slot, int32_t slots, int32_t phase);
+
+// ClockServo filters exchanges and steers a clock model towards the master clock
+class ClockServo {
+public:
+
+    // Fold in one completed exchange, returns true if it updated the model
+    bool sample(int64_t t1, int64_t t2, int64_t t3, int64_t t4);
+
+    // Forget the master, the model is unlocked until the next exchange
+    void reset();
+
+    const ClockModel &model() const;
+
+    // Round trip delay of the exchange the model was last updated with
+    int64_t delay() const;
+
+private:
+
+    ClockModel current{};
+    int64_t lastDelay = 0;
+
+    // Offsets and delays of the most recent exchanges, by local receive time
+    int64_t offsets[SYNC_WINDOW]{};
+    int64_t delays[SYNC_WINDOW]{};
+    int64_t received[SYNC_WINDOW]{};
+    int count = 0;
+    int next = 0;
+    int64_t lastUsed = 0;
+
+};
+
+// Microseconds on the clock this node runs on
+typedef int64_t (*SyncClock)(void *ctx);
+
+// SyncNode runs the protocol over a UDP socket using only BSD socket calls, so several nodes can be run on a
+// development machine over loopback
+class SyncNode {
+public:
+
+    SyncNode(SyncClock clock, void *ctx);
+
+    ~SyncNode();
+
+    SyncNode(const SyncNode &) = delete;
+
+    SyncNode &operator=(const SyncNode &) = delete;
+
+    // Bind the node to a port, followers send their requests to target (broadcast reaches any master on the
+    // network). Returns false if the socket cannot be opened.
+    bool open(SyncMode mode, uint16_t port, const char *target, uint16_t targetPort);
+
+    void close();
+
+    // Service the socket for up to timeoutMs: masters answer requests, followers send a request every interval and
+    // fold the responses into their clock model
+    void poll(int timeoutMs);
+
+    SyncMode mode() const;
+
+    // Copy the current clock model, safe to call from any task
+    ClockModel model() const;
+
+    // Round trip delay to the master of the last accepted exchange
+    int64_t delay() const;
+
+private:
+
+    SyncClock clock;
+    void *ctx;
+
+    SyncMode current = SYNC_OFF;
+    int socket = -1;
+    uint32_t targetAddress = 0;
+    uint16_t targetPort = 0;
+
+    uint32_t sequence = 0;
+    int64_t pendingT1 = 0;
+    int64_t lastRequest = 0;
+
+    ClockServo servo{};
+    Seqlock<ClockModel> published{};
+    int64_t lastDelay = 0;
+
+    void request(int64_t now);
+
+    void receive();
+
+};
+
+
+#endif //RADAR_TIMESYNC_H
@@ -0,0 +1,184 @@
+#include <cmath>
+#include "vibration.h"
+
+// Mid scale of the 12-bit ADC, where the IF amplifiers bias the signal, and its largest code
+#define VIBRATION_BIAS 2048.0f
+#define VIBRATION_FULL_SCALE 4095.0f
+
+Vibration::Vibration(float rate, const float *axis, float wavelength, float cutoff) {
+    for (int i = 0; i < 3; i++) {
+        this->axis[i] = axis[i];
+    }
+    phasePerMeter = 4.0f * (float) M_PI / wavelength;
+    period = 1.0f / rate;
+    alpha = std::exp(-2.0f * (float) M_PI * cutoff / rate);
+    settle = (uint32_t) (VIBRATION_SETTLE * rate);
+}
+
+void Vibration::add(int64_t time, const float *accel) {
+    float a = (accel[0] * axis[0] + accel[1] * axis[1] + accel[2] * axis[2]) * VIBRATION_GRAVITY;
+
+    // A gap leaves the integrators with nothing to go on, they start over
+    bool gap = run > 0 && (float) (time - last) > VIBRATION_GAP * period * 1e6f;
+    if (restart.exchange(false) || gap || run == 0) {
+        ready = false;
+        run = 0;
+        previous = a;
+        highPassed = 0;
+        velocity = 0;
+        position = 0;
+    }
+    last = time;
+
+    // First order high pass, then the trapezoidal rule into the leaky integrators
+    float hp = alpha * (highPassed + a - previous);
+    float v = alpha * velocity + 0.5f * (hp + highPassed) * period;
+    float d = alpha * position + 0.5f * (v + velocity) * period;
+    previous = a;
+    highPassed = hp;
+    velocity = v;
+    position = d;
+
+    // The step of the restart rings through the filters for a few time constants
+    if (++run < settle) {
+        return;
+    }
+    uint32_t index = head.load(std::memory_order_relaxed);
+    history[index % VIBRATION_HISTORY] = {time, d};
+    if (!ready) {
+        first.store(index, std::memory_order_relaxed);
+        meanSquare = d * d;
+    }
+    head.store(index + 1, std::memory_order_release);
+    ready.store(true, std::memory_order_release);
+
+    float mean = meanSquare.load(std::memory_order_relaxed);
+    meanSquare.store(mean + (d * d - mean) * period, std::memory_order_relaxed);
+}
+
+void Vibration::reset() {
+    ready = false;
+    restart = true;
+}
+
+uint32_t Vibration::oldest(uint32_t written) const {
+    if (!ready.load(std::memory_order_acquire)) {
+        return written;
+    }
+    uint32_t start = first.load(std::memory_order_relaxed);
+    uint32_t reach = VIBRATION_HISTORY - VIBRATION_GUARD;
+    return written - start < reach ? start : written - reach;
+}
+
+uint32_t Vibration::locate(int64_t time, uint32_t low, uint32_t high) const {
+    // Entries are in time order, the newest at or before time
+    while (high - low > 1) {
+        uint32_t middle = low + (high - low) / 2;
+        if (history[middle % VIBRATION_HISTORY].time <= time) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+float Vibration::interpolate(uint32_t index, int64_t time) const {
+    // Catmull-Rom through the entries either side, smooth where the samples are
+    const Entry &p0 = history[(index - 1) % VIBRATION_HISTORY];
+    const Entry &p1 = history[index % VIBRATION_HISTORY];
+    const Entry &p2 = history[(index + 1) % VIBRATION_HISTORY];
+    const Entry &p3 = history[(index + 2) % VIBRATION_HISTORY];
+    float span = (float) (p2.time - p1.time);
+    float u = span > 0 ? (float) (time - p1.time) / span : 0.0f;
+    float a = p0.displacement, b = p1.displacement, c = p2.displacement, d = p3.displacement;
+    return 0.5f * (2.0f * b + (c - a) * u + (2.0f * a - 5.0f * b + 4.0f * c - d) * u * u +
+                   (3.0f * (b - c) + d - a) * u * u * u);
+}
+
+bool Vibration::covers(int64_t time) const {
+    uint32_t written = head.load(std::memory_order_acquire);
+    uint32_t low = oldest(written);
+    // Interpolation needs an entry before and two after the pair around time
+    if (written - low < 4) {
+        return false;
+    }
+    return history[(low + 1) % VIBRATION_HISTORY].time <= time &&
+           history[(written - 2) % VIBRATION_HISTORY].time >= time;
+}
+
+int64_t Vibration::newest() const {
+    uint32_t written = head.load(std::memory_order_acquire);
+    if (written == oldest(written)) {
+        return 0;
+    }
+    return history[(written - 1) % VIBRATION_HISTORY].time;
+}
+
+bool Vibration::displacement(int64_t time, float *meters) const {
+    uint32_t written = head.load(std::memory_order_acquire);
+    uint32_t low = oldest(written);
+    if (!covers(time)) {
+        return false;
+    }
+    uint32_t index = locate(time, low + 1, written - 2);
+    *meters = interpolate(index, time);
+    return head.load(std::memory_order_acquire) - low < VIBRATION_HISTORY;
+}
+
+float Vibration::rms() const {
+    return std::sqrt(meanSquare.load(std::memory_order_relaxed));
+}
+
+bool Vibration::compensate(uint16_t **lanes, int samples, int64_t start, int64_t stop, float *excursion) {
+    *excursion = 0;
+    if (samples <= 0 || samples > VIBRATION_MAX_SAMPLES || stop < start) {
+        return false;
+    }
+    uint32_t written = head.load(std::memory_order_acquire);
+    uint32_t low = oldest(written);
+    if (written - low < 4 || history[(low + 1) % VIBRATION_HISTORY].time > start ||
+        history[(written - 2) % VIBRATION_HISTORY].time < stop) {
+        return false;
+    }
+
+    // The phase of every sample, walking the history along with the frame
+    uint32_t index = locate(start, low + 1, written - 2);
+    float peak = 0;
+    for (int i = 0; i < samples; i++) {
+        int64_t time = start + (stop - start) * i / samples;
+        while (index + 1 < written - 2 && history[(index + 1) % VIBRATION_HISTORY].time <= time) {
+            index++;
+        }
+        float d = interpolate(index, time);
+        peak = std::fabs(d) > peak ? std::fabs(d) : peak;
+        float phase = phasePerMeter * d;
+        cosines[i] = std::cos(phase);
+        sines[i] = std::sin(phase);
+    }
+    // Entries the writer came around to while they were read could have been any displacement
+    if (head.load(std::memory_order_acquire) - low >= VIBRATION_HISTORY) {
+        return false;
+    }
+    *excursion = peak;
+
+    // I1 and Q1, then I2 and Q2
+    const int pairs[2][2] = {{0, 1}, {3, 2}};
+    for (const auto &pair: pairs) {
+        uint16_t *in = lanes[pair[0]];
+        uint16_t *quadrature = lanes[pair[1]];
+        if (in == nullptr || quadrature == nullptr) {
+            continue;
+        }
+        for (int i = 0; i < samples; i++) {
+            float x = (float) in[i] - VIBRATION_BIAS, y = (float) quadrature[i] - VIBRATION_BIAS;
+            float rotatedI = x * cosines[i] - y * sines[i] + VIBRATION_BIAS;
+            float rotatedQ = x * sines[i] + y * cosines[i] + VIBRATION_BIAS;
+            rotatedI = rotatedI < 0 ? 0 : (rotatedI > VIBRATION_FULL_SCALE ? VIBRATION_FULL_SCALE : rotatedI);
+            rotatedQ = rotatedQ < 0 ? 0 : (rotatedQ > VIBRATION_FULL_SCALE ? VIBRATION_FULL_SCALE : rotatedQ);
+            in[i] = (uint16_t) std::lround(rotatedI);
+            quadrature[i] = (uint16_t) std::lround(rotatedQ);
+        }
+    }
+    return true;
+}
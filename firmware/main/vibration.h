@@ -0,0 +1,117 @@
+#ifndef RADAR_VIBRATION_H
+#define RADAR_VIBRATION_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#define VIBRATION_MAX_SAMPLES 1024
+// Displacements kept, about 2.5 s at 416 Hz, longer than any frame waits for the IMU
+#define VIBRATION_HISTORY 1024
+// Displacements at the old end of the history left alone, the IMU may overwrite them while a frame is compensated
+#define VIBRATION_GUARD 256
+// Hz, slower acceleration along the boresight is taken for tilt and drift rather than vibration
+#define VIBRATION_CUTOFF 0.5f
+// Seconds for the filters to settle after they start or restart, the mount is already moving when they start from rest
+#define VIBRATION_SETTLE 3.0f
+// Sample periods missing from the IMU stream that restart the filters
+#define VIBRATION_GAP 4
+#define VIBRATION_GRAVITY 9.80665f
+#define VIBRATION_SPEED_OF_LIGHT 299792458.0f
+
+enum VibrationMode {
+    VIBRATION_OFF = 0,
+    // Rotate the phase of each frame back by the displacement of the mount while it was captured
+    VIBRATION_COMPENSATE = 1,
+};
+
+// Vibration follows the displacement of the mount along the radar boresight from the accelerometer, and takes the
+// phase it adds out of the IF samples. Acceleration projected on the boresight is high passed and integrated twice
+// through leaky integrators, all three with their corner at the cutoff, so gravity, tilt and the drift of integrated
+// noise fall away while vibration above the cutoff comes through. Each displacement is kept against the time of its
+// sample.
+//
+// A displacement d toward the scene shortens every round trip by 2d, turning each beat back by 4 pi d / wavelength.
+// Within a chirp of several milliseconds the mount moves through a good part of a vibration cycle, so rather than one
+// correction per chirp, every sample is rotated forward by the phase interpolated at the time it was taken.
+//
+// One task adds samples while another compensates frames, the history is read without a lock and a read the writer
+// may have overtaken is given up.
+class Vibration {
+public:
+
+    // rate of the accelerometer samples in Hz, axis the unit vector along the boresight in the accelerometer frame,
+    // wavelength of the radar in meters
+    Vibration(float rate, const float *axis, float wavelength, float cutoff = VIBRATION_CUTOFF);
+
+    // Add an accelerometer sample in g taken at time, in microseconds. Samples come in order from one task.
+    void add(int64_t time, const float *accel);
+
+    // Samples were lost, the filters restart from the next one
+    void reset();
+
+    // Whether displacements are known on both sides of time
+    bool covers(int64_t time) const;
+
+    // Time of the newest displacement, zero before the filters have settled
+    int64_t newest() const;
+
+    // Meters toward the scene at time, false if it is not covered
+    bool displacement(int64_t time, float *meters) const;
+
+    // rms displacement in meters over about the last second
+    float rms() const;
+
+    // Rotate the I/Q pairs of a frame of lanes (I1, Q1, Q2, I2), sampled evenly from start to stop, back by the phase
+    // the displacement added to each sample. Each pair turns about mid scale rather than its own mean, a reflector
+    // close enough for its beat to stay near DC through a narrow chirp has to turn with the rest. excursion is the
+    // largest displacement across the frame in meters. False, with the lanes untouched, unless the whole frame is
+    // covered.
+    bool compensate(uint16_t **lanes, int samples, int64_t start, int64_t stop, float *excursion);
+
+private:
+
+    typedef struct Entry {
+        int64_t time;
+        float displacement;
+    } Entry;
+
+    float axis[3]{};
+    // Radians of round trip phase per meter of displacement
+    float phasePerMeter;
+    float period;
+    // Pole of the high pass and of both integrators
+    float alpha;
+    uint32_t settle;
+
+    // Filter state, touched only by add
+    int64_t last = 0;
+    uint32_t run = 0;
+    float previous = 0;
+    float highPassed = 0;
+    float velocity = 0;
+    float position = 0;
+
+    Entry history[VIBRATION_HISTORY]{};
+    // Entries written, and the first since the filters last settled, which only counts once ready
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> first{0};
+    std::atomic<bool> ready{false};
+    std::atomic<bool> restart{false};
+    std::atomic<float> meanSquare{0};
+
+    float cosines[VIBRATION_MAX_SAMPLES]{};
+    float sines[VIBRATION_MAX_SAMPLES]{};
+
+    // Oldest entry a reader may use
+    uint32_t oldest(uint32_t written) const;
+
+    // Index of the newest entry at or before time in [low, high), the entries around it interpolated
+    uint32_t locate(int64_t time, uint32_t low, uint32_t high) const;
+
+    float interpolate(uint32_t index, int64_t time) const;
+
+};
+
+
+#endif //RADAR_VIBRATION_H
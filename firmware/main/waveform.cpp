@@ -0,0 +1,145 @@
+#include <cmath>
+#include "waveform.h"
+
+int32_t chirpStepResolution(const Chirp &chirp) {
+    if (chirp.steps <= 0) {
+        return 1;
+    }
+    auto resolution = (int32_t) round((double) chirp.resolution / (double) chirp.steps);
+    return resolution <= 0 ? 1 : resolution;
+}
+
+float linearizationValue(const Linearization &linearization, float x) {
+    // Horner evaluation from the highest order coefficient
+    float value = 0.0f;
+    for (int i = LINEARIZATION_ORDER; i >= 0; i--) {
+        value = value * x + linearization.coefficients[i];
+    }
+    if (value < 0.0f) return 0.0f;
+    if (value > 1.0f) return 1.0f;
+    return value;
+}
+
+bool linearizationMonotonic(const Linearization &linearization) {
+    float previous = linearizationValue(linearization, 0.0f);
+    for (int i = 1; i <= LINEARIZATION_CHECK_POINTS; i++) {
+        float value = linearizationValue(linearization, (float) i / LINEARIZATION_CHECK_POINTS);
+        if (value < previous) {
+            return false;
+        }
+        previous = value;
+    }
+    // A flat curve would collapse the ramp onto a single frequency
+    return previous > linearizationValue(linearization, 0.0f);
+}
+
+// Normalized position along the ramp in [0, 1) for sawtooth and stepped chirps, [0, 1] for triangle chirps
+static float chirpPosition(const Chirp &chirp, int32_t step) {
+    auto span = (float) (chirp.steps - 1);
+    switch (chirp.shape) {
+        case CHIRP_TRIANGLE:
+            // Rise to the top of the band at the middle of the ramp and fall back
+            return 1.0f - fabsf(2.0f * (float) step / span - 1.0f);
+        case CHIRP_STEPPED: {
+            int32_t levels = chirp.levels > 0 ? chirp.levels : 1;
+            int32_t level = (int32_t) ((int64_t) step * levels / (chirp.steps - 1));
+            return (float) level / (float) levels;
+        }
+        default:
+            if (chirp.padding > 0) {
+                // Split the ramp into padding sub-chirps that each sweep the full range
+                return (float) ((step % chirp.padding) * (chirp.steps / chirp.padding)) / span;
+            }
+            return (float) step / span;
+    }
+}
+
+uint16_t chirpCode(const Chirp &chirp, const Linearization &linearization, int32_t stepResolution, int32_t step) {
+    // The final step returns the VCO to the bottom of the ramp
+    if (step >= chirp.steps - 1) {
+        return 0;
+    }
+    float x = chirpPosition(chirp, step);
+    if (chirp.linearize && linearization.valid) {
+        x = linearizationValue(linearization, x);
+    }
+    auto code = (int32_t) lroundf(x * (float) (stepResolution * (chirp.steps - 1)));
+    if (code < 0) code = 0;
+    if (code > MCP4922_MAX_CODE) code = MCP4922_MAX_CODE;
+    return (uint16_t) code;
+}
+
+size_t buildChirpTable(const Chirp &chirp, const Linearization &linearization, uint16_t *codes, size_t capacity) {
+    if (chirp.steps <= 0 || capacity < (size_t) chirp.steps) {
+        return 0;
+    }
+    int32_t stepResolution = chirpStepResolution(chirp);
+    for (int32_t step = 0; step < chirp.steps; step++) {
+        codes[step] = chirpCode(chirp, linearization, stepResolution, step);
+    }
+    return (size_t) chirp.steps;
+}
+
+bool waveformTiming(const Chirp &chirp, bool audible, uint32_t maxFrameRate, size_t maxBufferFrames,
+                    WaveformTiming *timing) {
+    if (chirp.steps <= 0 || chirp.duration <= 0 || chirp.prf < chirp.duration || maxBufferFrames == 0) {
+        return false;
+    }
+    timing->framesPerStep = audible ? 2 : 1;
+    double rate = (double) timing->framesPerStep * (double) chirp.steps * 1e6 / (double) chirp.duration;
+    if (rate > maxFrameRate || rate < 1.0) {
+        return false;
+    }
+    timing->frameRate = (uint32_t) round(rate);
+    timing->rampFrames = (size_t) chirp.steps * timing->framesPerStep;
+
+    auto frames = (size_t) round((double) chirp.prf * (double) timing->frameRate / 1e6);
+    if (frames < timing->rampFrames) {
+        frames = timing->rampFrames;
+    }
+    // Split the period into equally sized buffers, rounding the period up to the next whole buffer
+    timing->buffersPerPeriod = (frames + maxBufferFrames - 1) / maxBufferFrames;
+    timing->bufferFrames = (frames + timing->buffersPerPeriod - 1) / timing->buffersPerPeriod;
+    timing->periodFrames = timing->bufferFrames * timing->buffersPerPeriod;
+    return true;
+}
+
+size_t buildWaveform(const Chirp &chirp, const uint16_t *codes, int32_t audible, const WaveformTiming &timing,
+                     uint16_t *dest, size_t capacity) {
+    size_t words = timing.periodFrames * 2;
+    if (capacity < words) {
+        return 0;
+    }
+    uint16_t idle = mcp4922Word(0, MCP4922_CHANNEL_A);
+    uint16_t buzzer = mcp4922Word(0, MCP4922_CHANNEL_B);
+    int32_t alternate = 0;
+
+    size_t frame = 0;
+    for (int32_t step = 0; step < chirp.steps; step++) {
+        uint16_t word = mcp4922Word(codes[step], MCP4922_CHANNEL_A);
+        dest[frame * 2] = word;
+        dest[frame * 2 + 1] = word;
+        frame++;
+        if (timing.framesPerStep < 2) {
+            continue;
+        }
+        // The buzzer toggles every audible steps of the ramp
+        if (audible > 0) {
+            alternate = (alternate + 1) % audible;
+            if (alternate == 0) {
+                buzzer = mcp4922Word(MCP4922_BUZZER_LEVEL, MCP4922_CHANNEL_B);
+            } else if (alternate == 1) {
+                buzzer = mcp4922Word(0, MCP4922_CHANNEL_B);
+            }
+        }
+        dest[frame * 2] = buzzer;
+        dest[frame * 2 + 1] = buzzer;
+        frame++;
+    }
+    // Hold the bottom of the ramp for the rest of the period
+    for (; frame < timing.periodFrames; frame++) {
+        dest[frame * 2] = idle;
+        dest[frame * 2 + 1] = idle;
+    }
+    return words;
+}
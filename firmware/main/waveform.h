@@ -0,0 +1,69 @@
+#ifndef RADAR_WAVEFORM_H
+#define RADAR_WAVEFORM_H
+
+#include <cstddef>
+#include <cstdint>
+#include "parameters.h"
+
+// MCP4922 command nibbles
+// 0011 ---- ---- ---- (Channel A, Unbuffered, 1x Gain, Enabled) + input data
+#define MCP4922_CHANNEL_A 0x3000
+// 1111 ---- ---- ---- (Channel B, Buffered, 1x Gain, Enabled) + input data
+#define MCP4922_CHANNEL_B 0xF000
+// Buzzer level written to channel B while the buzzer is high
+#define MCP4922_BUZZER_LEVEL 2048
+
+// Combine a 12-bit DAC code with the command nibble of a channel
+static inline uint16_t mcp4922Word(uint16_t value, uint16_t mask) {
+    return (value & 0x0FFF) | mask;
+}
+
+// DAC code increment between sequential chirp steps
+int32_t chirpStepResolution(const Chirp &chirp);
+
+// Largest DAC code of the MCP4922
+#define MCP4922_MAX_CODE 4095
+// Number of points checked when testing a linearization for monotonicity
+#define LINEARIZATION_CHECK_POINTS 64
+
+// Evaluate the linearization polynomial at the normalized ramp position x, clamped to [0, 1]
+float linearizationValue(const Linearization &linearization, float x);
+
+// True when the linearization is non-decreasing over the whole ramp and rises overall, so that a rising ramp stays
+// rising
+bool linearizationMonotonic(const Linearization &linearization);
+
+// DAC code of the VCO at the given step of the ramp, the linearization is applied when the chirp enables it
+uint16_t chirpCode(const Chirp &chirp, const Linearization &linearization, int32_t stepResolution, int32_t step);
+
+// Fill codes with the DAC code of every step of one chirp. Returns the number of codes written or zero if codes
+// is too small.
+size_t buildChirpTable(const Chirp &chirp, const Linearization &linearization, uint16_t *codes, size_t capacity);
+
+typedef struct WaveformTiming {
+    // Output frames per second, each frame latches one MCP4922 command word
+    uint32_t frameRate;
+    // Frames per chirp step, two when every step also carries a buzzer update
+    int32_t framesPerStep;
+    // Frames spent on the ramp, the remainder of the period holds the VCO at the bottom of the ramp
+    size_t rampFrames;
+    // Frames per chirp period, a whole number of output buffers
+    size_t periodFrames;
+    // Frames per output buffer
+    size_t bufferFrames;
+    // Output buffers per chirp period
+    size_t buffersPerPeriod;
+} WaveformTiming;
+
+// Derive the frame timing of one chirp period. The period is padded by less than one frame per buffer so that it
+// divides into buffers of at most maxBufferFrames. Returns false if the frame rate would exceed maxFrameRate.
+bool waveformTiming(const Chirp &chirp, bool audible, uint32_t maxFrameRate, size_t maxBufferFrames,
+                    WaveformTiming *timing);
+
+// Fill dest with one chirp period of MCP4922 command words from a chirp table, two per frame (the latched word and
+// the word clocked out while the chip is deselected). Returns the number of words written or zero if dest is too small.
+size_t buildWaveform(const Chirp &chirp, const uint16_t *codes, int32_t audible, const WaveformTiming &timing,
+                     uint16_t *dest, size_t capacity);
+
+
+#endif //RADAR_WAVEFORM_H